@@ -71,6 +71,13 @@
 #include <time.h>
 #include <error.h>
 #include <infomax.h>
+#include <hostinfomax.h>
+#include <batch.h>
+#include <ensemble.h>
+#include <online.h>
+#include <profile.h>
+#include <plan.h>
+#include <pool.h>
 #include <string.h>
 #include <math.h>
 #include <signal.h>
@@ -112,12 +119,29 @@ int main(int argc, char* argv[]) {
 		return -1;
 	}
 
-	if (isParam("-d", argv, argc)) {
-		int device = atoi(getParam("-d", argv, argc));
-		selectDevice(device, 1);
+	if (isParam("-b", argv, argc)) {
+		eegdataset_t bench;
+		initDefaultConfig(&bench);
+		bench.config.backend = BACKEND_CPU;
+		checkDefaultConfig(&bench);
+		char *what = getParam("-b", argv, argc);
+		if (what != NULL && strcmp(what, "gpu") == 0) {
+			selectDevice(isParam("-d", argv, argc) ? atoi(getParam("-d", argv, argc)) : 0, 1);
+			deviceBenchmark();
+		} else if (what != NULL && strcmp(what, "sampling") == 0) {
+			hostBenchmarkSampling(bench.config.nthreads);
+		} else {
+			hostBenchmark(bench.config.nthreads);
+		}
+		return 0;
 	}
-	else {
-		selectDevice(0, 1);
+
+	if (isParam("-m", argv, argc)) {
+		natural device = 0;
+		if (isParam("-d", argv, argc)) {
+			device = atoi(getParam("-d", argv, argc));
+		}
+		return runBatch(getParam("-m", argv, argc), device) == SUCCESS ? 0 : -1;
 	}
 
 	if (!isParam("-f", argv, argc)) {
@@ -133,31 +157,106 @@ int main(int argc, char* argv[]) {
 	error err = parseConfig(filename, dataset);
 	checkDefaultConfig(dataset);
 
+	if (dataset->config.backend == BACKEND_GPU) {
+		if (isParam("-d", argv, argc)) {
+			int device = atoi(getParam("-d", argv, argc));
+			selectDevice(device, 1);
+		}
+		else {
+			selectDevice(0, 1);
+		}
+	} else {
+		printf("Running on the host with %d threads\n", dataset->config.nthreads);
+	}
 	
+	if (isParam("--plan", argv, argc)) {
+		plan_t plan;
+		size_t budget = 0;
+		size_t peak = 0;
+		if (err != SUCCESS) {
+			free(dataset);
+			return -1;
+		}
+		planJob(&dataset->config, &plan);
+		planPrint(&dataset->config, &plan);
+		if (isParam("--budget", argv, argc) && getParam("--budget", argv, argc) != NULL) {
+			budget = (size_t)atoi(getParam("--budget", argv, argc)) * 1048576;
+		} else if (dataset->config.backend == BACKEND_GPU) {
+			budget = getFreeMem();
+		} else {
+			budget = planHostMemory();
+		}
+		peak = dataset->config.backend == BACKEND_GPU ? plan.devicepeak : plan.hostpeak;
+		printf("Budget %.1f MB: %s\n", budget / 1048576.0, peak <= budget ? "fits" : "does not fit");
+		free(dataset);
+		return peak <= budget ? 0 : -1;
+	}
+
+	if (err == SUCCESS && dataset->config.online) {
+		err = runOnline(dataset);
+		free(dataset);
+		return err == SUCCESS ? 0 : -1;
+	}
+
 	if (err == SUCCESS) {
 		fprintf(stdout, "====================================\n");
 		fprintf(stdout, " Pre processing\n");
 		fprintf(stdout, "====================================\n\n");
+		if (dataset->config.profilefile != NULL) {
+			profileInit(&dataset->config);
+		}
+		if (dataset->config.backend == BACKEND_GPU) {
+			plan_t plan;
+			planJob(&dataset->config, &plan);
+			if (plan.devicepeak > getFreeMem() || poolArena(plan.devicepeak) != cudaSuccess) {
+				printf("Not enough device memory: the run needs %.1f MB, %.1f MB are free\n", plan.devicepeak / 1048576.0, getFreeMem() / 1048576.0);
+				free(dataset);
+				return -1;
+			}
+		}
 		printf("Loading dataset...");
+		PROFILE_BEGIN(PROFILE_LOAD);
 		err = loadEEG(dataset);
 		if (err != SUCCESS) exit(0);
-		err = loadToDevice(dataset);
-		if (err != SUCCESS) {
-			printf("Cannot load data to device\n");
-			return 0;
+		if (dataset->config.backend == BACKEND_GPU) {
+			err = loadToDevice(dataset);
+			if (err != SUCCESS) {
+				printf("Cannot load data to device\n");
+				return 0;
+			}
 		}
+		PROFILE_END(PROFILE_LOAD);
 		printf("Done!\n");
 
 		printf("Centering dataset...");
 		time_t start, end;
 		time(&start);
+		PROFILE_BEGIN(PROFILE_CENTER);
 		centerData(dataset);
+		PROFILE_DEVICE_END(PROFILE_CENTER);
 		printf("Done!\n");
+		if (pcaReduces(dataset)) {
+			printf("Reducing dataset to %d principal components...", dataset->config.pca);
+			PROFILE_BEGIN(PROFILE_PCA);
+			err = pcaReduce(dataset);
+			PROFILE_DEVICE_END(PROFILE_PCA);
+			if (err != SUCCESS) {
+				profileClose();
+				if (dataset->config.backend == BACKEND_GPU) freeDeviceMem(dataset);
+				freeEEG(dataset);
+				poolArenaRelease();
+				return -1;
+			}
+			printf("Done!\n");
+		}
 		if (dataset->config.sphering == 1 || dataset->config.sphering == 0) {
 			printf("Whitening dataset...");
+			PROFILE_BEGIN(PROFILE_WHITEN);
 			whiten(dataset);
+			PROFILE_DEVICE_END(PROFILE_WHITEN);
 			printf("Done!\n");
 		}
+		if (profileEnabled) profileStep("preprocess", 0);
 
 		printDatasetInfo(dataset);
 		time(&end);
@@ -170,17 +269,41 @@ int main(int argc, char* argv[]) {
 		fprintf(stdout, "====================================\n");
 		fprintf(stdout, " Starting Infomax\n");
 		fprintf(stdout, "====================================\n\n");
-		infomax(dataset);
-
-		// Do not post-process the weights here in order to be compatitable with pca option.
-		// Post-processing will be done in matlab scipt.
-		//fprintf(stdout, "====================================\n");
-		//fprintf(stdout, " Post processing\n");
-		//fprintf(stdout, "====================================\n\n");
-		//postprocess(dataset);
+		// The components are sorted by the same projected variance as in the
+		// matlab script, which sorts them again after the pca projection.
+		// The activations below are written in this order and sign. The
+		// ensemble post processes every run itself.
+		if (dataset->config.ensemble > 1) {
+			err = runEnsemble(dataset);
+		} else {
+			err = infomax(dataset);
+			if (err == SUCCESS) {
+				fprintf(stdout, "====================================\n");
+				fprintf(stdout, " Post processing\n");
+				fprintf(stdout, "====================================\n\n");
+				postprocess(dataset);
+			}
+		}
+		if (err != SUCCESS) {
+			profileClose();
+			if (dataset->config.backend == BACKEND_GPU) freeDeviceMem(dataset);
+			freeEEG(dataset);
+			poolArenaRelease();
+			return -1;
+		}
 
+		PROFILE_BEGIN(PROFILE_SAVE);
 		saveEEG(dataset);
+		if (dataset->config.activationsfile != NULL) {
+			printf("Writing activations...");
+			saveActivations(dataset);
+			printf("Done!\n");
+		}
+		PROFILE_END(PROFILE_SAVE);
+		if (profileEnabled) profileStep("save", 0);
+		profileClose();
 		freeEEG(dataset);
+		poolArenaRelease();
 	}
 	
 	return 0;
@@ -0,0 +1,53 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <config.h>
+
+/*
+ * Batch mode: runs every config file listed in a manifest (one path per
+ * line, blank lines and lines starting with # are skipped).
+ *
+ * Jobs go through a three stage pipeline: while job N runs Infomax, job N+1
+ * is loaded, centered and sphered and the results of job N-1 are saved, so
+ * up to three datasets are in memory at once. Work buffers are taken from
+ * the pool (see pool.h), so consecutive jobs of the same shape (backend,
+ * channels, samples, block size, precision and threads) reuse them; the
+ * free ones are released when the shape changes.
+ *
+ * With checkpoints on, SIGINT or SIGTERM stops the job running Infomax at
+ * its next checkpoint, it is saved as usual, and the jobs after it are
+ * skipped.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+error		runBatch(char *manifest, natural device);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -24,11 +24,36 @@
 #include <loader.h>
 
 
+/*
+ * Running means and scatter (sum of the outer products of the centered
+ * samples) of a set of samples. Samples are added in chunks of
+ * MOMENTS_CHUNK: the chunk means are summed in double, the chunk is
+ * centered on them before its scatter is taken, and chunks and partial
+ * moments are merged with the pairwise update of Chan et al., so no sum
+ * grows with the length of the recording and the mean never has to be
+ * subtracted from the raw second moments.
+ */
+#define MOMENTS_CHUNK	1024
+
+typedef struct {
+	double		count;
+	double *	mean;			//channels
+	real *		scatter;		//channels x channels, upper triangle, column major
+	real *		tmp;			//MOMENTS_CHUNK x channels centered samples
+} moments_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 void 		centerData(eegdataset_t *set);
+void 		hostCenterData(eegdataset_t *set);
+void		momentsInit(moments_t *moments, natural channels);
+void		momentsAdd(moments_t *moments, real *x, natural count, natural channels);
+void		momentsMerge(moments_t *moments, moments_t *other, natural channels);
+void		momentsResult(moments_t *moments, natural channels, real *mean, real *cov);
+void		momentsFree(moments_t *moments);
+void		hostMoments(real *data, natural channels, natural samples, int nparts, real *mean, real *cov);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,103 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <config.h>
+#include <stdint.h>
+#include "../lib/include/r250.h"
+
+/*
+ * Infomax checkpoints.
+ *
+ * A checkpoint file is a checkpointhdr_t followed by the arrays registered
+ * with checkpointArray() / checkpointDeviceArray(), in that order, each one
+ * stored contiguously (no pitch). The header holds the scalar state of the
+ * loop and the r250 state, so a resumed run takes the same path as one
+ * that was never stopped. Files are written by a background thread to
+ * FILE.tmp and renamed when complete, the loop only waits for the previous
+ * write and the copy of the state. A checkpoint is only resumed by a run
+ * with the same seed and permutation over the same data, compared through
+ * a checksum of the data Infomax reads.
+ */
+#define CHECKPOINT_MAGIC		"CUDAICK"
+#define CHECKPOINT_VERSION		2
+#define CHECKPOINT_ARRAYS		16
+#define CHECKPOINT_HASH_BYTES	(16 * 1048576)		// Staging size when hashing device data
+
+typedef struct {
+	char		magic[8];			//CHECKPOINT_MAGIC
+	uint32_t	version;			//CHECKPOINT_VERSION
+	uint32_t	elemsize;			//Bytes per weight value
+	uint64_t	channels;
+	uint64_t	samples;
+	uint64_t	block;
+	uint64_t	seed;
+	uint64_t	permutation;		//PERMUTATION_*
+	uint64_t	chunk;
+	uint64_t	datasum;			//Checksum of the data, see checkpointData()
+	uint64_t	bytes;				//Bytes of arrays after the header
+	int64_t		step;				//Completed steps
+	int64_t		t;					//Next block of the current step, 0 = step boundary
+	int64_t		blockno;
+	int64_t		extblocks;
+	int64_t		signcount;
+	int64_t		pleft;
+	int64_t		piter;
+	double		lrate;
+	double		change;
+	double		oldchange;
+	double		angledelta;
+	r250_state	rng;
+} checkpointhdr_t;
+
+typedef struct {
+	checkpointhdr_t	header;
+	char *			filename;			//NULL = checkpoints off
+	natural			every;				//Steps between checkpoints
+	int				narrays;
+	void *			ptr[CHECKPOINT_ARRAYS];
+	size_t			width[CHECKPOINT_ARRAYS];	//Bytes per row
+	size_t			height[CHECKPOINT_ARRAYS];	//Rows
+	size_t			pitch[CHECKPOINT_ARRAYS];	//Bytes between rows
+	int				device[CHECKPOINT_ARRAYS];	//In device memory
+	void *			writer;				//Background write in progress
+} checkpoint_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void		checkpointInit(checkpoint_t *ckpt, config_t *config, natural channels, natural samples, size_t elemsize);
+void		checkpointArray(checkpoint_t *ckpt, void *ptr, size_t size);
+void		checkpointData(checkpoint_t *ckpt, const void *ptr, size_t pitch, size_t width, size_t height, int device);
+void		checkpointDeviceArray(checkpoint_t *ckpt, void *ptr, size_t pitch, size_t width, size_t height);
+error		checkpointSave(checkpoint_t *ckpt);
+error		checkpointLoad(checkpoint_t *ckpt);
+void		checkpointWait(checkpoint_t *ckpt);
+int			checkpointInterrupted(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -29,8 +29,9 @@ extern "C" {
 
 __global__ void zeroMatrix(real* data, size_t pitch);
 
-__global__ void eye(real* data, size_t pitch);
+__global__ void eye(real* data, size_t pitch, natural channels);
 
+double		wallclock(void);
 void 		printVector(real* data, natural size);
 void 		dev_printVector(real* data, natural size, natural max);
 void 		dev_matwriteInt(char *fname, int rows, int cols, int *mat, size_t pitch);
@@ -38,6 +39,9 @@ void 		dev_matwriteNat(char *fname, int rows, int cols, natural *mat, size_t pit
 void 		dev_matreadInt(char *fname, int rows, int cols, int *mat, size_t pitch);
 void 		dev_matwrite(char *fname, int rows, int cols, real *mat, size_t pitch);
 void 		dev_matread(char *fname, int rows, int cols, real *mat, size_t pitch);
+void 		matwrite(char *fname, int rows, int cols, real *mat, size_t pitch);
+void 		matwriteInt(char *fname, int rows, int cols, int *mat, size_t pitch);
+int			replaceFile(const char *tmp, const char *target);
 
 real 		dsum_(integer *n, real *dx, integer *incx);
 #ifdef __cplusplus
@@ -28,7 +28,22 @@
   * GPU Paramteres
   */
 #define MAX_MULTIPROCESSORS 32
-#define MAX_CHANNELS 512
+/*
+ * Kernels work on tiles of CHANNEL_TILE channels: one thread per channel of
+ * the tile, and a second grid dimension (or a loop) over the tiles, so the
+ * channel count is only limited by memory.
+ */
+#define CHANNEL_TILE 256
+#define CHANNEL_TILES(channels)		(((channels) + CHANNEL_TILE - 1) / CHANNEL_TILE)
+#define CHANNEL_THREADS(channels)	((channels) < CHANNEL_TILE ? (channels) : CHANNEL_TILE)
+/*
+ * The channel count specializations of the Infomax kernels (CH = 32, 64,
+ * 128, 256) work on SAMPLE_TILE samples, or weight columns, per thread
+ * block: each weight a thread reads is kept in a register and used for all
+ * of them. The generic kernels (CH = 0) work on one.
+ */
+#define SAMPLE_TILE 4
+#define KERNEL_TILE(CH)				((CH) ? SAMPLE_TILE : 1)
 
 /*
  * Prints debugging messages
@@ -120,6 +135,80 @@ typedef int error;
 
 #define DEFAULT_VERBOSE			1
 
+/*
+ * Compute backends
+ */
+#define BACKEND_GPU				0
+#define BACKEND_CPU				1
+#define DEFAULT_BACKEND			BACKEND_GPU
+#define DEFAULT_THREADS			0		// 0 = one thread per core
+#define DEFAULT_STREAMING		0
+#define DEFAULT_MEMCAP			0		// MB, 0 = no cap
+#define DEFAULT_PREFETCH		2		// Blocks
+
+/*
+ * Ensemble mode
+ */
+#define DEFAULT_ENSEMBLE		1		// Runs, 1 = single run
+
+/*
+ * Checkpoints
+ */
+#define DEFAULT_CHECKPOINT		10		// Steps
+#define DEFAULT_RESUME			0
+#define DEFAULT_COUNTERS		0
+
+/*
+ * Online mode
+ */
+#define DEFAULT_ONLINE			0
+#define DEFAULT_ONLINE_BLOCK	128		// Samples
+#define DEFAULT_PUBLISH			10		// Blocks
+#define DEFAULT_DECAY			0.999	// lrate factor per block
+#define DEFAULT_LATENCY			8		// Blocks
+
+/*
+ * Solvers (backend cpu for all but infomax)
+ */
+#define SOLVER_INFOMAX			0		// Natural gradient on blocks, annealed lrate
+#define SOLVER_PICARD			1		// Full batch preconditioned L-BFGS, see picard.h
+#define SOLVER_COMPARE			2		// Infomax then Picard on the same data, keeps Picard's results
+#define DEFAULT_SOLVER			SOLVER_INFOMAX
+
+/*
+ * Sample order of each Infomax step, see permutation.h
+ */
+#define PERMUTATION_SHUFFLE		0		// Fisher-Yates over a table of all the samples
+#define PERMUTATION_FEISTEL		1		// Computed on demand from a few keys
+#define PERMUTATION_CHUNKS		2		// feistel on chunks of contiguous samples
+#define DEFAULT_PERMUTATION		PERMUTATION_SHUFFLE
+#define DEFAULT_CHUNK			64		// Samples, rounded up to a power of 2
+
+/*
+ * Principal components of the pca reduction, see pca.h
+ */
+#define PCA_EIG					0		// Eigenvectors of the covariance
+#define PCA_RANDOM				1		// Randomized range finder, for long recordings
+#define DEFAULT_PCAMETHOD		PCA_EIG
+
+/*
+ * Infomax arithmetic of both backends (hostinfomax.cu, infomax.cu)
+ */
+#define PRECISION_DOUBLE		0
+#define PRECISION_SINGLE		1
+#define PRECISION_MIXED			2		// Data, u and y in single, sums and weights in double
+#define DEFAULT_PRECISION		(sizeof(real) == sizeof(double) ? PRECISION_DOUBLE : PRECISION_SINGLE)
+#define DEFAULT_ACTPRECISION	PRECISION_DOUBLE	// ActivationsFile values, double or single
+
+/*
+ * Data file formats
+ */
+#define FORMAT_RAW				0		// Headerless doubles
+#define FORMAT_CONTAINER		1		// See container.h
+#define FORMAT_FDT				2		// EEGLAB float32, channels x points
+#define FORMAT_EDF				3		// European Data Format, int16 records
+#define FORMAT_BDF				4		// Biosemi Data Format, int24 records
+
 #define MAX_MEM_THRESHOLD 64
 
 #define RESERVED_MEM_BYTES (32 * 1024 * 1024)
@@ -186,6 +275,8 @@ typedef struct {
 	 * Required
 	 */
 	char *		datafile;			//Input data file
+	natural		dataformat;			//Data file format, results are written as containers for FORMAT_CONTAINER
+	char *		chanlist;			//Signals to read from EDF/BDF files
 	natural		nchannels;			//Channels
 	natural		nsamples;			//Samples
 	char *		weightsoutfile;		//Weights out file
@@ -198,6 +289,7 @@ typedef struct {
 	natural		biasing;			//Do bias
 	natural		extblocks;			//Do extended: N of blocks
 	natural		pca;				//Do PCA
+	natural		pcamethod;			//PCA_*
 	/*
 	 * Optional
 	 */
@@ -214,10 +306,34 @@ typedef struct {
 	char*		activationsfile;
 	char*		biasfile;
 	char*		signfile;
+	char*		checkpointfile;		//Checkpoint file, NULL = no checkpoints
+	char*		profilefile;		//Stage trace file, NULL = no trace
+	char*		pcafile;			//PCA projection out file
 
 	natural		verbose;
 
 	natural		seed;				//Random permutation seed
+	natural		ensemble;			//Runs with consecutive seeds, 1 = single run
+	natural		checkpoint;			//Steps between checkpoints, 0 = only when interrupted
+	natural		resume;				//Resume from checkpointfile if there is one
+	natural		counters;			//Hardware counters in the stage trace
+
+	natural		online;				//Learn from samples as they arrive on datafile
+	natural		publish;			//Online: blocks between weights publications
+	real		decay;				//Online: lrate factor per block
+	natural		latency;			//Online: blocks buffered before dropping the oldest samples
+
+	natural		backend;			//Compute backend (gpu/cpu)
+	natural		solver;				//SOLVER_*
+	natural		permutation;		//PERMUTATION_*
+	natural		chunk;				//Samples per chunk of permutation chunks
+	natural		nthreads;			//CPU backend threads
+	natural		precision;			//Infomax arithmetic (PRECISION_*)
+	natural		actprecision;		//ActivationsFile values, PRECISION_DOUBLE or PRECISION_SINGLE
+
+	natural		streaming;			//Keep the data out of core (cpu backend)
+	natural		memcap;				//Streaming resident memory cap in MB, 0 = none
+	natural		prefetch;			//Streaming prefetch distance in blocks
 
 	/*
 	 * Internal
@@ -227,9 +343,12 @@ typedef struct {
 	natural 	urextblocks;
 	real 		signsbias;
 	int			extended;
+	natural		embedded;			//Run through cudaica.h: no files, results in the caller's buffers
 
 } config_t;
 
+typedef struct stream_s stream_t;
+
 typedef struct {
 	natural			nchannels;			//Original channels (rows)
 	natural			nsamples;			//Original samples (cols)
@@ -243,6 +362,14 @@ typedef struct {
 	real* 			h_weights;			//Weights in host, used for weigths in file
 	real*			bias;
 	integer*		signs;
+	void*			mapping;			//Data file mapping when data points into it
+	size_t			mapsize;			//Size of the mapping
+	stream_t*		stream;				//Out-of-core data, data is NULL when used
+	natural			steps;				//Steps of the last Infomax run, up to its convergence
+	real*			mean;				//Channel means centerData() leaves to whiten(), NULL once subtracted
+	real*			cov;				//Covariance from centerData() (upper triangle), NULL when whiten() computes it
+	real*			projection;			//PCA projection (nchannels x urchannels, column major), NULL = no reduction
+	natural			urchannels;			//Channels before the PCA reduction
 	config_t 		config;
 } eegdataset_t;
 
@@ -265,6 +392,8 @@ char* getParam(const char * needle, char* haystack[], int count);
 
 error parseConfig(char* filename, eegdataset_t *dataset);
 
+error parseOption(config_t *config, const char *key, const char *value);
+
 int isParam(const char * needle, char* haystack[], int count);
 
 void printConfig(eegdataset_t *dataset);
@@ -0,0 +1,98 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CONTAINER_H__
+#define __CONTAINER_H__
+
+#include <config.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Self-describing binary container.
+ *
+ * A CONTAINER_HEADER bytes header followed, at byte offset "offset", by
+ * frames * epochs rows of channels values each (channels contiguous, the
+ * same layout as the raw data files). Results are stored the same way with
+ * one row per matrix row. All header fields are in the byte order of the
+ * writer, which is recorded in byteorder. Integer payloads are multiplied
+ * by scale when loaded.
+ *
+ * The checksum, when flagged, is the sum of the FNV-1a hashes of each
+ * CONTAINER_CHECKSUM_CHUNK bytes of the payload, each hash seeded with
+ * the chunk index so chunks can be hashed in parallel.
+ */
+#define CONTAINER_MAGIC				"CUDAICA"
+#define CONTAINER_VERSION			1
+#define CONTAINER_HEADER			128
+#define CONTAINER_ALIGNMENT			4096		//Payload alignment of the containers cudaica writes
+#define CONTAINER_BYTEORDER			0x01020304
+#define CONTAINER_CHECKSUM_CHUNK	1048576
+
+#define CONTAINER_FLAG_CHECKSUM		1
+
+#define DTYPE_F64	1
+#define DTYPE_F32	2
+#define DTYPE_I16	3
+#define DTYPE_I32	4
+
+#define DTYPE_REAL	(sizeof(real) == sizeof(double) ? DTYPE_F64 : DTYPE_F32)
+
+typedef struct {
+	char		magic[8];			//CONTAINER_MAGIC
+	uint32_t	version;			//CONTAINER_VERSION
+	uint32_t	byteorder;			//CONTAINER_BYTEORDER as written
+	uint32_t	dtype;				//DTYPE_*
+	uint32_t	flags;				//CONTAINER_FLAG_*
+	uint64_t	channels;			//Values per row
+	uint64_t	frames;				//Rows per epoch
+	uint64_t	epochs;				//Epochs
+	uint64_t	offset;				//Payload offset from the start of the file
+	uint64_t	alignment;			//Alignment used for offset
+	uint64_t	checksum;			//Payload checksum
+	double		scale;				//Scale for integer payloads
+	char		reserved[CONTAINER_HEADER - 80];
+} container_t;
+
+static inline uint32_t byteswap32(uint32_t v) {
+	return ((v & 0xff) << 24) | ((v & 0xff00) << 8) | ((v >> 8) & 0xff00) | (v >> 24);
+}
+
+static inline uint64_t byteswap64(uint64_t v) {
+	return ((uint64_t)byteswap32((uint32_t)v) << 32) | byteswap32((uint32_t)(v >> 32));
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+size_t		dtypeSize(natural dtype);
+void		convertValues(const char* src, real* dst, size_t first, size_t last, natural dtype, int swap, real scale);
+int			containerSwapped(container_t *header);
+error		containerProbe(char *filename, container_t *header);
+uint64_t	containerChecksum(const char *payload, size_t size);
+error		containerBegin(FILE *file, natural dtype, natural rows, natural cols, uint64_t checksum);
+error		containerWrite(char *filename, natural dtype, natural rows, natural cols, void *mat, size_t pitch);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
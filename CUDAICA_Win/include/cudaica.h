@@ -0,0 +1,99 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __CUDAICA_H__
+#define __CUDAICA_H__
+
+#include <stddef.h>
+#include <cuda_runtime.h>
+#include <config.h>
+#include <container.h>
+#include <error.h>
+
+/*
+ * Library interface: the pipeline of cudaica -f (center, pca, whiten,
+ * Infomax, post processing) in the calling process, on an array the caller
+ * owns. The components come in the order and signs cudaica -f saves.
+ *
+ * The data is read through its pointer and strides in bytes: channel c of
+ * sample s is at data + c * chanstride + s * samplestride, so a channels x
+ * samples array in C order has strides (samples * size, size). It is read
+ * once, into the working copy the pipeline centers and spheres, and never
+ * written.
+ *
+ * Options start from icaDefaults() and take the keys and values of the
+ * configuration file through icaOption() (or the config_t fields). There
+ * are no files: the data keys come from icadata_t, the results go to the
+ * buffers of icaresults_t, and ensemble, streaming and online are off.
+ *
+ * icaRun() returns SUCCESS or an error.h code, ERRORDEVICE and ERRORDIVERGED
+ * for what ends cudaica. The dataset and the device memory of a failed run
+ * are freed, a cuda or cublas error leaves the few host buffers of the
+ * device loop behind. The trap that turns cuda and cublas errors into codes
+ * belongs to the thread
+ * calling icaRun(): the cuda, cublas and divergence checks of a run are all
+ * made on it, an error raised on another thread (an OpenMP worker) would
+ * still end the process. Runs of backend cpu may go at the same time from
+ * several threads, runs of backend gpu take the device one at a time.
+ */
+typedef struct {
+	const void *	data;
+	natural			dtype;				//DTYPE_F64 or DTYPE_F32
+	natural			channels;
+	natural			samples;
+	ptrdiff_t		chanstride;			//Bytes from a channel to the next one
+	ptrdiff_t		samplestride;		//Bytes from a sample to the next one
+} icadata_t;
+
+typedef struct {
+	config_t		config;				//Keys of the configuration file
+	natural			device;				//cuda device of backend gpu (-d N)
+} icaoptions_t;
+
+/*
+ * Caller buffers, column major like the files cudaica writes (weights[i +
+ * c * components] weighs channel c in component i). components is the pca
+ * key when it reduces the data, channels otherwise.
+ */
+typedef struct {
+	real *			weights;			//components x components
+	real *			sphere;				//components x components, identity without sphering
+	real *			bias;				//components, zeros without bias, NULL = not wanted
+	integer *		signs;				//components, zeros without extended, NULL = not wanted
+	real *			projection;			//components x channels, needed when pca reduces
+	natural			components;			//Set by icaRun()
+	natural			steps;				//Set by icaRun(): Infomax steps run
+} icaresults_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void		icaDefaults(icaoptions_t *options);
+error		icaOption(icaoptions_t *options, const char *key, const char *value);
+natural		icaComponents(const icaoptions_t *options, natural channels);
+error		icaRun(const icadata_t *data, const icaoptions_t *options, icaresults_t *results);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
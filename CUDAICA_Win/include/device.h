@@ -43,6 +43,7 @@ size_t		getFreeMem(void);
 natural		getMaxThreads(void);
 natural		getMaxBlocks(void);
 error		selectDevice(natural, natural);
+error		bindDevice(void);
 
 void 		freeDeviceMem(eegdataset_t *set);
 error 		loadToDevice(eegdataset_t *set);
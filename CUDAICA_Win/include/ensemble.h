@@ -0,0 +1,57 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __ENSEMBLE_H__
+#define __ENSEMBLE_H__
+
+#include <config.h>
+#include <loader.h>
+
+/*
+ * Ensemble mode (config key ensemble N): Infomax runs N times on the same
+ * centered and sphered data with seeds seed to seed+N-1.
+ *
+ * The first run is the dataset itself and keeps the configured output
+ * files, run k writes its weights, bias and signs with ".<seed>" appended
+ * to the file names. Host runs go concurrently, splitting the threads
+ * among them (one at a time when streaming); device runs go one after the
+ * other on the data already in the device.
+ *
+ * Every run is post processed (posact and sorting, see postprocess.h)
+ * before its components are matched and saved, the first one too.
+ *
+ * Components of every run are matched to those of the first one by the
+ * absolute correlation of their unmixing rows (greedy, best pair first),
+ * and the matches are written to the weights file name plus ".ensemble".
+ */
+#define ENSEMBLE_STABLE		0.9		//Mean |r| of a reproducible component
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+error		runEnsemble(eegdataset_t *set);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -20,6 +20,8 @@
 #ifndef __ERROR_H__
 #define __ERROR_H__
 
+#include <setjmp.h>
+
 
 
 #define SUCCESS 0
@@ -29,7 +31,18 @@
 #define ERRORINVALIDPARAM	-3				//Parameter is invalid
 #define ERRORINVALIDCONFIG	-4				//Config file is invalid
 #define ERRORNOFILE			-5				//Error opening file
+#define ERRORDEVICE			-6				//A cuda or cublas call failed
+#define ERRORDIVERGED		-7				//Weights not invertible at the lowest lrate
+#define ERRORINTERRUPTED	-8				//Not run, SIGINT or SIGTERM arrived before
+#define ERRORLAPACK			-9				//A LAPACK decomposition failed
 
+/*
+ * Fatal errors end the process with EXIT_FAILURE. A thread that has set a
+ * trap with errorTrap() (the library calls of cudaica.h) jumps back to it
+ * instead, setjmp() then returns the error code. Traps are per thread and a
+ * jump cannot leave a parallel region: errors inside OpenMP loops end the
+ * process whatever the trap. The library calls make none there.
+ */
 #define HANDLE_ERROR( err ) (HandleError( err, __FILE__, __LINE__ ))
 #define CHECK_ERROR() (HandleError(cudaGetLastError(), __FILE__, __LINE__))
 
@@ -48,7 +61,7 @@
 		else PRINT_ERR(errn, CUBLAS_STATUS_EXECUTION_FAILED) \
 		else PRINT_ERR(errn, CUBLAS_STATUS_INTERNAL_ERROR) \
 		fprintf(stderr, "ERROR::%s (%x) in %s at line %d\n", "UNKNOWN", errn, __FILE__, __LINE__ ); \
-		exit( EXIT_FAILURE ); \
+		errorFail( ERRORDEVICE ); \
    }
 
 #ifdef __cplusplus
@@ -57,6 +70,8 @@ extern "C" {
 
 void HandleError( cudaError_t err, const char *file, int line );
 void ResetError(void);
+void errorTrap(jmp_buf *trap);
+void errorFail(int err);
 
 #ifdef __cplusplus
 }
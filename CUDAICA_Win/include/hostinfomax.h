@@ -0,0 +1,74 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HOSTINFOMAX_H__
+#define __HOSTINFOMAX_H__
+
+#include "config.h"
+#include <loader.h>
+
+#define HOST_TILE		64		//Samples of a block each thread keeps in cache at a time
+#define HOST_CONVERT_CHUNK	1048576	//Values converted per work item, in place (precision key)
+
+/*
+ * State of the block update used by the online mode: steps 1 to 4 and the
+ * kurtosis estimate of the cpu backend, run in real precision on blocks
+ * the caller supplies (centered and sphered).
+ */
+typedef struct {
+	natural		channels;
+	natural		block;
+	natural		extended;
+	natural		biasing;
+	natural		nsub;
+	int			nparts;
+	real		signsbias;
+	real		extmomentum;
+	real *		weights;			//Column major, pitch channels
+	real *		tmpweights;
+	real *		bias;
+	integer *	signs;
+	real *		kk;
+	real *		oldkk;
+	real *		bsum;
+	real *		yu;
+	real *		yupart;
+	real *		xtile;
+	real *		utile;
+	real *		ytile;
+} hostblock_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+error 		hostInfomax(eegdataset_t *set);
+error		hostInfomaxEnsemble(eegdataset_t **sets, int count, int concurrent);
+void		hostBenchmark(int nparts);
+void		hostBenchmarkSampling(int nparts);
+void		hostBlockInit(hostblock_t *hb, config_t *config, natural channels, real *weights);
+void		hostBlockReset(hostblock_t *hb);
+natural		hostBlockUpdate(hostblock_t *hb, real *x, real lrate, int pdf);
+void		hostBlockFree(hostblock_t *hb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
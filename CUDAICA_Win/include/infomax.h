@@ -27,7 +27,8 @@
 extern "C" {
 #endif
 
-void 		infomax(eegdataset_t *set);
+error 		infomax(eegdataset_t *set);
+void		deviceBenchmark(void);
 
 #ifdef __cplusplus
 }
@@ -29,6 +29,11 @@ void 			printDatasetInfo(eegdataset_t* dataset);
 error 			freeEEG(eegdataset_t *dataset);
 error 			loadEEG(eegdataset_t *dataset);
 error			saveEEG(eegdataset_t *dataset);
+error			hostSaveEEG(eegdataset_t *dataset);
+error			containerSaveEEG(eegdataset_t *dataset);
+void			freeData(eegdataset_t *dataset);
+error			edfProbe(char* src, natural format, char* chanlist, natural* channels, natural* frames);
+error			dataload(char* src, natural rows, natural cols, real** dst, void** mapping, size_t* mapsize);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,67 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __ONLINE_H__
+#define __ONLINE_H__
+
+#include <config.h>
+#include <loader.h>
+
+/*
+ * Online mode (config key online on): Infomax on samples as they arrive.
+ *
+ * Samples (chans values each, raw doubles or fdt float32) are read from
+ * DataFile, usually a pipe or - for stdin, into a ring of latency blocks.
+ * When learning falls behind a live source, the oldest samples are
+ * dropped, so a block is never older than the ring when it is learnt. A
+ * regular file is read no faster than it is learnt, nothing is dropped.
+ *
+ * The mean and covariance are running averages over the last ONLINE_WINDOW
+ * blocks. The sphere is computed after ONLINE_WARMUP blocks and again every
+ * publish blocks, the weights are then changed so that weights * sphere
+ * stays the same. Each block goes through steps 1 to 4 of the cpu backend
+ * with an lrate that decays by decay per block, down to ONLINE_MIN_LRATE of
+ * the initial one. Every publish blocks, and at the end of the data, the
+ * weights, sphere, bias and signs files are replaced with the current ones.
+ */
+#define ONLINE_WINDOW		100		//Blocks in the running mean and covariance
+#define ONLINE_WARMUP		4		//Blocks before the first sphere (at least 2 * chans samples)
+#define ONLINE_MIN_LRATE	0.1		//Fraction of the initial lrate the decay stops at
+
+typedef struct ring_s ring_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+ring_t *	ringCreate(natural channels, natural capacity, int wait);
+void		ringPush(ring_t *ring, real *samples, natural count);
+natural		ringPop(ring_t *ring, real *samples, natural count);
+void		ringClose(ring_t *ring);
+void		ringFree(ring_t *ring);
+error		onlineLearn(eegdataset_t *set, ring_t *ring);
+error		runOnline(eegdataset_t *set);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PCA_H__
+#define __PCA_H__
+
+#include <config.h>
+#include <loader.h>
+
+/*
+ * PCA reduction (config keys pca N, pcamethod, PCAFile), run between
+ * centering and whitening.
+ *
+ * eig takes the N leading eigenvectors of the covariance centerData()
+ * computes along with the means. random finds them with a randomized range
+ * finder (Halko, Martinsson and Tropp): a random basis of N + PCA_OVERSAMPLE
+ * columns goes through PCA_POWER products with the covariance, computed from
+ * the data without forming it, and the eigenvectors of the covariance
+ * restricted to that basis are taken. Each product is one pass over the data
+ * and costs channels x (N + PCA_OVERSAMPLE) per sample instead of the
+ * channels x channels of the covariance.
+ *
+ * The data is centered and projected in one more pass and replaces the
+ * original (on the device too for the gpu backend), so the rest of the
+ * pipeline runs on N channels. The covariance of the projected data is the
+ * diagonal of the eigenvalues and is left to whiten(). The projection is
+ * written to PCAFile, the unmixing matrix in channel space is
+ * weights * sphere * projection, as cudaica.m composes it.
+ *
+ * pcaReduce() returns ERRORLAPACK when the eigendecomposition fails, the
+ * data is not reduced then and the run stops.
+ */
+#define PCA_OVERSAMPLE		10
+#define PCA_POWER			3		//Products with the covariance, the last one also gives the eigenvalues
+#define PCA_CHUNK			4096	//Samples per product of a thread
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int			pcaReduces(eegdataset_t *set);
+error		pcaReduce(eegdataset_t *set);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __PERMUTATION_H__
+#define __PERMUTATION_H__
+
+#include <config.h>
+#include "../lib/include/r250.h"
+
+/*
+ * Sample permutations of the Infomax steps (config key permutation).
+ *
+ * shuffle keeps a table of all the samples, shuffled with r250 by
+ * Fisher-Yates at the start of every step (and by the pdf step when it
+ * has used it up).
+ *
+ * feistel keeps no table: the index i is encrypted by a balanced Feistel
+ * network of FEISTEL_ROUNDS rounds over the smallest even number of bits
+ * that holds every sample, and encrypted again while the result is not a
+ * sample (cycle walking, less than 4 rounds on average). This is a
+ * bijection of [0, samples), so any thread can compute its own sample
+ * with permAt(). A new permutation only draws FEISTEL_ROUNDS keys from
+ * r250, and the same seed gives the same permutations.
+ *
+ * chunks runs the same network on the indices of chunks of chunk (a power
+ * of 2) contiguous samples, and the samples of each chunk are reordered by
+ * an affine map keyed by the chunk. A block then reads block / chunk runs
+ * of contiguous memory instead of block scattered samples. The last,
+ * shorter, chunk is handled by cycle walking too. feistel is chunks of 1.
+ */
+#define FEISTEL_ROUNDS		6
+#define FEISTEL_CHUNK_KEY	0x9e3779b9U		//Tells the in-chunk keys from the round keys
+
+typedef struct {
+	natural *	table;				//Shuffled samples, NULL = feistel
+	natural		samples;
+	natural		chunks;				//Chunks the network permutes
+	natural		shift;				//log2 of the samples per chunk
+	natural		bits;				//Bits of each half of a chunk index
+	natural		keys[FEISTEL_ROUNDS];
+} perm_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void		permShuffle(natural samples, natural *table, r250_state *rng);
+void		permInit(perm_t *perm, natural samples, natural *table, natural chunk);
+void		permNext(perm_t *perm, r250_state *rng);
+void		permFill(const perm_t *perm, natural first, natural count, natural *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * Round function: the murmur3 finalizer of the half and the key
+ */
+__host__ __device__ static inline natural feistelRound(natural half, natural key) {
+	natural x = half ^ key;
+	x ^= x >> 16;
+	x *= 0x85ebca6bU;
+	x ^= x >> 13;
+	x *= 0xc2b2ae35U;
+	x ^= x >> 16;
+	return x;
+}
+
+/*
+ * Chunk at position c of the network
+ */
+__host__ __device__ static inline natural feistelAt(const perm_t *perm, natural c) {
+	natural bits = perm->bits;
+	natural mask = (natural)((1ULL << bits) - 1);
+	unsigned long long x = c;
+	do {
+		natural left = (natural)(x >> bits);
+		natural right = (natural)x & mask;
+		int r;
+		for (r = 0; r < FEISTEL_ROUNDS; r++) {
+			natural next = left ^ (feistelRound(right, perm->keys[r]) & mask);
+			left = right;
+			right = next;
+		}
+		x = ((unsigned long long)left << bits) | right;
+	} while (x >= perm->chunks);
+	return (natural)x;
+}
+
+/*
+ * Sample at position i of the permutation
+ */
+__host__ __device__ static inline natural permAt(const perm_t *perm, natural i) {
+	if (perm->table) return perm->table[i];
+	natural shift = perm->shift;
+	if (shift == 0) return feistelAt(perm, i);
+	natural mask = (1U << shift) - 1;
+	unsigned long long x = i;
+	do {
+		natural c = feistelAt(perm, (natural)(x >> shift));
+		natural a = feistelRound(c, perm->keys[0] ^ FEISTEL_CHUNK_KEY) | 1;
+		natural b = feistelRound(c, perm->keys[1] ^ FEISTEL_CHUNK_KEY);
+		natural o = (((natural)x & mask) * a + b) & mask;
+		x = ((unsigned long long)c << shift) | o;
+	} while (x >= perm->samples);
+	return (natural)x;
+}
+
+
+#endif
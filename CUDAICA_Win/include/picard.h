@@ -0,0 +1,64 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __PICARD_H__
+#define __PICARD_H__
+
+#include <config.h>
+#include <loader.h>
+
+/*
+ * Picard solver (config key solver picard), after Ablin, Cardoso and
+ * Gramfort, "Faster independent component analysis by preconditioning
+ * with Hessian approximations" (2018).
+ *
+ * Minimizes the Infomax loss -log|det W| + E[sum_i g(u_i)], u = W x, on
+ * the whole centered and sphered data, with the densities of the Infomax
+ * steps: g(u) = 2 log cosh(u/2) (score tanh(u/2)), or when extended
+ * u^2/2 + log cosh(u) for super- and u^2/2 - log cosh(u) for sub-gaussian
+ * components (score u +- tanh(u)), the signs taken from the kurtosis like
+ * the pdf step.
+ *
+ * Each step moves W to (I + alpha D) W, D being the L-BFGS direction
+ * (PICARD_MEMORY updates) preconditioned with the H2 Hessian
+ * approximation h_ij = E[g''(u_i) u_j^2], its 2x2 blocks regularized to
+ * eigenvalues of at least PICARD_LAMBDA_MIN. alpha is halved until the
+ * loss decreases, at most PICARD_LS_TRIES times. Stops when the largest
+ * entry of the relative gradient E[g'(u) u'] - I is below stop, or after
+ * maxsteps steps. Bias is not learnt (left at 0).
+ */
+#define PICARD_MEMORY		7
+#define PICARD_LAMBDA_MIN	0.01
+#define PICARD_LS_TRIES		10
+#define PICARD_CHUNK		1024		//Samples per thread work item
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void		picard(eegdataset_t *set);
+error		picardCompare(eegdataset_t *set);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __PLAN_H__
+#define __PLAN_H__
+
+#include <config.h>
+
+/*
+ * Memory planner (cudaica --plan).
+ *
+ * planJob() replays, from the config alone (channels, samples, block,
+ * pdfsize, momentum, precision...), the allocations and frees each stage of
+ * a run makes, in the same order, and keeps the bytes in use at the peak of
+ * every stage. Device buffers are replayed on an arena without memory, so
+ * the device peak is the size of the arena the run is then served from (see
+ * poolArena()). Host figures count every buffer of channels x channels
+ * values or more, the data and its file mapping included. Plans of the gpu
+ * backend need the device selected (selectDevice()).
+ */
+#define PLAN_LOAD			0
+#define PLAN_CENTER			1
+#define PLAN_PCA			2
+#define PLAN_WHITEN			3
+#define PLAN_INFOMAX		4
+#define PLAN_SAVE			5		//Results and ActivationsFile
+#define PLAN_STAGES			6
+
+typedef struct {
+	size_t		host[PLAN_STAGES];		//Peak bytes of each stage
+	size_t		device[PLAN_STAGES];
+	size_t		hostpeak;
+	size_t		devicepeak;				//Device arena size, 0 for backend cpu
+} plan_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void		planJob(config_t *config, plan_t *plan);
+void		planPrint(config_t *config, plan_t *plan);
+size_t		planHostMemory(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
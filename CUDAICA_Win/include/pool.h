@@ -0,0 +1,92 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <config.h>
+#include <cuda_runtime.h>
+
+/*
+ * Buffer pool for the batch mode.
+ *
+ * Buffers given back with poolFree() or poolCudaFree() are kept, keyed by
+ * their size (width and height for device buffers), and handed out again
+ * by the next request of the same size, so a job reuses the buffers of the
+ * previous job of the same shape. Pointers the pool did not hand out are
+ * released as usual. Until poolEnable() is called these are plain
+ * malloc/free and cudaMallocPitch/cudaFree.
+ *
+ * While an arena is set (poolArena()) the device buffers are carved out of
+ * one cudaMalloc instead, rows padded to POOL_PITCH bytes. Arena buffers are
+ * stacked: a freed buffer is reclaimed once every buffer above it is freed
+ * too, so the arena a run needs is the peak the same allocations and frees
+ * reach on an arena without memory (see plan.h). Should a run free in
+ * another order than the plan and go past the arena, the buffers that do
+ * not fit come from cudaMallocPitch as without an arena.
+ */
+#define POOL_PITCH			512
+#define poolPitch(width)	(((width) + POOL_PITCH - 1) / POOL_PITCH * POOL_PITCH)
+
+typedef struct arenablock_s arenablock_t;
+
+typedef struct {
+	char *			base;				//NULL when only replaying
+	size_t			size;				//Bytes, 0 = no limit
+	size_t			top;				//End of the top buffer
+	size_t			peak;				//Highest top since arenaInit() or the last arenaMark()
+	arenablock_t *	blocks;				//Buffers, the top one first
+} arena_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void		poolEnable(int enable);
+void *		poolMalloc(size_t size);
+void *		poolCalloc(size_t count, size_t size);
+void		poolFree(void *ptr);
+cudaError_t	poolMallocPitch(void **ptr, size_t *pitch, size_t width, size_t height);
+cudaError_t	poolCudaMalloc(void **ptr, size_t size);
+void		poolCudaFree(void *ptr);
+void		poolTrim(void);
+cudaError_t	poolArena(size_t bytes);
+void		poolArenaRelease(void);
+
+void		arenaInit(arena_t *arena, void *base, size_t size);
+int			arenaAlloc(arena_t *arena, size_t bytes, size_t *offset);
+int			arenaFree(arena_t *arena, size_t offset);
+void		arenaMark(arena_t *arena);
+void		arenaClear(arena_t *arena);
+
+#ifdef __cplusplus
+}
+
+template <class T> static inline cudaError_t poolMallocPitch(T **ptr, size_t *pitch, size_t width, size_t height) {
+	return poolMallocPitch((void**)ptr, pitch, width, height);
+}
+
+template <class T> static inline cudaError_t poolCudaMalloc(T **ptr, size_t size) {
+	return poolCudaMalloc((void**)ptr, size);
+}
+#endif
+
+
+#endif
@@ -22,11 +22,29 @@
 #include "config.h"
 #include <loader.h>
 
+/*
+ * Post processing of the results (posact, then components sorted by mean
+ * back-projected variance). The activations are computed POST_TILE samples
+ * at a time by every thread and only their sums of squares are kept, so the
+ * data is read once and neither copied nor permuted: only the weights, bias
+ * and signs are reordered.
+ */
+#define POST_TILE			1024	//Samples per activation tile of a thread
+
+/*
+ * ActivationsFile is computed ACT_TILE_BYTES of data at a time, in the
+ * order and signs of the saved weights, so after postprocess(). Each tile is handed to a writer
+ * thread and the next one is computed into the other of two buffers while
+ * it is written, so only a few tiles are held whatever the length.
+ */
+#define ACT_TILE_BYTES		(4 * 1048576)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void 		postprocess(eegdataset_t *set);
+error		postprocess(eegdataset_t *set);
+error		saveActivations(eegdataset_t *set);
 
 #ifdef __cplusplus
 }
@@ -21,6 +21,7 @@
 #define __PREPROCESS_H__
 
 #include "centering.h"
+#include "pca.h"
 #include "whitening.h"
 
 #endif
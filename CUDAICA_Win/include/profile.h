@@ -0,0 +1,88 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <config.h>
+#include <stdint.h>
+
+/*
+ * Stage trace (config key profile FILE, JSON or CSV when FILE ends in .csv).
+ *
+ * Each stage adds up monotonic nanoseconds and calls, and one record per
+ * stage is written at the end of every step (and of every preprocessing
+ * phase). Stages bracketed with PROFILE_BEGIN/PROFILE_END on the calling
+ * thread time the wall clock; gather, nonlinearity and yu of the cpu
+ * backend are timed inside the worker threads with PROFILE_ADD, so their
+ * time is summed over the threads (the streaming reads add to gather on the
+ * calling thread). Device stages synchronize before they are closed, only
+ * while profiling.
+ *
+ * With counters on (Linux), cycles and last level cache misses of the
+ * OpenMP threads are read at PROFILE_BEGIN/PROFILE_END through perf_event,
+ * and bytes are estimated as PROFILE_LINE bytes per miss.
+ *
+ * Profiling off costs one test of profileEnabled per stage.
+ */
+#define PROFILE_LINE		64		//Bytes moved per cache miss
+
+#define PROFILE_LOAD		0
+#define PROFILE_CENTER		1
+#define PROFILE_WHITEN		2
+#define PROFILE_SAVE		3
+#define PROFILE_PERM		4		//initperm
+#define PROFILE_GATHER		5		//Permuted samples into the tiles (cpu)
+#define PROFILE_FORWARD		6		//u = W x + bias, y = g(u) (steps 1 and 2)
+#define PROFILE_YU			7		//yu = y * u' + I (step 3)
+#define PROFILE_BLOCK		8		//Steps 1 to 3 of a block (cpu, wall clock)
+#define PROFILE_UPDATE		9		//Weights update (step 4)
+#define PROFILE_PDF			10		//Kurtosis and signs
+#define PROFILE_SYNC		11		//Device to host reads in the loop
+#define PROFILE_PCA			12
+#define PROFILE_STAGES		13
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int	profileEnabled;
+
+error		profileInit(config_t *config);
+uint64_t	profileNow(void);
+void		profileBegin(int stage);
+void		profileEnd(int stage);
+void		profileDeviceEnd(int stage);
+void		profileAdd(int stage, uint64_t ns);
+void		profileStep(const char *phase, int step);
+void		profileClose(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define PROFILE_BEGIN(stage)		if (profileEnabled) profileBegin(stage)
+#define PROFILE_END(stage)			if (profileEnabled) profileEnd(stage)
+#define PROFILE_DEVICE_END(stage)	if (profileEnabled) profileDeviceEnd(stage)
+#define PROFILE_TICK(var)			uint64_t var = profileEnabled ? profileNow() : 0
+#define PROFILE_ADD(stage, from, to)	if (profileEnabled) profileAdd(stage, (to) - (from))
+
+
+#endif
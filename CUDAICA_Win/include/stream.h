@@ -0,0 +1,74 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <config.h>
+#include <container.h>
+
+/*
+ * Out-of-core data store for the streaming mode.
+ *
+ * The data file stays mapped read-only and is read in tiles of consecutive
+ * samples. Centering and sphering are not applied to the file: the mean and
+ * sphere matrix are kept here and applied to every gathered block. Tiles
+ * touched are tracked with a clock so that no more than maxresident tiles
+ * stay mapped in; the others are handed back to the kernel.
+ */
+#define STREAM_TILE_BYTES		(4 * 1048576)
+
+struct stream_s {
+	char *			base;				//Payload start in the mapping
+	void *			mapping;
+	size_t			mapsize;
+	container_t		desc;				//Payload type, byte order and shape
+	int				swap;				//Payload byte order differs from the host
+	natural			channels;
+	natural			samples;
+	size_t			rowbytes;			//Bytes per sample in the file
+	natural			tilesamples;		//Samples per tile
+	natural			ntiles;
+	natural			maxresident;		//Resident tiles cap, 0 = no cap
+	natural			nresident;
+	natural			hand;				//Clock hand
+	unsigned char *	resident;			//Per tile: 0 out, 1 resident, 2 resident and referenced
+	real *			mean;				//Channel means, NULL until streamMean() or streamMoments()
+	real *			sphere;				//Sphere (column major), NULL when not sphering
+	real *			scratch;			//Sphering buffer
+	natural			scratchrows;		//Rows in the sphering buffer
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+error		streamOpen(char *src, container_t *desc, size_t memcap, stream_t **stream);
+void		streamClose(stream_t *stream);
+void		streamGather(stream_t *stream, natural *perm, natural count, real *out);
+void		streamPrefetch(stream_t *stream, natural *perm, natural count);
+void		streamMean(stream_t *stream, int nparts);
+void		streamMoments(stream_t *stream, real *cov, int nparts);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
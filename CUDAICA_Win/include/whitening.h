@@ -23,11 +23,19 @@
 #include <config.h>
 #include <loader.h>
 
+#define SPHERE_BUFFER	(64 * 1048576)	//Bytes of sphered samples between copies back to the data
+#define SPHERE_CHUNK	4096			//Samples a thread spheres at a time on the host
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 void 		whiten(eegdataset_t *set);
+void 		hostWhiten(eegdataset_t *set);
+void 		calcSphere(eegdataset_t *set, real *host_sphe);
+void 		sphereFromCov(real *host_sphe, natural channels);
+void 		hostEye(real *data, natural channels);
+void 		hostMultbySphere(real *sphere, real *mean, real *data, natural channels, natural samples, int nparts);
 
 #ifdef __cplusplus
 }
@@ -18,15 +18,29 @@
 extern "C" {
 #endif
 
+/* generator state, the _r functions keep it in the caller so that
+   several generators can run at once */
+typedef struct
+{
+	unsigned int buffer[ 250 ];
+	int index;
+} r250_state;
+
 #ifdef NO_PROTO
 void         r250_init();
 unsigned int r250();
 double      dr250();
+void         r250_init_r();
+unsigned int r250_r();
+double      dr250_r();
 
 #else
 void         r250_init(int seed);
 unsigned int r250( void );
 double       dr250( void );
+void         r250_init_r(r250_state *state, int seed);
+unsigned int r250_r(r250_state *state);
+double       dr250_r(r250_state *state);
 #endif
 
 #ifdef __cplusplus
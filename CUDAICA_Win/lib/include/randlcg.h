@@ -20,11 +20,13 @@ extern "C" {
 long         set_seed();
 long         get_seed();
 unsigned long int randlcg();
+unsigned long int randlcg_r();
 
 #else
 long         set_seed(long);
 long         get_seed(long);
 unsigned long int randlcg();
+unsigned long int randlcg_r(long *seed);
 
 #endif
 
@@ -63,18 +63,19 @@ static char rcsid[] = "@(#)r250.c	1.2 15:50:31 11/21/94   EFC";
 #define STEP        11
 #endif
 
-static unsigned int r250_buffer[ 250 ];
-static int r250_index;
+static r250_state r250_global;	/* state of r250_init, r250 and dr250 */
 
 #ifdef NO_PROTO
-void r250_init(sd)
+void r250_init_r(state, sd)
+r250_state *state;
 int seed;
 #else
-void r250_init(int sd)
+void r250_init_r(r250_state *state, int sd)
 #endif
 {
 	int j, k;
 	unsigned int mask, msb;
+	unsigned int *r250_buffer = state->buffer;
 
 #ifdef TRUST_RAND        
 
@@ -86,10 +87,10 @@ void r250_init(int sd)
 
 
 #else
-	set_seed( sd );
+	long int seed_val = sd;
 #endif
 	
-	r250_index = 0;
+	state->index = 0;
 	for (j = 0; j < 250; j++)      /* fill r250 buffer with BITS-1 bit values */
 #ifdef TRUST_RAND
 #if BITS == 32 || BITS == 31
@@ -98,7 +99,7 @@ void r250_init(int sd)
 		r250_buffer[j] = rand();
 #endif
 #else
-		r250_buffer[j] = randlcg();
+		r250_buffer[j] = randlcg_r( &seed_val );
 #endif
 
 
@@ -107,7 +108,7 @@ void r250_init(int sd)
 		if ( rand() > HALF_RANGE )
 			r250_buffer[j] |= MSB;
 #else
-		if ( randlcg() > HALF_RANGE )
+		if ( randlcg_r( &seed_val ) > HALF_RANGE )
 			r250_buffer[j] |= MSB;
 #endif
 
@@ -126,49 +127,63 @@ void r250_init(int sd)
 
 }
 
-unsigned int r250()		/* returns a random unsigned integer */
+#ifdef NO_PROTO
+unsigned int r250_r(state)
+r250_state *state;
+#else
+unsigned int r250_r(r250_state *state)
+#endif
 {
 	register int	j;
 	register unsigned int new_rand;
+	int r250_index = state->index;
 
 	if ( r250_index >= 147 )
 		j = r250_index - 147;	/* wrap pointer around */
 	else
 		j = r250_index + 103;
 
-	new_rand = r250_buffer[ r250_index ] ^ r250_buffer[ j ];
-	r250_buffer[ r250_index ] = new_rand;
+	new_rand = state->buffer[ r250_index ] ^ state->buffer[ j ];
+	state->buffer[ r250_index ] = new_rand;
 
 	if ( r250_index >= 249 )	/* increment pointer for next time */
-		r250_index = 0;
+		state->index = 0;
 	else
-		r250_index++;
+		state->index = r250_index + 1;
 
 	return new_rand;
 
 }
 
-
-double dr250()		/* returns a random double in range 0..1 */
+#ifdef NO_PROTO
+double dr250_r(state)
+r250_state *state;
+#else
+double dr250_r(r250_state *state)
+#endif
 {
-	register int	j;
-	register unsigned int new_rand;
-
-	if ( r250_index >= 147 )
-		j = r250_index - 147;	/* wrap pointer around */
-	else
-		j = r250_index + 103;
+	return (double)r250_r( state ) / ALL_BITS;
+}
 
-	new_rand = r250_buffer[ r250_index ] ^ r250_buffer[ j ];
-	r250_buffer[ r250_index ] = new_rand;
+#ifdef NO_PROTO
+void r250_init(sd)
+int seed;
+#else
+void r250_init(int sd)
+#endif
+{
+	r250_init_r( &r250_global, sd );
+}
 
-	if ( r250_index >= 249 )	/* increment pointer for next time */
-		r250_index = 0;
-	else
-		r250_index++;
+unsigned int r250()		/* returns a random unsigned integer */
+{
+	return r250_r( &r250_global );
+}
 
-	return (double)new_rand / ALL_BITS;
 
+double dr250()		/* returns a random double in range 0..1 */
+{
+	return dr250_r( &r250_global );
 }
 
 #ifdef MAIN
@@ -26,25 +26,31 @@ long get_seed()
 }
 
 
-unsigned long int randlcg()       /* returns a random unsigned integer */
+unsigned long int randlcg_r(long int *seed)   /* the same, advancing the caller's seed */
 {
-        if ( seed_val <= quotient )
-                seed_val = (seed_val * 16807L) % LONG_MAX;
+        if ( *seed <= quotient )
+                *seed = (*seed * 16807L) % LONG_MAX;
         else
         {
-                long int high_part = seed_val / quotient;
-                long int low_part  = seed_val % quotient;
+                long int high_part = *seed / quotient;
+                long int low_part  = *seed % quotient;
 
                 long int test = 16807L * low_part - remain * high_part;
 
                 if ( test > 0 )
-                        seed_val = test;
+                        *seed = test;
                 else
-                        seed_val = test + LONG_MAX;
+                        *seed = test + LONG_MAX;
 
         }
 
-        return seed_val;
+        return *seed;
+}
+
+
+unsigned long int randlcg()       /* returns a random unsigned integer */
+{
+        return randlcg_r( &seed_val );
 }
 
 
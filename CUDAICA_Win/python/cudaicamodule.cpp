@@ -0,0 +1,216 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+#include <cudaica.h>
+#include <string.h>
+#include <limits.h>
+
+/*
+ * Python module over the library interface (cudaica.h).
+ *
+ * cudaica.run(data, device=0, **options) takes a channels x samples array
+ * of float64 or float32, in C or Fortran order, through the buffer
+ * protocol, with no NumPy conversion: icaRun() reads it once, with its
+ * strides, into the one working copy the pipeline centers and spheres, and
+ * never writes it. The GIL is released while it runs. options are the keys
+ * of the configuration file, True and False standing for on and off. The
+ * results are written by icaRun() straight into the NumPy arrays returned.
+ */
+#define NPY_REAL (sizeof(real) == sizeof(double) ? NPY_DOUBLE : NPY_FLOAT)
+
+static int setOptions(icaoptions_t *options, PyObject *kwargs) {
+	PyObject *key, *value;
+	Py_ssize_t pos = 0;
+	while (PyDict_Next(kwargs, &pos, &key, &value)) {
+		const char *name = PyUnicode_AsUTF8(key);
+		if (name == NULL) return -1;
+		if (strcmp(name, "device") == 0) {
+			long device = PyLong_AsLong(value);
+			if (device == -1 && PyErr_Occurred()) return -1;
+			if (device < 0) {
+				PyErr_SetString(PyExc_ValueError, "device must be a cuda device number");
+				return -1;
+			}
+			options->device = (natural)device;
+			continue;
+		}
+		PyObject *text = PyBool_Check(value) ? PyUnicode_FromString(value == Py_True ? "on" : "off") : PyObject_Str(value);
+		if (text == NULL) return -1;
+		const char *str = PyUnicode_AsUTF8(text);
+		error err = str != NULL ? icaOption(options, name, str) : SUCCESS;
+		Py_DECREF(text);
+		if (str == NULL) return -1;
+		if (err == ERRORNOPARAM) {
+			PyErr_Format(PyExc_TypeError, "run() got an unknown option '%s'", name);
+			return -1;
+		}
+		if (err != SUCCESS) {
+			PyErr_Format(PyExc_ValueError, "invalid value %R for option '%s'", value, name);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Element type of a buffer format, native byte order only
+ */
+static int bufferType(const Py_buffer *view, natural *dtype) {
+	const char *format = view->format != NULL ? view->format : "B";
+	const int one = 1;
+	const char native = *(const char*)&one ? '<' : '>';
+	if (*format == '@' || *format == '=' || *format == native) format++;
+	if (strcmp(format, "d") == 0 && view->itemsize == 8) {
+		*dtype = DTYPE_F64;
+		return 0;
+	}
+	if (strcmp(format, "f") == 0 && view->itemsize == 4) {
+		*dtype = DTYPE_F32;
+		return 0;
+	}
+	PyErr_Format(PyExc_TypeError, "data must be float64 or float32 in native byte order, not '%s'", view->format);
+	return -1;
+}
+
+static PyObject *newArray(int nd, npy_intp *dims, int type) {
+	return PyArray_New(&PyArray_Type, nd, dims, type, NULL, NULL, 0, NPY_ARRAY_F_CONTIGUOUS, NULL);
+}
+
+static void setError(error err) {
+	switch (err) {
+		case ERRORINVALIDPARAM:
+		case ERRORNOPARAM:
+			PyErr_SetString(PyExc_ValueError, "invalid data or options (see stderr)");
+			break;
+		case ERRORNODEVICEMEM:
+			PyErr_SetString(PyExc_MemoryError, "not enough device memory for the run");
+			break;
+		case ERRORDIVERGED:
+			PyErr_SetString(PyExc_RuntimeError, "Infomax diverged: lower lrate");
+			break;
+		case ERRORDEVICE:
+			PyErr_SetString(PyExc_RuntimeError, "cuda or cublas error (see stderr)");
+			break;
+		case ERRORLAPACK:
+			PyErr_SetString(PyExc_RuntimeError, "pca eigendecomposition failed (see stderr)");
+			break;
+		default:
+			PyErr_Format(PyExc_RuntimeError, "cudaica failed with error %d", err);
+	}
+}
+
+PyDoc_STRVAR(run_doc,
+"run(data, device=0, **options) -> dict\n"
+"\n"
+"Runs ICA (center, pca, whiten, Infomax, posact and sorting by variance)\n"
+"on data, a channels x samples float64 or float32 array in C or Fortran\n"
+"order. data is not converted or written: it is read once into the working\n"
+"copy the pipeline runs on.\n"
+"options are the keys of the configuration file (extended=1, maxsteps=512,\n"
+"backend='gpu', pca=30...), True and False for on and off. Returns weights\n"
+"and sphere (components x components), bias and signs (components),\n"
+"projection (components x channels, when pca reduces) and steps.");
+
+static PyObject *run(PyObject *self, PyObject *args, PyObject *kwargs) {
+	PyObject *object;
+	if (!PyArg_ParseTuple(args, "O:run", &object)) return NULL;
+
+	icaoptions_t options;
+	icaDefaults(&options);
+	if (kwargs != NULL && setOptions(&options, kwargs) < 0) return NULL;
+
+	Py_buffer view;
+	if (PyObject_GetBuffer(object, &view, PyBUF_ANY_CONTIGUOUS | PyBUF_FORMAT) < 0) return NULL;
+	icadata_t data;
+	if (bufferType(&view, &data.dtype) < 0) {
+		PyBuffer_Release(&view);
+		return NULL;
+	}
+	if (view.ndim != 2 || view.shape[0] == 0 || view.shape[1] == 0 || view.shape[0] > UINT_MAX || view.shape[1] > UINT_MAX) {
+		PyBuffer_Release(&view);
+		PyErr_SetString(PyExc_ValueError, "data must be a non empty channels x samples array");
+		return NULL;
+	}
+	data.data = view.buf;
+	data.channels = (natural)view.shape[0];
+	data.samples = (natural)view.shape[1];
+	data.chanstride = view.strides[0];
+	data.samplestride = view.strides[1];
+
+	natural k = icaComponents(&options, data.channels);
+	npy_intp square[2] = {k, k};
+	npy_intp vector[1] = {k};
+	npy_intp rect[2] = {k, data.channels};
+	PyObject *weights = newArray(2, square, NPY_REAL);
+	PyObject *sphere = newArray(2, square, NPY_REAL);
+	PyObject *bias = newArray(1, vector, NPY_REAL);
+	PyObject *signs = newArray(1, vector, sizeof(integer) == 4 ? NPY_INT32 : NPY_INT64);
+	PyObject *projection = k < data.channels ? newArray(2, rect, NPY_REAL) : NULL;
+	PyObject *dict = NULL;
+	if (weights == NULL || sphere == NULL || bias == NULL || signs == NULL || (k < data.channels && projection == NULL)) goto done;
+
+	icaresults_t results;
+	results.weights = (real*)PyArray_DATA((PyArrayObject*)weights);
+	results.sphere = (real*)PyArray_DATA((PyArrayObject*)sphere);
+	results.bias = (real*)PyArray_DATA((PyArrayObject*)bias);
+	results.signs = (integer*)PyArray_DATA((PyArrayObject*)signs);
+	results.projection = projection != NULL ? (real*)PyArray_DATA((PyArrayObject*)projection) : NULL;
+
+	error err;
+	Py_BEGIN_ALLOW_THREADS
+	err = icaRun(&data, &options, &results);
+	Py_END_ALLOW_THREADS
+	if (err != SUCCESS) {
+		setError(err);
+		goto done;
+	}
+
+	dict = Py_BuildValue("{s:O,s:O,s:O,s:O,s:I}", "weights", weights, "sphere", sphere, "bias", bias, "signs", signs, "steps", results.steps);
+	if (dict != NULL && projection != NULL && PyDict_SetItemString(dict, "projection", projection) < 0) {
+		Py_CLEAR(dict);
+	}
+
+done:
+	PyBuffer_Release(&view);
+	Py_XDECREF(weights);
+	Py_XDECREF(sphere);
+	Py_XDECREF(bias);
+	Py_XDECREF(signs);
+	Py_XDECREF(projection);
+	return dict;
+}
+
+static PyMethodDef methods[] = {
+	{"run", (PyCFunction)(void(*)(void))run, METH_VARARGS | METH_KEYWORDS, run_doc},
+	{NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef module = {
+	PyModuleDef_HEAD_INIT, "cudaica", "Infomax ICA of cudaica on NumPy arrays.", -1, methods
+};
+
+PyMODINIT_FUNC PyInit_cudaica(void) {
+	import_array();
+	return PyModule_Create(&module);
+}
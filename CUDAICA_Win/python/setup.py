@@ -0,0 +1,66 @@
+"""
+Builds the cudaica Python module (cudaicamodule.cpp) over the library
+interface of include/cudaica.h.
+
+The core comes from the Library|x64 configuration of CUDAICA_Win.sln: the
+objects of src/ and lib/, without cudaica_win.c, archived into
+x64\\Library\\cudaica.lib next to the solution. CUDAICA_LIB names another
+archive. CUDA_PATH is the toolkit it was built with and MKLROOT the MKL it
+links against.
+
+    msbuild ..\\..\\CUDAICA_Win.sln /p:Configuration=Library /p:Platform=x64
+    python setup.py build_ext --inplace
+
+    >>> import numpy, cudaica
+    >>> ica = cudaica.run(data, extended=1, backend="gpu", pca=30)
+    >>> activations = ica["weights"] @ ica["sphere"] @ ica["projection"] @ (data - data.mean(1, keepdims=True))
+"""
+
+import os
+import sys
+
+import numpy
+from setuptools import Extension, setup
+
+here = os.path.dirname(os.path.abspath(__file__))
+root = os.path.dirname(here)
+cuda = os.environ.get("CUDA_PATH", "")
+mkl = os.environ.get("MKLROOT", "")
+arch = "x64" if sys.platform == "win32" else "lib64"
+
+include_dirs = [os.path.join(root, "include"), os.path.join(root, "lib", "include"), numpy.get_include()]
+library_dirs = []
+if cuda:
+    include_dirs.append(os.path.join(cuda, "include"))
+    library_dirs.append(os.path.join(cuda, "lib", arch) if sys.platform == "win32" else os.path.join(cuda, arch))
+if mkl:
+    include_dirs.append(os.path.join(mkl, "include"))
+    library_dirs.append(os.path.join(mkl, "lib", "intel64"))
+
+if sys.platform == "win32":
+    compile_args = ["/openmp", "/O2"]
+    link_args = []
+    libraries = ["cudart_static", "cublas", "mkl_rt"]
+else:
+    compile_args = ["-fopenmp", "-O2"]
+    link_args = ["-fopenmp"]
+    libraries = ["cudart_static", "cublas", "mkl_rt", "pthread", "dl", "rt"]
+
+setup(
+    name="cudaica",
+    version="1.1",
+    description="Infomax ICA of cudaica on NumPy arrays",
+    ext_modules=[
+        Extension(
+            "cudaica",
+            sources=[os.path.join(here, "cudaicamodule.cpp")],
+            include_dirs=include_dirs,
+            library_dirs=library_dirs,
+            libraries=libraries,
+            extra_objects=[os.environ.get("CUDAICA_LIB", os.path.join(os.path.dirname(root), "x64", "Library", "cudaica.lib"))],
+            extra_compile_args=compile_args,
+            extra_link_args=link_args,
+        )
+    ],
+    install_requires=["numpy"],
+)
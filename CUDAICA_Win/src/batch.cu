@@ -0,0 +1,325 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <batch.h>
+#include <loader.h>
+#include <preprocess.h>
+#include <infomax.h>
+#include <ensemble.h>
+#include <postprocess.h>
+#include <device.h>
+#include <pool.h>
+#include <plan.h>
+#include <checkpoint.h>
+#include <error.h>
+#include <common.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define BATCH_LINE 5000
+
+typedef struct {
+	char *			filename;			//Config file
+	eegdataset_t *	dataset;			//NULL once saved
+	config_t		config;				//Copy of the parsed config, outlives the dataset
+	error			err;
+	size_t			prepare;			//Device peak of loading to sphering (plan.h)
+	size_t			infomax;			//Device peak of Infomax
+	size_t			kept;				//Device bytes kept until the job is saved
+} batchjob_t;
+
+/*
+ * Reads the config paths in the manifest. Returns the number of jobs, or -1
+ * if the manifest cannot be opened.
+ */
+static int batchRead(char *manifest, batchjob_t **jobs) {
+	FILE *mfile = fopen(manifest, "r");
+	if (mfile == NULL) {
+		fprintf(stderr, "ERROR::Cannot open batch manifest %s\n", manifest);
+		return -1;
+	}
+	char *buffer = (char*)malloc(BATCH_LINE);
+	int njobs = 0;
+	int size = 0;
+	*jobs = NULL;
+	while (fgets(buffer, BATCH_LINE, mfile) != NULL) {
+		char *line = buffer;
+		while (*line == ' ' || *line == '\t') line++;
+		size_t len = strlen(line);
+		while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r' || line[len-1] == ' ' || line[len-1] == '\t')) {
+			line[--len] = '\0';
+		}
+		if (len == 0 || line[0] == '#') continue;
+		if (njobs == size) {
+			size = size ? size * 2 : 8;
+			*jobs = (batchjob_t*)realloc(*jobs, size * sizeof(batchjob_t));
+		}
+		batchjob_t *job = *jobs + njobs++;
+		memset(job, 0, sizeof(batchjob_t));
+		job->filename = (char*)malloc(len + 1);
+		strcpy(job->filename, line);
+	}
+	free(buffer);
+	fclose(mfile);
+	return njobs;
+}
+
+/*
+ * True if both jobs run Infomax with the same buffers
+ */
+static int batchSameShape(config_t *a, config_t *b) {
+	return a->backend == b->backend && a->nchannels == b->nchannels && a->nsamples == b->nsamples &&
+		a->block == b->block && a->precision == b->precision && a->nthreads == b->nthreads &&
+		a->extended == b->extended && a->pdfsize == b->pdfsize && a->biasing == b->biasing;
+}
+
+/*
+ * First stage: loads, centers and spheres the dataset
+ */
+static void batchPrepare(batchjob_t *job) {
+	eegdataset_t *set = job->dataset;
+	if (job->err != SUCCESS) return;
+#ifdef _OPENMP
+	omp_set_num_threads(set->config.nthreads);
+#endif
+	if (set->config.backend == BACKEND_GPU) bindDevice();
+	job->err = loadEEG(set);
+	if (job->err != SUCCESS) {
+		fprintf(stderr, "ERROR::Cannot load the dataset of %s\n", job->filename);
+		return;
+	}
+	if (set->config.backend == BACKEND_GPU) {
+		job->err = loadToDevice(set);
+		if (job->err != SUCCESS) {
+			fprintf(stderr, "ERROR::Cannot load the dataset of %s to device\n", job->filename);
+			return;
+		}
+	}
+	centerData(set);
+	if (pcaReduces(set)) {
+		job->err = pcaReduce(set);
+		if (job->err != SUCCESS) {
+			fprintf(stderr, "ERROR::Cannot reduce the dataset of %s\n", job->filename);
+			return;
+		}
+	}
+	if (set->config.sphering == 1 || set->config.sphering == 0) {
+		whiten(set);
+	}
+	printf("Batch: %s prepared\n", job->filename);
+}
+
+/*
+ * Second stage: runs Infomax. The free pool buffers are released first if
+ * the previous job had another shape.
+ */
+static void batchInfomax(batchjob_t *job, batchjob_t *prev) {
+	eegdataset_t *set = job->dataset;
+	if (job->err != SUCCESS) return;
+	if (prev != NULL && !batchSameShape(&prev->config, &job->config)) {
+		poolTrim();
+	}
+#ifdef _OPENMP
+	omp_set_num_threads(set->config.nthreads);
+#endif
+	if (set->config.backend == BACKEND_GPU) bindDevice();
+	printf("Batch: running Infomax for %s\n", job->filename);
+	if (set->config.ensemble > 1) {
+		job->err = runEnsemble(set);
+	} else {
+		job->err = infomax(set);
+	}
+}
+
+/*
+ * Last stage: post processes the results (an ensemble did already), saves
+ * them and frees the dataset
+ */
+static void batchSave(batchjob_t *job) {
+	eegdataset_t *set = job->dataset;
+	if (set == NULL) return;
+	if (set->config.backend == BACKEND_GPU) bindDevice();
+	if (job->err == SUCCESS && set->config.ensemble <= 1) {
+		job->err = postprocess(set);
+	}
+	if (job->err == SUCCESS) {
+		job->err = saveEEG(set);
+		if (job->err == SUCCESS && set->config.activationsfile != NULL) {
+			job->err = saveActivations(set);
+		}
+		printf("Batch: %s saved\n", job->filename);
+	}
+	if (set->config.backend == BACKEND_GPU) freeDeviceMem(set);
+	freeEEG(set);
+	job->dataset = NULL;
+}
+
+/*
+ * True while job holds or may hold device memory: until it is saved
+ */
+static int batchActive(batchjob_t *job) {
+	return job != NULL && job->dataset != NULL;
+}
+
+/*
+ * Skips the jobs from first on that did not fail yet: the signal that
+ * stopped Infomax stays set for the rest of the process
+ */
+static void batchStop(batchjob_t *jobs, int first, int njobs) {
+	int i;
+	for (i = first; i < njobs; i++) {
+		if (jobs[i].err == SUCCESS) {
+			fprintf(stderr, "ERROR::Interrupted, skipping %s\n", jobs[i].filename);
+			jobs[i].err = ERRORINTERRUPTED;
+		}
+	}
+}
+
+/*
+ * Runs every job in the manifest. Jobs that fail are reported and skipped.
+ *
+ * manifest: file with one config file path per line
+ * device: cuda device for the gpu backend jobs
+ */
+error runBatch(char *manifest, natural device) {
+	batchjob_t *jobs;
+	int njobs = batchRead(manifest, &jobs);
+	int gpujobs = 0;
+	int failed = 0;
+	int tick = 0;
+	int i = 0;
+	int stopped = 0;
+	size_t freemem = 0;
+	if (njobs < 0) return ERRORNOFILE;
+
+	/*
+	 * All configs are parsed up front: parseConfig() uses strtok() and the
+	 * loader may too, so they cannot run while a job is being loaded.
+	 */
+	for (i = 0; i < njobs; i++) {
+		batchjob_t *job = jobs + i;
+		job->dataset = (eegdataset_t*)malloc(sizeof(eegdataset_t));
+		initDefaultConfig(job->dataset);
+		job->err = parseConfig(job->filename, job->dataset);
+		checkDefaultConfig(job->dataset);
+		job->config = job->dataset->config;
+		if (job->err != SUCCESS) {
+			fprintf(stderr, "ERROR::Invalid config file %s, skipping it\n", job->filename);
+		} else if (job->config.backend == BACKEND_GPU) {
+			gpujobs++;
+		}
+	}
+	if (gpujobs > 0) {
+		selectDevice(device, 1);
+		/*
+		 * A job whose peak alone does not fit is skipped now rather than
+		 * when one of its allocations fails
+		 */
+		freemem = getFreeMem();
+		for (i = 0; i < njobs; i++) {
+			batchjob_t *job = jobs + i;
+			plan_t plan;
+			int s;
+			if (job->err != SUCCESS || job->config.backend != BACKEND_GPU) continue;
+			planJob(&job->config, &plan);
+			if (plan.devicepeak > freemem) {
+				fprintf(stderr, "ERROR::%s needs %.1f MB of device memory, %.1f MB are free, skipping it\n", job->filename, plan.devicepeak / 1048576.0, freemem / 1048576.0);
+				job->err = ERRORNODEVICEMEM;
+				continue;
+			}
+			for (s = PLAN_LOAD; s < PLAN_INFOMAX; s++) {
+				if (plan.device[s] > job->prepare) job->prepare = plan.device[s];
+			}
+			job->infomax = plan.device[PLAN_INFOMAX];
+			job->kept = plan.device[PLAN_SAVE];
+		}
+	}
+
+	printf("Batch: %d jobs\n", njobs);
+	double start = wallclock();
+	poolEnable(1);
+#ifdef _OPENMP
+	omp_set_nested(1);
+#endif
+	for (tick = 0; tick < njobs + 2; tick++) {
+		batchjob_t *prepare = tick < njobs ? jobs + tick : NULL;
+		batchjob_t *run = tick >= 1 && tick <= njobs ? jobs + tick - 1 : NULL;
+		batchjob_t *save = tick >= 2 ? jobs + tick - 2 : NULL;
+
+		if (!stopped && checkpointInterrupted()) {
+			batchStop(jobs, tick >= 1 ? tick - 1 : 0, njobs);
+			stopped = 1;
+		}
+
+		/*
+		 * The three stages of a tick hold the device data of three jobs.
+		 * When they do not fit together they go one at a time, freeing
+		 * first, and a job is saved early if the next one cannot be
+		 * prepared next to it.
+		 */
+		size_t overlap = (batchActive(prepare) ? prepare->prepare : 0) + (batchActive(run) ? run->infomax : 0) + (batchActive(save) ? save->kept : 0);
+		if (overlap > freemem) {
+			printf("Batch: %.1f MB of device memory needed at once, %.1f MB are free, running the stages one at a time\n", overlap / 1048576.0, freemem / 1048576.0);
+			if (save != NULL) batchSave(save);
+			poolTrim();
+			if (run != NULL) batchInfomax(run, tick >= 2 ? jobs + tick - 2 : NULL);
+			if (prepare != NULL) {
+				if (batchActive(run) && run->kept + prepare->prepare > freemem) {
+					batchSave(run);
+					poolTrim();
+				}
+				batchPrepare(prepare);
+			}
+			continue;
+		}
+		#pragma omp parallel sections num_threads(3)
+		{
+			#pragma omp section
+			{
+				if (tick < njobs) batchPrepare(jobs + tick);
+			}
+			#pragma omp section
+			{
+				if (tick >= 1 && tick <= njobs) batchInfomax(jobs + tick - 1, tick >= 2 ? jobs + tick - 2 : NULL);
+			}
+			#pragma omp section
+			{
+				if (tick >= 2) batchSave(jobs + tick - 2);
+			}
+		}
+	}
+	poolTrim();
+	poolEnable(0);
+
+	for (i = 0; i < njobs; i++) {
+		if (jobs[i].err != SUCCESS) {
+			fprintf(stderr, "Batch: %s failed (%d)\n", jobs[i].filename, jobs[i].err);
+			failed++;
+		}
+		free(jobs[i].filename);
+	}
+	free(jobs);
+	printf("Batch: %d of %d jobs finished in %.2f s\n", njobs - failed, njobs, wallclock() - start);
+	return failed ? ERRORINVALIDCONFIG : SUCCESS;
+}
@@ -28,11 +28,17 @@
 
 #include <stdio.h>
 #include <centering.h>
+#include <pca.h>
+#include <stream.h>
 #include <error.h>
 #include <common.h>
 #include <device.h>
+#include <pool.h>
+#include <cblas.h>
 #include <cuda_runtime.h>
 #include <device_launch_parameters.h>
+#include <stdlib.h>
+#include <string.h>
 
 /*
  * Magic:
@@ -49,7 +55,9 @@ __shared__ bool isLastBlockFinished; //If true, then last block has finished.
  * Computes the sums for each channel and then divides by the number of samples.
  * sums = sum(channels(data))/samples
  *
- * Should be launched with N blocks of channels threads
+ * Should be launched with N x CHANNEL_TILES(channels) blocks of
+ * CHANNEL_THREADS(channels) threads. The last block to finish adds up the
+ * partial sums of every channel tile.
  *
  * data: matrix
  * channels: number of channels
@@ -62,29 +70,36 @@ __global__ void getMean(real* data, natural channels, natural samples, size_t pi
 	double sum = 0.0;
 	size_t colwidth = pitch/sizeof(real);
 	size_t sumcolwidth = sumspitch/sizeof(real);
+	natural c = threadIdx.x + blockIdx.y * blockDim.x;
+	natural nblocks = gridDim.x * gridDim.y;
 	int count = samples / gridDim.x;	// Process a fraction of a column
 	int i = count * blockIdx.x;			// Starts when it should
 	int end = count * (blockIdx.x + 1);	// Ends when the next starts
 	if (blockIdx.x == gridDim.x -1) {	// If its the last, finish
 		end = samples;
 	}
-	for (; i < end; i++) {
-		sum += data[(i*colwidth) + threadIdx.x];
+	if (c < channels) {
+		for (; i < end; i++) {
+			sum += data[(i*colwidth) + c];
+		}
+		sums[blockIdx.x * sumcolwidth + c] = sum;
 	}
-	sums[blockIdx.x * sumcolwidth + threadIdx.x] = sum;
+	__threadfence();
 
 	if (threadIdx.x == 0) {
-		natural value = atomicInc(&blocksFinished, gridDim.x);
-		isLastBlockFinished = (value == gridDim.x-1);
+		natural value = atomicInc(&blocksFinished, nblocks);
+		isLastBlockFinished = (value == nblocks-1);
 	}
 
 	__syncthreads();
 	if (isLastBlockFinished) {
-		sum = 0.0;
-		for (i = 0; i < gridDim.x; i++) {
-			sum += sums[threadIdx.x + i * sumcolwidth];
+		for (c = threadIdx.x; c < channels; c += blockDim.x) {
+			sum = 0.0;
+			for (i = 0; i < gridDim.x; i++) {
+				sum += sums[c + i * sumcolwidth];
+			}
+			sums[c] = sum/samples;
 		}
-		sums[threadIdx.x] = sum/samples;
 		if (threadIdx.x == 0) {
 			blocksFinished = 0;
 		}
@@ -95,7 +110,8 @@ __global__ void getMean(real* data, natural channels, natural samples, size_t pi
  * Centers data by substracting the mean value from means vector
  * data = data - mean
  *
- * Should be launched with N blocks of channels threads
+ * Should be launched with N x CHANNEL_TILES(channels) blocks of
+ * CHANNEL_THREADS(channels) threads
  *
  * data: matrix
  * channels: number of channels
@@ -105,7 +121,9 @@ __global__ void getMean(real* data, natural channels, natural samples, size_t pi
  */
 __global__ void subMean(real* data, natural channels, natural samples, size_t pitch, real* means) {
 	int colwidth = pitch/sizeof(real);
-	real mean = means[threadIdx.x];
+	natural c = threadIdx.x + blockIdx.y * blockDim.x;
+	if (c >= channels) return;
+	real mean = means[c];
 	int count = samples / gridDim.x;		// Process a fraction of a column
 	int i = count * blockIdx.x;				// Starts when it should
 	int end = count * (blockIdx.x + 1);		// Ends when the next starts
@@ -113,8 +131,221 @@ __global__ void subMean(real* data, natural channels, natural samples, size_t pi
 		end = samples;
 	}
 	for (; i < end; i++) {
-		data[(i*colwidth) + threadIdx.x] -= mean;
+		data[(i*colwidth) + c] -= mean;
+	}
+}
+
+/*
+ * Empty moments of channels channels
+ */
+void momentsInit(moments_t *moments, natural channels) {
+	moments->count = 0.0;
+	moments->mean = (double*)calloc(channels, sizeof(double));
+	moments->scatter = (real*)calloc((size_t)channels * channels, sizeof(real));
+	moments->tmp = (real*)malloc((size_t)MOMENTS_CHUNK * channels * sizeof(real));
+}
+
+/*
+ * Releases the buffers of the moments
+ */
+void momentsFree(moments_t *moments) {
+	free(moments->mean);
+	free(moments->scatter);
+	free(moments->tmp);
+}
+
+/*
+ * Merges count samples of means mean, whose scatter has already been added
+ * to moments->scatter:
+ * scatter += (mean - moments->mean) * (mean - moments->mean)' * n1 * n2 / (n1 + n2)
+ */
+static void momentsCombine(moments_t *moments, double count, double *mean, natural channels) {
+	double total = moments->count + count;
+	double factor = moments->count * count / total;
+	natural i, j;
+	for (j = 0; j < channels; j++) {
+		double dj = (mean[j] - moments->mean[j]) * factor;
+		real *col = moments->scatter + (size_t)j * channels;
+		for (i = 0; i <= j; i++) {
+			col[i] += (mean[i] - moments->mean[i]) * dj;
+		}
+	}
+	for (i = 0; i < channels; i++) {
+		moments->mean[i] += (mean[i] - moments->mean[i]) * count / total;
 	}
+	moments->count = total;
+}
+
+/*
+ * Adds count samples (count x channels) to the moments
+ */
+void momentsAdd(moments_t *moments, real *x, natural count, natural channels) {
+	double *mean = (double*)malloc(channels * sizeof(double));
+	char uplo = 'U', transn = 'N';
+	int m = channels;
+	real alpha = 1.0, beta = 1.0;
+	natural i, c, n;
+	for (; count > 0; count -= n, x += (size_t)n * channels) {
+		n = count > MOMENTS_CHUNK ? MOMENTS_CHUNK : count;
+		for (c = 0; c < channels; c++) {
+			mean[c] = 0.0;
+		}
+		for (i = 0; i < n; i++) {
+			for (c = 0; c < channels; c++) {
+				mean[c] += x[(size_t)i * channels + c];
+			}
+		}
+		for (c = 0; c < channels; c++) {
+			mean[c] /= n;
+		}
+		for (i = 0; i < n; i++) {
+			for (c = 0; c < channels; c++) {
+				moments->tmp[(size_t)i * channels + c] = x[(size_t)i * channels + c] - mean[c];
+			}
+		}
+		int k = n;
+		dsyrk_(&uplo, &transn, &m, &k, &alpha, moments->tmp, &m, &beta, moments->scatter, &m);
+		momentsCombine(moments, n, mean, channels);
+	}
+	free(mean);
+}
+
+/*
+ * Adds the samples of other to moments
+ */
+void momentsMerge(moments_t *moments, moments_t *other, natural channels) {
+	if (other->count == 0.0) return;
+	size_t i;
+	for (i = 0; i < (size_t)channels * channels; i++) {
+		moments->scatter[i] += other->scatter[i];
+	}
+	momentsCombine(moments, other->count, other->mean, channels);
+}
+
+/*
+ * Channel means and covariance (upper triangle, column major, normalized
+ * by samples - 1 as the dsyrk in calcSphere)
+ */
+void momentsResult(moments_t *moments, natural channels, real *mean, real *cov) {
+	size_t i;
+	for (i = 0; i < channels; i++) {
+		mean[i] = moments->mean[i];
+	}
+	for (i = 0; i < (size_t)channels * channels; i++) {
+		cov[i] = moments->scatter[i] / (moments->count - 1.0);
+	}
+}
+
+/*
+ * Means and covariance of host data (samples x channels) in a single pass.
+ * Each thread accumulates the moments of a fraction of the samples.
+ */
+void hostMoments(real *data, natural channels, natural samples, int nparts, real *mean, real *cov) {
+	moments_t *parts = (moments_t*)malloc(nparts * sizeof(moments_t));
+	int p = 0;
+	#pragma omp parallel for
+	for (p = 0; p < nparts; p++) {
+		size_t i = ((size_t)samples * p) / nparts;
+		size_t end = ((size_t)samples * (p + 1)) / nparts;
+		momentsInit(&parts[p], channels);
+		momentsAdd(&parts[p], data + i * channels, (natural)(end - i), channels);
+	}
+	for (p = 1; p < nparts; p++) {
+		momentsMerge(&parts[0], &parts[p], channels);
+		momentsFree(&parts[p]);
+	}
+	momentsResult(&parts[0], channels, mean, cov);
+	momentsFree(&parts[0]);
+	free(parts);
+}
+
+/*
+ * Whether whiten() multiplies the data by a sphere computed from it. The
+ * covariance is then taken in the same pass as the means, and the means
+ * are subtracted as the sphere is applied.
+ */
+static int spheresData(eegdataset_t *set) {
+	return set->config.sphering == 1 || (set->config.sphering == 0 && set->config.weightsinfile == NULL);
+}
+
+/*
+ * Host version of getMean and subMean for the cpu backend.
+ * Each thread processes a fraction of the samples, the same way each block
+ * does on the device. Out-of-core data only gets its means computed, they
+ * are subtracted as the data is read. When the data is going to be
+ * sphered, the means and the covariance are computed together and left in
+ * set for whiten(). When it is going to be reduced, the means (and for
+ * pcamethod eig the covariance) are left to pcaReduce(), for the host copy
+ * of the gpu backend too.
+ *
+ * set: the dataset to be centered (data in host memory)
+ */
+void hostCenterData(eegdataset_t *set) {
+	natural channels = set->nchannels;
+	natural samples = set->nsamples;
+	int nparts = set->config.nthreads;
+	real *data = set->data;
+	int reduce = pcaReduces(set);
+	if (reduce ? set->config.pcamethod == PCA_EIG : spheresData(set)) {
+		set->cov = (real*)malloc((size_t)channels * channels * sizeof(real));
+		if (set->stream != NULL) {
+			streamMoments(set->stream, set->cov, nparts);
+		} else {
+			DPRINTF(2, "Getting channels mean and covariance on host with %d threads\n", nparts);
+			set->mean = (real*)malloc(channels * sizeof(real));
+			hostMoments(data, channels, samples, nparts, set->mean, set->cov);
+		}
+		return;
+	}
+	if (set->stream != NULL) {
+		streamMean(set->stream, nparts);
+		return;
+	}
+	double *sums = (double*)calloc(nparts * channels, sizeof(double));
+	real *means = (real*)malloc(channels * sizeof(real));
+	int p = 0;
+	natural c = 0;
+
+	DPRINTF(2, "Getting channels mean on host with %d threads\n", nparts);
+	#pragma omp parallel for private(c)
+	for (p = 0; p < nparts; p++) {
+		size_t i = ((size_t)samples * p) / nparts;
+		size_t end = ((size_t)samples * (p + 1)) / nparts;
+		double *sum = sums + p * channels;
+		for (; i < end; i++) {
+			real *x = data + i * channels;
+			for (c = 0; c < channels; c++) {
+				sum[c] += x[c];
+			}
+		}
+	}
+	for (c = 0; c < channels; c++) {
+		double sum = 0.0;
+		for (p = 0; p < nparts; p++) {
+			sum += sums[p * channels + c];
+		}
+		means[c] = sum/samples;
+	}
+	if (reduce) {
+		set->mean = means;
+		free(sums);
+		return;
+	}
+
+	DPRINTF(2, "Substracting mean to data on host\n");
+	#pragma omp parallel for private(c)
+	for (p = 0; p < nparts; p++) {
+		size_t i = ((size_t)samples * p) / nparts;
+		size_t end = ((size_t)samples * (p + 1)) / nparts;
+		for (; i < end; i++) {
+			real *x = data + i * channels;
+			for (c = 0; c < channels; c++) {
+				x[c] -= means[c];
+			}
+		}
+	}
+	free(means);
+	free(sums);
 }
 
 /*
@@ -126,22 +357,39 @@ __global__ void subMean(real* data, natural channels, natural samples, size_t pi
  */
 void centerData(eegdataset_t *set) {
 	DPRINTF(1, "Centering dataset channels %d, samples %d\n", set->nchannels, set->nsamples);
+	if (set->config.backend == BACKEND_CPU || pcaReduces(set)) {
+		hostCenterData(set);
+		return;
+	}
 	real *sums;
 	size_t sumspitch;
-	natural nthreads = set->nchannels;
-	natural nblocks = getMaxBlocks();
-	DPRINTF(2, "cudaMallocPitch %lu x %d for sums\n", set->nchannels * sizeof(real), nblocks);
-	HANDLE_ERROR(cudaMallocPitch(&sums, &sumspitch, set->nchannels * sizeof(real), nblocks));
+	natural nthreads = CHANNEL_THREADS(set->nchannels);
+	dim3 nblocks(getMaxBlocks(), CHANNEL_TILES(set->nchannels));
+	DPRINTF(2, "cudaMallocPitch %lu x %d for sums\n", set->nchannels * sizeof(real), nblocks.x);
+	HANDLE_ERROR(poolMallocPitch(&sums, &sumspitch, set->nchannels * sizeof(real), nblocks.x));
 	real *data = (real*)set->devicePointer;
 
-	DPRINTF(2, "Getting channels mean\n");
-	getMean<<<nblocks,nthreads>>>(data, set->nchannels, set->nsamples, set->pitch, sums, sumspitch);
-	CHECK_ERROR();
+	if (spheresData(set) && set->data != NULL) {
+		/*
+		 * The host copy gives the means and the covariance whiten() needs
+		 * in one pass
+		 */
+		DPRINTF(2, "Getting channels mean and covariance on host\n");
+		real *means = (real*)malloc(set->nchannels * sizeof(real));
+		set->cov = (real*)malloc((size_t)set->nchannels * set->nchannels * sizeof(real));
+		hostMoments(set->data, set->nchannels, set->nsamples, set->config.nthreads, means, set->cov);
+		HANDLE_ERROR(cudaMemcpy(sums, means, set->nchannels * sizeof(real), cudaMemcpyHostToDevice));
+		free(means);
+	} else {
+		DPRINTF(2, "Getting channels mean\n");
+		getMean<<<nblocks,nthreads>>>(data, set->nchannels, set->nsamples, set->pitch, sums, sumspitch);
+		CHECK_ERROR();
+	}
 
 	DPRINTF(2, "Substracting mean to data\n");
 	subMean<<<nblocks,nthreads>>>(data, set->nchannels, set->nsamples, set->pitch, sums);
 	CHECK_ERROR();
 	DPRINTF(1, "Centering dataset finished! channels %d, samples %d\n", set->nchannels, set->nsamples);
-	HANDLE_ERROR(cudaFree(sums));
+	poolCudaFree(sums);
 
 }
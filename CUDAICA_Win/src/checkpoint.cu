@@ -0,0 +1,276 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <checkpoint.h>
+#include <error.h>
+#include <container.h>
+#include <common.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <cuda_runtime.h>
+#include <thread>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static volatile sig_atomic_t interrupted = 0;
+
+/*
+ * SIGINT/SIGTERM: asks the loop to write a checkpoint and stop. A second
+ * signal terminates as usual.
+ */
+static void checkpointSignal(int sig) {
+	interrupted = 1;
+	signal(sig, SIG_DFL);
+}
+
+/*
+ * True once SIGINT or SIGTERM arrived while checkpoints were on
+ */
+int checkpointInterrupted(void) {
+	return interrupted;
+}
+
+/*
+ * Sets the header for a run and catches SIGINT/SIGTERM when checkpoints
+ * are on (config->checkpointfile set)
+ */
+void checkpointInit(checkpoint_t *ckpt, config_t *config, natural channels, natural samples, size_t elemsize) {
+	memset(ckpt, 0, sizeof(checkpoint_t));
+	memcpy(ckpt->header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	ckpt->header.version = CHECKPOINT_VERSION;
+	ckpt->header.elemsize = (uint32_t)elemsize;
+	ckpt->header.channels = channels;
+	ckpt->header.samples = samples;
+	ckpt->header.block = config->block;
+	ckpt->header.seed = config->seed;
+	ckpt->header.permutation = config->permutation;
+	ckpt->header.chunk = config->chunk;
+	ckpt->filename = config->checkpointfile;
+	ckpt->every = config->checkpoint;
+	if (ckpt->filename != NULL) {
+		signal(SIGINT, checkpointSignal);
+		signal(SIGTERM, checkpointSignal);
+	}
+}
+
+/*
+ * Sets the data checksum from the height rows of width bytes the loop
+ * reads, host or device ones. Device rows are staged to the host in
+ * CHECKPOINT_HASH_BYTES batches. Nothing is read when checkpoints are off,
+ * and they are turned off when there is no memory for the staging buffer.
+ */
+void checkpointData(checkpoint_t *ckpt, const void *ptr, size_t pitch, size_t width, size_t height, int device) {
+	if (ckpt->filename == NULL || ptr == NULL) return;
+	size_t rows = CHECKPOINT_HASH_BYTES / width > 0 ? CHECKPOINT_HASH_BYTES / width : 1;
+	char *buffer = NULL;
+	if (device || pitch != width) {
+		buffer = (char*)malloc(rows * width);
+		if (buffer == NULL) {
+			fprintf(stderr, "ERROR: Not enough memory to hash the data of checkpoint %s, checkpoints off\n", ckpt->filename);
+			ckpt->filename = NULL;
+			return;
+		}
+	}
+	uint64_t sum = 0;
+	size_t first;
+	for (first = 0; first < height; first += rows) {
+		size_t count = first + rows < height ? rows : height - first;
+		const char *src = (const char*)ptr + first * pitch;
+		if (device) {
+			HANDLE_ERROR(cudaMemcpy2D(buffer, width, src, pitch, width, count, cudaMemcpyDeviceToHost));
+			src = buffer;
+		} else if (buffer != NULL) {
+			size_t r;
+			for (r = 0; r < count; r++) {
+				memcpy(buffer + r * width, src + r * pitch, width);
+			}
+			src = buffer;
+		}
+		sum = sum * 1099511628211ULL ^ containerChecksum(src, count * width);
+	}
+	free(buffer);
+	ckpt->header.datasum = sum;
+}
+
+/*
+ * Adds a host array, NULL ones are skipped
+ */
+void checkpointArray(checkpoint_t *ckpt, void *ptr, size_t size) {
+	if (ptr == NULL) return;
+	int i = ckpt->narrays++;
+	ckpt->ptr[i] = ptr;
+	ckpt->width[i] = size;
+	ckpt->height[i] = 1;
+	ckpt->pitch[i] = size;
+	ckpt->device[i] = 0;
+}
+
+/*
+ * Adds a pitched device array, NULL ones are skipped
+ */
+void checkpointDeviceArray(checkpoint_t *ckpt, void *ptr, size_t pitch, size_t width, size_t height) {
+	if (ptr == NULL) return;
+	int i = ckpt->narrays++;
+	ckpt->ptr[i] = ptr;
+	ckpt->width[i] = width;
+	ckpt->height[i] = height;
+	ckpt->pitch[i] = pitch;
+	ckpt->device[i] = 1;
+}
+
+static size_t checkpointBytes(checkpoint_t *ckpt) {
+	size_t bytes = 0;
+	int i;
+	for (i = 0; i < ckpt->narrays; i++) {
+		bytes += ckpt->width[i] * ckpt->height[i];
+	}
+	return bytes;
+}
+
+/*
+ * Background part of checkpointSave(): writes FILE.tmp, flushes it to the
+ * disk and renames it, so a crash leaves the previous checkpoint or the
+ * new one
+ */
+static void checkpointWrite(char *filename, char *buffer, size_t size) {
+	char *tmp = (char*)malloc(strlen(filename) + 5);
+	sprintf(tmp, "%s.tmp", filename);
+	FILE *out = fopen(tmp, "wb");
+	if (out == NULL || fwrite(buffer, 1, size, out) != size || fflush(out) != 0) {
+		fprintf(stderr, "ERROR: Cannot write checkpoint %s\n", tmp);
+		if (out != NULL) fclose(out);
+	} else {
+#ifdef _WIN32
+		_commit(_fileno(out));
+#else
+		fsync(fileno(out));
+#endif
+		fclose(out);
+		if (replaceFile(tmp, filename) != 0) {
+			fprintf(stderr, "ERROR: Cannot rename checkpoint %s to %s\n", tmp, filename);
+		}
+	}
+	free(tmp);
+	free(buffer);
+}
+
+/*
+ * Waits for the write in progress, if any
+ */
+void checkpointWait(checkpoint_t *ckpt) {
+	std::thread *writer = (std::thread*)ckpt->writer;
+	if (writer == NULL) return;
+	writer->join();
+	delete writer;
+	ckpt->writer = NULL;
+}
+
+/*
+ * Copies the header and the arrays and writes them in the background
+ */
+error checkpointSave(checkpoint_t *ckpt) {
+	checkpointWait(ckpt);
+	size_t bytes = checkpointBytes(ckpt);
+	size_t size = sizeof(checkpointhdr_t) + bytes;
+	char *buffer = (char*)malloc(size);
+	if (buffer == NULL) {
+		fprintf(stderr, "ERROR: Not enough memory for checkpoint %s\n", ckpt->filename);
+		return ERRORNODEVICEMEM;
+	}
+	ckpt->header.bytes = bytes;
+	memcpy(buffer, &ckpt->header, sizeof(checkpointhdr_t));
+	char *dst = buffer + sizeof(checkpointhdr_t);
+	int i;
+	for (i = 0; i < ckpt->narrays; i++) {
+		if (ckpt->device[i]) {
+			HANDLE_ERROR(cudaMemcpy2D(dst, ckpt->width[i], ckpt->ptr[i], ckpt->pitch[i], ckpt->width[i], ckpt->height[i], cudaMemcpyDeviceToHost));
+		} else {
+			memcpy(dst, ckpt->ptr[i], ckpt->width[i]);
+		}
+		dst += ckpt->width[i] * ckpt->height[i];
+	}
+	DPRINTF(1, "Writing checkpoint %s at step %lld\n", ckpt->filename, (long long)ckpt->header.step);
+	ckpt->writer = new std::thread(checkpointWrite, ckpt->filename, buffer, size);
+	return SUCCESS;
+}
+
+/*
+ * Reads a checkpoint into the registered arrays and the header. Returns
+ * ERRORNOFILE if there is none and ERRORINVALIDCONFIG if it belongs to
+ * another run (channels, samples, block size, precision or arrays differ)
+ * or to another seed, permutation or data.
+ */
+error checkpointLoad(checkpoint_t *ckpt) {
+	checkpointhdr_t header;
+	FILE *in = fopen(ckpt->filename, "rb");
+	if (in == NULL) return ERRORNOFILE;
+	size_t bytes = checkpointBytes(ckpt);
+	if (fread(&header, sizeof(checkpointhdr_t), 1, in) != 1 ||
+			memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 ||
+			header.version != CHECKPOINT_VERSION ||
+			header.elemsize != ckpt->header.elemsize ||
+			header.channels != ckpt->header.channels ||
+			header.samples != ckpt->header.samples ||
+			header.block != ckpt->header.block ||
+			header.bytes != bytes) {
+		fprintf(stderr, "ERROR: Checkpoint %s does not match this run\n", ckpt->filename);
+		fclose(in);
+		return ERRORINVALIDCONFIG;
+	}
+	if (header.seed != ckpt->header.seed || header.permutation != ckpt->header.permutation || header.chunk != ckpt->header.chunk) {
+		fprintf(stderr, "ERROR: Checkpoint %s was written with seed %llu and permutation %llu (chunk %llu), not seed %llu and permutation %llu (chunk %llu)\n", ckpt->filename,
+			(unsigned long long)header.seed, (unsigned long long)header.permutation, (unsigned long long)header.chunk,
+			(unsigned long long)ckpt->header.seed, (unsigned long long)ckpt->header.permutation, (unsigned long long)ckpt->header.chunk);
+		fclose(in);
+		return ERRORINVALIDCONFIG;
+	}
+	if (header.datasum != ckpt->header.datasum) {
+		fprintf(stderr, "ERROR: Checkpoint %s was written for other data (checksum %016llx, this run %016llx)\n", ckpt->filename,
+			(unsigned long long)header.datasum, (unsigned long long)ckpt->header.datasum);
+		fclose(in);
+		return ERRORINVALIDCONFIG;
+	}
+	char *buffer = (char*)malloc(bytes);
+	if (fread(buffer, 1, bytes, in) != bytes) {
+		fprintf(stderr, "ERROR: Checkpoint %s is truncated\n", ckpt->filename);
+		free(buffer);
+		fclose(in);
+		return ERRORINVALIDCONFIG;
+	}
+	fclose(in);
+	char *src = buffer;
+	int i;
+	for (i = 0; i < ckpt->narrays; i++) {
+		if (ckpt->device[i]) {
+			HANDLE_ERROR(cudaMemcpy2D(ckpt->ptr[i], ckpt->pitch[i], src, ckpt->width[i], ckpt->width[i], ckpt->height[i], cudaMemcpyHostToDevice));
+		} else {
+			memcpy(ckpt->ptr[i], src, ckpt->width[i]);
+		}
+		src += ckpt->width[i] * ckpt->height[i];
+	}
+	free(buffer);
+	ckpt->header = header;
+	return SUCCESS;
+}
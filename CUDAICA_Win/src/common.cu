@@ -38,6 +38,13 @@
 #include <cuda_runtime.h>
 #include <device_launch_parameters.h>
 #include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #define MAX_DIMENSION(a) ( a > 512 ? 512 : a)
 
@@ -54,20 +61,35 @@ __global__ void zeroMatrix(real* data, size_t pitch) {
 
  /*
   * Identity matrix
-  * Should be launched with channels blocks x channels threads
+  * Should be launched with channels x CHANNEL_TILES(channels) blocks of
+  * CHANNEL_THREADS(channels) threads
   *
   * data: matrix
   * pitch: matrix row size in bytes
+  * channels: matrix size
   */
-__global__ void eye(real * data, size_t pitch) {
+__global__ void eye(real * data, size_t pitch, natural channels) {
 
 	size_t colwidth = pitch/sizeof(real);
-	real value = (threadIdx.x == blockIdx.x ? 1.0 : 0.0);
+	natural row = threadIdx.x + blockIdx.y * blockDim.x;
+	if (row >= channels) return;
+	real value = (row == blockIdx.x ? 1.0 : 0.0);
 
-	data[threadIdx.x + blockIdx.x * colwidth] = value;
+	data[row + blockIdx.x * colwidth] = value;
 }
 
 
+/*
+ * Wall clock in seconds, for throughput reports and benchmarks
+ */
+double wallclock(void) {
+#ifdef _OPENMP
+	return omp_get_wtime();
+#else
+	return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
 /*
  * Memory mappings functions
  */
@@ -300,6 +322,79 @@ void dev_matwriteNat(char *fname, int rows, int cols, natural *mat, size_t pitch
 }
 
 
+/*
+ * Write a total of size floting point values from matrix in the host memory to the
+ * file.
+ *
+ * fname: file name to be written to
+ * rows: number of rows in the matrix
+ * cols: number of rows in the matrix
+ * mat: matrix
+ * pitch: matrix row size in bytes
+ */
+void matwrite(char *fname, int rows, int cols, real *mat, size_t pitch) {
+	FILE *file = fopen(fname,"wb");
+	int items = 0;
+	int i = 0;
+	if (!file) {
+		printf("open failed\n");
+		exit (0);
+	}
+	DPRINTF(2, "Writing %d by %d cols from %p\n", rows, cols, mat);
+	for (i = 0; i < rows; i++) {
+		items += (int)fwrite((char*)mat + i * pitch, sizeof(real), cols, file);
+	}
+	if (items != rows * cols) {
+		printf("invalid number of elements\n");
+		exit (0);
+	}
+
+	fclose(file);
+}
+
+/*
+ * Moves tmp over target in one step, target is never missing: rename()
+ * replaces an existing file on POSIX only. Returns 0 on success.
+ */
+int replaceFile(const char *tmp, const char *target) {
+#ifdef _WIN32
+	return MoveFileExA(tmp, target, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+#else
+	return rename(tmp, target);
+#endif
+}
+
+
+/*
+ * Write a total of size integer values from matrix in the host memory to the
+ * file.
+ *
+ * fname: file name to be written to
+ * rows: number of rows in the matrix
+ * cols: number of rows in the matrix
+ * mat: matrix
+ * pitch: matrix row size in bytes
+ */
+void matwriteInt(char *fname, int rows, int cols, int *mat, size_t pitch) {
+	FILE *file = fopen(fname,"wb");
+	int items = 0;
+	int i = 0;
+	if (!file) {
+		printf("open failed\n");
+		exit (0);
+	}
+	for (i = 0; i < rows; i++) {
+		items += (int)fwrite((char*)mat + i * pitch, sizeof(int), cols, file);
+	}
+	if (items != rows * cols) {
+		printf("invalid number of elements\n");
+		exit (0);
+	}
+
+	fclose(file);
+}
+
+
 
 void printVector(real* data, natural size) {
 	int j = 0;
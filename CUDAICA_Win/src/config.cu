@@ -25,6 +25,9 @@
  */
 
 #include <config.h>
+#include <container.h>
+#include <loader.h>
+#include <pca.h>
 #include <error.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,6 +35,11 @@
 #include <errno.h>
 #include <math.h>
 #include <time.h>
+#include <stddef.h>
+#include <mutex>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #define xstr_val(val) #val
 #define str_val(val) xstr_val(val)
@@ -39,6 +47,12 @@
 #define PRINTREAL(val) printf("\t%s = %.16f\n", str_val(val), (dataset->config.val));
 #define PRINTBOOL(val) printf("\t%s = %s\n", str_val(val), (dataset->config.val) == 0 ? "off" : "on" );
 #define PRINTSTRING(val) printf("\t%s = %s\n", str_val(val), (dataset->config.val));
+#define PRINTSTRING_FORMAT(val) printf("\t%s = %s\n", str_val(val), formatName(dataset->config.val));
+#define PRINTSTRING_BACKEND(val) printf("\t%s = %s\n", str_val(val), (dataset->config.val) == BACKEND_CPU ? "cpu" : "gpu" );
+#define PRINTSTRING_PRECISION(val) printf("\t%s = %s\n", str_val(val), precisionName(dataset->config.val));
+#define PRINTSTRING_SOLVER(val) printf("\t%s = %s\n", str_val(val), solverName(dataset->config.val));
+#define PRINTSTRING_PERMUTATION(val) printf("\t%s = %s\n", str_val(val), permutationName(dataset->config.val));
+#define PRINTSTRING_PCAMETHOD(val) printf("\t%s = %s\n", str_val(val), pcamethodName(dataset->config.val));
 
 
 char* getParam(const char * needle, char* haystack[], int count) {
@@ -66,6 +80,61 @@ int isParam(const char * needle, char* haystack[], int count) {
 
 
 
+/*
+ * Size of a file in bytes, 0 if it cannot be opened
+ */
+static uint64_t fileSize(const char* filename) {
+	FILE *file = fopen(filename, "rb");
+	if (file == NULL) return 0;
+	fseek(file, 0, SEEK_END);
+#ifdef _WIN32
+	uint64_t size = _ftelli64(file);
+#else
+	uint64_t size = ftello(file);
+#endif
+	fclose(file);
+	return size;
+}
+
+static const char* formatName(natural format) {
+	switch (format) {
+		case FORMAT_CONTAINER: return "container";
+		case FORMAT_FDT: return "fdt";
+		case FORMAT_EDF: return "edf";
+		case FORMAT_BDF: return "bdf";
+	}
+	return "raw";
+}
+
+static const char* precisionName(natural precision) {
+	switch (precision) {
+		case PRECISION_SINGLE: return "single";
+		case PRECISION_MIXED: return "mixed";
+	}
+	return "double";
+}
+
+static const char* solverName(natural solver) {
+	switch (solver) {
+		case SOLVER_PICARD: return "picard";
+		case SOLVER_COMPARE: return "compare";
+	}
+	return "infomax";
+}
+
+static const char* pcamethodName(natural pcamethod) {
+	return pcamethod == PCA_RANDOM ? "random" : "eig";
+}
+
+static const char* permutationName(natural permutation) {
+	switch (permutation) {
+		case PERMUTATION_FEISTEL: return "feistel";
+		case PERMUTATION_CHUNKS: return "chunks";
+	}
+	return "shuffle";
+}
+
+
 error getReal(char* buffer[], const char* string, int count, real* result) {
 	int i = 0;
 	for (i = 0; i < count; i ++) {
@@ -158,6 +227,151 @@ error getVerbose(char* buffer[], const char* string, int count, natural* result)
 	return ERRORNOPARAM;
 }
 
+error getBackend(char* buffer[], const char* string, int count, natural* result) {
+	int i = 0;
+	for (i = 0; i < count; i ++) {
+		if (strstr(buffer[i], string) != NULL) {
+			char* item = strtok(buffer[i], " ");
+			if (item == NULL) {
+				return ERRORINVALIDPARAM;
+			}
+			if (strcmp(item, string) == 0) {
+				item = strtok(NULL, " ");
+				if (item == NULL) {
+					return ERRORINVALIDPARAM;
+				}
+				if (strcmp(item, "gpu") == 0) {
+					*result = BACKEND_GPU;
+				} else if (strcmp(item, "gpu\n") == 0) {
+					*result = BACKEND_GPU;
+				} else if (strcmp(item, "cpu") == 0) {
+					*result = BACKEND_CPU;
+				} else if (strcmp(item, "cpu\n") == 0) {
+					*result = BACKEND_CPU;
+				} else {
+					return ERRORINVALIDPARAM;
+				}
+				return SUCCESS;
+			}
+		}
+	}
+	return ERRORNOPARAM;
+}
+
+error getPrecision(char* buffer[], const char* string, int count, natural* result) {
+	int i = 0;
+	for (i = 0; i < count; i ++) {
+		if (strstr(buffer[i], string) != NULL) {
+			char* item = strtok(buffer[i], " ");
+			if (item == NULL) {
+				return ERRORINVALIDPARAM;
+			}
+			if (strcmp(item, string) == 0) {
+				item = strtok(NULL, " ");
+				if (item == NULL) {
+					return ERRORINVALIDPARAM;
+				}
+				if (strcmp(item, "double") == 0 || strcmp(item, "double\n") == 0) {
+					*result = PRECISION_DOUBLE;
+				} else if (strcmp(item, "single") == 0 || strcmp(item, "single\n") == 0) {
+					*result = PRECISION_SINGLE;
+				} else if (strcmp(item, "mixed") == 0 || strcmp(item, "mixed\n") == 0) {
+					*result = PRECISION_MIXED;
+				} else {
+					return ERRORINVALIDPARAM;
+				}
+				return SUCCESS;
+			}
+		}
+	}
+	return ERRORNOPARAM;
+}
+
+error getSolver(char* buffer[], const char* string, int count, natural* result) {
+	int i = 0;
+	for (i = 0; i < count; i ++) {
+		if (strstr(buffer[i], string) != NULL) {
+			char* item = strtok(buffer[i], " ");
+			if (item == NULL) {
+				return ERRORINVALIDPARAM;
+			}
+			if (strcmp(item, string) == 0) {
+				item = strtok(NULL, " ");
+				if (item == NULL) {
+					return ERRORINVALIDPARAM;
+				}
+				if (strcmp(item, "infomax") == 0 || strcmp(item, "infomax\n") == 0) {
+					*result = SOLVER_INFOMAX;
+				} else if (strcmp(item, "picard") == 0 || strcmp(item, "picard\n") == 0) {
+					*result = SOLVER_PICARD;
+				} else if (strcmp(item, "compare") == 0 || strcmp(item, "compare\n") == 0) {
+					*result = SOLVER_COMPARE;
+				} else {
+					return ERRORINVALIDPARAM;
+				}
+				return SUCCESS;
+			}
+		}
+	}
+	return ERRORNOPARAM;
+}
+
+error getPermutation(char* buffer[], const char* string, int count, natural* result) {
+	int i = 0;
+	for (i = 0; i < count; i ++) {
+		if (strstr(buffer[i], string) != NULL) {
+			char* item = strtok(buffer[i], " ");
+			if (item == NULL) {
+				return ERRORINVALIDPARAM;
+			}
+			if (strcmp(item, string) == 0) {
+				item = strtok(NULL, " ");
+				if (item == NULL) {
+					return ERRORINVALIDPARAM;
+				}
+				if (strcmp(item, "shuffle") == 0 || strcmp(item, "shuffle\n") == 0) {
+					*result = PERMUTATION_SHUFFLE;
+				} else if (strcmp(item, "feistel") == 0 || strcmp(item, "feistel\n") == 0) {
+					*result = PERMUTATION_FEISTEL;
+				} else if (strcmp(item, "chunks") == 0 || strcmp(item, "chunks\n") == 0) {
+					*result = PERMUTATION_CHUNKS;
+				} else {
+					return ERRORINVALIDPARAM;
+				}
+				return SUCCESS;
+			}
+		}
+	}
+	return ERRORNOPARAM;
+}
+
+error getPcamethod(char* buffer[], const char* string, int count, natural* result) {
+	int i = 0;
+	for (i = 0; i < count; i ++) {
+		if (strstr(buffer[i], string) != NULL) {
+			char* item = strtok(buffer[i], " ");
+			if (item == NULL) {
+				return ERRORINVALIDPARAM;
+			}
+			if (strcmp(item, string) == 0) {
+				item = strtok(NULL, " ");
+				if (item == NULL) {
+					return ERRORINVALIDPARAM;
+				}
+				if (strcmp(item, "eig") == 0 || strcmp(item, "eig\n") == 0) {
+					*result = PCA_EIG;
+				} else if (strcmp(item, "random") == 0 || strcmp(item, "random\n") == 0) {
+					*result = PCA_RANDOM;
+				} else {
+					return ERRORINVALIDPARAM;
+				}
+				return SUCCESS;
+			}
+		}
+	}
+	return ERRORNOPARAM;
+}
+
 error getInt(char* buffer[], const char* string, int count, natural* result) {
 	int i = 0;
 	for (i = 0; i < count; i ++) {
@@ -203,6 +417,45 @@ error getString(char* buffer[], const char* string, int count, char** result) {
 	return ERRORNOPARAM;
 }
 
+error getFormat(char* buffer[], const char* string, int count, natural* result) {
+	int i = 0;
+	for (i = 0; i < count; i ++) {
+		if (strstr(buffer[i], string) != NULL) {
+			char* item = strtok(buffer[i], " ");
+			if (item == NULL) {
+				return ERRORINVALIDPARAM;
+			}
+			if (strcmp(item, string) == 0) {
+				item = strtok(NULL, " ");
+				if (item == NULL) {
+					return ERRORINVALIDPARAM;
+				}
+				if (strcmp(item, "raw") == 0) {
+					*result = FORMAT_RAW;
+				} else if (strcmp(item, "raw\n") == 0) {
+					*result = FORMAT_RAW;
+				} else if (strcmp(item, "fdt") == 0) {
+					*result = FORMAT_FDT;
+				} else if (strcmp(item, "fdt\n") == 0) {
+					*result = FORMAT_FDT;
+				} else if (strcmp(item, "edf") == 0) {
+					*result = FORMAT_EDF;
+				} else if (strcmp(item, "edf\n") == 0) {
+					*result = FORMAT_EDF;
+				} else if (strcmp(item, "bdf") == 0) {
+					*result = FORMAT_BDF;
+				} else if (strcmp(item, "bdf\n") == 0) {
+					*result = FORMAT_BDF;
+				} else {
+					return ERRORINVALIDPARAM;
+				}
+				return SUCCESS;
+			}
+		}
+	}
+	return ERRORNOPARAM;
+}
+
 char* programname;
 
 void help() {
@@ -211,9 +464,15 @@ void help() {
 	printf("\t-h or --help		Print this help\n");
 	printf("\n");
 	printf("\t-f FILE			Run CUDAICA using the script configuration file FILE\n");
+	printf("\t-m FILE			Run every configuration file listed in FILE (one per line) as a batch\n");
 	printf("\n");
 	printf("\tCurrent options are:\n");
-	printf("\t-d N 			Use device N as cuda GPU\n");
+	printf("\t-d N 			Use device N as cuda GPU (ignored with backend cpu)\n");
+	printf("\t-b			Benchmark the channel count specializations of the cpu backend and exit\n");
+	printf("\t-b gpu			Benchmark the channel count specializations of the device kernels\n\t\t\t\ton device -d N and exit\n");
+	printf("\t-b sampling		Benchmark the permutation modes of the cpu backend (samples per\n\t\t\t\tsecond and steps to convergence on synthetic data) and exit\n");
+	printf("\t--plan			Print the peak memory of every stage of the run of -f FILE and exit,\n\t\t\t\tnonzero if it does not fit in the budget\n");
+	printf("\t--budget MB		Memory budget of --plan (default: free device memory, or the host\n\t\t\t\tmemory with backend cpu)\n");
 	//printf("\t-s FILE			Run in silent redirecting output to FILE and ignoring SIGHUP\n");
 	printf("\n");
 	printf("The configuration file is a text file where each nonblank line must be a\nparameter and its value separated by a space.\n\n");
@@ -229,6 +488,7 @@ void help() {
 	printf("\tchans\t\tN\t\tNumber of data channels (data rows)\n");
 	printf("\tframes\t\tN\t\tNumber of data points per epoch (data columns)\n");
 	printf("\tepochs\t\tN\t\tNumber of epochs\n");
+	printf("\t\t\t\t\tchans, frames and epochs may be omitted when DataFile is a\n\t\t\t\t\tcudaica container, results are then written as containers\n");
 	printf("\tWeightsOutFile\tFILE\t\tBinary file to store ICA weight matrix (floats)\n");
 	printf("\tSphereFile\tFILE\t\tBinary file to store sphering matrix (floats)\n");
 	printf("\t\n");
@@ -237,7 +497,9 @@ void help() {
 	printf("\tsphering\tON/OFF\t\tToggles sphering of data (on/off)   {default: on}\n");
 	printf("\tbias\t\tON/OFF\t\tPerform bias adjustment (on/off) {default: on}\n");
 	printf("\textended\tN\t\tPerform \"extended-ICA\" using tanh() with kurtosis estimation\n\t\t\t\t\tevery N training blocks.If N < 0 fix number\n\t\t\t\t\tof sub-Gaussian components to -N {default|0: off}\n");
-	printf("\tpca\t\tN\t\tDecompose a principal component subspace of the data.\n\t\t\t\t\tRetain N PCs. {default|0: all} NOT SUPPORTED (yet)\n");
+	printf("\tpca\t\tN\t\tDecompose a principal component subspace of the data.\n\t\t\t\t\tRetain N PCs. {default|0: all}\n");
+	printf("\tpcamethod\tEIG/RANDOM\tPrincipal components from the eigenvectors of the\n\t\t\t\t\tcovariance, or from a randomized range finder (a few\n\t\t\t\t\tpasses of N + %d columns, for long recordings)\n\t\t\t\t\t{default: eig}\n", PCA_OVERSAMPLE);
+	printf("\tPCAFile\t\tFILE\t\tBinary file to store the pca projection (N by chans),\n\t\t\t\t\trequired with pca. The unmixing matrix in channel\n\t\t\t\t\tspace is weights * sphere * projection\n");
 	printf("\tWeightsInFile\tFILE\t\tStarting ICA weight matrix (chans by ncomps)\n\t\t\t\t\t{default: identity or sphering matrix}\n");
 	printf("\tlrate\t\tF\t\tInitial ICA learning rate {default: heuristic ~5e-4}\n");
 	printf("\tblocksize\tN\t\tICA block size {default: heuristic fraction of\n\t\t\t\t\tlog data length}\n");
@@ -249,18 +511,42 @@ void help() {
 	printf("\tmomentum\tF\t\tMomentum gain (range [0,1]) {default: 0}\n");
 	printf("\tverbose\tON (2) | MATLAB (1) | OFF (0)\t\tPrint extra information {default: on}\n");
 	printf("\tseed\tF\t\tRandom seed {default: time()}\n");
+	printf("\tensemble\tN\t\tRun Infomax N times on the same preprocessed data with\n\t\t\t\t\tseeds seed to seed+N-1 and match their components\n\t\t\t\t\t{default: 1}\n");
+	printf("\tDataFormat\tRAW/FDT/EDF/BDF	DataFile holds doubles (raw), is an EEGLAB .fdt\n\t\t\t\t\t(float32, frames is then optional) or an EDF/BDF\n\t\t\t\t\trecording (chans and frames are then optional)\n\t\t\t\t\t{default: raw}\n");
+	printf("\tChannelList\tLIST\t\tEDF/BDF signals to use, e.g. 1-32,35\n\t\t\t\t\t{default: all but annotations/status}\n");
+	printf("\tbackend\t\tGPU/CPU\t\tRun on the cuda device or on the host cores {default: gpu}\n");
+	printf("\tsolver\t\tINFOMAX/PICARD/COMPARE\tNatural gradient Infomax, or the same likelihood\n\t\t\t\t\tminimized by full batch preconditioned L-BFGS\n\t\t\t\t\t(backend cpu, stop is then the gradient tolerance),\n\t\t\t\t\tor both with their times compared {default: infomax}\n");
+	printf("\tpermutation\tSHUFFLE/FEISTEL/CHUNKS\tSample order of each step: a shuffled table of all\n\t\t\t\t\tthe samples, a keyed Feistel network computed on\n\t\t\t\t\tdemand (no table), or the same network on chunks of\n\t\t\t\t\tcontiguous samples, shuffled inside each chunk\n\t\t\t\t\t{default: shuffle}\n");
+	printf("\tchunk\t\tN\t\tSamples per chunk of permutation chunks, a power of 2\n\t\t\t\t\t{default: 64}\n");
+	printf("\tthreads\t\tN\t\tNumber of host threads for backend cpu {default|0: all cores}\n");
+	printf("\tactprecision\tDOUBLE/SINGLE\t\tActivationsFile values {default: double}\n");
+	printf("\tprecision\tDOUBLE/SINGLE/MIXED\tInfomax arithmetic, mixed keeps the data in single\n\t\t\t\t\tand the sums in double\n\t\t\t\t\t{default: build precision}\n");
+	printf("\tstreaming\tON/OFF\t\tKeep the data file out of core, reading it in tiles\n\t\t\t\t\t(backend cpu only) {default: off}\n");
+	printf("\tmemcap\t\tN\t\tMB of the data file kept in memory when streaming\n\t\t\t\t\t{default|0: no cap}\n");
+	printf("\tprefetch\tN\t\tBlocks read ahead when streaming {default: 2}\n");
+	printf("\tcheckpoint\tN\t\tSteps between checkpoints to CheckpointFile\n\t\t\t\t\t{default: 10, 0: only when interrupted}\n");
+	printf("\tresume\t\tON/OFF\t\tContinue from CheckpointFile if it exists {default: off}\n");
+	printf("\tcounters\tON/OFF\t\tAdd cycles and cache misses to the profile trace\n\t\t\t\t\t(Linux perf_event) {default: off}\n");
+	printf("\tonline\t\tON/OFF\t\tLearn from samples as they arrive on DataFile (a pipe,\n\t\t\t\t\t- for stdin), raw or fdt samples of chans values,\n\t\t\t\t\tframes is then optional (backend cpu only) {default: off}\n");
+	printf("\tpublish\t\tN\t\tOnline: blocks between writes of the current weights\n\t\t\t\t\tand sphere {default: 10}\n");
+	printf("\tdecay\t\tF\t\tOnline: lrate factor per block {default: 0.999}\n");
+	printf("\tlatency\t\tN\t\tOnline: blocks buffered before the oldest samples are\n\t\t\t\t\tdropped {default: 8}\n");
 	printf("\n");
 
 	printf("Optional parameters (without default values):\n");
-	printf("\tActivationsFile\tFILE\t\tActivations (matrix) of each component (ncomps by points)\n");
+	printf("\tActivationsFile\tFILE\t\tActivations (matrix) of each component (ncomps by points)\n\t\t\t\t\tof the centered data, written in actprecision\n");
 	printf("\tBiasFile\tFILE\t\tBias weights vector (ncomps)\n");
 	printf("\tSignFile\tFILE\t\tSigns vector designating (-1) sub- and (1)super-Gaussian\n\t\t\t\t\tcomponents (ncomps)\n");
+	printf("\tCheckpointFile\tFILE\t\tInfomax state, written every checkpoint steps and when\n\t\t\t\t\tinterrupted (SIGINT/SIGTERM)\n");
+	printf("\tprofile\t\tFILE\t\tTime of each stage of each step in ns, as JSON or as\n\t\t\t\t\tCSV when FILE ends in .csv (single runs)\n");
 }
 
 void printConfig(eegdataset_t *dataset) {
 	fprintf(stdout, "====================================\n");
 	fprintf(stdout, "          Configuration\n\n");
 	PRINTSTRING(datafile);
+	PRINTSTRING_FORMAT(dataformat);
+	PRINTSTRING(chanlist);
 	PRINTINT(nchannels);
 	PRINTINT(nsamples);
 	PRINTSTRING(weightsoutfile);
@@ -270,6 +556,7 @@ void printConfig(eegdataset_t *dataset) {
 	PRINTBOOL(biasing);
 	PRINTINT(extblocks);
 	PRINTINT(pca);
+	PRINTSTRING_PCAMETHOD(pcamethod);
 
 	PRINTSTRING(weightsinfile);
 	PRINTREAL(lrate)
@@ -289,10 +576,31 @@ void printConfig(eegdataset_t *dataset) {
 
 	PRINTINT(verbose);
 	PRINTINT(seed);
+	PRINTINT(ensemble);
+	PRINTSTRING_BACKEND(backend);
+	PRINTSTRING_SOLVER(solver);
+	PRINTSTRING_PERMUTATION(permutation);
+	PRINTINT(chunk);
+	PRINTINT(nthreads);
+	PRINTSTRING_PRECISION(precision);
+	PRINTSTRING_PRECISION(actprecision);
+	PRINTBOOL(streaming);
+	PRINTINT(memcap);
+	PRINTINT(prefetch);
+	PRINTINT(checkpoint);
+	PRINTBOOL(resume);
+	PRINTBOOL(counters);
+	PRINTBOOL(online);
+	PRINTINT(publish);
+	PRINTREAL(decay);
+	PRINTINT(latency);
 
 	PRINTSTRING(activationsfile);
 	PRINTSTRING(biasfile);
 	PRINTSTRING(signfile);
+	PRINTSTRING(checkpointfile);
+	PRINTSTRING(profilefile);
+	PRINTSTRING(pcafile);
 	fprintf(stdout, "====================================\n\n");
 }
 
@@ -330,7 +638,59 @@ error parseConfig(char* filename, eegdataset_t *dataset) {
 		exit(0);
 	}
 
-	if (getInt(configs, "chans", lines, (natural*) &dataset->config.nchannels) != SUCCESS) {
+	if (getFormat(configs, "DataFormat", lines, &dataset->config.dataformat) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid data format, expected raw, fdt, edf or bdf\n");
+		exit(0);
+	}
+
+	if (getString(configs, "ChannelList", lines, &dataset->config.chanlist) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid channel list\n");
+		exit(0);
+	}
+
+	if (getBool(configs, "online", lines, &dataset->config.online) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid online value\n");
+	}
+
+	/*
+	 * Containers and EDF/BDF files describe their own shape, chans and frames
+	 * become optional. For an EEGLAB .fdt (float32, channels x points) frames
+	 * can be derived from the file size. Online sources are pipes, they are
+	 * not probed and have no length.
+	 */
+	container_t header;
+	int described = 0;
+	if (dataset->config.online) {
+		if (dataset->config.dataformat != FORMAT_RAW && dataset->config.dataformat != FORMAT_FDT) {
+			fprintf(stderr, "ERROR: Online data must be raw or fdt samples\n");
+			exit(0);
+		}
+	} else if (dataset->config.dataformat == FORMAT_EDF || dataset->config.dataformat == FORMAT_BDF) {
+		natural edfchannels, edfframes;
+		if (edfProbe(dataset->config.datafile, dataset->config.dataformat, dataset->config.chanlist, &edfchannels, &edfframes) != SUCCESS) {
+			fprintf(stderr, "ERROR: Invalid EDF/BDF data file %s\n", dataset->config.datafile);
+			exit(0);
+		}
+		header.channels = edfchannels;
+		header.frames = edfframes;
+		header.epochs = 1;
+		described = 1;
+	} else {
+		error probe = containerProbe(dataset->config.datafile, &header);
+		if (probe == ERRORINVALIDCONFIG) {
+			fprintf(stderr, "ERROR: Invalid data container %s\n", dataset->config.datafile);
+			exit(0);
+		}
+		if (probe == SUCCESS) {
+			dataset->config.dataformat = FORMAT_CONTAINER;
+			described = 1;
+		}
+	}
+
+	error found = getInt(configs, "chans", lines, (natural*) &dataset->config.nchannels);
+	if (described && found == ERRORNOPARAM) {
+		dataset->config.nchannels = (natural)header.channels;
+	} else if (found != SUCCESS || dataset->config.nchannels == 0) {
 		fprintf(stderr,"ERROR: Invalid number of channels\n");
 		help();
 		exit(0);
@@ -342,18 +702,43 @@ error parseConfig(char* filename, eegdataset_t *dataset) {
 	 */
 	natural frames = 0;
 	natural epochs = 1;
-	if (getInt(configs, "frames", lines, &frames) != SUCCESS) {
+	found = getInt(configs, "epochs", lines, &epochs);
+	if (described && found == ERRORNOPARAM) {
+		epochs = (natural)header.epochs;
+	} else if (found == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid number of epochs\n");
+	}
+	if (epochs == 0) epochs = 1;
+
+	found = getInt(configs, "frames", lines, &frames);
+	if (described && found == ERRORNOPARAM) {
+		frames = (natural)header.frames;
+	} else if (dataset->config.dataformat == FORMAT_FDT && found == ERRORNOPARAM && !dataset->config.online) {
+		uint64_t points = fileSize(dataset->config.datafile) / sizeof(float);
+		frames = (natural)(points / ((uint64_t)dataset->config.nchannels * epochs));
+		if (frames == 0 || (uint64_t)frames * dataset->config.nchannels * epochs != points) {
+			fprintf(stderr,"ERROR: %s does not hold a whole number of %d channel frames\n", dataset->config.datafile, dataset->config.nchannels);
+			exit(0);
+		}
+	} else if (found == ERRORINVALIDPARAM || (found == ERRORNOPARAM && !dataset->config.online)) {
 		fprintf(stderr,"ERROR: Invalid number of frames\n");
 		help();
 		exit(0);
 	}
 
-	if (getInt(configs, "epochs", lines, &epochs) == ERRORINVALIDPARAM) {
-		fprintf(stderr,"ERROR: Invalid number of epochs\n");
-	}
-
 	dataset->config.nsamples = frames * epochs;
 
+	if (described && (dataset->config.nchannels != header.channels || dataset->config.nsamples != header.frames * header.epochs)) {
+		fprintf(stderr,"ERROR: chans/frames/epochs do not match the data file (%llu x %llu x %llu)\n",
+				(unsigned long long)header.channels, (unsigned long long)header.frames, (unsigned long long)header.epochs);
+		exit(0);
+	}
+	if (dataset->config.dataformat == FORMAT_FDT && !dataset->config.online && fileSize(dataset->config.datafile) != (uint64_t)dataset->config.nsamples * dataset->config.nchannels * sizeof(float)) {
+		fprintf(stderr,"ERROR: %s holds %llu bytes, chans/frames/epochs give %llu\n", dataset->config.datafile,
+				(unsigned long long)fileSize(dataset->config.datafile), (unsigned long long)dataset->config.nsamples * dataset->config.nchannels * sizeof(float));
+		exit(0);
+	}
+
 
 	if (getString(configs, "WeightsOutFile", lines, &dataset->config.weightsoutfile) != SUCCESS) {
 		fprintf(stderr,"ERROR: Invalid weights out file\n");
@@ -382,14 +767,23 @@ error parseConfig(char* filename, eegdataset_t *dataset) {
 
 	dataset->config.extended = (dataset->config.extblocks != 0);
 
+	if (getPcamethod(configs, "pcamethod", lines, &dataset->config.pcamethod) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid pcamethod, expected eig or random\n");
+	}
+
 	if (getInt(configs, "pca", lines, &dataset->config.pca)  == ERRORINVALIDPARAM) {
 		fprintf(stderr,"ERROR: Invalid pca number\n");
 	}
 
-	/*if (dataset->config.pca != 0) {
-		fprintf(stderr,"WARNING: PCA currently not supported, will continue with pca = 0\n");
-		dataset->config.pca = 0;
-	} */
+	if (getString(configs, "PCAFile", lines, &dataset->config.pcafile) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid pca projection file\n");
+	}
+
+	if (dataset->config.pca != 0 && dataset->config.pca < dataset->config.nchannels && dataset->config.pcafile == NULL) {
+		fprintf(stderr,"ERROR: pca %d needs a PCAFile for the projection\n", dataset->config.pca);
+		help();
+		exit(0);
+	}
 
 	if (getString(configs, "WeightsInFile", lines, &dataset->config.weightsinfile) == ERRORINVALIDPARAM) {
 		fprintf(stderr,"ERROR: Invalid initial weights file\n");
@@ -407,6 +801,18 @@ error parseConfig(char* filename, eegdataset_t *dataset) {
 		fprintf(stderr,"ERROR: Invalid sings output file\n");
 	}
 
+	if (getString(configs, "CheckpointFile", lines, &dataset->config.checkpointfile) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid checkpoint file\n");
+	}
+
+	if (getString(configs, "profile", lines, &dataset->config.profilefile) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid profile file\n");
+	}
+
+	if (getBool(configs, "counters", lines, &dataset->config.counters) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid counters flag\n");
+	}
+
 	if (getReal(configs, "lrate", lines, &dataset->config.lrate) == ERRORINVALIDPARAM) {
 		fprintf(stderr,"ERROR: Invalid initial lrate\n");
 	}
@@ -447,6 +853,71 @@ error parseConfig(char* filename, eegdataset_t *dataset) {
 		fprintf(stderr,"ERROR: Invalid seed value\n");
 	}
 
+	if (getInt(configs, "ensemble", lines, &dataset->config.ensemble) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid ensemble value\n");
+	}
+
+	if (getBackend(configs, "backend", lines, &dataset->config.backend) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid backend, expected gpu or cpu\n");
+	}
+
+	if (getSolver(configs, "solver", lines, &dataset->config.solver) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid solver, expected infomax, picard or compare\n");
+	}
+
+	if (getPermutation(configs, "permutation", lines, &dataset->config.permutation) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid permutation, expected shuffle, feistel or chunks\n");
+	}
+
+	if (getInt(configs, "chunk", lines, &dataset->config.chunk) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid chunk size\n");
+	}
+
+	if (getInt(configs, "threads", lines, &dataset->config.nthreads) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid number of threads\n");
+	}
+
+	if (getPrecision(configs, "actprecision", lines, &dataset->config.actprecision) == ERRORINVALIDPARAM || dataset->config.actprecision == PRECISION_MIXED) {
+		fprintf(stderr,"ERROR: Invalid activations precision, expected double or single\n");
+		dataset->config.actprecision = DEFAULT_ACTPRECISION;
+	}
+
+	if (getPrecision(configs, "precision", lines, &dataset->config.precision) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid precision, expected double, single or mixed\n");
+	}
+
+	if (getBool(configs, "streaming", lines, &dataset->config.streaming) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid streaming value\n");
+	}
+
+	if (getInt(configs, "memcap", lines, &dataset->config.memcap) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid memcap value\n");
+	}
+
+	if (getInt(configs, "prefetch", lines, &dataset->config.prefetch) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid prefetch value\n");
+	}
+
+	if (getInt(configs, "checkpoint", lines, &dataset->config.checkpoint) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid checkpoint value\n");
+	}
+
+	if (getBool(configs, "resume", lines, &dataset->config.resume) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid resume value\n");
+	}
+
+	if (getInt(configs, "publish", lines, &dataset->config.publish) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid publish value\n");
+	}
+
+	if (getReal(configs, "decay", lines, &dataset->config.decay) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid decay value\n");
+	}
+
+	if (getInt(configs, "latency", lines, &dataset->config.latency) == ERRORINVALIDPARAM) {
+		fprintf(stderr,"ERROR: Invalid latency value\n");
+	}
+
 	DPRINTF(2, "Config file parsed correctly\n");
 	printConfig(dataset);
 	for (i = 0; i < lines; i++) {
@@ -461,11 +932,96 @@ error parseConfig(char* filename, eegdataset_t *dataset) {
 
 }
 
+/*
+ * Keys of parseOption(): those of the configuration file that are not files
+ * or the data shape, read by the same functions
+ */
+typedef error (*getnatural_t)(char* buffer[], const char* string, int count, natural* result);
+
+static const struct {
+	const char *	key;
+	getnatural_t	get;				//NULL = getReal()
+	size_t			offset;
+} options[] = {
+	{"sphering",		getBool,		offsetof(config_t, sphering)},
+	{"bias",			getBool,		offsetof(config_t, biasing)},
+	{"extended",		getInt,			offsetof(config_t, extblocks)},
+	{"pcamethod",		getPcamethod,	offsetof(config_t, pcamethod)},
+	{"pca",				getInt,			offsetof(config_t, pca)},
+	{"counters",		getBool,		offsetof(config_t, counters)},
+	{"lrate",			NULL,			offsetof(config_t, lrate)},
+	{"blocksize",		getInt,			offsetof(config_t, block)},
+	{"stop",			NULL,			offsetof(config_t, nochange)},
+	{"maxsteps",		getInt,			offsetof(config_t, maxsteps)},
+	{"posact",			getBool,		offsetof(config_t, posact)},
+	{"annealstep",		NULL,			offsetof(config_t, annealstep)},
+	{"annealdeg",		NULL,			offsetof(config_t, annealdeg)},
+	{"momentum",		NULL,			offsetof(config_t, momentum)},
+	{"verbose",			getVerbose,		offsetof(config_t, verbose)},
+	{"seed",			getInt,			offsetof(config_t, seed)},
+	{"ensemble",		getInt,			offsetof(config_t, ensemble)},
+	{"backend",			getBackend,		offsetof(config_t, backend)},
+	{"solver",			getSolver,		offsetof(config_t, solver)},
+	{"permutation",		getPermutation,	offsetof(config_t, permutation)},
+	{"chunk",			getInt,			offsetof(config_t, chunk)},
+	{"threads",			getInt,			offsetof(config_t, nthreads)},
+	{"actprecision",	getPrecision,	offsetof(config_t, actprecision)},
+	{"precision",		getPrecision,	offsetof(config_t, precision)},
+	{"streaming",		getBool,		offsetof(config_t, streaming)},
+	{"memcap",			getInt,			offsetof(config_t, memcap)},
+	{"prefetch",		getInt,			offsetof(config_t, prefetch)},
+	{"checkpoint",		getInt,			offsetof(config_t, checkpoint)},
+	{"resume",			getBool,		offsetof(config_t, resume)},
+	{"online",			getBool,		offsetof(config_t, online)},
+	{"publish",			getInt,			offsetof(config_t, publish)},
+	{"decay",			NULL,			offsetof(config_t, decay)},
+	{"latency",			getInt,			offsetof(config_t, latency)},
+};
+
+/*
+ * Sets one option as the line "key value" of a configuration file would.
+ * Returns ERRORNOPARAM for an unknown key and ERRORINVALIDPARAM for an
+ * invalid value, which leaves the option as it was.
+ */
+error parseOption(config_t *config, const char *key, const char *value) {
+	static std::mutex lock;				//The getters use strtok()
+	size_t i = 0;
+	for (i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+		if (strcmp(key, options[i].key) == 0) break;
+	}
+	if (i == sizeof(options) / sizeof(options[0])) {
+		fprintf(stderr, "ERROR: Unknown option %s\n", key);
+		return ERRORNOPARAM;
+	}
+	char *line = (char*)malloc(strlen(key) + strlen(value) + 3);
+	sprintf(line, "%s %s\n", key, value);
+	config_t parsed = *config;
+	void *field = (char*)&parsed + options[i].offset;
+	error err;
+	lock.lock();
+	if (options[i].get != NULL) {
+		err = options[i].get(&line, key, 1, (natural*)field);
+	} else {
+		err = getReal(&line, key, 1, (real*)field);
+	}
+	lock.unlock();
+	free(line);
+	if (err != SUCCESS || (field == &parsed.actprecision && parsed.actprecision == PRECISION_MIXED)) {
+		fprintf(stderr, "ERROR: Invalid %s value %s\n", key, value);
+		return ERRORINVALIDPARAM;
+	}
+	parsed.extended = (parsed.extblocks != 0);
+	*config = parsed;
+	return SUCCESS;
+}
+
 /*
  * Inits configuration for dataset. Should be called AFTER loading data.
  */
 void initDefaultConfig(eegdataset_t *set) {
 	set->config.datafile = NULL;
+	set->config.dataformat = FORMAT_RAW;
+	set->config.chanlist = NULL;
 	set->config.nchannels = 0;
 	set->config.nsamples = 0;
 	set->config.weightsoutfile = NULL;
@@ -475,6 +1031,8 @@ void initDefaultConfig(eegdataset_t *set) {
 	set->config.biasing = DEFAULT_BIASING;
 	set->config.extblocks = DEFAULT_EXTBLOCKS;
 	set->config.pca = DEFAULT_PCA;
+	set->config.pcamethod = DEFAULT_PCAMETHOD;
+	set->config.pcafile = NULL;
 
 	set->config.weightsinfile = NULL;
 	set->config.lrate = 0.0;
@@ -490,6 +1048,8 @@ void initDefaultConfig(eegdataset_t *set) {
 	set->config.activationsfile = NULL;
 	set->config.biasfile = NULL;
 	set->config.signfile = NULL;
+	set->config.checkpointfile = NULL;
+	set->config.profilefile = NULL;
 
 	set->config.nsub = DEFAULT_NSUB;
 	set->config.pdfsize = MAX_PDFSIZE;
@@ -498,6 +1058,25 @@ void initDefaultConfig(eegdataset_t *set) {
 	set->config.extended = DEFAULT_EXTENDED;
 	set->config.verbose = DEFAULT_VERBOSE;
 	set->config.seed = (int)time(NULL);
+	set->config.ensemble = DEFAULT_ENSEMBLE;
+	set->config.backend = DEFAULT_BACKEND;
+	set->config.solver = DEFAULT_SOLVER;
+	set->config.permutation = DEFAULT_PERMUTATION;
+	set->config.chunk = DEFAULT_CHUNK;
+	set->config.nthreads = DEFAULT_THREADS;
+	set->config.precision = DEFAULT_PRECISION;
+	set->config.actprecision = DEFAULT_ACTPRECISION;
+	set->config.streaming = DEFAULT_STREAMING;
+	set->config.memcap = DEFAULT_MEMCAP;
+	set->config.prefetch = DEFAULT_PREFETCH;
+	set->config.checkpoint = DEFAULT_CHECKPOINT;
+	set->config.resume = DEFAULT_RESUME;
+	set->config.counters = DEFAULT_COUNTERS;
+	set->config.online = DEFAULT_ONLINE;
+	set->config.publish = DEFAULT_PUBLISH;
+	set->config.decay = DEFAULT_DECAY;
+	set->config.latency = DEFAULT_LATENCY;
+	set->config.embedded = 0;
 
 	set->nchannels = 0;
 	set->nsamples = 0;
@@ -511,14 +1090,92 @@ void initDefaultConfig(eegdataset_t *set) {
 	set->h_weights = NULL;
 	set->bias = NULL;
 	set->signs = NULL;
+	set->mapping = NULL;
+	set->mapsize = 0;
+	set->stream = NULL;
+	set->steps = 0;
+	set->mean = NULL;
+	set->cov = NULL;
+	set->projection = NULL;
+	set->urchannels = 0;
 
 }
 
 void checkDefaultConfig(eegdataset_t *set) {
 
 	if (set->config.lrate == 0) set->config.lrate = DEFAULT_LRATE(set->config.nchannels);
-	if (set->config.block == 0) set->config.block = DEFAULT_BLOCK(set->config.nsamples);
+	if (set->config.block == 0) {
+		set->config.block = set->config.online ? DEFAULT_ONLINE_BLOCK : DEFAULT_BLOCK(set->config.nsamples);
+	}
 	if (set->config.annealstep == 0.0) {
 		set->config.annealstep = (set->config.extended) ? DEFAULT_EXTANNEAL : DEFAULT_ANNEALSTEP;
 	}
+	if (set->config.ensemble == 0) set->config.ensemble = 1;
+	if (set->config.embedded && (set->config.ensemble > 1 || set->config.streaming || set->config.online)) {
+		printf("Library runs keep the data in memory and return one run, ignoring ensemble, streaming and online\n");
+		set->config.ensemble = 1;
+		set->config.streaming = 0;
+		set->config.online = 0;
+	}
+	if (set->config.streaming && set->config.backend == BACKEND_GPU) {
+		printf("Streaming is only available on the host, switching to backend cpu\n");
+		set->config.backend = BACKEND_CPU;
+	}
+	if (set->config.solver != SOLVER_INFOMAX && set->config.streaming) {
+		printf("Solver %s needs the data in memory, streaming uses infomax\n", solverName(set->config.solver));
+		set->config.solver = SOLVER_INFOMAX;
+	}
+	if (set->config.solver != SOLVER_INFOMAX && set->config.backend == BACKEND_GPU) {
+		printf("Solver %s is only available on the host, switching to backend cpu\n", solverName(set->config.solver));
+		set->config.backend = BACKEND_CPU;
+	}
+	if (set->config.solver != SOLVER_INFOMAX && set->config.ensemble > 1) {
+		printf("Solver %s does not depend on the seed, running it once\n", solverName(set->config.solver));
+		set->config.ensemble = 1;
+	}
+	if (set->config.online && set->config.backend == BACKEND_GPU) {
+		printf("Online mode is only available on the host, switching to backend cpu\n");
+		set->config.backend = BACKEND_CPU;
+	}
+	if (set->config.profilefile != NULL && (set->config.ensemble > 1 || set->config.online)) {
+		printf("Profiling is only available for single batch runs, not writing %s\n", set->config.profilefile);
+		free(set->config.profilefile);
+		set->config.profilefile = NULL;
+	}
+	if (set->config.activationsfile != NULL && set->config.online) {
+		printf("Online mode keeps no data, not writing %s\n", set->config.activationsfile);
+		free(set->config.activationsfile);
+		set->config.activationsfile = NULL;
+	}
+	if (set->config.pca != 0 && (set->config.streaming || set->config.online)) {
+		printf("PCA reduction needs the data in memory, decomposing all the channels\n");
+		set->config.pca = 0;
+	}
+	if (set->config.pca != 0 && set->config.pcafile == NULL && !set->config.embedded) {
+		printf("PCA reduction needs a PCAFile for the projection, decomposing all the channels\n");
+		set->config.pca = 0;
+	}
+	if (set->config.pca != 0 && set->config.pca < set->config.nchannels && set->config.weightsinfile != NULL) {
+		printf("Initial weights are given in channel space, not used with pca\n");
+		free(set->config.weightsinfile);
+		set->config.weightsinfile = NULL;
+	}
+	if (set->config.chunk == 0) set->config.chunk = 1;
+	if (set->config.chunk & (set->config.chunk - 1)) {
+		natural chunk = set->config.chunk;
+		while (set->config.chunk & (set->config.chunk - 1)) {
+			set->config.chunk += set->config.chunk & -set->config.chunk;
+		}
+		if (set->config.permutation == PERMUTATION_CHUNKS) {
+			printf("Chunk %d is not a power of 2, using %d samples\n", chunk, set->config.chunk);
+		}
+	}
+	if (set->config.publish == 0) set->config.publish = 1;
+	if (set->config.latency == 0) set->config.latency = 1;
+#ifdef _OPENMP
+	if (set->config.nthreads == 0) set->config.nthreads = omp_get_num_procs();
+	omp_set_num_threads(set->config.nthreads);
+#else
+	set->config.nthreads = 1;
+#endif
 }
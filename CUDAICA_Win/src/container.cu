@@ -0,0 +1,230 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <container.h>
+#include <error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define FNV_OFFSET	14695981039346656037ULL
+#define FNV_PRIME	1099511628211ULL
+
+
+/*
+ * Size in bytes of each value of the given type
+ */
+size_t dtypeSize(natural dtype) {
+	switch (dtype) {
+		case DTYPE_F64: return sizeof(double);
+		case DTYPE_F32: return sizeof(float);
+		case DTYPE_I16: return sizeof(int16_t);
+		case DTYPE_I32: return sizeof(int32_t);
+	}
+	return 0;
+}
+
+/*
+ * Converts values [first, last) of a payload of type dtype to real
+ */
+void convertValues(const char* src, real* dst, size_t first, size_t last, natural dtype, int swap, real scale) {
+	size_t i;
+	switch (dtype) {
+		case DTYPE_F64:
+			for (i = first; i < last; i++) {
+				uint64_t v;
+				memcpy(&v, src + i * sizeof(v), sizeof(v));
+				if (swap) v = byteswap64(v);
+				double d;
+				memcpy(&d, &v, sizeof(d));
+				dst[i] = (real)d;
+			}
+			break;
+		case DTYPE_F32:
+			for (i = first; i < last; i++) {
+				uint32_t v;
+				memcpy(&v, src + i * sizeof(v), sizeof(v));
+				if (swap) v = byteswap32(v);
+				float f;
+				memcpy(&f, &v, sizeof(f));
+				dst[i] = (real)f;
+			}
+			break;
+		case DTYPE_I16:
+			for (i = first; i < last; i++) {
+				uint16_t v;
+				memcpy(&v, src + i * sizeof(v), sizeof(v));
+				if (swap) v = (uint16_t)((v << 8) | (v >> 8));
+				dst[i] = scale * (real)(int16_t)v;
+			}
+			break;
+		case DTYPE_I32:
+			for (i = first; i < last; i++) {
+				uint32_t v;
+				memcpy(&v, src + i * sizeof(v), sizeof(v));
+				if (swap) v = byteswap32(v);
+				dst[i] = scale * (real)(int32_t)v;
+			}
+			break;
+	}
+}
+
+/*
+ * Returns 1 if the header (as read from disk) was written with the other byte order
+ */
+int containerSwapped(container_t *header) {
+	return header->byteorder == byteswap32(CONTAINER_BYTEORDER);
+}
+
+/*
+ * Reads the container header of filename into header, in native byte order.
+ * byteorder is left as read so containerSwapped() still tells whether the
+ * payload needs swapping.
+ *
+ * Returns ERRORNOPARAM if the file is not a container, so callers can fall
+ * back to headerless data, and ERRORINVALIDCONFIG if the header is damaged
+ * or does not match the file size.
+ */
+error containerProbe(char *filename, container_t *header) {
+	FILE *file = fopen(filename, "rb");
+	if (file == NULL) {
+		return ERRORNOFILE;
+	}
+	size_t items = fread(header, sizeof(container_t), 1, file);
+	fseek(file, 0, SEEK_END);
+#ifdef _WIN32
+	uint64_t fsize = _ftelli64(file);
+#else
+	uint64_t fsize = ftello(file);
+#endif
+	fclose(file);
+	if (items != 1 || memcmp(header->magic, CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC)) != 0) {
+		return ERRORNOPARAM;
+	}
+	if (containerSwapped(header)) {
+		header->version = byteswap32(header->version);
+		header->dtype = byteswap32(header->dtype);
+		header->flags = byteswap32(header->flags);
+		header->channels = byteswap64(header->channels);
+		header->frames = byteswap64(header->frames);
+		header->epochs = byteswap64(header->epochs);
+		header->offset = byteswap64(header->offset);
+		header->alignment = byteswap64(header->alignment);
+		header->checksum = byteswap64(header->checksum);
+		uint64_t scale;
+		memcpy(&scale, &header->scale, sizeof(scale));
+		scale = byteswap64(scale);
+		memcpy(&header->scale, &scale, sizeof(scale));
+	} else if (header->byteorder != CONTAINER_BYTEORDER) {
+		fprintf(stderr, "Container %s has an unknown byte order %x\n", filename, header->byteorder);
+		return ERRORINVALIDCONFIG;
+	}
+	if (header->version > CONTAINER_VERSION) {
+		fprintf(stderr, "Container %s has version %u, only %d is supported\n", filename, header->version, CONTAINER_VERSION);
+		return ERRORINVALIDCONFIG;
+	}
+	if (dtypeSize(header->dtype) == 0) {
+		fprintf(stderr, "Container %s has an unknown data type %u\n", filename, header->dtype);
+		return ERRORINVALIDCONFIG;
+	}
+	if (header->epochs == 0) header->epochs = 1;
+	uint64_t payload = header->channels * header->frames * header->epochs * dtypeSize(header->dtype);
+	if (header->offset < sizeof(container_t) || header->offset + payload > fsize) {
+		fprintf(stderr, "Container %s is truncated: %llu bytes, %llu needed\n", filename,
+				(unsigned long long)fsize, (unsigned long long)(header->offset + payload));
+		return ERRORINVALIDCONFIG;
+	}
+	DPRINTF(1, "Container %s: %llu channels, %llu frames, %llu epochs, type %u\n", filename,
+			(unsigned long long)header->channels, (unsigned long long)header->frames, (unsigned long long)header->epochs, header->dtype);
+	return SUCCESS;
+}
+
+/*
+ * Checksum of a payload, chunks are hashed in parallel
+ */
+uint64_t containerChecksum(const char *payload, size_t size) {
+	int nchunks = (int)((size + CONTAINER_CHECKSUM_CHUNK - 1) / CONTAINER_CHECKSUM_CHUNK);
+	uint64_t sum = 0;
+	int c;
+	#pragma omp parallel for reduction(+:sum) schedule(dynamic)
+	for (c = 0; c < nchunks; c++) {
+		size_t first = (size_t)c * CONTAINER_CHECKSUM_CHUNK;
+		size_t last = first + CONTAINER_CHECKSUM_CHUNK < size ? first + CONTAINER_CHECKSUM_CHUNK : size;
+		uint64_t hash = FNV_OFFSET ^ (uint64_t)c;
+		for (size_t i = first; i < last; i++) {
+			hash = (hash ^ (unsigned char)payload[i]) * FNV_PRIME;
+		}
+		sum += hash;
+	}
+	return sum;
+}
+
+/*
+ * Writes the header of a rows x cols container and the zeros up to its
+ * payload, at the first CONTAINER_ALIGNMENT boundary after the header
+ */
+error containerBegin(FILE *file, natural dtype, natural rows, natural cols, uint64_t checksum) {
+	container_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC));
+	header.version = CONTAINER_VERSION;
+	header.byteorder = CONTAINER_BYTEORDER;
+	header.dtype = dtype;
+	header.flags = checksum != 0 ? CONTAINER_FLAG_CHECKSUM : 0;
+	header.channels = cols;
+	header.frames = rows;
+	header.epochs = 1;
+	header.offset = (sizeof(container_t) + CONTAINER_ALIGNMENT - 1) / CONTAINER_ALIGNMENT * CONTAINER_ALIGNMENT;
+	header.alignment = CONTAINER_ALIGNMENT;
+	header.checksum = checksum;
+	header.scale = 1.0;
+
+	static const char zeros[CONTAINER_ALIGNMENT] = {0};
+	if (fwrite(&header, sizeof(header), 1, file) != 1 || fwrite(zeros, 1, header.offset - sizeof(header), file) != header.offset - sizeof(header)) {
+		return ERRORNOFILE;
+	}
+	return SUCCESS;
+}
+
+/*
+ * Writes a host matrix of rows x cols values, each row pitch bytes apart,
+ * as a container with a checksum
+ */
+error containerWrite(char *filename, natural dtype, natural rows, natural cols, void *mat, size_t pitch) {
+	FILE *file = fopen(filename, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "Error opening %s (%d) %s\n", filename, errno, strerror(errno));
+		return ERRORNOFILE;
+	}
+	size_t width = cols * dtypeSize(dtype);
+	char *payload = (char*)malloc(rows * width);
+	for (natural r = 0; r < rows; r++) {
+		memcpy(payload + r * width, (char*)mat + r * pitch, width);
+	}
+
+	error err = SUCCESS;
+	if (containerBegin(file, dtype, rows, cols, containerChecksum(payload, rows * width)) != SUCCESS || fwrite(payload, width, rows, file) != rows) {
+		fprintf(stderr, "Error writing container %s\n", filename);
+		err = ERRORNOFILE;
+	}
+	free(payload);
+	fclose(file);
+	return err;
+}
@@ -0,0 +1,225 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cudaica.h>
+#include <loader.h>
+#include <device.h>
+#include <preprocess.h>
+#include <postprocess.h>
+#include <infomax.h>
+#include <plan.h>
+#include <pool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+
+/*
+ * The device, its arena and the selected device number are shared by the
+ * runs of backend gpu
+ */
+static std::mutex gpuLock;
+static int selected = -1;
+
+void icaDefaults(icaoptions_t *options) {
+	eegdataset_t set;
+	initDefaultConfig(&set);
+	options->config = set.config;
+	options->device = 0;
+}
+
+error icaOption(icaoptions_t *options, const char *key, const char *value) {
+	return parseOption(&options->config, key, value);
+}
+
+natural icaComponents(const icaoptions_t *options, natural channels) {
+	natural pca = options->config.pca;
+	return pca != 0 && pca < channels ? pca : channels;
+}
+
+/*
+ * Reads the caller's array into the sample major working copy
+ */
+static void icaGather(eegdataset_t *set, const icadata_t *in) {
+	natural m = in->channels;
+	int s = 0;
+	set->data = (real*)malloc((size_t)in->samples * m * sizeof(real));
+	#pragma omp parallel for
+	for (s = 0; s < (int)in->samples; s++) {
+		const char *src = (const char*)in->data + (ptrdiff_t)s * in->samplestride;
+		real *dst = set->data + (size_t)s * m;
+		natural c;
+		if (in->dtype == DTYPE_F32) {
+			for (c = 0; c < m; c++) dst[c] = (real)*(const float*)(src + (ptrdiff_t)c * in->chanstride);
+		} else {
+			for (c = 0; c < m; c++) dst[c] = (real)*(const double*)(src + (ptrdiff_t)c * in->chanstride);
+		}
+	}
+}
+
+/*
+ * Copies rows of a result into a caller buffer, from the device with
+ * backend gpu
+ */
+static void icaCopy(eegdataset_t *set, void *dst, const void *src, size_t spitch, size_t width, size_t rows) {
+	if (set->config.backend == BACKEND_GPU) {
+		HANDLE_ERROR(cudaMemcpy2D(dst, width, src, spitch, width, rows, cudaMemcpyDeviceToHost));
+		return;
+	}
+	size_t r = 0;
+	for (r = 0; r < rows; r++) {
+		memcpy((char*)dst + r * width, (const char*)src + r * spitch, width);
+	}
+}
+
+static void icaResults(eegdataset_t *set, icaresults_t *results) {
+	natural k = set->nchannels;
+	size_t width = k * sizeof(real);
+	natural i = 0;
+	results->components = k;
+	results->steps = set->steps;
+	icaCopy(set, results->weights, set->weights, set->wpitch, width, k);
+	if (set->sphere != NULL) {
+		icaCopy(set, results->sphere, set->sphere, set->spitch, width, k);
+	} else {
+		memset(results->sphere, 0, k * width);
+		for (i = 0; i < k; i++) results->sphere[i + i * k] = 1.0;
+	}
+	if (results->bias != NULL) {
+		if (set->bias != NULL) {
+			icaCopy(set, results->bias, set->bias, width, width, 1);
+		} else {
+			memset(results->bias, 0, width);
+		}
+	}
+	if (results->signs != NULL) {
+		if (set->signs != NULL) {
+			icaCopy(set, results->signs, set->signs, k * sizeof(integer), k * sizeof(integer), 1);
+		} else {
+			memset(results->signs, 0, k * sizeof(integer));
+		}
+	}
+	if (set->projection != NULL) {
+		memcpy(results->projection, set->projection, (size_t)k * set->urchannels * sizeof(real));
+	}
+}
+
+/*
+ * The steps of main() from the data to the results. Infomax returns
+ * ERRORDIVERGED, the cuda and cublas errors jump out of it, to icaRun().
+ */
+static error icaPipeline(eegdataset_t *set, const icadata_t *in, icaresults_t *results) {
+	icaGather(set, in);
+	set->nchannels = in->channels;
+	set->nsamples = in->samples;
+	if (set->config.backend == BACKEND_GPU) {
+		plan_t plan;
+		planJob(&set->config, &plan);
+		if (plan.devicepeak > getFreeMem() || poolArena(plan.devicepeak) != cudaSuccess) {
+			fprintf(stderr, "ERROR: Not enough device memory: the run needs %.1f MB, %.1f MB are free\n", plan.devicepeak / 1048576.0, getFreeMem() / 1048576.0);
+			return ERRORNODEVICEMEM;
+		}
+		error err = loadToDevice(set);
+		if (err != SUCCESS) return err;
+	}
+	centerData(set);
+	if (pcaReduces(set)) {
+		error err = pcaReduce(set);
+		if (err != SUCCESS) return err;
+	}
+	if (set->config.sphering == 1 || set->config.sphering == 0) {
+		whiten(set);
+	}
+	error err = infomax(set);
+	if (err != SUCCESS) return err;
+	err = postprocess(set);
+	if (err != SUCCESS) return err;
+	icaResults(set, results);
+	return SUCCESS;
+}
+
+/*
+ * Runs the pipeline on the caller's data, see cudaica.h
+ */
+error icaRun(const icadata_t *data, const icaoptions_t *options, icaresults_t *results) {
+	if (data == NULL || data->data == NULL || data->channels == 0 || data->samples == 0 || (data->dtype != DTYPE_F64 && data->dtype != DTYPE_F32)) {
+		fprintf(stderr, "ERROR: Invalid data, expected float64 or float32 channels x samples\n");
+		return ERRORINVALIDPARAM;
+	}
+	if (results == NULL || results->weights == NULL || results->sphere == NULL) {
+		fprintf(stderr, "ERROR: The weights and sphere buffers are needed\n");
+		return ERRORINVALIDPARAM;
+	}
+	if (icaComponents(options, data->channels) < data->channels && results->projection == NULL) {
+		fprintf(stderr, "ERROR: pca %d needs a projection buffer\n", options->config.pca);
+		return ERRORINVALIDPARAM;
+	}
+
+	eegdataset_t *set = (eegdataset_t*)malloc(sizeof(eegdataset_t));
+	initDefaultConfig(set);
+	set->config = options->config;
+	set->config.datafile = NULL;
+	set->config.chanlist = NULL;
+	set->config.weightsoutfile = NULL;
+	set->config.sphereoutfile = NULL;
+	set->config.weightsinfile = NULL;
+	set->config.activationsfile = NULL;
+	set->config.biasfile = NULL;
+	set->config.signfile = NULL;
+	set->config.checkpointfile = NULL;
+	set->config.profilefile = NULL;
+	set->config.pcafile = NULL;
+	set->config.nchannels = data->channels;
+	set->config.nsamples = data->samples;
+	set->config.embedded = 1;
+	checkDefaultConfig(set);
+
+	int gpu = set->config.backend == BACKEND_GPU;
+	if (gpu) {
+		gpuLock.lock();
+	}
+	volatile error err = SUCCESS;
+	jmp_buf trap;
+	err = (error)setjmp(trap);
+	if (err == SUCCESS) {
+		errorTrap(&trap);
+		if (gpu) {
+			if (selected != (int)options->device) {
+				selected = -1;
+				selectDevice(options->device, 0);
+				selected = options->device;
+			} else {
+				bindDevice();
+			}
+		}
+		err = icaPipeline(set, data, results);
+	}
+	if (setjmp(trap) == 0) {
+		errorTrap(&trap);
+		if (gpu) freeDeviceMem(set);
+		freeEEG(set);
+		if (gpu) poolArenaRelease();
+	}
+	errorTrap(NULL);
+	if (gpu) {
+		gpuLock.unlock();
+	}
+	return err;
+}
@@ -31,6 +31,7 @@
 #include "config.h"
 #include <common.h>
 #include <error.h>
+#include <pool.h>
 #include <cuda_runtime.h>
 
 #ifdef __cplusplus
@@ -95,6 +96,15 @@ error selectDevice(natural deviceNum, natural verbose) {
 	return SUCCESS;
 }
 
+/*
+ * Makes the selected device current for the calling host thread, for
+ * threads other than the one that called selectDevice()
+ */
+error bindDevice(void) {
+	HANDLE_ERROR(cudaSetDevice(gpu.device));
+	return SUCCESS;
+}
+
 /*
  * Return the maximum number of threads supported by the device
  */ 
@@ -153,14 +163,14 @@ void recalcFreeMem(size_t elemspercolumn) {
 }
 
 /*
- * Returns the amount of memory available to use by data
- * TODO: Fix
+ * Returns the device memory free now minus the reserved memory, 0 if there
+ * is no more than that
  */ 
 size_t getFreeMem() {
+	recalcFreeMem(0);
 	DPRINTF(1, "Available Mem %llu (free %llu - res %llu)\n", (gpu.currentFreeMem - gpu.neededReservedMem), gpu.currentFreeMem, gpu.neededReservedMem);
 	if (gpu.currentFreeMem < gpu.neededReservedMem) {
-		fprintf(stderr, "Not enough mem!\n");
-		exit(-1);
+		return 0;
 	}
 	return gpu.currentFreeMem - gpu.neededReservedMem;
 }
@@ -222,7 +232,7 @@ void saveData(eegdataset_t *set){
 void freeDeviceMem(eegdataset_t *set) {
 	if (set->devicePointer != NULL) {
 		DPRINTF(1, "Freeing matrix in device memory\n");
-		HANDLE_ERROR(cudaFree(set->devicePointer));
+		poolCudaFree(set->devicePointer);
 		set->devicePointer = NULL;
 	}	
 }
@@ -240,7 +250,7 @@ error loadToDevice(eegdataset_t *set) {
 		size_t height = set->nsamples;
 		DPRINTF(1, "cudaMallocPitch width %lu bytes, height %lu rows\n", width, height);
 		size_t pitch;
-		err = cudaMallocPitch(&ptr, &pitch, width, height);
+		err = poolMallocPitch(&ptr, &pitch, width, height);
 		DPRINTF(1, "cudaMallocPitch result %p with pitch %lu\n", ptr, pitch);
 		if ( err != cudaSuccess) {
 			return ERRORNODEVICEMEM;
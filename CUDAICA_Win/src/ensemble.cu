@@ -0,0 +1,272 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <ensemble.h>
+#include <infomax.h>
+#include <hostinfomax.h>
+#include <pool.h>
+#include <postprocess.h>
+#include <error.h>
+#include <common.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <cuda_runtime.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*
+ * File name of one run: name.seed, NULL stays NULL
+ */
+static char *ensembleName(const char *name, natural seed) {
+	if (name == NULL) return NULL;
+	char *out = (char*)malloc(strlen(name) + 16);
+	sprintf(out, "%s.%u", name, seed);
+	return out;
+}
+
+/*
+ * Copy of the dataset for run k, sharing the data and the sphere
+ */
+static eegdataset_t *ensembleMember(eegdataset_t *set, natural k) {
+	eegdataset_t *member = (eegdataset_t*)malloc(sizeof(eegdataset_t));
+	*member = *set;
+	member->config.seed = set->config.seed + k;
+	member->config.weightsoutfile = ensembleName(set->config.weightsoutfile, member->config.seed);
+	member->config.biasfile = ensembleName(set->config.biasfile, member->config.seed);
+	member->config.signfile = ensembleName(set->config.signfile, member->config.seed);
+	member->config.checkpointfile = ensembleName(set->config.checkpointfile, member->config.seed);
+	member->sphere = NULL;
+	member->weights = NULL;
+	member->bias = NULL;
+	member->signs = NULL;
+	member->projection = NULL;
+	return member;
+}
+
+/*
+ * Frees the results and names of a copy, not the shared data
+ */
+static void ensembleFree(eegdataset_t *member) {
+	if (member->config.backend == BACKEND_CPU) {
+		if (member->weights != NULL) poolFree(member->weights);
+		if (member->signs != NULL) poolFree(member->signs);
+		if (member->bias != NULL) poolFree(member->bias);
+	} else {
+		if (member->weights != NULL) poolCudaFree(member->weights);
+		if (member->signs != NULL) poolCudaFree(member->signs);
+		if (member->bias != NULL) poolCudaFree(member->bias);
+	}
+	free(member->config.weightsoutfile);
+	free(member->config.biasfile);
+	free(member->config.signfile);
+	free(member->config.checkpointfile);
+	free(member);
+}
+
+/*
+ * Host copy of the weights of a run, column major with pitch channels
+ */
+static real *ensembleWeights(eegdataset_t *set) {
+	natural n = set->nchannels;
+	real *w = (real*)malloc(n * n * sizeof(real));
+	if (set->config.backend == BACKEND_CPU) {
+		natural c;
+		for (c = 0; c < n; c++) {
+			memcpy(w + c * n, (char*)set->weights + c * set->wpitch, n * sizeof(real));
+		}
+	} else {
+		HANDLE_ERROR(cudaMemcpy2D(w, n * sizeof(real), set->weights, set->wpitch, n * sizeof(real), n, cudaMemcpyDeviceToHost));
+	}
+	return w;
+}
+
+/*
+ * |Pearson correlation| of row i of a and row j of b (n x n, column major)
+ */
+static double ensembleCorrelation(real *a, natural i, real *b, natural j, natural n) {
+	double ma = 0.0, mb = 0.0, ab = 0.0, aa = 0.0, bb = 0.0;
+	natural c;
+	for (c = 0; c < n; c++) {
+		ma += a[i + c * n];
+		mb += b[j + c * n];
+	}
+	ma /= n;
+	mb /= n;
+	for (c = 0; c < n; c++) {
+		double x = a[i + c * n] - ma;
+		double y = b[j + c * n] - mb;
+		ab += x * y;
+		aa += x * x;
+		bb += y * y;
+	}
+	if (aa == 0.0 || bb == 0.0) return 0.0;
+	return fabs(ab / sqrt(aa * bb));
+}
+
+/*
+ * Matches the components of every run to those of the first one and writes
+ * the summary. match[k * n + i] is the component of run k in the cluster of
+ * component i of the first run, r the same for their |correlation|.
+ */
+static void ensembleSummary(eegdataset_t **members, natural runs) {
+	natural n = members[0]->nchannels;
+	real **w = (real**)malloc(runs * sizeof(real*));
+	natural *match = (natural*)malloc(runs * n * sizeof(natural));
+	double *r = (double*)malloc(runs * n * sizeof(double));
+	double *corr = (double*)malloc(n * n * sizeof(double));
+	int *used = (int*)malloc(2 * n * sizeof(int));
+	natural k, i, j, m;
+	int stable = 0;
+
+	for (k = 0; k < runs; k++) {
+		w[k] = ensembleWeights(members[k]);
+	}
+	for (i = 0; i < n; i++) {
+		match[i] = i;
+		r[i] = 1.0;
+	}
+	for (k = 1; k < runs; k++) {
+		int p = 0;
+		#pragma omp parallel for private(j)
+		for (p = 0; p < (int)n; p++) {
+			for (j = 0; j < n; j++) {
+				corr[p * n + j] = ensembleCorrelation(w[0], p, w[k], j, n);
+			}
+		}
+		memset(used, 0, 2 * n * sizeof(int));
+		for (m = 0; m < n; m++) {
+			natural bi = 0, bj = 0;
+			double best = -1.0;
+			for (i = 0; i < n; i++) {
+				if (used[i]) continue;
+				for (j = 0; j < n; j++) {
+					if (!used[n + j] && corr[i * n + j] > best) {
+						best = corr[i * n + j];
+						bi = i;
+						bj = j;
+					}
+				}
+			}
+			used[bi] = 1;
+			used[n + bj] = 1;
+			match[k * n + bi] = bj;
+			r[k * n + bi] = best;
+		}
+	}
+
+	char *fname = (char*)malloc(strlen(members[0]->config.weightsoutfile) + 16);
+	sprintf(fname, "%s.ensemble", members[0]->config.weightsoutfile);
+	FILE *out = fopen(fname, "w");
+	if (out == NULL) {
+		fprintf(stderr, "ERROR: Cannot write the ensemble summary %s\n", fname);
+	} else {
+		fprintf(out, "# %u runs, seeds %u to %u, components matched to seed %u by |correlation| of the unmixing rows\n", runs, members[0]->config.seed, members[runs-1]->config.seed, members[0]->config.seed);
+		fprintf(out, "# component mean|r| min|r|, then the matched component (from 1) and |r| of each run\n");
+	}
+	for (i = 0; i < n; i++) {
+		double mean = 0.0, min = 1.0;
+		for (k = 1; k < runs; k++) {
+			mean += r[k * n + i];
+			if (r[k * n + i] < min) min = r[k * n + i];
+		}
+		mean /= runs - 1;
+		if (mean >= ENSEMBLE_STABLE) stable++;
+		if (out == NULL) continue;
+		fprintf(out, "%u %.4f %.4f", i + 1, mean, min);
+		for (k = 1; k < runs; k++) {
+			fprintf(out, " %u %.4f", match[k * n + i] + 1, r[k * n + i]);
+		}
+		fprintf(out, "\n");
+	}
+	if (out != NULL) fclose(out);
+	printf("Ensemble: %d of %u components reproduced with mean |r| >= %.2f (%s)\n", stable, n, ENSEMBLE_STABLE, fname);
+
+	for (k = 0; k < runs; k++) {
+		free(w[k]);
+	}
+	free(fname);
+	free(used);
+	free(corr);
+	free(r);
+	free(match);
+	free(w);
+}
+
+/*
+ * Runs the ensemble, post processes every run, saves the results of every
+ * run but the first one (left in set for saveEEG) and writes the summary.
+ *
+ * set: the centered and sphered dataset
+ */
+error runEnsemble(eegdataset_t *set) {
+	natural runs = set->config.ensemble;
+	natural nthreads = set->config.nthreads;
+	eegdataset_t **members = (eegdataset_t**)malloc(runs * sizeof(eegdataset_t*));
+	error err = SUCCESS;
+	natural k;
+
+	members[0] = set;
+	for (k = 1; k < runs; k++) {
+		members[k] = ensembleMember(set, k);
+	}
+	printf("Running an ensemble of %u runs, seeds %u to %u\n", runs, set->config.seed, set->config.seed + runs - 1);
+	if (set->config.backend == BACKEND_CPU) {
+		natural concurrent = set->stream != NULL ? 1 : (runs < nthreads ? runs : nthreads);
+		for (k = 0; k < runs; k++) {
+			members[k]->config.nthreads = nthreads / concurrent;
+		}
+#ifdef _OPENMP
+		omp_set_nested(1);
+#endif
+		err = hostInfomaxEnsemble(members, runs, concurrent);
+		set->config.nthreads = nthreads;
+#ifdef _OPENMP
+		omp_set_num_threads(nthreads);
+#endif
+	} else {
+		for (k = 0; k < runs && err == SUCCESS; k++) {
+			err = infomax(members[k]);
+		}
+	}
+
+	/*
+	 * The members see the shared sphere while they are post processed only,
+	 * it is saved and freed with the first run
+	 */
+	for (k = 0; k < runs && err == SUCCESS; k++) {
+		members[k]->config.nthreads = nthreads;
+		members[k]->sphere = set->sphere;
+		err = postprocess(members[k]);
+		if (k > 0) members[k]->sphere = NULL;
+	}
+
+	if (err == SUCCESS && set->config.weightsoutfile != NULL) {
+		ensembleSummary(members, runs);
+	}
+	for (k = 1; k < runs; k++) {
+		if (err == SUCCESS) saveEEG(members[k]);
+		ensembleFree(members[k]);
+	}
+	free(members);
+	return err;
+}
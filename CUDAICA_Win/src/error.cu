@@ -46,6 +46,25 @@ void HandleError(cudaError_t err, const char *file, int line ) {
 		if (newerr != err && newerr != cudaSuccess) {
 			DPRINTF(1, "DEBUG::Another error %s (%x) in %s at line %d\n", cudaGetErrorString(newerr), newerr, file, line);
 		}
-		exit( EXIT_FAILURE );
+		errorFail(ERRORDEVICE);
 	}
 }
+
+/*
+ * Trap of the calling thread, NULL = fatal errors end the process
+ */
+static thread_local jmp_buf *trap = NULL;
+
+void errorTrap(jmp_buf *buf) {
+	trap = buf;
+}
+
+/*
+ * Jumps to the trap of the calling thread, which is cleared, or exits
+ */
+void errorFail(int err) {
+	jmp_buf *buf = trap;
+	if (buf == NULL) exit(EXIT_FAILURE);
+	trap = NULL;
+	longjmp(*buf, err);
+}
@@ -0,0 +1,1517 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *  Modified to build under Windows by Yunhui Zhou.
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host (cpu backend) version of the Infomax loop in infomax.cu.
+ *
+ * Every step mirrors the cuda kernel with the same name: the data, u and y
+ * matrices are stored one sample per row (channels contiguous), the weights
+ * and yu matrices in column major order, all of them with pitch
+ * channels * sizeof(real). The random permutations (permutation.h) are
+ * taken from r250 in the same order as the device version, so both
+ * backends see the same samples for the same seed.
+ *
+ * The loop is a template on two types chosen by the precision key: T for
+ * the data, the only large array it streams through, and A for everything
+ * else (weights, yu, bias and kurtosis sums, and the u and y tiles, which
+ * stay in cache). double is <double, double>, single <float, float> and
+ * mixed <float, double>.
+ *
+ * The kernels also take the channel count as a template argument CH. The
+ * common montages (32, 64, 128 and 256, see hostInfomaxCH()) get their own
+ * instantiation, which runs the GEMMs with hostColumnKernel() on constant
+ * length columns. Any other count runs CH = 0, which reads it from the
+ * channels argument and uses the 4x4 register tiles.
+ */
+
+#include <hostinfomax.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <error.h>
+#include <stream.h>
+#include <common.h>
+#include <pool.h>
+#include <checkpoint.h>
+#include <whitening.h>
+#include <profile.h>
+#include <permutation.h>
+#include "../lib/include/r250.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*
+ * Register tile of the host GEMMs. Every product below is computed
+ * HOST_MR x HOST_NR outputs at a time, kept in registers while the inner
+ * dimension is walked, and handed to an epilogue before being stored.
+ */
+#define HOST_MR			4
+#define HOST_NR			4
+#define HOST_BENCHMARK_SECONDS	1.0		//Time spent on each benchmark case
+
+/*
+ * acc(r, q) = sum_p a[r + p * acs] * b[p * brs + q * bcs]
+ * for r < mr, q < nr, p < k. The sums are kept in local variables so they
+ * can live in registers, full tiles take the first branch so the compiler
+ * can unroll it.
+ */
+template <typename A>
+static inline void hostMicroKernel(natural mr, natural nr, natural k, const A *a, size_t acs, const A *b, size_t brs, size_t bcs, A acc[HOST_MR][HOST_NR]) {
+	A sum[HOST_MR][HOST_NR];
+	size_t p;
+	natural r, q;
+	for (r = 0; r < HOST_MR; r++) {
+		for (q = 0; q < HOST_NR; q++) {
+			sum[r][q] = 0.0;
+		}
+	}
+	if (mr == HOST_MR && nr == HOST_NR) {
+		for (p = 0; p < k; p++) {
+			const A *ap = a + p * acs;
+			const A *bp = b + p * brs;
+			for (q = 0; q < HOST_NR; q++) {
+				A bq = bp[q * bcs];
+				for (r = 0; r < HOST_MR; r++) {
+					sum[r][q] += ap[r] * bq;
+				}
+			}
+		}
+	} else {
+		for (p = 0; p < k; p++) {
+			const A *ap = a + p * acs;
+			const A *bp = b + p * brs;
+			for (q = 0; q < nr; q++) {
+				A bq = bp[q * bcs];
+				for (r = 0; r < mr; r++) {
+					sum[r][q] += ap[r] * bq;
+				}
+			}
+		}
+	}
+	memcpy(acc, sum, sizeof(sum));
+}
+
+/*
+ * acc[q][c] = sum_p a[c + p * acs] * b[p * brs + q * bcs]
+ * for c < CH, q < nr, p < k. Kernel of the channel count specializations:
+ * whole columns of CH values are accumulated at once, so the inner loops
+ * have a constant length and are fully vectorized.
+ */
+template <int CH, typename A>
+static inline void hostColumnKernel(natural nr, natural k, const A *a, size_t acs, const A *b, size_t brs, size_t bcs, A acc[HOST_NR][CH]) {
+	size_t p;
+	natural c, q;
+	for (q = 0; q < HOST_NR; q++) {
+		for (c = 0; c < CH; c++) {
+			acc[q][c] = 0.0;
+		}
+	}
+	for (p = 0; p < k; p++) {
+		const A *ap = a + p * acs;
+		const A *bp = b + p * brs;
+		for (q = 0; q < nr; q++) {
+			A bq = bp[q * bcs];
+			for (c = 0; c < CH; c++) {
+				acc[q][c] += ap[c] * bq;
+			}
+		}
+	}
+}
+
+static inline float hostTanh(float value) {
+	return tanhf(value);
+}
+
+static inline double hostTanh(double value) {
+	return tanh(value);
+}
+
+/* STEP 1 (forward GEMM + epilogue)
+ * Performs, for nt samples of x (one sample per row):
+ * u = weigths * x;
+ * if (biasing) u += bias;
+ * if (! extended)
+ * 	y = -tanh(u/2);
+ * else
+ * 	y = tanh(u)
+ * if (biasing) bsum += y
+ * if (extended) {
+ * 	if (signs[i]) y[i] = -y[i];
+ * 	y = -(y + u)
+ * }
+ *
+ * The last part folds the sign inversion of step 2 and the -(y + u) of
+ * step 3 into y, so that step 3 is a plain y * u' product.
+ */
+template <typename A>
+static inline void hostActivate(natural extended, natural biasing, A *bias, int *signs, A *bsum, natural c, A value, A *u, A *y) {
+	A yv;
+	if (biasing) {
+		value += bias[c];
+	}
+	if (! extended) {
+		yv = -hostTanh(value/(A)2.0);
+	} else {
+		yv = hostTanh(value);
+	}
+	if (biasing) {
+		bsum[c] += yv;
+	}
+	if (extended) {
+		if (signs[c]) yv = -yv;
+		yv = -(yv + value);
+	}
+	*u = value;
+	*y = yv;
+}
+
+template <int CH, typename A>
+static void hostForward(natural nchannels, natural extended, natural nt, A *weights, A *x, natural biasing, A *bias, int *signs, A *u, A *y, A *bsum) {
+	const natural channels = CH ? CH : nchannels;
+	const int CW = CH ? CH : 1;
+	natural i0, s0, r, q;
+	if (CH) {
+		A acc[HOST_NR][CW];
+		for (s0 = 0; s0 < nt; s0 += HOST_NR) {
+			natural nr = nt - s0 < HOST_NR ? nt - s0 : HOST_NR;
+			hostColumnKernel<CW>(nr, channels, weights, channels, x + (size_t)s0 * channels, 1, channels, acc);
+			for (q = 0; q < nr; q++) {
+				size_t idx = (size_t)(s0 + q) * channels;
+				for (r = 0; r < channels; r++) {
+					hostActivate(extended, biasing, bias, signs, bsum, r, acc[q][r], u + idx + r, y + idx + r);
+				}
+			}
+		}
+		return;
+	}
+	A acc[HOST_MR][HOST_NR];
+	for (i0 = 0; i0 < channels; i0 += HOST_MR) {
+		natural mr = channels - i0 < HOST_MR ? channels - i0 : HOST_MR;
+		for (s0 = 0; s0 < nt; s0 += HOST_NR) {
+			natural nr = nt - s0 < HOST_NR ? nt - s0 : HOST_NR;
+			hostMicroKernel(mr, nr, channels, weights + i0, channels, x + (size_t)s0 * channels, 1, channels, acc);
+			for (r = 0; r < mr; r++) {
+				natural c = i0 + r;
+				for (q = 0; q < nr; q++) {
+					size_t idx = (size_t)(s0 + q) * channels + c;
+					hostActivate(extended, biasing, bias, signs, bsum, c, acc[r][q], u + idx, y + idx);
+				}
+			}
+		}
+	}
+}
+
+/* STEP 3 (outer GEMM)
+ * Performs yu += y * u' for nt samples
+ */
+template <int CH, typename A>
+static void hostOuter(natural nchannels, natural nt, A *y, A *u, A *yu) {
+	const natural channels = CH ? CH : nchannels;
+	const int CW = CH ? CH : 1;
+	natural i0, j0, r, q;
+	if (CH) {
+		A cols[HOST_NR][CW];
+		for (j0 = 0; j0 < channels; j0 += HOST_NR) {
+			natural nr = channels - j0 < HOST_NR ? channels - j0 : HOST_NR;
+			hostColumnKernel<CW>(nr, nt, y, channels, u + j0, channels, 1, cols);
+			for (q = 0; q < nr; q++) {
+				A *yucol = yu + (size_t)(j0 + q) * channels;
+				for (r = 0; r < channels; r++) {
+					yucol[r] += cols[q][r];
+				}
+			}
+		}
+		return;
+	}
+	A acc[HOST_MR][HOST_NR];
+	for (j0 = 0; j0 < channels; j0 += HOST_NR) {
+		natural nr = channels - j0 < HOST_NR ? channels - j0 : HOST_NR;
+		for (i0 = 0; i0 < channels; i0 += HOST_MR) {
+			natural mr = channels - i0 < HOST_MR ? channels - i0 : HOST_MR;
+			hostMicroKernel(mr, nr, nt, y + i0, channels, u + j0, channels, 1, acc);
+			for (q = 0; q < nr; q++) {
+				A *yucol = yu + (size_t)(j0 + q) * channels + i0;
+				for (r = 0; r < mr; r++) {
+					yucol[r] += acc[r][q];
+				}
+			}
+		}
+	}
+}
+
+/* STEPS 1 to 3
+ * Computes, for the block samples t to t + block of data (permuted by
+ * perm when not NULL):
+ *
+ * yu = y * u' + I(BLOCK)				(-y*u' - u*u' + I(BLOCK) if extended)
+ * if (biasing) bias = lrate * bsum + bias		(bsum = -2 * sum(y) if extended)
+ *
+ * Each thread takes a fraction of the block, gathers it HOST_TILE samples
+ * at a time (converting them to A) and runs both GEMMs on the tile while
+ * it is in cache, adding into its own rows of yupart and bsum. These are
+ * then added in thread order, so results only depend on the number of
+ * threads.
+ */
+template <int CH, typename T, typename A>
+static void hostBlock(natural nchannels, natural extended, natural t, natural block, A *weights, T *data, const perm_t *perm, natural biasing, A *bias, int *signs, real lrate, A *xtile, A *utile, A *ytile, A *yupart, A *bsum, A *yu, int nparts) {
+	const natural channels = CH ? CH : nchannels;
+	size_t chxch = (size_t)channels * channels;
+	size_t tile = (size_t)HOST_TILE * channels;
+	int p = 0;
+	int col = 0;
+
+	#pragma omp parallel for
+	for (p = 0; p < nparts; p++) {
+		natural first = (natural)(((size_t)block * p) / nparts);
+		natural end = (natural)(((size_t)block * (p + 1)) / nparts);
+		A *x = xtile + p * tile;
+		A *u = utile + p * tile;
+		A *y = ytile + p * tile;
+		A *yup = yupart + p * chxch;
+		A *bs = biasing ? bsum + (size_t)p * channels : NULL;
+		natural s, c, nt;
+		memset(yup, 0, chxch * sizeof(A));
+		if (bs) memset(bs, 0, channels * sizeof(A));
+		for (; first < end; first += nt) {
+			nt = end - first < HOST_TILE ? end - first : HOST_TILE;
+			A *xs = x;
+			PROFILE_TICK(t0);
+			if (perm) {
+				for (s = 0; s < nt; s++) {
+					T *sample = data + (size_t)permAt(perm, t + first + s) * channels;
+					for (c = 0; c < channels; c++) {
+						x[(size_t)s * channels + c] = sample[c];
+					}
+				}
+			} else if (sizeof(T) == sizeof(A)) {
+				xs = (A*)(data + (size_t)(t + first) * channels);
+			} else {
+				T *sample = data + (size_t)(t + first) * channels;
+				for (s = 0; s < nt * channels; s++) {
+					x[s] = sample[s];
+				}
+			}
+			PROFILE_TICK(t1);
+			hostForward<CH>(channels, extended, nt, weights, xs, biasing, bias, signs, u, y, bs);
+			PROFILE_TICK(t2);
+			hostOuter<CH>(channels, nt, y, u, yup);
+			PROFILE_TICK(t3);
+			PROFILE_ADD(PROFILE_GATHER, t0, t1);
+			PROFILE_ADD(PROFILE_FORWARD, t1, t2);
+			PROFILE_ADD(PROFILE_YU, t2, t3);
+		}
+	}
+
+	PROFILE_TICK(t0);
+	#pragma omp parallel for
+	for (col = 0; col < (int)channels; col++) {
+		A *yucol = yu + (size_t)col * channels;
+		natural c;
+		memcpy(yucol, yupart + (size_t)col * channels, channels * sizeof(A));
+		for (p = 1; p < nparts; p++) {
+			A *partcol = yupart + p * chxch + (size_t)col * channels;
+			for (c = 0; c < channels; c++) {
+				yucol[c] += partcol[c];
+			}
+		}
+		yucol[col] += block;
+	}
+	PROFILE_TICK(t1);
+	PROFILE_ADD(PROFILE_YU, t0, t1);
+
+	if (biasing) {
+		natural c;
+		for (c = 0; c < channels; c++) {
+			A sum = 0.0;
+			for (p = 0; p < nparts; p++) {
+				sum += bsum[(size_t)p * channels + c];
+			}
+			bias[c] += lrate * (extended ? -2*sum : sum);
+		}
+	}
+}
+
+/*
+ * Step 4
+ * Computes:
+ *
+ * weigths = lrate * yu * weights + weights
+ * if (momentum > 0.0) {
+ * 		weights = weights + momentum * prevwtchange
+ * 		prevwtchange = weights - prevweights
+ * 		prevweights = weights
+ * }
+ *
+ * The momentum and the MAX_WEIGHT check are applied to each register tile
+ * of the product as it is stored in tmpweights, which is then copied back
+ * to weights. Each thread computes a fraction of the weights columns.
+ * Returns 1 if any weight is bigger than MAX_WEIGHT.
+ */
+template <typename A>
+static inline int hostUpdate(A product, real lrate, size_t idx, A *weights, A *tmpweights, A *prevweights, A *prevwtchange, real momentum) {
+	A sum = product * (A)lrate + weights[idx];
+	if (momentum > 0.0) {
+		sum += momentum * prevwtchange[idx];
+		prevwtchange[idx] = sum - prevweights[idx];
+		prevweights[idx] = sum;
+	}
+	tmpweights[idx] = sum;
+	return fabs((double)sum) > MAX_WEIGHT;
+}
+
+template <int CH, typename A>
+static natural hostStep4(real lrate, natural nchannels, A *yu, A *weights, A *tmpweights, A *prevweights, A *prevwtchange, real momentum) {
+	const natural channels = CH ? CH : nchannels;
+	const int CW = CH ? CH : 1;
+	int j0 = 0;
+	int blowup = 0;
+	#pragma omp parallel for reduction(|:blowup)
+	for (j0 = 0; j0 < (int)channels; j0 += HOST_NR) {
+		natural nr = channels - j0 < HOST_NR ? channels - j0 : HOST_NR;
+		natural k0, r, q;
+		if (CH) {
+			A cols[HOST_NR][CW];
+			hostColumnKernel<CW>(nr, channels, yu, channels, weights + (size_t)j0 * channels, 1, channels, cols);
+			for (q = 0; q < nr; q++) {
+				for (r = 0; r < channels; r++) {
+					size_t idx = (size_t)(j0 + q) * channels + r;
+					blowup |= hostUpdate(cols[q][r], lrate, idx, weights, tmpweights, prevweights, prevwtchange, momentum);
+				}
+			}
+			continue;
+		}
+		A acc[HOST_MR][HOST_NR];
+		for (k0 = 0; k0 < channels; k0 += HOST_MR) {
+			natural mr = channels - k0 < HOST_MR ? channels - k0 : HOST_MR;
+			hostMicroKernel(mr, nr, channels, yu + k0, channels, weights + (size_t)j0 * channels, 1, channels, acc);
+			for (q = 0; q < nr; q++) {
+				for (r = 0; r < mr; r++) {
+					size_t idx = (size_t)(j0 + q) * channels + k0 + r;
+					blowup |= hostUpdate(acc[r][q], lrate, idx, weights, tmpweights, prevweights, prevwtchange, momentum);
+				}
+			}
+		}
+	}
+	memcpy(weights, tmpweights, channels * channels * sizeof(A));
+	return blowup;
+}
+
+/*
+ * PDF
+ * Computes:
+ * tmp = weigths * sample
+ * kk[i] = (sum(tmp^4) * pdfsize/ sum(tmp^2)^2) -3
+ *
+ * distintos = #(signs != oldsigns)
+ * signs = kk[i] < - signsbias
+ *
+ * Each thread accumulates the sums of a fraction of the pdfsize samples in
+ * its own row of kk (nparts rows of 2 * channels).
+ * Returns distintos.
+ */
+template <int CH, typename T, typename A>
+static natural hostPdf(T *data, natural nchannels, A *weights, const perm_t *pdfperm, natural pdfsize, natural piter, int *signs, real signsbias, A *kk, A *old_kk, real extmomentum, int nparts) {
+	const natural channels = CH ? CH : nchannels;
+	int p = 0;
+	natural c = 0;
+	natural distintos = 0;
+	memset(kk, 0, nparts * 2 * channels * sizeof(A));
+
+	#pragma omp parallel for
+	for (p = 0; p < nparts; p++) {
+		natural s = (natural)(((size_t)pdfsize * p) / nparts);
+		natural end = (natural)(((size_t)pdfsize * (p + 1)) / nparts);
+		A *sum = kk + (size_t)p * 2 * channels;
+		A *sum2 = sum + channels;
+		A *tmp = (A*)malloc(channels * sizeof(A));
+		natural i, k;
+		for (; s < end; s++) {
+			natural swap = s;
+			if (pdfperm) {
+				swap = permAt(pdfperm, piter * pdfsize + s);
+			}
+			T *sample = data + (size_t)swap * channels;
+			for (k = 0; k < channels; k++) {
+				tmp[k] = 0.0;
+			}
+			for (i = 0; i < channels; i++) {
+				A value = sample[i];
+				A *wi = weights + i * channels;
+				for (k = 0; k < channels; k++) {
+					tmp[k] += wi[k] * value;
+				}
+			}
+			for (k = 0; k < channels; k++) {
+				A value = tmp[k] * tmp[k];
+				sum[k] += value;
+				sum2[k] += value * value;
+			}
+		}
+		free(tmp);
+	}
+
+	for (c = 0; c < channels; c++) {
+		A sum = 0.0;
+		A sum2 = 0.0;
+		for (p = 0; p < nparts; p++) {
+			sum += kk[(size_t)p * 2 * channels + c];
+			sum2 += kk[(size_t)p * 2 * channels + channels + c];
+		}
+		sum2 = (sum2 * pdfsize / (sum * sum)) - 3.0;
+		if (extmomentum > 0.0) {
+			sum2 = (1.0 - extmomentum) * sum2 + extmomentum * old_kk[c];
+		}
+		int sign = (sum2 < (-signsbias));
+		if (sign != signs[c]) {
+			distintos++;
+		}
+		signs[c] = sign;
+		old_kk[c] = sum2;
+	}
+	return distintos;
+}
+
+/*
+ * Sum of elem(a)*elem(b) for channels x channels matrices
+ */
+template <typename A>
+static real hostDotProduct(natural channels, A *a, A *b) {
+	size_t i = 0;
+	A sum = 0.0;
+	for (i = 0; i < (size_t)channels * channels; i++) {
+		sum += a[i] * b[i];
+	}
+	return sum;
+}
+
+/*
+ * Initializes bias, signs and old kurtosis like initChannelsVectors
+ */
+template <typename A>
+static void hostInitChannelsVectors(A *bias, natural biasing, int *signs, A *oldkk, natural extended, natural nsub, natural channels) {
+	natural c = 0;
+	for (c = 0; c < channels; c++) {
+		if (biasing) {
+			bias[c] = 0.0;
+		}
+		if (extended) {
+			signs[c] = (c < nsub) ? 1 : 0;
+			oldkk[c] = 0.0;
+		}
+	}
+}
+
+/*
+ * Converts count values of type S into type D in the same buffer. The
+ * chunks go in waves of one per thread: a wave is read into a buffer of
+ * its own before it is written, and the waves run from the start when D
+ * is narrower and from the end when it is wider, so no wave writes over
+ * values a later one still has to read.
+ */
+template <typename D, typename S>
+static void hostConvertInPlace(void *buffer, size_t count) {
+	S *src = (S*)buffer;
+	D *dst = (D*)buffer;
+	int nchunks = (int)((count + HOST_CONVERT_CHUNK - 1) / HOST_CONVERT_CHUNK);
+	int nthreads = 1;
+	int w = 0;
+#ifdef _OPENMP
+	nthreads = omp_get_max_threads();
+#endif
+	if (nchunks == 0) return;
+	if (nthreads > nchunks) nthreads = nchunks;
+	size_t width = count < (size_t)nthreads * HOST_CONVERT_CHUNK ? count : (size_t)nthreads * HOST_CONVERT_CHUNK;
+	D *temp = (D*)poolMalloc(width * sizeof(D));
+	int nwaves = (nchunks + nthreads - 1) / nthreads;
+	for (w = 0; w < nwaves; w++) {
+		int first = (sizeof(D) < sizeof(S) ? w : nwaves - 1 - w) * nthreads;
+		size_t begin = (size_t)first * HOST_CONVERT_CHUNK;
+		size_t end = begin + (size_t)nthreads * HOST_CONVERT_CHUNK < count ? begin + (size_t)nthreads * HOST_CONVERT_CHUNK : count;
+		int c = 0;
+		#pragma omp parallel for num_threads(nthreads)
+		for (c = 0; c < nthreads; c++) {
+			size_t i = begin + (size_t)c * HOST_CONVERT_CHUNK;
+			size_t stop = i + HOST_CONVERT_CHUNK < end ? i + HOST_CONVERT_CHUNK : end;
+			for (; i < stop; i++) {
+				temp[i - begin] = (D)src[i];
+			}
+		}
+		memcpy(dst + begin, temp, (end - begin) * sizeof(D));
+	}
+	poolFree(temp);
+}
+
+/*
+ * Points the sets sharing the host data at data, a heap buffer
+ */
+static void hostShareData(eegdataset_t **sets, int count, void *data) {
+	int k;
+	for (k = 0; k < count; k++) {
+		sets[k]->data = (real*)data;
+		sets[k]->mapping = NULL;
+		sets[k]->mapsize = 0;
+	}
+}
+
+/*
+ * Converts the host data shared by the sets to the storage type T, which
+ * is the same buffer: there is a single copy of the data at a time. When
+ * T is wider than real the buffer grows first, off its file mapping if it
+ * was loaded in place. hostDataToReal() converts it back after the run.
+ */
+template <typename T>
+static error hostDataToT(eegdataset_t **sets, int count, T **data) {
+	eegdataset_t *dataset = sets[0];
+	*data = (T*)dataset->data;
+	if (dataset->data == NULL || sizeof(T) == sizeof(real)) {
+		return SUCCESS;
+	}
+	size_t values = (size_t)dataset->nsamples * dataset->nchannels;
+	if (sizeof(T) > sizeof(real)) {
+		void *grown;
+		if (dataset->mapping != NULL) {
+			grown = malloc(values * sizeof(T));
+			if (grown != NULL) {
+				memcpy(grown, dataset->data, values * sizeof(real));
+				freeData(dataset);
+			}
+		} else {
+			grown = realloc(dataset->data, values * sizeof(T));
+		}
+		if (grown == NULL) {
+			fprintf(stderr, "ERROR: Cannot grow the data to %lu bytes for the configured precision\n", (unsigned long)(values * sizeof(T)));
+			return ERRORNODEVICEMEM;
+		}
+		hostShareData(sets, count, grown);
+	}
+	hostConvertInPlace<T, real>(dataset->data, values);
+	*data = (T*)dataset->data;
+	return SUCCESS;
+}
+
+/*
+ * Converts the host data of the sets back to real for the stages after
+ * Infomax (post processing, activations, Picard)
+ */
+template <typename T>
+static void hostDataToReal(eegdataset_t **sets, int count) {
+	eegdataset_t *dataset = sets[0];
+	if (dataset->data == NULL || sizeof(T) == sizeof(real)) return;
+	size_t values = (size_t)dataset->nsamples * dataset->nchannels;
+	hostConvertInPlace<real, T>(dataset->data, values);
+	if (sizeof(T) > sizeof(real)) {
+		void *shrunk = realloc(dataset->data, values * sizeof(real));
+		if (shrunk != NULL) hostShareData(sets, count, shrunk);
+	}
+}
+
+/*
+ * Copies n reals into a T buffer
+ */
+template <typename T>
+static void hostConvert(real *src, T *dst, size_t n) {
+	size_t i;
+	for (i = 0; i < n; i++) {
+		dst[i] = (T)src[i];
+	}
+}
+
+/*
+ * New real copy of an accumulator vector or matrix, for the results
+ */
+template <typename A>
+static real *hostResult(A *src, size_t n) {
+	real *dst = (real*)malloc(n * sizeof(real));
+	size_t i;
+	for (i = 0; i < n; i++) {
+		dst[i] = (real)src[i];
+	}
+	return dst;
+}
+
+/*
+ * Returns ERRORDIVERGED if the weights blow up at the lowest lrate, the
+ * results are set and freed with the dataset all the same
+ */
+template <int CH, typename T, typename A>
+static error hostInfomaxT(eegdataset_t *dataset, T *data) {
+	/*
+	* Configuration variables
+	*/
+	natural nsub = dataset->config.nsub;
+	natural extended = dataset->config.extended;
+	natural biasing = dataset->config.biasing;
+	natural channels = dataset->nchannels;
+	natural nsamples = dataset->nsamples;
+	natural pdfsize = dataset->config.pdfsize;
+	natural urextblocks = dataset->config.urextblocks;
+	natural extblocks = dataset->config.extblocks;
+	natural block = dataset->config.block;
+	natural verbose = dataset->config.verbose;
+	natural t = 0;
+	real lrate = dataset->config.lrate;
+	real signsbias = dataset->config.signsbias;
+	real annealdeg = dataset->config.annealdeg;
+	real annealstep = dataset->config.annealstep;
+	real nochange = dataset->config.nochange;
+	real momentum = dataset->config.momentum;
+	int maxsteps = dataset->config.maxsteps;
+	int nparts = dataset->config.nthreads;
+	stream_t * stream = dataset->stream;
+	natural prefetch = dataset->config.prefetch;
+	natural chunk = dataset->config.permutation == PERMUTATION_CHUNKS ? dataset->config.chunk : 1;
+
+	if (verbose != 0) {
+		fprintf(stdout, "*********************************\n");
+		fprintf(stdout, "      Infomax configuration      \n");
+		fprintf(stdout, "*********************************\n");
+		fprintf(stdout, "  backend cpu (%d threads)\n", nparts);
+		fprintf(stdout, "  precision %s\n", sizeof(T) == sizeof(A) ? (sizeof(T) == sizeof(double) ? "double" : "single") : "mixed");
+		if (stream != NULL) {
+			fprintf(stdout, "  streaming (memcap %d MB, prefetch %d blocks)\n", dataset->config.memcap, prefetch);
+		}
+		fprintf(stdout, "  channels %d\n", channels);
+		fprintf(stdout, "  samples %d\n", nsamples);
+		fprintf(stdout, "  biasing %d\n", biasing);
+		fprintf(stdout, "  extblocks %d\n", extblocks);
+		fprintf(stdout, "  lrate %.16f\n", lrate);
+		fprintf(stdout, "  block %d\n", block);
+		fprintf(stdout, "  nochange %.16f\n", nochange);
+		fprintf(stdout, "  maxsteps %d\n", maxsteps);
+		fprintf(stdout, "  annealstep %.16f\n", annealstep);
+		fprintf(stdout, "  annealdeg %.16f\n", annealdeg);
+		fprintf(stdout, "  momentum %.16f\n", momentum);
+
+		fprintf(stdout, "  nsub %d\n", nsub);
+		fprintf(stdout, "  pdfsize %d\n", pdfsize);
+		fprintf(stdout, "  urextblocks %d\n", urextblocks);
+		fprintf(stdout, "  signsbias %.16f\n", signsbias);
+		fprintf(stdout, "  extended %d\n", extended);
+		fprintf(stdout, "*********************************\n");
+	}
+
+	DPRINTF(1, "Running with random seed %d\n", dataset->config.seed);
+	r250_state rng;
+	r250_init_r(&rng, dataset->config.seed);
+
+	size_t chxch = channels * channels * sizeof(A);
+	size_t ch = channels * sizeof(A);
+	size_t cht = channels * sizeof(T);
+
+	natural weights_blowup = 0;
+	natural	blockno = 1;
+	natural pleft = nsamples;
+	natural piter = 0;
+	natural signcount = 0;
+	real angledelta = 0.0;
+	real change = 0.0;
+	real oldchange = 0.0;
+	real epsilon = 0.0;
+	real extmomentum = DEFAULT_EXTMOMENTUM;
+
+	perm_t dataperm;
+	perm_t pdfperm;
+	natural * datatable = NULL;
+	natural * pdftable = NULL;
+	natural * streamperm = NULL;
+	A * weights = (A*)poolMalloc(chxch);
+	A * tmpweights = (A*)poolMalloc(chxch);
+	A * oldweights = (A*)poolMalloc(chxch);
+	A * startweights = (A*)poolMalloc(chxch);
+	A * delta = (A*)poolCalloc(channels * channels, sizeof(A));
+	A * olddelta = (A*)poolCalloc(channels * channels, sizeof(A));
+	A * prevweights = NULL;
+	A * prevwtchange = NULL;
+	A * bias = NULL;
+	A * bsum = NULL;
+	int * signs = NULL;
+	A * kk = NULL;
+	A * oldkk = NULL;
+	A * u = NULL;
+	A * y = NULL;
+	A * x = NULL;
+	A * yupart = NULL;
+	A * yu = NULL;
+	real * xgather = NULL;
+	T * xblock = NULL;
+	T * xpdf = NULL;
+
+	/*
+	 * ch x ch matrixes
+	 */
+	if (dataset->h_weights != NULL) {
+		size_t i;
+		for (i = 0; i < (size_t)channels * channels; i++) {
+			weights[i] = (A)dataset->h_weights[i];
+		}
+	} else {
+		natural c;
+		memset(weights, 0, chxch);
+		for (c = 0; c < channels; c++) {
+			weights[c + c * channels] = 1.0;
+		}
+	}
+	memcpy(startweights, weights, chxch);
+	memcpy(oldweights, weights, chxch);
+
+	if (momentum > 0) {
+		prevweights = (A*)poolMalloc(chxch);
+		prevwtchange = (A*)poolCalloc(channels * channels, sizeof(A));
+		memcpy(prevweights, weights, chxch);
+	}
+
+	/*
+	 * 1 x ch vectors
+	 */
+	if (biasing) {
+		bias = (A*)poolMalloc(ch);
+		bsum = (A*)poolMalloc(nparts * ch);
+	}
+	if (extended) {
+		signs = (int*)malloc(channels * sizeof(int));
+
+		if (pdfsize > nsamples) {
+			pdfsize = nsamples;
+		}
+
+		if (dataset->config.permutation == PERMUTATION_SHUFFLE) {
+			pdftable = (natural*)poolMalloc(nsamples * sizeof(natural));
+		}
+		permInit(&pdfperm, nsamples, pdftable, chunk);
+		permNext(&pdfperm, &rng);
+
+		kk = (A*)poolMalloc(nparts * 2 * ch);
+		oldkk = (A*)poolMalloc(ch);
+	}
+	hostInitChannelsVectors(bias, biasing, signs, oldkk, extended, nsub, channels);
+
+	/*
+	 * Permutation of the samples of each step
+	 */
+	if (dataset->config.permutation == PERMUTATION_SHUFFLE) {
+		datatable = (natural*)poolMalloc(nsamples * sizeof(natural));
+	}
+	permInit(&dataperm, nsamples, datatable, chunk);
+
+	/*
+	 * Alloc mem for other structures
+	 */
+	x = (A*)poolMalloc(nparts * HOST_TILE * ch);
+	u = (A*)poolMalloc(nparts * HOST_TILE * ch);
+	y = (A*)poolMalloc(nparts * HOST_TILE * ch);
+	yupart = (A*)poolMalloc(nparts * chxch);
+	yu = (A*)poolMalloc(chxch);
+
+	/*
+	 * Out-of-core data: every block is gathered (centered and sphered) into
+	 * xgather and stored as T before going through the steps.
+	 */
+	if (stream != NULL) {
+		xgather = (real*)poolMalloc((size_t)(extended && pdfsize > block ? pdfsize : block) * channels * sizeof(real));
+		xblock = (T*)poolMalloc(block * cht);
+		if (extended) {
+			xpdf = (T*)poolMalloc(pdfsize * cht);
+		}
+		if (datatable == NULL) {
+			natural count = prefetch * block > pdfsize ? prefetch * block : pdfsize;
+			streamperm = (natural*)poolMalloc((count > block ? count : block) * sizeof(natural));
+		}
+	}
+
+	/*
+	 * Samples first to first + count of perm, for the stream reads
+	 */
+	auto samplesOf = [&](perm_t *perm, natural first, natural count) {
+		if (perm->table) return perm->table + first;
+		permFill(perm, first, count, streamperm);
+		return streamperm;
+	};
+
+	urextblocks = extblocks;
+
+	time_t start, stepstart, stepend, end;
+	time_t dif, hour, min, sec;
+	time (&start);
+
+	int step = 0;
+	natural tstart = 0;
+	int interrupted = 0;
+	error err = SUCCESS;
+
+	/*
+	 * Checkpoints hold everything the steps below read before writing
+	 */
+	checkpoint_t ckpt;
+	checkpointInit(&ckpt, &dataset->config, channels, nsamples, sizeof(A));
+	if (stream != NULL) {
+		checkpointData(&ckpt, stream->base, stream->rowbytes, stream->rowbytes, nsamples, 0);
+	} else {
+		checkpointData(&ckpt, data, channels * sizeof(T), channels * sizeof(T), nsamples, 0);
+	}
+	checkpointArray(&ckpt, weights, chxch);
+	checkpointArray(&ckpt, oldweights, chxch);
+	checkpointArray(&ckpt, startweights, chxch);
+	checkpointArray(&ckpt, delta, chxch);
+	checkpointArray(&ckpt, olddelta, chxch);
+	checkpointArray(&ckpt, prevweights, chxch);
+	checkpointArray(&ckpt, prevwtchange, chxch);
+	checkpointArray(&ckpt, bias, ch);
+	checkpointArray(&ckpt, signs, channels * sizeof(int));
+	checkpointArray(&ckpt, oldkk, ch);
+	checkpointArray(&ckpt, datatable, nsamples * sizeof(natural));
+	checkpointArray(&ckpt, pdftable, nsamples * sizeof(natural));
+	if (datatable == NULL) {
+		checkpointArray(&ckpt, dataperm.keys, sizeof(dataperm.keys));
+		if (extended) checkpointArray(&ckpt, pdfperm.keys, sizeof(pdfperm.keys));
+	}
+	auto checkpoint = [&](natural at) {
+		ckpt.header.step = step;
+		ckpt.header.t = at;
+		ckpt.header.blockno = blockno;
+		ckpt.header.extblocks = extblocks;
+		ckpt.header.signcount = signcount;
+		ckpt.header.pleft = pleft;
+		ckpt.header.piter = piter;
+		ckpt.header.lrate = lrate;
+		ckpt.header.change = change;
+		ckpt.header.oldchange = oldchange;
+		ckpt.header.angledelta = angledelta;
+		ckpt.header.rng = rng;
+		checkpointSave(&ckpt);
+	};
+	if (ckpt.filename != NULL && dataset->config.resume && checkpointLoad(&ckpt) == SUCCESS) {
+		step = (int)ckpt.header.step;
+		tstart = (natural)ckpt.header.t;
+		blockno = (natural)ckpt.header.blockno;
+		extblocks = (natural)ckpt.header.extblocks;
+		signcount = (natural)ckpt.header.signcount;
+		pleft = (natural)ckpt.header.pleft;
+		piter = (natural)ckpt.header.piter;
+		lrate = ckpt.header.lrate;
+		change = ckpt.header.change;
+		oldchange = ckpt.header.oldchange;
+		angledelta = ckpt.header.angledelta;
+		rng = ckpt.header.rng;
+		printf("Resuming from checkpoint %s after step %d\n", ckpt.filename, step);
+	}
+
+	dataset->steps = maxsteps;
+	while (step < maxsteps) {
+		if (tstart == 0) {
+			PROFILE_BEGIN(PROFILE_PERM);
+			permNext(&dataperm, &rng);
+			PROFILE_END(PROFILE_PERM);
+		}
+
+		time(&stepstart);
+
+		for (t = tstart; t < nsamples - block && !weights_blowup; t += block) {
+			if (stream != NULL) {
+				natural first = t == 0 ? block : t + prefetch * block;
+				natural last = t + (prefetch + 1) * block;
+				if (last > nsamples) last = nsamples;
+				if (first < last) {
+					streamPrefetch(stream, samplesOf(&dataperm, first, last - first), last - first);
+				}
+				PROFILE_BEGIN(PROFILE_GATHER);
+				streamGather(stream, samplesOf(&dataperm, t, block), block, xgather);
+				hostConvert(xgather, xblock, (size_t)block * channels);
+				PROFILE_END(PROFILE_GATHER);
+				PROFILE_BEGIN(PROFILE_BLOCK);
+				hostBlock<CH>(channels, extended, 0, block, weights, xblock, NULL, biasing, bias, signs, lrate, x, u, y, yupart, bsum, yu, nparts);
+				PROFILE_END(PROFILE_BLOCK);
+			} else {
+				PROFILE_BEGIN(PROFILE_BLOCK);
+				hostBlock<CH>(channels, extended, t, block, weights, data, &dataperm, biasing, bias, signs, lrate, x, u, y, yupart, bsum, yu, nparts);
+				PROFILE_END(PROFILE_BLOCK);
+			}
+			PROFILE_BEGIN(PROFILE_UPDATE);
+			weights_blowup = hostStep4<CH>(lrate, channels, yu, weights, tmpweights, prevweights, prevwtchange, momentum);
+			PROFILE_END(PROFILE_UPDATE);
+
+			if (extended && ! weights_blowup && extblocks > 0 && blockno%extblocks ==0) {
+				if (pleft < pdfsize) {
+					PROFILE_BEGIN(PROFILE_PERM);
+					permNext(&pdfperm, &rng);
+					PROFILE_END(PROFILE_PERM);
+					piter = 0;
+					pleft = nsamples;
+				}
+				natural distintos;
+				PROFILE_BEGIN(PROFILE_PDF);
+				if (stream != NULL) {
+					streamGather(stream, samplesOf(&pdfperm, piter * pdfsize, pdfsize), pdfsize, xgather);
+					hostConvert(xgather, xpdf, (size_t)pdfsize * channels);
+					distintos = hostPdf<CH>(xpdf, channels, weights, NULL, pdfsize, 0, signs, signsbias, kk, oldkk, extmomentum, nparts);
+				} else {
+					distintos = hostPdf<CH>(data, channels, weights, &pdfperm, pdfsize, piter, signs, signsbias, kk, oldkk, extmomentum, nparts);
+				}
+				PROFILE_END(PROFILE_PDF);
+				if (!distintos) signcount++;
+				else signcount = 0;
+				DPRINTF(3, "Signcount %d - distintos %d\n", signcount, distintos);
+				if (signcount >= SIGNCOUNT_THRESHOLD) {
+					extblocks = (int)(extblocks * SIGNCOUNT_STEP);
+					signcount = 0;
+				}
+				piter++;
+				pleft -= pdfsize;
+			}
+			blockno++;
+			if (ckpt.filename != NULL && !weights_blowup && checkpointInterrupted()) {
+				interrupted = 1;
+				break;
+			}
+		}
+		tstart = 0;
+		if (profileEnabled) profileStep("infomax", step + 1);
+		if (interrupted) {
+			checkpoint(t + block);
+			break;
+		}
+		if (!weights_blowup) {
+			size_t i;
+			step ++;
+			angledelta = 0.0;
+			for (i = 0; i < (size_t)channels * channels; i++) {
+				delta[i] = weights[i] - oldweights[i];
+			}
+			change = hostDotProduct(channels, delta, delta);
+			time(&stepend);
+			dif = difftime(stepend,stepstart);
+
+			if (step > 2) {
+				epsilon = hostDotProduct(channels, delta, olddelta);
+				angledelta = acos(epsilon/sqrt(change*oldchange));
+				if (verbose != 0) {
+					printf("Step %d - lrate %7.9f, wchange %7.9f, angledelta %4.1f deg - time = %llu s\n",step, lrate, change, DEGCONST*angledelta, dif);
+				} else {
+					printf("Step %d.\n", step);
+				}
+			} else {
+				if (verbose != 0) {
+					printf("Step %d - lrate %7.9f, wchange %7.9f - time = %llu s\n", step,lrate, change, dif);
+				} else {
+					printf("Step %d.\n", step);
+				}
+			}
+		} else {
+			printf("Step %d [ BLOWUP! ]\n\n", step + 1);
+
+			step = 0;
+			change = nochange;
+			weights_blowup = 0;
+			blockno = 1;
+			extblocks = urextblocks;
+			lrate = lrate * DEFAULT_RESTART_FAC;
+			memcpy(weights, startweights, chxch);
+			memset(delta, 0, chxch);
+			memset(olddelta, 0, chxch);
+			hostInitChannelsVectors(bias, biasing, signs, oldkk, extended, nsub, channels);
+
+			if (momentum > 0.0) {
+				memcpy(oldweights, startweights, chxch);
+				memcpy(prevweights, startweights, chxch);
+				memset(prevwtchange, 0, chxch);
+			}
+
+			if (lrate > MIN_LRATE) {
+				if (verbose != 0) {
+					printf("Lowering learning rate to %g and starting again.\n",lrate);
+				}
+			} else {
+				printf("QUITTING - weight matrix may not be invertible!\n");
+				err = ERRORDIVERGED;
+				break;
+			}
+		}
+		memcpy(oldweights, weights, chxch);
+
+		if (DEGCONST*angledelta > annealdeg) {
+			memcpy(olddelta, delta, chxch);
+			lrate = lrate*annealstep;
+			oldchange = change;
+		} else {
+			if (step == 1) {
+				memcpy(olddelta, delta, chxch);
+				oldchange = change;
+			}
+		}
+
+		if (step > 2 && change < nochange) {
+			dataset->steps = step;
+			step = maxsteps;
+		} else {
+			if (change > DEFAULT_BLOWUP) {
+				lrate = lrate*DEFAULT_BLOWUP_FAC;
+			}
+		}
+
+		if (ckpt.filename != NULL && step < maxsteps) {
+			interrupted = checkpointInterrupted();
+			if (interrupted || (ckpt.every > 0 && step > 0 && step % ckpt.every == 0)) {
+				checkpoint(0);
+			}
+			if (interrupted) break;
+		}
+	}
+	checkpointWait(&ckpt);
+	if (interrupted) {
+		printf("\nInterrupted in step %d, checkpoint written to %s\n", step + 1, ckpt.filename);
+	}
+
+	time (&end);
+	dif = difftime(end,start);
+	hour = dif/3600;
+	min = dif/60 % 60;
+	sec = dif % 60;
+	printf("\nElapsed Infomax ICA time: %llu h %llu m %llu s\n", hour, min, sec);
+
+	/*
+	 * whiten() leaves the sphere here when sphering is off, the device
+	 * version starts from the identity too.
+	 */
+	if (dataset->weights != NULL) free(dataset->weights);
+	dataset->weights = hostResult(weights, channels * channels);
+	dataset->wpitch = channels * sizeof(real);
+	if (bias) dataset->bias = hostResult(bias, channels);
+	if (signs) dataset->signs = signs;
+	poolFree(weights);
+	if (bias) poolFree(bias);
+	if (datatable) poolFree(datatable);
+	poolFree(tmpweights);
+	poolFree(oldweights);
+	poolFree(startweights);
+	poolFree(delta);
+	poolFree(olddelta);
+	if (prevweights) poolFree(prevweights);
+	if (prevwtchange) poolFree(prevwtchange);
+	if (bsum) poolFree(bsum);
+	if (pdftable) poolFree(pdftable);
+	if (streamperm) poolFree(streamperm);
+	if (kk) poolFree(kk);
+	if (oldkk) poolFree(oldkk);
+	poolFree(x);
+	poolFree(u);
+	poolFree(y);
+	poolFree(yupart);
+	poolFree(yu);
+	if (xgather) poolFree(xgather);
+	if (xblock) poolFree(xblock);
+	if (xpdf) poolFree(xpdf);
+	return err;
+}
+
+/*
+ * Runs the loop instantiated for the channel count, if there is one
+ */
+template <typename T, typename A>
+static error hostInfomaxCH(eegdataset_t *dataset, T *data) {
+	switch (dataset->nchannels) {
+		case 32: return hostInfomaxT<32, T, A>(dataset, data);
+		case 64: return hostInfomaxT<64, T, A>(dataset, data);
+		case 128: return hostInfomaxT<128, T, A>(dataset, data);
+		case 256: return hostInfomaxT<256, T, A>(dataset, data);
+		default: return hostInfomaxT<0, T, A>(dataset, data);
+	}
+}
+
+/*
+ * Runs the loop for count datasets sharing the same data, concurrent of
+ * them at a time. The data is converted to T once, for all of them, and
+ * back to real whether they succeed or not. Returns the error of the first
+ * run that failed.
+ */
+template <typename T, typename A>
+static error hostInfomaxRuns(eegdataset_t **sets, int count, int concurrent) {
+	T *data = NULL;
+	error err = hostDataToT<T>(sets, count, &data);
+	int k = 0;
+	if (err != SUCCESS) return err;
+	if (count == 1) {
+		err = hostInfomaxCH<T, A>(sets[0], data);
+	} else {
+		error *errs = (error*)malloc(count * sizeof(error));
+		#pragma omp parallel for num_threads(concurrent) schedule(dynamic)
+		for (k = 0; k < count; k++) {
+#ifdef _OPENMP
+			omp_set_num_threads(sets[k]->config.nthreads);
+#endif
+			errs[k] = hostInfomaxCH<T, A>(sets[k], data);
+		}
+		for (k = 0; k < count && err == SUCCESS; k++) {
+			err = errs[k];
+		}
+		free(errs);
+	}
+	hostDataToReal<T>(sets, count);
+	return err;
+}
+
+/*
+ * Runs the loops with the types of the configured precision
+ */
+static error hostInfomaxPrecision(eegdataset_t **sets, int count, int concurrent) {
+	switch (sets[0]->config.precision) {
+		case PRECISION_SINGLE:
+			return hostInfomaxRuns<float, float>(sets, count, concurrent);
+		case PRECISION_MIXED:
+			return hostInfomaxRuns<float, double>(sets, count, concurrent);
+		default:
+			return hostInfomaxRuns<double, double>(sets, count, concurrent);
+	}
+}
+
+error hostInfomax(eegdataset_t *dataset) {
+	return hostInfomaxPrecision(&dataset, 1, 1);
+}
+
+/*
+ * Ensemble version: sets are copies of one dataset with their own seed and
+ * results. Out-of-core data must run one at a time (concurrent = 1), the
+ * stream tile cache is not shared safely.
+ */
+error hostInfomaxEnsemble(eegdataset_t **sets, int count, int concurrent) {
+	return hostInfomaxPrecision(sets, count, concurrent);
+}
+
+/*
+ * Sets up the block update for config (block, biasing, extended, threads)
+ * starting from weights, or the identity when weights is NULL
+ */
+void hostBlockInit(hostblock_t *hb, config_t *config, natural channels, real *weights) {
+	size_t ch = channels * sizeof(real);
+	size_t chxch = channels * ch;
+	int nparts = config->nthreads;
+	memset(hb, 0, sizeof(hostblock_t));
+	hb->channels = channels;
+	hb->block = config->block;
+	hb->extended = config->extended;
+	hb->biasing = config->biasing;
+	hb->nsub = config->nsub;
+	hb->nparts = nparts;
+	hb->signsbias = config->signsbias;
+	hb->extmomentum = DEFAULT_EXTMOMENTUM;
+	hb->weights = (real*)poolMalloc(chxch);
+	hb->tmpweights = (real*)poolMalloc(chxch);
+	if (weights != NULL) {
+		memcpy(hb->weights, weights, chxch);
+	} else {
+		hostEye(hb->weights, channels);
+	}
+	if (hb->biasing) {
+		hb->bias = (real*)poolMalloc(ch);
+		hb->bsum = (real*)poolMalloc(nparts * ch);
+	}
+	if (hb->extended) {
+		hb->signs = (integer*)poolMalloc(channels * sizeof(integer));
+		hb->kk = (real*)poolMalloc(nparts * 2 * ch);
+		hb->oldkk = (real*)poolMalloc(ch);
+	}
+	hb->xtile = (real*)poolMalloc(nparts * HOST_TILE * ch);
+	hb->utile = (real*)poolMalloc(nparts * HOST_TILE * ch);
+	hb->ytile = (real*)poolMalloc(nparts * HOST_TILE * ch);
+	hb->yupart = (real*)poolMalloc(nparts * chxch);
+	hb->yu = (real*)poolMalloc(chxch);
+	hostBlockReset(hb);
+}
+
+/*
+ * Back to the initial bias, signs and kurtosis, as after a blowup
+ */
+void hostBlockReset(hostblock_t *hb) {
+	hostInitChannelsVectors(hb->bias, hb->biasing, hb->signs, hb->oldkk, hb->extended, hb->nsub, hb->channels);
+}
+
+template <int CH>
+static natural hostBlockSteps(hostblock_t *hb, real *x, real lrate, int pdf) {
+	hostBlock<CH>(hb->channels, hb->extended, 0, hb->block, hb->weights, x, NULL, hb->biasing, hb->bias, hb->signs, lrate, hb->xtile, hb->utile, hb->ytile, hb->yupart, hb->bsum, hb->yu, hb->nparts);
+	natural blowup = hostStep4<CH>(lrate, hb->channels, hb->yu, hb->weights, hb->tmpweights, (real*)NULL, (real*)NULL, 0.0);
+	if (hb->extended && pdf && !blowup) {
+		hostPdf<CH>(x, hb->channels, hb->weights, NULL, hb->block, 0, hb->signs, hb->signsbias, hb->kk, hb->oldkk, hb->extmomentum, hb->nparts);
+	}
+	return blowup;
+}
+
+/*
+ * Runs steps 1 to 4 on the block samples of x (one sample per row) and,
+ * when pdf is set, updates the signs from the kurtosis of the same block.
+ * Returns 1 if the weights blew up.
+ */
+natural hostBlockUpdate(hostblock_t *hb, real *x, real lrate, int pdf) {
+	switch (hb->channels) {
+		case 32: return hostBlockSteps<32>(hb, x, lrate, pdf);
+		case 64: return hostBlockSteps<64>(hb, x, lrate, pdf);
+		case 128: return hostBlockSteps<128>(hb, x, lrate, pdf);
+		case 256: return hostBlockSteps<256>(hb, x, lrate, pdf);
+	}
+	return hostBlockSteps<0>(hb, x, lrate, pdf);
+}
+
+void hostBlockFree(hostblock_t *hb) {
+	poolFree(hb->weights);
+	poolFree(hb->tmpweights);
+	if (hb->bias != NULL) poolFree(hb->bias);
+	if (hb->bsum != NULL) poolFree(hb->bsum);
+	if (hb->signs != NULL) poolFree(hb->signs);
+	if (hb->kk != NULL) poolFree(hb->kk);
+	if (hb->oldkk != NULL) poolFree(hb->oldkk);
+	poolFree(hb->xtile);
+	poolFree(hb->utile);
+	poolFree(hb->ytile);
+	poolFree(hb->yupart);
+	poolFree(hb->yu);
+}
+
+/*
+ * Blocks per second of steps 1 to 4 with the CH instantiation, on random
+ * data of samples x channels in random order.
+ */
+template <int CH>
+static double hostBenchmarkBlocks(natural channels, natural samples, natural block, real *data, perm_t *perm, int nparts, real seconds) {
+	size_t ch = channels * sizeof(real);
+	size_t chxch = channels * ch;
+	real *weights = (real*)malloc(chxch);
+	real *tmpweights = (real*)malloc(chxch);
+	real *bias = (real*)calloc(channels, sizeof(real));
+	real *bsum = (real*)malloc(nparts * ch);
+	int *signs = (int*)malloc(channels * sizeof(int));
+	real *x = (real*)malloc(nparts * HOST_TILE * ch);
+	real *u = (real*)malloc(nparts * HOST_TILE * ch);
+	real *y = (real*)malloc(nparts * HOST_TILE * ch);
+	real *yupart = (real*)malloc(nparts * chxch);
+	real *yu = (real*)malloc(chxch);
+	natural c, blocks = 0, t = 0;
+
+	hostInitChannelsVectors(bias, 1, signs, (real*)tmpweights, 1, channels / 2, channels);
+	memset(weights, 0, chxch);
+	for (c = 0; c < channels; c++) {
+		weights[c + c * channels] = 1.0;
+	}
+	double start = wallclock();
+	double elapsed = 0.0;
+	while (elapsed < seconds) {
+		/*
+		 * A tiny learning rate keeps the weights from blowing up however
+		 * long it runs
+		 */
+		hostBlock<CH>(channels, 1, t, block, weights, data, perm, 1, bias, signs, 1e-9, x, u, y, yupart, bsum, yu, nparts);
+		hostStep4<CH>(1e-9, channels, yu, weights, tmpweights, (real*)NULL, (real*)NULL, 0.0);
+		t = t + 2 * block < samples ? t + block : 0;
+		blocks++;
+		elapsed = wallclock() - start;
+	}
+
+	free(weights);
+	free(tmpweights);
+	free(bias);
+	free(bsum);
+	free(signs);
+	free(x);
+	free(u);
+	free(y);
+	free(yupart);
+	free(yu);
+	return blocks / elapsed;
+}
+
+/*
+ * Compares each channel count specialization of the host loop with the
+ * generic version and prints the speedups
+ */
+void hostBenchmark(int nparts) {
+	const natural counts[] = {32, 64, 128, 256};
+	natural samples = 1 << 16;
+	natural i;
+	size_t s;
+
+	printf("Host Infomax block update, %d threads, blocks per second\n", nparts);
+	printf("  channels     block       generic   specialized   speedup\n");
+	r250_state rng;
+	r250_init_r(&rng, 1);
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		natural channels = counts[i];
+		natural block = DEFAULT_BLOCK(samples);
+		real *data = (real*)malloc((size_t)samples * channels * sizeof(real));
+		perm_t perm;
+		permInit(&perm, samples, (natural*)malloc(samples * sizeof(natural)), 1);
+		for (s = 0; s < (size_t)samples * channels; s++) {
+			data[s] = (real)r250_r(&rng) / 2147483648.0 - 0.5;
+		}
+		permNext(&perm, &rng);
+
+		double generic = hostBenchmarkBlocks<0>(channels, samples, block, data, &perm, nparts, HOST_BENCHMARK_SECONDS);
+		double specialized = 0.0;
+		switch (channels) {
+			case 32: specialized = hostBenchmarkBlocks<32>(channels, samples, block, data, &perm, nparts, HOST_BENCHMARK_SECONDS); break;
+			case 64: specialized = hostBenchmarkBlocks<64>(channels, samples, block, data, &perm, nparts, HOST_BENCHMARK_SECONDS); break;
+			case 128: specialized = hostBenchmarkBlocks<128>(channels, samples, block, data, &perm, nparts, HOST_BENCHMARK_SECONDS); break;
+			case 256: specialized = hostBenchmarkBlocks<256>(channels, samples, block, data, &perm, nparts, HOST_BENCHMARK_SECONDS); break;
+		}
+		printf("  %8d  %8d  %12.1f  %12.1f  %7.2fx\n", channels, block, generic, specialized, specialized / generic);
+		free(data);
+		free(perm.table);
+	}
+}
+
+/*
+ * Amari index of p (channels x channels): 0 when p is a scaled permutation
+ */
+static double hostAmari(natural channels, real *p) {
+	double sum = 0.0;
+	natural i, j;
+	for (i = 0; i < channels; i++) {
+		double rowmax = 0.0, colmax = 0.0, rowsum = 0.0, colsum = 0.0;
+		for (j = 0; j < channels; j++) {
+			double r = fabs(p[i + j * channels]);
+			double c = fabs(p[j + i * channels]);
+			rowsum += r;
+			colsum += c;
+			if (r > rowmax) rowmax = r;
+			if (c > colmax) colmax = c;
+		}
+		sum += rowsum / rowmax - 1.0 + colsum / colmax - 1.0;
+	}
+	return sum / (2.0 * channels * (channels - 1));
+}
+
+/*
+ * Compares the permutation modes on synthetic data larger than the caches:
+ * HOST_SAMPLING_CHANNELS sources, half Laplacian and half uniform (unit
+ * variance), mixed by a random rotation so the data is already centered
+ * and white. For each mode prints the samples per second of the block
+ * update, and the steps, time and Amari index of an extended Infomax run
+ * with the same seed.
+ */
+#define HOST_SAMPLING_CHANNELS	32
+#define HOST_SAMPLING_SAMPLES	(1 << 19)
+#define HOST_SAMPLING_MODES		5
+
+void hostBenchmarkSampling(int nparts) {
+	const natural modes[HOST_SAMPLING_MODES] = {PERMUTATION_SHUFFLE, PERMUTATION_FEISTEL, PERMUTATION_CHUNKS, PERMUTATION_CHUNKS, PERMUTATION_CHUNKS};
+	const natural chunks[HOST_SAMPLING_MODES] = {1, 1, 16, 64, 256};
+	const char *names[HOST_SAMPLING_MODES] = {"shuffle", "feistel", "chunks", "chunks", "chunks"};
+	natural channels = HOST_SAMPLING_CHANNELS;
+	natural samples = HOST_SAMPLING_SAMPLES;
+	natural block = DEFAULT_BLOCK(samples);
+	double rates[HOST_SAMPLING_MODES], seconds[HOST_SAMPLING_MODES], amari[HOST_SAMPLING_MODES];
+	natural steps[HOST_SAMPLING_MODES];
+	natural i, j, k;
+	size_t s;
+
+	r250_state rng;
+	r250_init_r(&rng, 1);
+	real *mixing = (real*)malloc((size_t)channels * channels * sizeof(real));
+	real *sources = (real*)malloc((size_t)samples * channels * sizeof(real));
+	real *data = (real*)malloc((size_t)samples * channels * sizeof(real));
+	for (s = 0; s < (size_t)samples * channels; s++) {
+		double u = ((r250_r(&rng) & 0x7fffffffU) + 0.5) / 2147483648.0;
+		if (s % channels < channels / 2) {
+			sources[s] = u < 0.5 ? log(2.0 * u) / sqrt(2.0) : -log(2.0 - 2.0 * u) / sqrt(2.0);
+		} else {
+			sources[s] = (u - 0.5) * sqrt(12.0);
+		}
+	}
+	/*
+	 * Gram-Schmidt on a random matrix
+	 */
+	for (j = 0; j < channels; j++) {
+		real *col = mixing + (size_t)j * channels;
+		for (i = 0; i < channels; i++) {
+			col[i] = (r250_r(&rng) & 0x7fffffffU) / 2147483648.0 - 0.5;
+		}
+		for (k = 0; k < j; k++) {
+			real *prev = mixing + (size_t)k * channels;
+			double dot = 0.0;
+			for (i = 0; i < channels; i++) dot += col[i] * prev[i];
+			for (i = 0; i < channels; i++) col[i] -= dot * prev[i];
+		}
+		double norm = 0.0;
+		for (i = 0; i < channels; i++) norm += col[i] * col[i];
+		for (i = 0; i < channels; i++) col[i] /= sqrt(norm);
+	}
+	int n = 0;
+	#pragma omp parallel for
+	for (n = 0; n < (int)samples; n++) {
+		real *src = sources + (size_t)n * channels;
+		real *dst = data + (size_t)n * channels;
+		natural r, c;
+		for (r = 0; r < channels; r++) {
+			double value = 0.0;
+			for (c = 0; c < channels; c++) {
+				value += mixing[r + c * channels] * src[c];
+			}
+			dst[r] = value;
+		}
+	}
+	free(sources);
+
+	for (k = 0; k < HOST_SAMPLING_MODES; k++) {
+		perm_t perm;
+		natural *table = modes[k] == PERMUTATION_SHUFFLE ? (natural*)malloc(samples * sizeof(natural)) : NULL;
+		permInit(&perm, samples, table, chunks[k]);
+		permNext(&perm, &rng);
+		rates[k] = hostBenchmarkBlocks<HOST_SAMPLING_CHANNELS>(channels, samples, block, data, &perm, nparts, HOST_BENCHMARK_SECONDS) * block;
+		if (table) free(table);
+
+		eegdataset_t set;
+		initDefaultConfig(&set);
+		set.nchannels = set.config.nchannels = channels;
+		set.nsamples = set.config.nsamples = samples;
+		set.data = data;
+		set.config.backend = BACKEND_CPU;
+		set.config.extended = 1;
+		set.config.verbose = 0;
+		set.config.seed = 1;
+		set.config.nthreads = nparts;
+		set.config.permutation = modes[k];
+		set.config.chunk = chunks[k];
+		checkDefaultConfig(&set);
+		double start = wallclock();
+		hostInfomax(&set);
+		seconds[k] = wallclock() - start;
+		steps[k] = set.steps;
+
+		real *product = (real*)calloc((size_t)channels * channels, sizeof(real));
+		for (j = 0; j < channels; j++) {
+			for (n = 0; n < (int)channels; n++) {
+				for (i = 0; i < channels; i++) {
+					product[i + j * channels] += set.weights[i + n * channels] * mixing[n + j * channels];
+				}
+			}
+		}
+		amari[k] = hostAmari(channels, product);
+		free(product);
+		free(set.weights);
+		if (set.bias) free(set.bias);
+		if (set.signs) free(set.signs);
+	}
+
+	printf("\nHost Infomax sampling, %d channels, %d samples, block %d, %d threads\n", channels, samples, block, nparts);
+	printf("  permutation   chunk     samples/s   steps   seconds    amari\n");
+	for (k = 0; k < HOST_SAMPLING_MODES; k++) {
+		printf("  %-11s  %6d  %12.0f  %6d  %8.1f  %7.4f\n", names[k], chunks[k], rates[k], steps[k], seconds[k], amari[k]);
+	}
+	free(mixing);
+	free(data);
+}
@@ -37,11 +37,17 @@
  */
 
 #include <infomax.h>
+#include <hostinfomax.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <error.h>
 #include <common.h>
 #include <device.h>
+#include <pool.h>
+#include <checkpoint.h>
+#include <picard.h>
+#include <profile.h>
+#include <permutation.h>
 #include "..\lib\include\r250.h"
 #include <cublas_v2.h>
 #include <cuda_runtime.h>
@@ -50,6 +56,8 @@
 
 
 #define ERASE_STRING "\r"
+#define DEVICE_BENCHMARK_SECONDS	1.0		//Time spent on each benchmark case
+#define DEVICE_BENCHMARK_SYNC		8		//Blocks queued between clock readings
 
 /*
  * Magic:
@@ -65,60 +73,82 @@ __shared__ bool isLastBlockFinished; //If true, then last block has finished.
 //extern "C" {
 __device__ unsigned int weights_blowup;
 //}
-__device__ real sums[MAX_CHANNELS*MAX_CHANNELS];
 
 
 /*************************
  * ICA Initializing steps
  *************************/
 
+ /*
+  * Channels x channels kernels are launched with chxchblocks blocks (one
+  * per column and channel tile) of chxchthreads threads, see infomax().
+  * Each thread handles row threadIdx.x + blockIdx.y * blockDim.x of column
+  * blockIdx.x.
+  *
+  * The kernels are templates on the types of the precision key, as in the
+  * host loop (hostinfomax.cu): T for the data, u and y, A for the weights,
+  * yu, bias, kurtosis and every sum. Shared memory holds T values when it
+  * stages data, u or y and A values otherwise.
+  */
+
  /*
   * Initializes momentum needed variables
-  * Should be launched with channels blocks x channels threads
+  * Should be launched with chxchblocks blocks of chxchthreads threads
   */
- __global__ void initprvweights(real * weights, size_t wpitch, real * prevweights, size_t prevweightspitch, real * prevwtschange, size_t prevwtschangepitch) {
+ template <typename A>
+ __global__ void initprvweights(A * weights, size_t wpitch, A * prevweights, size_t prevweightspitch, A * prevwtschange, size_t prevwtschangepitch, natural channels) {
 
-	size_t wcolwidth = wpitch/sizeof(real);
-	size_t prvwtscolwidth = prevweightspitch/sizeof(real);
-	size_t prvwtschgcolwidth = prevwtschangepitch/sizeof(real);
-	prevweights[threadIdx.x + blockIdx.x * prvwtscolwidth] = weights[threadIdx.x + blockIdx.x * wcolwidth];
-	prevwtschange[threadIdx.x + blockIdx.x * prvwtschgcolwidth ] = 0.0;
+	size_t wcolwidth = wpitch/sizeof(A);
+	size_t prvwtscolwidth = prevweightspitch/sizeof(A);
+	size_t prvwtschgcolwidth = prevwtschangepitch/sizeof(A);
+	natural row = threadIdx.x + blockIdx.y * blockDim.x;
+	if (row >= channels) return;
+	prevweights[row + blockIdx.x * prvwtscolwidth] = weights[row + blockIdx.x * wcolwidth];
+	prevwtschange[row + blockIdx.x * prvwtschgcolwidth ] = 0.0;
 
 }
 
  /*
   * Initializes needed variables
-  * Should be launched with channels blocks x channels threads
+  * Should be launched with chxchblocks blocks of chxchthreads threads
   */
-__global__ void initChxChMatrixes(real * weights, real* startweights, real* oldweights, size_t wpitch, size_t startwpitch, size_t oldwpitch, int initweights) {
-
-	size_t wcolwidth = wpitch/sizeof(real);
-	size_t startwcolwidth = startwpitch/sizeof(real);
-	size_t oldwcolwidth = oldwpitch/sizeof(real);
-	real value = 0;
+template <typename A>
+__global__ void initChxChMatrixes(A * weights, A* startweights, A* oldweights, size_t wpitch, size_t startwpitch, size_t oldwpitch, int initweights, natural channels) {
+
+	size_t wcolwidth = wpitch/sizeof(A);
+	size_t startwcolwidth = startwpitch/sizeof(A);
+	size_t oldwcolwidth = oldwpitch/sizeof(A);
+	natural row = threadIdx.x + blockIdx.y * blockDim.x;
+	A value = 0;
+	if (row >= channels) return;
 	if (initweights) {
-		value = (threadIdx.x == blockIdx.x ? 1.0 : 0.0);
-		weights[threadIdx.x + blockIdx.x * wcolwidth] = value;
+		value = (row == blockIdx.x ? 1.0 : 0.0);
+		weights[row + blockIdx.x * wcolwidth] = value;
 	} else {
-		value = weights[threadIdx.x + blockIdx.x * wcolwidth];
+		value = weights[row + blockIdx.x * wcolwidth];
 	}
-	startweights[threadIdx.x + blockIdx.x * startwcolwidth] = value;
-	oldweights[threadIdx.x + blockIdx.x * oldwcolwidth ] = value;
+	startweights[row + blockIdx.x * startwcolwidth] = value;
+	oldweights[row + blockIdx.x * oldwcolwidth ] = value;
 
 }
 
 /*
  * Initializes all channel's sized vectors.
  *
- * Should be launched with b blocks and t threads where n*t >= channels
+ * Should be launched with 1 block, each thread takes every blockDim.x-th
+ * channel
  */
-__global__ void initChannelsVectors(real * bias, natural biasing, int* signs, real*oldkk, natural extended, natural nsub, natural channels) {
-	if (biasing) {
-		bias[threadIdx.x] = 0.0;
-	}
-	if (extended) {
-		signs[threadIdx.x] = (threadIdx.x < nsub) ? 1 : 0;
-		oldkk[threadIdx.x] = 0.0;
+template <typename A>
+__global__ void initChannelsVectors(A * bias, natural biasing, int* signs, A*oldkk, natural extended, natural nsub, natural channels) {
+	natural c = 0;
+	for (c = threadIdx.x; c < channels; c += blockDim.x) {
+		if (biasing) {
+			bias[c] = 0.0;
+		}
+		if (extended) {
+			signs[c] = (c < nsub) ? 1 : 0;
+			oldkk[c] = 0.0;
+		}
 	}
 }
 
@@ -136,50 +166,88 @@ __global__ void initChannelsVectors(real * bias, natural biasing, int* signs, re
  * 	y = tanh(u)
  *
  *
- * Should be launched with block blocks and channels threads
+ * Should be launched with ceil(count / KERNEL_TILE(CH)) x
+ * CHANNEL_TILES(channels) blocks of chxchthreads threads, and
+ * KERNEL_TILE(CH) x chxchthreads T values of shared memory. Each block takes
+ * KERNEL_TILE(CH) of the count samples from t, loaded one tile of channels
+ * at a time. CH is the channel count of the specializations (see
+ * infomax()), 0 for any other.
  */
 extern __shared__ real sample[];
+template <int CH, typename T, typename A>
 __global__ void step1(
 	natural channels,
 	natural extended,
 	natural t,
-	real *weights,
-	real *data,
-	real *u,
-	real *y,
-	natural * dataperm,
+	natural count,
+	A *weights,
+	T *data,
+	T *u,
+	T *y,
+	perm_t dataperm,
 	natural biasing,
-	real * bias,
+	A * bias,
 	size_t wpi,
 	size_t dpi,
 	size_t upi,
 	size_t ypi
 	) {
 	int i = 0;
-	size_t colwidth = dpi/sizeof(real);
-	size_t wcolwidth = wpi/sizeof(real);
-	size_t ucolwidth = upi/sizeof(real);
-	size_t ycolwidth = ypi/sizeof(real);
-	natural swap = dataperm[t + blockIdx.x];
-	//TODO: This makes	four 32B accesses instead of two 64B access. Why?
-	//real thissample = data[swap * colwidth + threadIdx.x];	//Copy data into local memory.
-	//sample[threadIdx.x] = thissample;
-	sample[threadIdx.x] = data[swap * colwidth + threadIdx.x];
-	__syncthreads();
-
-	real value = 0.0;
-	for (i = 0; i < channels; i++) {
-		value += weights[threadIdx.x + wcolwidth * i] * sample[i];
+	size_t colwidth = dpi/sizeof(T);
+	size_t wcolwidth = wpi/sizeof(A);
+	size_t ucolwidth = upi/sizeof(T);
+	size_t ycolwidth = ypi/sizeof(T);
+	T *tile = (T*)sample;
+	const int R = KERNEL_TILE(CH);
+	natural nch = CH ? CH : channels;
+	natural row = threadIdx.x + blockIdx.y * blockDim.x;
+	natural first = blockIdx.x * R;
+	natural swap[R];
+	A value[R];
+	natural k0 = 0;
+	int r = 0;
+
+	#pragma unroll
+	for (r = 0; r < R; r++) {
+		swap[r] = permAt(&dataperm, t + (first + r < count ? first + r : first));
+		value[r] = 0.0;
 	}
-	if (biasing) {
-		value += bias[threadIdx.x];
+	for (k0 = 0; k0 < nch; k0 += blockDim.x) {
+		natural n = (CH && CH <= CHANNEL_TILE) ? CH : (nch - k0 < blockDim.x ? nch - k0 : blockDim.x);
+		//TODO: This makes	four 32B accesses instead of two 64B access. Why?
+		if (threadIdx.x < n) {
+			#pragma unroll
+			for (r = 0; r < R; r++) {
+				tile[r * blockDim.x + threadIdx.x] = data[swap[r] * colwidth + k0 + threadIdx.x];
+			}
+		}
+		__syncthreads();
+		if (row < nch) {
+			#pragma unroll
+			for (i = 0; i < n; i++) {
+				A w = weights[row + wcolwidth * (k0 + i)];
+				#pragma unroll
+				for (r = 0; r < R; r++) {
+					value[r] += w * tile[r * blockDim.x + i];
+				}
+			}
+		}
+		__syncthreads();
 	}
-
-	u[blockIdx.x * ucolwidth + threadIdx.x] = value;
-	if (! extended) {
-		y[blockIdx.x * ycolwidth + threadIdx.x] = -tanh(value/2.0);
-	} else {
-		y[blockIdx.x * ycolwidth + threadIdx.x] = tanh(value);
+	if (row >= nch) return;
+	#pragma unroll
+	for (r = 0; r < R; r++) {
+		if (first + r >= count) break;
+		A v = value[r];
+		if (biasing) {
+			v += bias[row];
+		}
+		u[(first + r) * ucolwidth + row] = (T)v;
+		if (! extended) {
+			y[(first + r) * ycolwidth + row] = (T)-tanh(v / (A)2.0);
+		} else {
+			y[(first + r) * ycolwidth + row] = (T)tanh(v);
+		}
 	}
 }
 
@@ -191,20 +259,26 @@ __global__ void step1(
  * 	bsum = -2*sum(channels(y))
  *  if (signs[i] != -) -y[i];
  *
- * Should be launched with MAX_MULTIPROCESSORS block of channel threads
+ * Should be launched with MAX_MULTIPROCESSORS x CHANNEL_TILES(channels)
+ * blocks of chxchthreads threads. bpart holds the partial sums of each
+ * block (gridDim.x x channels), the last block to finish adds them up.
  */
 
+template <typename T, typename A>
 __global__ void step2(
 	natural block,
 	natural extended,
 	natural channels,
 	int *signs,
-	real *y,
-	real *bsum,
+	T *y,
+	A *bsum,
 	size_t ypitch,
-	int biasing
+	int biasing,
+	A *bpart
 ) {
-	size_t ycolwidth = ypitch/sizeof(real);
+	size_t ycolwidth = ypitch/sizeof(T);
+	natural c = threadIdx.x + blockIdx.y * blockDim.x;
+	natural nblocks = gridDim.x * gridDim.y;
 	natural count = block / gridDim.x;	//Each block iterates count samples
 	natural start = blockIdx.x * count;	//Each block starts where previous finished;
 	natural end = ((blockIdx.x + 1) * count) -1; //Each block ends one before the next
@@ -212,32 +286,37 @@ __global__ void step2(
 		end = block -1; //If last block, it ends
 	}
 	int i = start;
-	real sum = 0.0f;
+	A sum = 0.0f;
 	natural invert = 0;
-	if (extended) {
-		invert = signs[threadIdx.x];
-	}
-	for (i = start; i <= end; i++) {
-		if (biasing) sum += y[i * ycolwidth + threadIdx.x];
-		if (invert) y[i * ycolwidth + threadIdx.x] = -y[i * ycolwidth + threadIdx.x];
+	if (c < channels) {
+		if (extended) {
+			invert = signs[c];
+		}
+		for (i = start; i <= end; i++) {
+			if (biasing) sum += y[i * ycolwidth + c];
+			if (invert) y[i * ycolwidth + c] = -y[i * ycolwidth + c];
+		}
+		if (biasing) bpart[blockIdx.x * channels + c] = sum;
 	}
-	if (biasing) sums[blockIdx.x * MAX_CHANNELS + threadIdx.x] = sum;
 
 	if (biasing) {
+		__threadfence();
 		if (threadIdx.x == 0) {
-			natural value = atomicInc(&blocksFinished, gridDim.x);
-			isLastBlockFinished = (value == gridDim.x-1);
+			natural value = atomicInc(&blocksFinished, nblocks);
+			isLastBlockFinished = (value == nblocks-1);
 		}
 		__syncthreads();
 		if (isLastBlockFinished) {
-			sum = 0.0f;
-			for (i = 0; i < gridDim.x; i++) {
-				sum += sums[threadIdx.x + i * MAX_CHANNELS];
-			}
-			if (!extended) {
-				bsum[threadIdx.x] = sum;
-			} else {
-				bsum[threadIdx.x] = -2*sum;
+			for (c = threadIdx.x; c < channels; c += blockDim.x) {
+				sum = 0.0f;
+				for (i = 0; i < gridDim.x; i++) {
+					sum += bpart[c + i * channels];
+				}
+				if (!extended) {
+					bsum[c] = sum;
+				} else {
+					bsum[c] = -2*sum;
+				}
 			}
 			if (threadIdx.x == 0) {
 				blocksFinished = 0;
@@ -258,54 +337,59 @@ extern __shared__ real uchannel[];
  * fi
  *  yu =+ I(BLOCK);
  *
- * Should be launched with channels block of channels threads
+ * Should be launched with chxchblocks blocks of chxchthreads threads, and
+ * block T values of shared memory
  */
+template <typename T, typename A>
 __global__ void step3(
 	natural extended,
 	natural channels,
 	natural block,
-	real *u,
-	real *y,
-	real *yu,
+	T *u,
+	T *y,
+	A *yu,
 	size_t upitch,
 	size_t ypitch,
 	size_t yupitch
 	) {
 
 	int i = 0;
-	real sum = 0.0f;
-	size_t ucolwidth = upitch/sizeof(real);
-	size_t ycolwidth = ypitch/sizeof(real);
-	size_t yucolwidth = yupitch/sizeof(real);
+	A sum = 0.0f;
+	size_t ucolwidth = upitch/sizeof(T);
+	size_t ycolwidth = ypitch/sizeof(T);
+	size_t yucolwidth = yupitch/sizeof(A);
+	T *utile = (T*)uchannel;
 	int start = threadIdx.x;
 	int end = block;
+	natural row = threadIdx.x + blockIdx.y * blockDim.x;
 
 	/*
 	 * Copy channel into shared memory
 	 * for 32 bits broadcast access
 	 */
 	for (i = start; i < end; i += blockDim.x) {
-		uchannel[i] = u[blockIdx.x + ucolwidth * i];
+		utile[i] = u[blockIdx.x + ucolwidth * i];
 	}
 	__syncthreads();
+	if (row >= channels) return;
 
 	if (!extended) {
 		for (i = 0; i < block; i++) {
-			sum += uchannel[i] * y[threadIdx.x + ycolwidth *i];
+			sum += (A)utile[i] * y[row + ycolwidth *i];
 		}
-		if (threadIdx.x == blockIdx.x) {
+		if (row == blockIdx.x) {
 			sum += block;
 		}
-		yu[threadIdx.x + yucolwidth * blockIdx.x] = sum; //stores again in column major order
+		yu[row + yucolwidth * blockIdx.x] = sum; //stores again in column major order
 	} else {
 		for (i = 0; i < block; i++) {
-			sum -= (y[threadIdx.x + ycolwidth*i] + u[threadIdx.x + ucolwidth*i]) * uchannel[i];
+			sum -= ((A)y[row + ycolwidth*i] + u[row + ucolwidth*i]) * utile[i];
 		}
 
-		if (threadIdx.x == blockIdx.x) {
+		if (row == blockIdx.x) {
 			sum += block;
 		}
-		yu[threadIdx.x + yucolwidth * blockIdx.x] = sum; //stores again in column major order
+		yu[row + yucolwidth * blockIdx.x] = sum; //stores again in column major order
 	}
 
 
@@ -323,66 +407,107 @@ __global__ void step3(
  * 		prevweights = weights
  * }
  *
- * Should be launched with channel blocks and channel threads
+ * Should be launched with ceil(channels / KERNEL_TILE(CH)) x
+ * CHANNEL_TILES(channels) blocks of chxchthreads threads, and
+ * KERNEL_TILE(CH) x chxchthreads A values of shared memory. Each block updates
+ * KERNEL_TILE(CH) weights columns, loaded one tile at a time. Blocks of
+ * other tiles may still be reading the columns, so the new weights go to
+ * tmpweights (same pitch as weights).
  */
  extern __shared__ real wchannel[];
+ template <int CH, typename A>
  __global__ void step4(
-	real lrate,
+	A lrate,
 	natural channels,
 	natural biasing,
-	real* bsum,
-	real* bias,
-	real* yu,
-	real* weights,
+	A* bsum,
+	A* bias,
+	A* yu,
+	A* weights,
+	A* tmpweights,
 	size_t yupitch,
 	size_t wpitch,
-	real * prevweights,
+	A * prevweights,
 	size_t prevweightspitch,
-	real * prevwtchange,
+	A * prevwtchange,
 	size_t prevwtchangepitch,
-	real v_momentum
+	A v_momentum
  ) {
-	size_t wcolwidth = wpitch/sizeof(real);
-	size_t yucolwidth = yupitch/sizeof(real);
-	size_t pwcolwidth = prevweightspitch/sizeof(real);
-	size_t pwchangecolwidth = prevwtchangepitch/sizeof(real);
-
+	size_t wcolwidth = wpitch/sizeof(A);
+	size_t yucolwidth = yupitch/sizeof(A);
+	size_t pwcolwidth = prevweightspitch/sizeof(A);
+	size_t pwchangecolwidth = prevwtchangepitch/sizeof(A);
+	A *wtile = (A*)wchannel;
+
+	const int R = KERNEL_TILE(CH);
+	natural nch = CH ? CH : channels;
+	natural row = threadIdx.x + blockIdx.y * blockDim.x;
+	natural first = blockIdx.x * R;
+	natural col[R];
+	A sum[R];
+	natural k0 = 0;
 	int i = 0;
+	int r = 0;
 
-   /*
-	* Copy weigths column into shared memory
-	* for 32 bits broadcast access
-	*/
-	wchannel[threadIdx.x] = weights[blockIdx.x * wcolwidth + threadIdx.x];
-	__syncthreads();
-	real sum = 0.0;
-	for (i = 0; i < channels; i++) {
-		sum += yu[threadIdx.x + yucolwidth * i] * wchannel[i];
+	#pragma unroll
+	for (r = 0; r < R; r++) {
+		col[r] = first + r < nch ? first + r : first;
+		sum[r] = 0.0;
 	}
-
-	sum *= lrate;
-	sum += wchannel[threadIdx.x];
-
-	weights[threadIdx.x + blockIdx.x * wcolwidth] = sum;
-
-	if (v_momentum > 0.0) {
-		weights[threadIdx.x + blockIdx.x * wcolwidth] = weights[threadIdx.x + blockIdx.x * wcolwidth] * v_momentum + prevweights[threadIdx.x + blockIdx.x * pwcolwidth];
-		prevwtchange[threadIdx.x + blockIdx.x * pwchangecolwidth] = weights[threadIdx.x + blockIdx.x * wcolwidth] - prevweights[threadIdx.x + blockIdx.x * pwcolwidth];
-		prevweights[threadIdx.x + blockIdx.x * pwcolwidth] = weights[threadIdx.x + blockIdx.x * wcolwidth];
-		sum = weights[threadIdx.x + blockIdx.x * wcolwidth];
+	for (k0 = 0; k0 < nch; k0 += blockDim.x) {
+		natural n = (CH && CH <= CHANNEL_TILE) ? CH : (nch - k0 < blockDim.x ? nch - k0 : blockDim.x);
+	   /*
+		* Copy weigths column tiles into shared memory
+		* for 32 bits broadcast access
+		*/
+		if (threadIdx.x < n) {
+			#pragma unroll
+			for (r = 0; r < R; r++) {
+				wtile[r * blockDim.x + threadIdx.x] = weights[col[r] * wcolwidth + k0 + threadIdx.x];
+			}
+		}
+		__syncthreads();
+		if (row < nch) {
+			#pragma unroll
+			for (i = 0; i < n; i++) {
+				A y = yu[row + yucolwidth * (k0 + i)];
+				#pragma unroll
+				for (r = 0; r < R; r++) {
+					sum[r] += y * wtile[r * blockDim.x + i];
+				}
+			}
+		}
+		__syncthreads();
 	}
+	if (row >= nch) return;
+
+	#pragma unroll
+	for (r = 0; r < R; r++) {
+		if (first + r >= nch) break;
+		size_t c = col[r];
+		A value = sum[r] * lrate;
+		value += weights[row + c * wcolwidth];
+
+		if (v_momentum > 0.0) {
+			value = value * v_momentum + prevweights[row + c * pwcolwidth];
+			prevwtchange[row + c * pwchangecolwidth] = value - prevweights[row + c * pwcolwidth];
+			prevweights[row + c * pwcolwidth] = value;
+		}
 
-	if (absolute(sum) > MAX_WEIGHT) {
-		weights_blowup = 1;
+		tmpweights[row + c * wcolwidth] = value;
+
+		if (absolute(value) > MAX_WEIGHT) {
+			weights_blowup = 1;
+		}
 	}
 
 	/*
-	 * Only block 0 calculates
+	 * Only column 0 calculates
 	 * if (biasing) bias = lrate * bsum + bias
 	 */
 	if (blockIdx.x == 0) {
 		if (biasing) {
-			bias[threadIdx.x] += lrate * bsum[threadIdx.x];
+			bias[row] += lrate * bsum[row];
 		}
 	}
  }
@@ -397,73 +522,113 @@ __global__ void step3(
  * distintos = #(signs != oldsigns)
  * signs = kk[i] < - signsbias
  *
- * Should be launched with pdfsize blocks of channel threads
+ * Should be launched with ceil(pdfsize / KERNEL_TILE(CH)) x
+ * CHANNEL_TILES(channels) blocks of chxchthreads threads, and
+ * KERNEL_TILE(CH) x chxchthreads T values of shared memory, KERNEL_TILE(CH)
+ * samples per block. The last block to finish computes kk for every
+ * channel.
  */
 __device__ unsigned int distintos;
+template <int CH, typename T, typename A>
 __global__ void pdf(
-	real* data,
+	T* data,
 	natural channels,
-	real * weights,
-	natural * pdfperm,
+	A * weights,
+	perm_t pdfperm,
 	natural pdfsize,
 	natural piter,
 	int * signs,
 	//int * oldsigns,
-	real signsbias,
-	real* kk,
+	A signsbias,
+	A* kk,
 	size_t dpitch,
 	size_t wpitch,
 	size_t kkpitch,
-	real * old_kk,
-	real extmomentum
+	A * old_kk,
+	A extmomentum
 ) {
-	real sum = 0.0;
-	real sum2 = 0.0;
+	A sum = 0.0;
+	A sum2 = 0.0;
 	int i = 0;
-	size_t dcolwidth = dpitch / sizeof(real);
-	size_t wcolwidth = wpitch / sizeof(real);
-	size_t kkcolwidth = kkpitch /sizeof(real);
-
-	int swap = blockIdx.x;
-	if (pdfperm) {
-		swap = pdfperm[piter * pdfsize + blockIdx.x];
+	size_t dcolwidth = dpitch / sizeof(T);
+	size_t wcolwidth = wpitch / sizeof(A);
+	size_t kkcolwidth = kkpitch /sizeof(A);
+	T *tile = (T*)sample;
+	const int R = KERNEL_TILE(CH);
+	natural nch = CH ? CH : channels;
+	natural row = threadIdx.x + blockIdx.y * blockDim.x;
+	natural nblocks = gridDim.x * gridDim.y;
+	natural first = blockIdx.x * R;
+	natural swap[R];
+	A value[R];
+	natural k0 = 0;
+	int r = 0;
+
+	#pragma unroll
+	for (r = 0; r < R; r++) {
+		swap[r] = permAt(&pdfperm, piter * pdfsize + (first + r < pdfsize ? first + r : first));
+		value[r] = 0.0;
 	}
-	sample[threadIdx.x] = data[threadIdx.x + swap * dcolwidth];
-	
-	__syncthreads();
-
-	for (i = 0; i < channels; i++) {
-		sum += weights[threadIdx.x + i * wcolwidth] * sample[i];
+	for (k0 = 0; k0 < nch; k0 += blockDim.x) {
+		natural n = (CH && CH <= CHANNEL_TILE) ? CH : (nch - k0 < blockDim.x ? nch - k0 : blockDim.x);
+		if (threadIdx.x < n) {
+			#pragma unroll
+			for (r = 0; r < R; r++) {
+				tile[r * blockDim.x + threadIdx.x] = data[k0 + threadIdx.x + swap[r] * dcolwidth];
+			}
+		}
+		__syncthreads();
+		if (row < nch) {
+			#pragma unroll
+			for (i = 0; i < n; i++) {
+				A w = weights[row + (k0 + i) * wcolwidth];
+				#pragma unroll
+				for (r = 0; r < R; r++) {
+					value[r] += w * tile[r * blockDim.x + i];
+				}
+			}
+		}
+		__syncthreads();
 	}
 
-	sum = sum * sum;
-	kk[blockIdx.x * kkcolwidth + threadIdx.x] = sum;
-	sum = sum * sum;
-	kk[(pdfsize + blockIdx.x) * kkcolwidth + threadIdx.x] = sum;
+	if (row < nch) {
+		#pragma unroll
+		for (r = 0; r < R; r++) {
+			if (first + r >= pdfsize) break;
+			sum = value[r] * value[r];
+			kk[(first + r) * kkcolwidth + row] = sum;
+			sum = sum * sum;
+			kk[(pdfsize + first + r) * kkcolwidth + row] = sum;
+		}
+	}
+	__threadfence();
 	if (threadIdx.x == 0) {
-		natural value = atomicInc(&blocksFinished, gridDim.x);
-		isLastBlockFinished = (value == gridDim.x-1);
+		natural value = atomicInc(&blocksFinished, nblocks);
+		isLastBlockFinished = (value == nblocks-1);
 	}
 	__syncthreads();
 	if (isLastBlockFinished) {
-		sum = 0.0;
-		for (i = 0; i < pdfsize; i++) {
-			sum += kk[threadIdx.x + i * kkcolwidth];
-			sum2 += kk[threadIdx.x + (i + pdfsize) * kkcolwidth];
-		}
-		sum2 = (sum2 * pdfsize / (sum * sum)) - 3.0;
-		if (extmomentum > 0.0) {
-			real okk = old_kk[threadIdx.x];
-			sum2 = (1.0 - extmomentum) * sum2 + extmomentum * okk;
-		}
-		int sign = (sum2 < (-signsbias));
-		if (sign != signs[threadIdx.x]) {
-			atomicInc(&distintos, gridDim.x);
-		}
-		signs[threadIdx.x] = sign;
+		for (row = threadIdx.x; row < nch; row += blockDim.x) {
+			sum = 0.0;
+			sum2 = 0.0;
+			for (i = 0; i < pdfsize; i++) {
+				sum += kk[row + i * kkcolwidth];
+				sum2 += kk[row + (i + pdfsize) * kkcolwidth];
+			}
+			sum2 = (sum2 * pdfsize / (sum * sum)) - (A)3.0;
+			if (extmomentum > 0.0) {
+				A okk = old_kk[row];
+				sum2 = ((A)1.0 - extmomentum) * sum2 + extmomentum * okk;
+			}
+			int sign = (sum2 < (-signsbias));
+			if (sign != signs[row]) {
+				atomicAdd(&distintos, 1);
+			}
+			signs[row] = sign;
 
-		kk[threadIdx.x] = sum2;
-		old_kk[threadIdx.x] = sum2;
+			kk[row] = sum2;
+			old_kk[row] = sum2;
+		}
 		if (threadIdx.x == 0) {
 			blocksFinished = 0;
 		}
@@ -473,50 +638,59 @@ __global__ void pdf(
 /*
  * calcDelta
  * Calculates DELTA from WEIGHTS and OLDWEIGHTS
- * Should be launched with channel blocks of channel threads
+ * Should be launched with chxchblocks blocks of chxchthreads threads
  */
+template <typename A>
 __global__ void calcDelta(
 	natural channels,
-	real * delta,
-	real * weights,
-	real * oldweights,
+	A * delta,
+	A * weights,
+	A * oldweights,
 	size_t deltapitch,
 	size_t wpitch,
 	size_t oldwpitch
 	) {
 
-	size_t dcolwidth = deltapitch / sizeof(real);
-	size_t wcolwidth = wpitch / sizeof(real);
-	size_t oldwcolwidth = oldwpitch /sizeof(real);
-	delta[threadIdx.x + blockIdx.x * dcolwidth] = weights[threadIdx.x + blockIdx.x * wcolwidth] - oldweights[threadIdx.x + blockIdx.x * oldwcolwidth];
+	size_t dcolwidth = deltapitch / sizeof(A);
+	size_t wcolwidth = wpitch / sizeof(A);
+	size_t oldwcolwidth = oldwpitch /sizeof(A);
+	natural row = threadIdx.x + blockIdx.y * blockDim.x;
+	if (row >= channels) return;
+	delta[row + blockIdx.x * dcolwidth] = weights[row + blockIdx.x * wcolwidth] - oldweights[row + blockIdx.x * oldwcolwidth];
 }
 
 /*
  * dotProductSame
  * Calulates sum(elem(matrix)^2);
- * Should be launched with 1 block of channel threads
+ * Should be launched with 1 block of chxchthreads threads, and chxchthreads
+ * A values of shared memory. Each thread adds up every blockDim.x-th row.
  */
 extern __shared__ real matrixsums[];
 __device__ real dotResult;
+template <typename A>
 __global__ void dotProductSame(
 	natural channels,
-	real* matrix,
+	A* matrix,
 	size_t pitch
 	) {
-	size_t colwidth = pitch/sizeof(real);
+	size_t colwidth = pitch/sizeof(A);
+	A *partial = (A*)matrixsums;
 	int i = 0;
-	real sum = 0.0;
-	real elem = 0.0;
-	for (i = 0; i < channels; i++) {
-		elem = matrix[threadIdx.x + i * colwidth];
-		sum += elem * elem;
+	natural row = 0;
+	A sum = 0.0;
+	A elem = 0.0;
+	for (row = threadIdx.x; row < channels; row += blockDim.x) {
+		for (i = 0; i < channels; i++) {
+			elem = matrix[row + i * colwidth];
+			sum += elem * elem;
+		}
 	}
-	matrixsums[threadIdx.x] = sum;
+	partial[threadIdx.x] = sum;
 	__syncthreads();
 	if (threadIdx.x == 0) {
 		sum = 0;
-		for (i = 0; i < channels; i++) {
-			sum += matrixsums[i];
+		for (i = 0; i < blockDim.x; i++) {
+			sum += partial[i];
 		}
 		dotResult = sum;
 	}
@@ -525,70 +699,154 @@ __global__ void dotProductSame(
 /*
  * dotProduct
  * Calulates A * B as vectors;
- * Should be launched with 1 block of channel threads
+ * Should be launched with 1 block of chxchthreads threads, and chxchthreads
+ * A values of shared memory. Each thread adds up every blockDim.x-th row.
  */
+template <typename A>
 __global__ void dotProduct(
 	natural channels,
-	real* matrixa,
-	real * matrixb,
+	A* matrixa,
+	A * matrixb,
 	size_t apitch,
 	size_t bpitch
 	) {
-	size_t acolwidth = apitch/sizeof(real);
-	size_t bcolwidth = bpitch/sizeof(real);
+	size_t acolwidth = apitch/sizeof(A);
+	size_t bcolwidth = bpitch/sizeof(A);
+	A *partial = (A*)matrixsums;
 	int i = 0;
-	real sum = 0.0;
-	for (i = 0; i < channels; i++) {
-		sum += matrixa[threadIdx.x + i * acolwidth] * matrixb[threadIdx.x + i * bcolwidth];
+	natural row = 0;
+	A sum = 0.0;
+	for (row = threadIdx.x; row < channels; row += blockDim.x) {
+		for (i = 0; i < channels; i++) {
+			sum += matrixa[row + i * acolwidth] * matrixb[row + i * bcolwidth];
+		}
 	}
-	matrixsums[threadIdx.x] = sum;
+	partial[threadIdx.x] = sum;
 	__syncthreads();
 	if (threadIdx.x == 0) {
 		sum = 0;
-		for (i = 0; i < channels; i++) {
-			sum += matrixsums[i];
+		for (i = 0; i < blockDim.x; i++) {
+			sum += partial[i];
 		}
 		dotResult = sum;
 	}
 }
 
-void initperm(size_t samples, natural* perm, natural *hostperm) {
-	natural i = 0;
-	for (i = 0; i < samples; i++) {
-		hostperm[i] = i;
+/*
+ * Converts count samples of channels values from S to D in place, each
+ * row keeping its pitch.
+ * Should be launched with up to MAX_CUDA_BLOCKS blocks of
+ * CHANNEL_THREADS(channels) threads, and channels S values of shared
+ * memory. Each block takes every gridDim.x-th sample, read whole before
+ * it is written.
+ */
+template <typename D, typename S>
+__global__ void convertSamples(void *data, size_t pitch, natural channels, natural count) {
+	S *values = (S*)sample;
+	natural s = 0;
+	natural c = 0;
+	for (s = blockIdx.x; s < count; s += gridDim.x) {
+		S *src = (S*)((char*)data + s * pitch);
+		D *dst = (D*)((char*)data + s * pitch);
+		for (c = threadIdx.x; c < channels; c += blockDim.x) {
+			values[c] = src[c];
+		}
+		__syncthreads();
+		for (c = threadIdx.x; c < channels; c += blockDim.x) {
+			dst[c] = (D)values[c];
+		}
+		__syncthreads();
+	}
+}
+
+/*
+ * Copies columns of rows A values into real ones
+ * Should be launched with columns x CHANNEL_TILES(rows) blocks of
+ * CHANNEL_THREADS(rows) threads
+ */
+template <typename A>
+__global__ void toReal(A *src, size_t spitch, real *dst, size_t dpitch, natural rows) {
+	natural row = threadIdx.x + blockIdx.y * blockDim.x;
+	if (row >= rows) return;
+	dst[row + blockIdx.x * (dpitch / sizeof(real))] = (real)src[row + blockIdx.x * (spitch / sizeof(A))];
+}
+
+/*
+ * Converts the device data (samples rows of pitch bytes) from S to D in
+ * place. Does nothing when both have the same size.
+ */
+template <typename D, typename S>
+static void deviceConvertSamples(void *data, size_t pitch, natural channels, natural samples) {
+	if (sizeof(D) == sizeof(S)) return;
+	decltype(&convertSamples<D, S>) convertk = convertSamples<D, S>;
+	natural nblocks = samples > MAX_CUDA_BLOCKS ? MAX_CUDA_BLOCKS : samples;
+	convertk<<<nblocks, CHANNEL_THREADS(channels), channels * sizeof(S)>>>(data, pitch, channels, samples);
+	CHECK_ERROR();
+}
+
+/*
+ * Returns rows x cols A values (column major, spitch bytes per column) as
+ * real ones, with their pitch in dpitch. When A is not real they go to a
+ * new buffer and src is freed.
+ */
+template <typename A>
+static real *deviceToReal(A *src, size_t spitch, natural rows, natural cols, size_t *dpitch) {
+	if (sizeof(A) == sizeof(real)) {
+		*dpitch = spitch;
+		return (real*)src;
 	}
+	real *dst = NULL;
+	HANDLE_ERROR(poolMallocPitch(&dst, dpitch, rows * sizeof(real), cols));
+	toReal<<<dim3(cols, CHANNEL_TILES(rows)), CHANNEL_THREADS(rows)>>>(src, spitch, dst, *dpitch, rows);
+	CHECK_ERROR();
+	poolCudaFree(src);
+	return dst;
+}
+
+/*
+ * Draws the next permutation of perm. Tables are shuffled in hostperm and
+ * copied to the device.
+ */
+void initperm(perm_t *perm, natural *hostperm, r250_state *rng) {
 	DPRINTF(1, "Using permutations\n");
-	natural temp;
-	natural swap;
-	for (i = samples; i > 0; i--) {
-		swap = r250() %i;
-
-		if ((i-1) != swap) {
-			temp = hostperm[swap];
-			hostperm[swap] = hostperm[i-1];
-			hostperm[i-1] = temp;
-		}
+	if (perm->table == NULL) {
+		permNext(perm, rng);
+		return;
 	}
-	HANDLE_ERROR(cudaMemcpy(perm, hostperm, samples*sizeof(natural), cudaMemcpyHostToDevice));
+	permShuffle(perm->samples, hostperm, rng);
+	HANDLE_ERROR(cudaMemcpy(perm->table, hostperm, perm->samples*sizeof(natural), cudaMemcpyHostToDevice));
 }
 
 
-__global__ void addEye(real *y, size_t inc, real value) {
-	if (threadIdx.x == blockIdx.x) {
-		y[threadIdx.x + blockIdx.x * inc] += value;
+__global__ void addEye(real *y, size_t inc, real value, natural channels) {
+	natural row = threadIdx.x + blockIdx.y * blockDim.x;
+	if (row < channels && row == blockIdx.x) {
+		y[row + blockIdx.x * inc] += value;
 	}
 }
 
-__global__ void matScale(real *a, natural arowsize, real *b, natural browsize, real *c, natural crowsize, real scale) {
-	c[threadIdx.x + blockIdx.x * crowsize] = a[threadIdx.x + blockIdx.x * arowsize] + scale * b[threadIdx.x + blockIdx.x * browsize];
+__global__ void matScale(real *a, natural arowsize, real *b, natural browsize, real *c, natural crowsize, real scale, natural channels) {
+	natural row = threadIdx.x + blockIdx.y * blockDim.x;
+	if (row >= channels) return;
+	c[row + blockIdx.x * crowsize] = a[row + blockIdx.x * arowsize] + scale * b[row + blockIdx.x * browsize];
 }
 
-__global__ void getBlowup(real *weights, natural wrowsize) {
-	if (absolute(weights[threadIdx.x + blockIdx.x * wrowsize]) > MAX_WEIGHT) atomicInc(&weights_blowup, threadIdx.x + blockIdx.x * wrowsize);
+__global__ void getBlowup(real *weights, natural wrowsize, natural channels) {
+	natural row = threadIdx.x + blockIdx.y * blockDim.x;
+	if (row >= channels) return;
+	if (absolute(weights[row + blockIdx.x * wrowsize]) > MAX_WEIGHT) atomicInc(&weights_blowup, row + blockIdx.x * wrowsize);
 }
 
 
-void infomax(eegdataset_t *dataset) {
+/*
+ * Device Infomax with the types of the precision key, as the host loop: T
+ * for the data, u and y, A for everything else. The data is converted to T
+ * in place for the run and back after it, the weights and bias are left
+ * in real. Returns ERRORDIVERGED if the weights blow up at the lowest
+ * lrate, after the same cleanup.
+ */
+template <typename T, typename A>
+static error deviceInfomax(eegdataset_t *dataset) {
 	/*
 	* Configuration variables
 	*/
@@ -607,13 +865,14 @@ void infomax(eegdataset_t *dataset) {
 	real signsbias;
 	real annealdeg;
 	real annealstep;
-	real * data;
+	T * data;
 	real nochange;
 	size_t pitch;
 	size_t ypitch;
 	size_t upitch;
 	size_t yupitch;
 	size_t wpitch;
+	size_t tmpwpitch;
 	size_t startwpitch;
 	size_t oldwpitch;
 	size_t kkpitch;
@@ -634,7 +893,7 @@ void infomax(eegdataset_t *dataset) {
 	extblocks = dataset->config.extblocks;
 	block = dataset->config.block;
 	t = 0;
-	data = (real*)dataset->devicePointer;
+	data = (T*)dataset->devicePointer;
 	lrate = dataset->config.lrate;
 	signsbias = dataset->config.signsbias;
 	annealstep = dataset->config.annealstep;
@@ -644,6 +903,7 @@ void infomax(eegdataset_t *dataset) {
 	verbose = dataset->config.verbose;
 	int maxsteps = dataset->config.maxsteps;
 	real momentum = dataset->config.momentum;
+	deviceConvertSamples<T, real>(data, pitch, channels, samples);
 	if (verbose != 0) {
 		fprintf(stdout, "*********************************\n");
 		fprintf(stdout, "      Infomax configuration      \n");
@@ -673,7 +933,8 @@ void infomax(eegdataset_t *dataset) {
 	}
 
 	DPRINTF(1, "Running with random seed %d\n", dataset->config.seed);
-	r250_init(dataset->config.seed);
+	r250_state rng;
+	r250_init_r(&rng, dataset->config.seed);
 
 	/*
 	 * Variables for CUBLAS
@@ -691,9 +952,10 @@ void infomax(eegdataset_t *dataset) {
 	int	zero = 0;
 	natural nchannels = channels;
 	natural nsamples = dataset->nsamples;
-	size_t chxch = nchannels * nchannels * sizeof(real);
-	size_t ch = nchannels * sizeof(real);
+	size_t chxch = nchannels * nchannels * sizeof(A);
+	size_t ch = nchannels * sizeof(A);
 	size_t intsamples = nsamples * sizeof(natural);
+	natural chunk = dataset->config.permutation == PERMUTATION_CHUNKS ? dataset->config.chunk : 1;
 
 	natural h_weights_blowup = 0;
 	natural	blockno = 1;
@@ -705,32 +967,36 @@ void infomax(eegdataset_t *dataset) {
 	real h_oldchange = 0.0f;
 	real epsilon = 0.0f;
 
-	natural chxchblocks = nchannels;
-	natural chxchthreads = nchannels;
+	dim3 chxchblocks(nchannels, CHANNEL_TILES(nchannels));
+	natural chxchthreads = CHANNEL_THREADS(nchannels);
 
 	natural chthreads = getMaxThreads();
 
-	natural * dataperm = NULL;
+	perm_t dataperm;
+	natural * datatable = NULL;
 	natural * h_dataperm = NULL;
-	real * weights = NULL;
-	real * oldweights = NULL;
-	real * startweights = NULL;
-	real * bias = NULL;
-	real * bsum = NULL;
+	A * weights = NULL;
+	A * tmpweights = NULL;
+	A * oldweights = NULL;
+	A * startweights = NULL;
+	A * bias = NULL;
+	A * bsum = NULL;
+	A * bpart = NULL;
 	int * signs = NULL;
-	natural * pdfperm = NULL;
+	perm_t pdfperm;
+	natural * pdftable = NULL;
 	natural * h_pdfperm = NULL;
-	real * kk = NULL;
-	real * oldkk = NULL;
-	real * u = NULL;
-	real * y = NULL;
-	real * yu = NULL;
-	real * delta = NULL;
-	real * olddelta = NULL;
+	A * kk = NULL;
+	A * oldkk = NULL;
+	T * u = NULL;
+	T * y = NULL;
+	A * yu = NULL;
+	A * delta = NULL;
+	A * olddelta = NULL;
 
 	real extmomentum = DEFAULT_EXTMOMENTUM;
-	real * prevweights = NULL;
-	real * prevwtschange = NULL;
+	A * prevweights = NULL;
+	A * prevwtschange = NULL;
 	size_t prevweightspitch = 0;
 	size_t prevwtschangepitch = 0;
 
@@ -738,53 +1004,66 @@ void infomax(eegdataset_t *dataset) {
 	/*
 	 * Permutation vector
 	 */
-	DPRINTF(2, "cudaMalloc %lu bytes for permutation vector (dataperm)\n", intsamples);
-	HANDLE_ERROR(cudaMalloc(&dataperm, intsamples));
-	h_dataperm = (natural*)malloc(intsamples);
+	if (dataset->config.permutation == PERMUTATION_SHUFFLE) {
+		DPRINTF(2, "cudaMalloc %lu bytes for permutation vector (dataperm)\n", intsamples);
+		HANDLE_ERROR(poolCudaMalloc(&datatable, intsamples));
+		h_dataperm = (natural*)malloc(intsamples);
+	}
+	permInit(&dataperm, nsamples, datatable, chunk);
 
 	/*
 	 * ch x ch matrixes
 	 */
 	DPRINTF(2, "cudaMalloc %lu bytes for weights (weights)\n", chxch);
-	HANDLE_ERROR(cudaMallocPitch(&weights, &wpitch, nchannels * sizeof(real), nchannels));
+	HANDLE_ERROR(poolMallocPitch(&weights, &wpitch, nchannels * sizeof(A), nchannels));
 	DPRINTF(2, "Pointer address in device: %p\n", weights);
 
+	DPRINTF(2, "cudaMalloc %lu bytes for new weights (tmpweights)\n", chxch);
+	HANDLE_ERROR(poolMallocPitch(&tmpweights, &tmpwpitch, nchannels * sizeof(A), nchannels));
+	DPRINTF(2, "Pointer address in device: %p\n", tmpweights);
+
 	DPRINTF(2, "cudaMalloc %lu bytes for old weights (oldweights)\n", chxch);
-	HANDLE_ERROR(cudaMallocPitch(&oldweights, &oldwpitch, nchannels * sizeof(real), nchannels));
+	HANDLE_ERROR(poolMallocPitch(&oldweights, &oldwpitch, nchannels * sizeof(A), nchannels));
 	DPRINTF(2, "Pointer address in device: %p\n", oldweights);
 
 	DPRINTF(2, "cudaMalloc %lu bytes for start weights (startweights)\n", chxch);
-	HANDLE_ERROR(cudaMallocPitch(&startweights, &startwpitch, nchannels * sizeof(real), nchannels));
+	HANDLE_ERROR(poolMallocPitch(&startweights, &startwpitch, nchannels * sizeof(A), nchannels));
 	DPRINTF(2, "Pointer address in device: %p\n", startweights);
 
 	DPRINTF(2, "cudaMalloc %lu bytes for delta (delta)\n", chxch);
-	HANDLE_ERROR(cudaMallocPitch(&delta, &deltapitch, nchannels * sizeof(real), nchannels));
+	HANDLE_ERROR(poolMallocPitch(&delta, &deltapitch, nchannels * sizeof(A), nchannels));
 	DPRINTF(2, "Pointer address in device: %p\n", delta);
 
 	DPRINTF(2, "cudaMalloc %lu bytes for old delta (olddelta)\n", chxch);
-	HANDLE_ERROR(cudaMallocPitch(&olddelta, &olddeltapitch, nchannels * sizeof(real), nchannels));
+	HANDLE_ERROR(poolMallocPitch(&olddelta, &olddeltapitch, nchannels * sizeof(A), nchannels));
 	DPRINTF(2, "Pointer address in device: %p\n", olddelta);
 
 	if (momentum > 0) {
 		DPRINTF(2, "cudaMalloc %lu bytes for prevweights (prevweights)\n", chxch);
-		HANDLE_ERROR(cudaMallocPitch(&prevweights, &prevwtschangepitch, nchannels * sizeof(real), nchannels));
+		HANDLE_ERROR(poolMallocPitch(&prevweights, &prevweightspitch, nchannels * sizeof(A), nchannels));
 		DPRINTF(2, "Pointer address in device: %p\n", prevweights);
 
 		DPRINTF(2, "cudaMalloc %lu bytes for prevwtschange (prevwtschange)\n", chxch);
-		HANDLE_ERROR(cudaMallocPitch(&prevwtschange, &prevwtschangepitch, nchannels * sizeof(real), nchannels));
+		HANDLE_ERROR(poolMallocPitch(&prevwtschange, &prevwtschangepitch, nchannels * sizeof(A), nchannels));
 		DPRINTF(2, "Pointer address in device: %p\n", prevwtschange);
 
-		initprvweights<<<chxchblocks, chxchthreads>>>(weights, wpitch, prevweights, prevweightspitch, prevwtschange, prevwtschangepitch);
+		initprvweights<<<chxchblocks, chxchthreads>>>(weights, wpitch, prevweights, prevweightspitch, prevwtschange, prevwtschangepitch, nchannels);
 		CHECK_ERROR();
 	}
 
 	int initweights = 1;
 	if (dataset->h_weights != NULL) {
-		HANDLE_ERROR(cudaMemcpy2D(weights, wpitch, dataset->h_weights, nchannels * sizeof(real),  nchannels * sizeof(real), nchannels, cudaMemcpyHostToDevice));
+		A *h_start = (A*)malloc(chxch);
+		size_t i;
+		for (i = 0; i < (size_t)nchannels * nchannels; i++) {
+			h_start[i] = (A)dataset->h_weights[i];
+		}
+		HANDLE_ERROR(cudaMemcpy2D(weights, wpitch, h_start, ch, ch, nchannels, cudaMemcpyHostToDevice));
+		free(h_start);
 		initweights = 0;
 	}
 
-	initChxChMatrixes<<<chxchblocks, chxchthreads>>>(weights, startweights, oldweights, wpitch,	startwpitch, oldwpitch, initweights);
+	initChxChMatrixes<<<chxchblocks, chxchthreads>>>(weights, startweights, oldweights, wpitch,	startwpitch, oldwpitch, initweights, nchannels);
 
 	CHECK_ERROR();
 
@@ -793,34 +1072,41 @@ void infomax(eegdataset_t *dataset) {
 	 */
 	if (biasing) {
 		DPRINTF(2, "cudaMalloc %lu bytes for bias (bias)\n", ch);
-		HANDLE_ERROR(cudaMalloc(&bias, ch));
+		HANDLE_ERROR(poolCudaMalloc(&bias, ch));
 		DPRINTF(2, "Pointer address in device: %p\n", bias);
 
 		DPRINTF(2, "cudaMalloc %lu bytes for bias sums (bsum)\n", ch);
-		HANDLE_ERROR(cudaMalloc(&bsum,nchannels * sizeof(real)));
+		HANDLE_ERROR(poolCudaMalloc(&bsum,nchannels * sizeof(A)));
 		DPRINTF(2, "Pointer address in device: %p\n", bsum);
+
+		DPRINTF(2, "cudaMalloc %lu bytes for partial bias sums (bpart)\n", MAX_MULTIPROCESSORS * ch);
+		HANDLE_ERROR(poolCudaMalloc(&bpart, MAX_MULTIPROCESSORS * ch));
+		DPRINTF(2, "Pointer address in device: %p\n", bpart);
 	}
 	if (extended) {
 		DPRINTF(2, "cudaMalloc %lu bytes for signs (signs)\n", ch);
-		HANDLE_ERROR(cudaMalloc(&signs, ch));
+		HANDLE_ERROR(poolCudaMalloc(&signs, ch));
 		DPRINTF(2, "Pointer address in device: %p\n", signs);
 
 		if (pdfsize > nsamples) {
 			pdfsize = nsamples;
 		}
 
-		DPRINTF(2, "cudaMalloc %lu bytes for PDF permutation (pdfperm)\n", nsamples * sizeof(natural));
-		HANDLE_ERROR(cudaMalloc(&pdfperm, nsamples * sizeof(natural)));
-		h_pdfperm = (natural*)malloc(nsamples * sizeof(natural));
-		DPRINTF(2, "Pointer address in device: %p\n", pdfperm);
-		initperm(nsamples, (natural*) pdfperm, h_pdfperm);
+		if (dataset->config.permutation == PERMUTATION_SHUFFLE) {
+			DPRINTF(2, "cudaMalloc %lu bytes for PDF permutation (pdfperm)\n", nsamples * sizeof(natural));
+			HANDLE_ERROR(poolCudaMalloc(&pdftable, nsamples * sizeof(natural)));
+			h_pdfperm = (natural*)malloc(nsamples * sizeof(natural));
+			DPRINTF(2, "Pointer address in device: %p\n", pdftable);
+		}
+		permInit(&pdfperm, nsamples, pdftable, chunk);
+		initperm(&pdfperm, h_pdfperm, &rng);
 
-		DPRINTF(2, "cudaMalloc %lu bytes for kurtosis estimation (kk)\n", nchannels * sizeof(real) * 2 * pdfsize);
-		HANDLE_ERROR(cudaMallocPitch(&kk, &kkpitch, nchannels * sizeof(real), 2*pdfsize));
+		DPRINTF(2, "cudaMalloc %lu bytes for kurtosis estimation (kk)\n", nchannels * sizeof(A) * 2 * pdfsize);
+		HANDLE_ERROR(poolMallocPitch(&kk, &kkpitch, nchannels * sizeof(A), 2*pdfsize));
 		DPRINTF(2, "Pointer address in device: %p\n", kk);
 
 		DPRINTF(2, "cudaMalloc %lu bytes for old kurtosis estimation (oldkk)\n", ch);
-		HANDLE_ERROR(cudaMallocPitch(&oldkk, &oldkkpitch, nchannels * sizeof(real), 1));
+		HANDLE_ERROR(poolMallocPitch(&oldkk, &oldkkpitch, nchannels * sizeof(A), 1));
 		DPRINTF(2, "Pointer address in device: %p\n", oldkk);
 	}
 	initChannelsVectors<<<1, chxchthreads>>>(bias, biasing, signs, oldkk, extended, nsub, channels);
@@ -829,16 +1115,16 @@ void infomax(eegdataset_t *dataset) {
 	/*
 	 * Alloc mem for other structures
 	 */
-	DPRINTF(2, "cudaMalloc %lu bytes for auxiliar matrix (u)\n", nchannels * sizeof(real) * block);
-	HANDLE_ERROR(cudaMallocPitch(&u, &upitch, nchannels * sizeof(real), block));
+	DPRINTF(2, "cudaMalloc %lu bytes for auxiliar matrix (u)\n", nchannels * sizeof(T) * block);
+	HANDLE_ERROR(poolMallocPitch(&u, &upitch, nchannels * sizeof(T), block));
 	DPRINTF(2, "Pointer address in device: %p\n", u);
 
-	DPRINTF(2, "cudaMalloc %lu bytes for auxiliar matrix (y)\n", nchannels * sizeof(real) * block);
-	HANDLE_ERROR(cudaMallocPitch(&y, &ypitch, nchannels * sizeof(real), block));
+	DPRINTF(2, "cudaMalloc %lu bytes for auxiliar matrix (y)\n", nchannels * sizeof(T) * block);
+	HANDLE_ERROR(poolMallocPitch(&y, &ypitch, nchannels * sizeof(T), block));
 	DPRINTF(2, "Pointer address in device: %p\n", y);
 
-	DPRINTF(2, "cudaMalloc %lu bytes for auxiliar matrix (yu)\n", nchannels * sizeof(real) * block);
-	HANDLE_ERROR(cudaMallocPitch(&yu, &yupitch, nchannels * sizeof(real), nchannels));
+	DPRINTF(2, "cudaMalloc %lu bytes for auxiliar matrix (yu)\n", nchannels * sizeof(A) * block);
+	HANDLE_ERROR(poolMallocPitch(&yu, &yupitch, nchannels * sizeof(A), nchannels));
 	DPRINTF(2, "Pointer address in device: %p\n", yu);
 
 	urextblocks = extblocks;
@@ -847,35 +1133,120 @@ void infomax(eegdataset_t *dataset) {
 	time_t dif, hour, min, sec;
 	time (&start);
 
+	/*
+	 * Kernels with the channel loops unrolled and the weights reused from
+	 * registers for the common montages
+	 */
+	decltype(&step1<0, T, A>) step1k = step1<0, T, A>;
+	decltype(&step4<0, A>) step4k = step4<0, A>;
+	decltype(&pdf<0, T, A>) pdfk = pdf<0, T, A>;
+	natural ktile = 1;
+	switch (nchannels) {
+		case 32: step1k = step1<32, T, A>; step4k = step4<32, A>; pdfk = pdf<32, T, A>; ktile = KERNEL_TILE(32); break;
+		case 64: step1k = step1<64, T, A>; step4k = step4<64, A>; pdfk = pdf<64, T, A>; ktile = KERNEL_TILE(64); break;
+		case 128: step1k = step1<128, T, A>; step4k = step4<128, A>; pdfk = pdf<128, T, A>; ktile = KERNEL_TILE(128); break;
+		case 256: step1k = step1<256, T, A>; step4k = step4<256, A>; pdfk = pdf<256, T, A>; ktile = KERNEL_TILE(256); break;
+	}
+
 	int step = 0;
 	int numblocks = 0;
 	numblocks = nsamples/block;
+	natural tstart = 0;
+	int interrupted = 0;
+	error err = SUCCESS;
 
+	/*
+	 * Same checkpoint layout as the host loop. The arrays are registered
+	 * again before each use, step 4 swaps the weights buffers.
+	 */
+	checkpoint_t ckpt;
+	checkpointInit(&ckpt, &dataset->config, nchannels, nsamples, sizeof(A));
+	checkpointData(&ckpt, data, pitch, nchannels * sizeof(T), nsamples, 1);
+	auto checkpointArrays = [&]() {
+		ckpt.narrays = 0;
+		checkpointDeviceArray(&ckpt, weights, wpitch, ch, nchannels);
+		checkpointDeviceArray(&ckpt, oldweights, oldwpitch, ch, nchannels);
+		checkpointDeviceArray(&ckpt, startweights, startwpitch, ch, nchannels);
+		checkpointDeviceArray(&ckpt, delta, deltapitch, ch, nchannels);
+		checkpointDeviceArray(&ckpt, olddelta, olddeltapitch, ch, nchannels);
+		checkpointDeviceArray(&ckpt, prevweights, prevweightspitch, ch, nchannels);
+		checkpointDeviceArray(&ckpt, prevwtschange, prevwtschangepitch, ch, nchannels);
+		checkpointDeviceArray(&ckpt, bias, ch, ch, 1);
+		checkpointDeviceArray(&ckpt, signs, nchannels * sizeof(int), nchannels * sizeof(int), 1);
+		checkpointDeviceArray(&ckpt, oldkk, oldkkpitch, ch, 1);
+		checkpointDeviceArray(&ckpt, datatable, intsamples, intsamples, 1);
+		checkpointDeviceArray(&ckpt, pdftable, intsamples, intsamples, 1);
+		if (datatable == NULL) {
+			checkpointArray(&ckpt, dataperm.keys, sizeof(dataperm.keys));
+			if (extended) checkpointArray(&ckpt, pdfperm.keys, sizeof(pdfperm.keys));
+		}
+	};
+	auto checkpoint = [&](natural at) {
+		checkpointArrays();
+		ckpt.header.step = step;
+		ckpt.header.t = at;
+		ckpt.header.blockno = blockno;
+		ckpt.header.extblocks = extblocks;
+		ckpt.header.signcount = signcount;
+		ckpt.header.pleft = pleft;
+		ckpt.header.piter = piter;
+		ckpt.header.lrate = lrate;
+		ckpt.header.change = h_change;
+		ckpt.header.oldchange = h_oldchange;
+		ckpt.header.angledelta = angledelta;
+		ckpt.header.rng = rng;
+		checkpointSave(&ckpt);
+	};
+	checkpointArrays();
+	if (ckpt.filename != NULL && dataset->config.resume && checkpointLoad(&ckpt) == SUCCESS) {
+		step = (int)ckpt.header.step;
+		tstart = (natural)ckpt.header.t;
+		blockno = (natural)ckpt.header.blockno;
+		extblocks = (natural)ckpt.header.extblocks;
+		signcount = (natural)ckpt.header.signcount;
+		pleft = (natural)ckpt.header.pleft;
+		piter = (natural)ckpt.header.piter;
+		lrate = ckpt.header.lrate;
+		h_change = ckpt.header.change;
+		h_oldchange = ckpt.header.oldchange;
+		angledelta = ckpt.header.angledelta;
+		rng = ckpt.header.rng;
+		printf("Resuming from checkpoint %s after step %d\n", ckpt.filename, step);
+	}
+
+	dataset->steps = maxsteps;
 	while (step < maxsteps) {
-		initperm(nsamples, (unsigned int*) dataperm, h_dataperm);
+		if (tstart == 0) {
+			PROFILE_BEGIN(PROFILE_PERM);
+			initperm(&dataperm, h_dataperm, &rng);
+			PROFILE_END(PROFILE_PERM);
+		}
 
 		DPRINTF(3, "Will run for %i blocks\n", numblocks);
 
 		time(&stepstart);
 
-		for (t = 0; t < nsamples - block && !h_weights_blowup; t += block) {
+		for (t = tstart; t < nsamples - block && !h_weights_blowup; t += block) {
 			DPRINTF(3, "Starting step\n", numblocks);
 			DPRINTF(3, "Step 1\n", numblocks);
-			step1<<<block, nchannels, nchannels*sizeof(real)>>>(channels, extended, t, weights, data, u, y, dataperm, biasing, bias, wpitch, pitch, upitch, ypitch);
+			PROFILE_BEGIN(PROFILE_FORWARD);
+			step1k<<<dim3((block + ktile - 1) / ktile, CHANNEL_TILES(nchannels)), chxchthreads, ktile * chxchthreads * sizeof(T)>>>(channels, extended, t, block, weights, data, u, y, dataperm, biasing, bias, wpitch, pitch, upitch, ypitch);
 			CHECK_ERROR();
 			DPRINTF(3, "Step 1 end\n", numblocks);
 			if (extended || biasing) {
 				DPRINTF(3, "Step 2\n");
 				natural n_max_multi = block < MAX_MULTIPROCESSORS ? 1 : MAX_MULTIPROCESSORS;
-				step2<<<n_max_multi, nchannels>>>(block, extended, channels, signs, y, bsum, ypitch, biasing);
+				step2<<<dim3(n_max_multi, CHANNEL_TILES(nchannels)), chxchthreads>>>(block, extended, channels, signs, y, bsum, ypitch, biasing, bpart);
 				CHECK_ERROR();
 				DPRINTF(3, "Step 2 end\n");
 			}
+			PROFILE_DEVICE_END(PROFILE_FORWARD);
 
 
 			// STEP 3 
 			DPRINTF(3, "Step 3\n");
- 			step3<<<nchannels, nchannels, block*sizeof(real)>>>(extended, channels, block, u, y, yu, upitch, ypitch, yupitch);
+			PROFILE_BEGIN(PROFILE_YU);
+ 			step3<<<chxchblocks, chxchthreads, block*sizeof(T)>>>(extended, channels, block, u, y, yu, upitch, ypitch, yupitch);
  			CHECK_ERROR();
 			/*
 			if (! extended) {
@@ -886,15 +1257,21 @@ void infomax(eegdataset_t *dataset) {
 				HANDLE_CUBLAS_ERROR(cublas(geam)(handle, transn, transn, nchannels, block, &alpha, y, ypitch/sizeof(real), &alpha, u, upitch/sizeof(real), y, ypitch/sizeof(real)));
 				HANDLE_CUBLAS_ERROR(cublas(gemm)(handle, transn, transt, nchannels, nchannels, block, &gamma, y, ypitch/sizeof(real), u, upitch/sizeof(real), &beta, yu, yupitch/sizeof(real)));
 			}
-			addEye<<<nchannels, nchannels>>>(yu, yupitch/sizeof(real), block);
+			addEye<<<chxchblocks, chxchthreads>>>(yu, yupitch/sizeof(real), block, nchannels);
 			CHECK_ERROR();
 			*/
+			PROFILE_DEVICE_END(PROFILE_YU);
 			DPRINTF(3, "Step 3 end\n");
 
 			// STEP 4 
 			DPRINTF(3, "Step 4\n", numblocks);
-			step4 <<<nchannels, nchannels, wpitch * sizeof(real) >>> (lrate, nchannels, biasing, bsum, bias, yu, weights, yupitch, wpitch, prevweights, prevweightspitch, prevwtschange, prevwtschangepitch, momentum);
+			PROFILE_BEGIN(PROFILE_UPDATE);
+			step4k<<<dim3((nchannels + ktile - 1) / ktile, CHANNEL_TILES(nchannels)), chxchthreads, ktile * chxchthreads * sizeof(A) >>> (lrate, nchannels, biasing, bsum, bias, yu, weights, tmpweights, yupitch, wpitch, prevweights, prevweightspitch, prevwtschange, prevwtschangepitch, momentum);
 			CHECK_ERROR();
+			PROFILE_DEVICE_END(PROFILE_UPDATE);
+			A *swapweights = weights;
+			weights = tmpweights;
+			tmpweights = swapweights;
 			
 			/*
 			HANDLE_CUBLAS_ERROR(cublas(gemm)(handle, transn, transn, nchannels, nchannels, nchannels, &lrate, yu, yupitch/sizeof(real), weights, wpitch/sizeof(real), &alpha, weights, wpitch/sizeof(real)));
@@ -904,28 +1281,33 @@ void infomax(eegdataset_t *dataset) {
 			// Add momentum 
 			if (momentum > 0.0) {
 				HANDLE_CUBLAS_ERROR(cublas(axpy)(handle, chxch, &momentum,prevwtschange,inc,weights,inc));
-				matScale<<<nchannels, nchannels>>>(weights, wpitch/sizeof(real), prevweights, prevweightspitch/sizeof(real), prevwtschange, prevwtschangepitch/sizeof(real), -1.0);
+				matScale<<<chxchblocks, chxchthreads>>>(weights, wpitch/sizeof(real), prevweights, prevweightspitch/sizeof(real), prevwtschange, prevwtschangepitch/sizeof(real), -1.0, nchannels);
 				CHECK_ERROR();
 
-				HANDLE_ERROR(cudaMemcpy2D(prevweights, prevweightspitch, weights, wpitch, nchannels * sizeof(real), nchannels, cudaMemcpyDeviceToDevice));
+				HANDLE_ERROR(cudaMemcpy2D(prevweights, prevweightspitch, weights, wpitch, nchannels * sizeof(A), nchannels, cudaMemcpyDeviceToDevice));
 			}
-			getBlowup << <nchannels, nchannels >> >(weights, wpitch / sizeof(real));
+			getBlowup<<<chxchblocks, chxchthreads>>>(weights, wpitch / sizeof(real), nchannels);
 			CHECK_ERROR();
 			DPRINTF(3, "Step 4 end\n", numblocks);
 			*/
 
 			//HANDLE_ERROR(cudaMemcpyFromSymbol(&h_weights_blowup, SYMBOL(weights_blowup), sizeof(h_weights_blowup), 0, cudaMemcpyDeviceToHost));
 			//HANDLE_ERROR(cudaMemcpyToSymbol(SYMBOL(weights_blowup), &zero, sizeof(zero), 0, cudaMemcpyHostToDevice));
+			PROFILE_BEGIN(PROFILE_SYNC);
 			HANDLE_ERROR(cudaMemcpyFromSymbol(&h_weights_blowup, weights_blowup, sizeof(h_weights_blowup), 0, cudaMemcpyDeviceToHost));
 			HANDLE_ERROR(cudaMemcpyToSymbol(weights_blowup, &zero, sizeof(zero), 0, cudaMemcpyHostToDevice));
+			PROFILE_END(PROFILE_SYNC);
 
 			if (extended && ! h_weights_blowup && extblocks > 0 && blockno%extblocks ==0) {
 				DPRINTF(3, "PDF\n");
-				if (pdfperm && pleft < pdfsize) {
-					initperm(nsamples, pdfperm, h_pdfperm);
+				if (pleft < pdfsize) {
+					PROFILE_BEGIN(PROFILE_PERM);
+					initperm(&pdfperm, h_pdfperm, &rng);
+					PROFILE_END(PROFILE_PERM);
 					piter = 0;
 					pleft = nsamples;
 				}
+				PROFILE_BEGIN(PROFILE_PDF);
 				int h_distintos = 0;
 				// HANDLE_ERROR(cudaMemcpyToSymbol(SYMBOL(distintos), &h_distintos, sizeof(h_distintos)));
 				HANDLE_ERROR(cudaMemcpyToSymbol(distintos, &h_distintos, sizeof(h_distintos)));
@@ -933,12 +1315,13 @@ void infomax(eegdataset_t *dataset) {
 				/*
 				 * PDF
 				 */
-				DPRINTF(3,"Launching PDF with %d blocks, %d threads, %lu shared mem, data=%p, nchannels=%d, w=%p, pdfperm=%p, pdfsize=%d, piter=%d, signs=%p, signsbias=%f, pitch=%d, wpitch=%d, kkpitch=%d, kk=%p, oldkk=%p, extmomentum=%f\n", pdfsize, nchannels, (nchannels+2)*sizeof(real),data, nchannels, weights, pdfperm, pdfsize, piter, signs, signsbias, pitch, wpitch, kkpitch, kk, oldkk, extmomentum);
-				pdf<<<pdfsize, nchannels, (nchannels+2) * sizeof(real), 0>>>(data, nchannels, weights, pdfperm, pdfsize, piter, signs, signsbias, kk, pitch, wpitch, kkpitch, oldkk, extmomentum);
+				DPRINTF(3,"Launching PDF with %d blocks, %d threads, %lu shared mem, data=%p, nchannels=%d, w=%p, pdfperm=%p, pdfsize=%d, piter=%d, signs=%p, signsbias=%f, pitch=%d, wpitch=%d, kkpitch=%d, kk=%p, oldkk=%p, extmomentum=%f\n", pdfsize, chxchthreads, chxchthreads*sizeof(A),data, nchannels, weights, pdftable, pdfsize, piter, signs, signsbias, pitch, wpitch, kkpitch, kk, oldkk, extmomentum);
+				pdfk<<<dim3((pdfsize + ktile - 1) / ktile, CHANNEL_TILES(nchannels)), chxchthreads, ktile * chxchthreads * sizeof(T), 0>>>(data, nchannels, weights, pdfperm, pdfsize, piter, signs, signsbias, kk, pitch, wpitch, kkpitch, oldkk, extmomentum);
 				CHECK_ERROR();
 				//HANDLE_ERROR(cudaDeviceSynchronize());
 				//HANDLE_ERROR(cudaMemcpyFromSymbol(&h_distintos, SYMBOL(distintos), sizeof(h_distintos)));
 				HANDLE_ERROR(cudaMemcpyFromSymbol(&h_distintos, distintos, sizeof(h_distintos)));
+				PROFILE_END(PROFILE_PDF);
 				DPRINTF(3, "PDF end\n");
 				if (!h_distintos) signcount++;
 				else signcount = 0;
@@ -951,14 +1334,23 @@ void infomax(eegdataset_t *dataset) {
 				pleft -= pdfsize;
 			}
 			blockno++;
-
+			if (ckpt.filename != NULL && !h_weights_blowup && checkpointInterrupted()) {
+				interrupted = 1;
+				break;
+			}
+		}
+		tstart = 0;
+		if (profileEnabled) profileStep("infomax", step + 1);
+		if (interrupted) {
+			checkpoint(t + block);
+			break;
 		}
 		if (!h_weights_blowup) {
 			step ++;
 			angledelta = 0.0;
-			calcDelta<<<nchannels, nchannels, 0, 0>>>(nchannels, delta, weights, oldweights, deltapitch, wpitch, oldwpitch);
+			calcDelta<<<chxchblocks, chxchthreads, 0, 0>>>(nchannels, delta, weights, oldweights, deltapitch, wpitch, oldwpitch);
 			CHECK_ERROR();
-			dotProductSame<<<1, nchannels, nchannels * sizeof(real), 0>>>(nchannels, delta, deltapitch);
+			dotProductSame<<<1, chxchthreads, chxchthreads * sizeof(A), 0>>>(nchannels, delta, deltapitch);
 			CHECK_ERROR();
 			//HANDLE_ERROR(cudaDeviceSynchronize());
 			//HANDLE_ERROR(cudaMemcpyFromSymbol(&h_change, SYMBOL(dotResult), sizeof(h_change)));
@@ -967,7 +1359,7 @@ void infomax(eegdataset_t *dataset) {
 			dif = difftime(stepend,stepstart);
 
 			if (step > 2) {
-				dotProduct<<<1, nchannels, nchannels * sizeof(real), 0>>>(nchannels, delta, olddelta, deltapitch, olddeltapitch);
+				dotProduct<<<1, chxchthreads, chxchthreads * sizeof(A), 0>>>(nchannels, delta, olddelta, deltapitch, olddeltapitch);
 				CHECK_ERROR();
 				//HANDLE_ERROR(cudaDeviceSynchronize());
 				//HANDLE_ERROR(cudaMemcpyFromSymbol(&epsilon, SYMBOL(dotResult), sizeof(epsilon)));
@@ -994,16 +1386,16 @@ void infomax(eegdataset_t *dataset) {
 			blockno = 1;
 			extblocks = urextblocks;
 			lrate = lrate * DEFAULT_RESTART_FAC;
-			HANDLE_ERROR(cudaMemcpy2D(weights, wpitch, startweights, startwpitch, nchannels * sizeof(real), nchannels, cudaMemcpyDeviceToDevice));
-			HANDLE_ERROR(cudaMemset2D(delta, deltapitch, 0, nchannels * sizeof(real), nchannels));
-			HANDLE_ERROR(cudaMemset2D(olddelta, olddeltapitch, 0, nchannels * sizeof(real), nchannels));
+			HANDLE_ERROR(cudaMemcpy2D(weights, wpitch, startweights, startwpitch, nchannels * sizeof(A), nchannels, cudaMemcpyDeviceToDevice));
+			HANDLE_ERROR(cudaMemset2D(delta, deltapitch, 0, nchannels * sizeof(A), nchannels));
+			HANDLE_ERROR(cudaMemset2D(olddelta, olddeltapitch, 0, nchannels * sizeof(A), nchannels));
 			initChannelsVectors<<<1, chxchthreads>>>(bias, biasing, /*oldsigns,*/ signs, oldkk, extended, nsub, channels);
 			CHECK_ERROR();
 
 			if (momentum > 0.0) {
-				HANDLE_ERROR(cudaMemcpy2D(oldweights, oldwpitch, startweights, startwpitch, nchannels * sizeof(real), nchannels, cudaMemcpyDeviceToDevice));
-				HANDLE_ERROR(cudaMemcpy2D(prevweights, prevweightspitch, startweights, startwpitch, nchannels * sizeof(real), nchannels, cudaMemcpyDeviceToDevice));
-				HANDLE_ERROR(cudaMemset2D(prevwtschange, prevwtschangepitch, 0, nchannels * sizeof(real), nchannels));
+				HANDLE_ERROR(cudaMemcpy2D(oldweights, oldwpitch, startweights, startwpitch, nchannels * sizeof(A), nchannels, cudaMemcpyDeviceToDevice));
+				HANDLE_ERROR(cudaMemcpy2D(prevweights, prevweightspitch, startweights, startwpitch, nchannels * sizeof(A), nchannels, cudaMemcpyDeviceToDevice));
+				HANDLE_ERROR(cudaMemset2D(prevwtschange, prevwtschangepitch, 0, nchannels * sizeof(A), nchannels));
 			}
 
 
@@ -1013,29 +1405,43 @@ void infomax(eegdataset_t *dataset) {
 				}
 			} else {
 				printf("QUITTING - weight matrix may not be invertible!\n");
-				exit(1);
+				err = ERRORDIVERGED;
+				break;
 			}
 		}
-		HANDLE_ERROR(cudaMemcpy2D(oldweights, oldwpitch, weights, wpitch, nchannels * sizeof(real), nchannels, cudaMemcpyDeviceToDevice));
+		HANDLE_ERROR(cudaMemcpy2D(oldweights, oldwpitch, weights, wpitch, nchannels * sizeof(A), nchannels, cudaMemcpyDeviceToDevice));
 
 		if (DEGCONST*angledelta > annealdeg) {
-			HANDLE_ERROR(cudaMemcpy2D(olddelta, olddeltapitch, delta, deltapitch, nchannels * sizeof(real), nchannels, cudaMemcpyDeviceToDevice));
+			HANDLE_ERROR(cudaMemcpy2D(olddelta, olddeltapitch, delta, deltapitch, nchannels * sizeof(A), nchannels, cudaMemcpyDeviceToDevice));
 			lrate = lrate*annealstep;
 			h_oldchange = h_change;
 		} else {
 			if (step == 1) {
-				HANDLE_ERROR(cudaMemcpy2D(olddelta, olddeltapitch, delta, deltapitch, nchannels * sizeof(real), nchannels, cudaMemcpyDeviceToDevice));
+				HANDLE_ERROR(cudaMemcpy2D(olddelta, olddeltapitch, delta, deltapitch, nchannels * sizeof(A), nchannels, cudaMemcpyDeviceToDevice));
 				h_oldchange = h_change;
 			}
 		}
 
 		if (step > 2 && h_change < nochange) {
+			dataset->steps = step;
 			step = maxsteps;
 		} else {
 			if (h_change > DEFAULT_BLOWUP) {
 				lrate = lrate*DEFAULT_BLOWUP_FAC;
 			}
 		}
+
+		if (ckpt.filename != NULL && step < maxsteps) {
+			interrupted = checkpointInterrupted();
+			if (interrupted || (ckpt.every > 0 && step > 0 && step % ckpt.every == 0)) {
+				checkpoint(0);
+			}
+			if (interrupted) break;
+		}
+	}
+	checkpointWait(&ckpt);
+	if (interrupted) {
+		printf("\nInterrupted in step %d, checkpoint written to %s\n", step + 1, ckpt.filename);
 	}
 
 	time (&end);
@@ -1045,21 +1451,176 @@ void infomax(eegdataset_t *dataset) {
 	sec = dif % 60;
 	printf("\nElapsed Infomax ICA time: %llu h %llu m %llu s\n", hour, min, sec);
 
-	if (dataperm) HANDLE_ERROR(cudaFree(dataperm));
-	dataset->weights = weights;
-	dataset->wpitch = wpitch;
-	if (bias) dataset->bias = bias;
+	if (datatable) poolCudaFree(datatable);
+	if (tmpweights) poolCudaFree(tmpweights);
+	if (oldweights) poolCudaFree(oldweights);
+	if (startweights) poolCudaFree(startweights);
+	if (bsum) poolCudaFree(bsum);
+	if (bpart) poolCudaFree(bpart);
+	if (pdftable) poolCudaFree(pdftable);
+	if (kk) poolCudaFree(kk);
+	if (oldkk) poolCudaFree(oldkk);
+	if (u) poolCudaFree(u);
+	if (y) poolCudaFree(y);
+	if (yu) poolCudaFree(yu);
+	if (delta) poolCudaFree(delta);
+	if (olddelta) poolCudaFree(olddelta);
+	if (prevweights) poolCudaFree(prevweights);
+	if (prevwtschange) poolCudaFree(prevwtschange);
+	if (h_dataperm) free(h_dataperm);
+	if (h_pdfperm) free(h_pdfperm);
+
+	/*
+	 * The stages after Infomax read the data, weights and bias in real
+	 */
+	deviceConvertSamples<real, T>(data, pitch, channels, samples);
+	dataset->weights = deviceToReal(weights, wpitch, nchannels, nchannels, &dataset->wpitch);
+	if (bias) {
+		size_t bpitch;
+		dataset->bias = deviceToReal(bias, ch, nchannels, 1, &bpitch);
+	}
 	if (signs) dataset->signs = signs;
-	if (oldweights) HANDLE_ERROR(cudaFree(oldweights));
-	if (startweights) HANDLE_ERROR(cudaFree(startweights));
-	if (bsum) HANDLE_ERROR(cudaFree(bsum));
-	if (pdfperm) HANDLE_ERROR(cudaFree(pdfperm));
-	if (kk) HANDLE_ERROR(cudaFree(kk));
-	if (oldkk) HANDLE_ERROR(cudaFree(oldkk));
-	if (u) HANDLE_ERROR(cudaFree(u));
-	if (y) HANDLE_ERROR(cudaFree(y));
-	if (yu) HANDLE_ERROR(cudaFree(yu));
 
 	//HANDLE_CUBLAS_ERROR(cublasDestroy(handle));
+	return err;
+}
+
+/*
+ * Runs the configured solver. Returns SUCCESS, or ERRORDIVERGED if Infomax
+ * gave up: the dataset holds results all the same, it is freed as usual.
+ */
+error infomax(eegdataset_t *dataset) {
+	if (dataset->config.solver == SOLVER_PICARD) {
+		picard(dataset);
+		return SUCCESS;
+	}
+	if (dataset->config.solver == SOLVER_COMPARE) {
+		return picardCompare(dataset);
+	}
+	if (dataset->config.backend == BACKEND_CPU) {
+		return hostInfomax(dataset);
+	}
+	switch (dataset->config.precision) {
+		case PRECISION_SINGLE:
+			return deviceInfomax<float, float>(dataset);
+		case PRECISION_MIXED:
+			return deviceInfomax<float, double>(dataset);
+		default:
+			return deviceInfomax<double, double>(dataset);
+	}
+}
+
+
+/*
+ * Blocks per second of steps 1 to 4 on the device with the CH
+ * instantiation, on data of samples x channels (pitch bytes per sample) in
+ * random order.
+ */
+template <int CH>
+static double deviceBenchmarkBlocks(natural channels, natural samples, natural block, real *data, size_t pitch, perm_t *perm, real seconds) {
+	size_t ch = channels * sizeof(real);
+	natural threads = CHANNEL_THREADS(channels);
+	natural tiles = CHANNEL_TILES(channels);
+	natural ktile = KERNEL_TILE(CH);
+	natural nmulti = block < MAX_MULTIPROCESSORS ? 1 : MAX_MULTIPROCESSORS;
+	real *weights, *tmpweights, *u, *y, *yu, *bias, *bsum, *bpart;
+	int *signs;
+	size_t wpitch, tmpwpitch, upitch, ypitch, yupitch;
+	natural zero = 0;
+
+	HANDLE_ERROR(cudaMallocPitch(&weights, &wpitch, ch, channels));
+	HANDLE_ERROR(cudaMallocPitch(&tmpweights, &tmpwpitch, ch, channels));
+	HANDLE_ERROR(cudaMallocPitch(&u, &upitch, ch, block));
+	HANDLE_ERROR(cudaMallocPitch(&y, &ypitch, ch, block));
+	HANDLE_ERROR(cudaMallocPitch(&yu, &yupitch, ch, channels));
+	HANDLE_ERROR(cudaMalloc(&bias, ch));
+	HANDLE_ERROR(cudaMalloc(&bsum, ch));
+	HANDLE_ERROR(cudaMalloc(&bpart, MAX_MULTIPROCESSORS * ch));
+	HANDLE_ERROR(cudaMalloc(&signs, channels * sizeof(int)));
+	initChxChMatrixes<<<dim3(channels, tiles), threads>>>(weights, tmpweights, tmpweights, wpitch, tmpwpitch, tmpwpitch, 1, channels);
+	CHECK_ERROR();
+	initChannelsVectors<<<1, threads>>>(bias, 1, signs, bsum, 1, channels / 2, channels);
+	CHECK_ERROR();
 
+	decltype(&step1<0, real, real>) step1k = step1<CH, real, real>;
+	decltype(&step4<0, real>) step4k = step4<CH, real>;
+	natural blocks = 0, t = 0;
+	double start = wallclock();
+	double elapsed = 0.0;
+	while (elapsed < seconds) {
+		/*
+		 * A tiny learning rate keeps the weights from blowing up however
+		 * long it runs
+		 */
+		step1k<<<dim3((block + ktile - 1) / ktile, tiles), threads, ktile * threads * sizeof(real)>>>(channels, 1, t, block, weights, data, u, y, *perm, 1, bias, wpitch, pitch, upitch, ypitch);
+		step2<<<dim3(nmulti, tiles), threads>>>(block, 1, channels, signs, y, bsum, ypitch, 1, bpart);
+		step3<<<dim3(channels, tiles), threads, block * sizeof(real)>>>(1, channels, block, u, y, yu, upitch, ypitch, yupitch);
+		step4k<<<dim3((channels + ktile - 1) / ktile, tiles), threads, ktile * threads * sizeof(real)>>>(1e-9, channels, 1, bsum, bias, yu, weights, tmpweights, yupitch, wpitch, NULL, 0, NULL, 0, 0.0);
+		CHECK_ERROR();
+		real *swapweights = weights;
+		weights = tmpweights;
+		tmpweights = swapweights;
+		t = t + 2 * block < samples ? t + block : 0;
+		blocks++;
+		if (blocks % DEVICE_BENCHMARK_SYNC == 0) {
+			HANDLE_ERROR(cudaDeviceSynchronize());
+			elapsed = wallclock() - start;
+		}
+	}
+	HANDLE_ERROR(cudaMemcpyToSymbol(weights_blowup, &zero, sizeof(zero), 0, cudaMemcpyHostToDevice));
+
+	HANDLE_ERROR(cudaFree(weights));
+	HANDLE_ERROR(cudaFree(tmpweights));
+	HANDLE_ERROR(cudaFree(u));
+	HANDLE_ERROR(cudaFree(y));
+	HANDLE_ERROR(cudaFree(yu));
+	HANDLE_ERROR(cudaFree(bias));
+	HANDLE_ERROR(cudaFree(bsum));
+	HANDLE_ERROR(cudaFree(bpart));
+	HANDLE_ERROR(cudaFree(signs));
+	return blocks / elapsed;
+}
+
+/*
+ * Compares each channel count specialization of the device kernels with
+ * the generic ones and prints the speedups. The device must be selected.
+ */
+void deviceBenchmark(void) {
+	const natural counts[] = {32, 64, 128, 256};
+	natural samples = 1 << 16;
+	natural i;
+	size_t s;
+
+	printf("Device Infomax block update, blocks per second\n");
+	printf("  channels     block       generic   specialized   speedup\n");
+	r250_state rng;
+	r250_init_r(&rng, 1);
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		natural channels = counts[i];
+		natural block = DEFAULT_BLOCK(samples);
+		size_t ch = channels * sizeof(real);
+		real *host = (real*)malloc((size_t)samples * ch);
+		for (s = 0; s < (size_t)samples * channels; s++) {
+			host[s] = (real)r250_r(&rng) / 2147483648.0 - 0.5;
+		}
+		real *data = NULL;
+		size_t pitch = 0;
+		HANDLE_ERROR(cudaMallocPitch(&data, &pitch, ch, samples));
+		HANDLE_ERROR(cudaMemcpy2D(data, pitch, host, ch, ch, samples, cudaMemcpyHostToDevice));
+		free(host);
+		perm_t perm;
+		permInit(&perm, samples, NULL, 1);
+		permNext(&perm, &rng);
+
+		double generic = deviceBenchmarkBlocks<0>(channels, samples, block, data, pitch, &perm, DEVICE_BENCHMARK_SECONDS);
+		double specialized = 0.0;
+		switch (channels) {
+			case 32: specialized = deviceBenchmarkBlocks<32>(channels, samples, block, data, pitch, &perm, DEVICE_BENCHMARK_SECONDS); break;
+			case 64: specialized = deviceBenchmarkBlocks<64>(channels, samples, block, data, pitch, &perm, DEVICE_BENCHMARK_SECONDS); break;
+			case 128: specialized = deviceBenchmarkBlocks<128>(channels, samples, block, data, pitch, &perm, DEVICE_BENCHMARK_SECONDS); break;
+			case 256: specialized = deviceBenchmarkBlocks<256>(channels, samples, block, data, pitch, &perm, DEVICE_BENCHMARK_SECONDS); break;
+		}
+		printf("  %8d  %8d  %12.1f  %12.1f  %7.2fx\n", channels, block, generic, specialized, specialized / generic);
+		HANDLE_ERROR(cudaFree(data));
+	}
 }
@@ -28,9 +28,10 @@
  */
 
 #include <loader.h>
+#include <container.h>
+#include <stream.h>
 #include <string.h>
 #include <stdlib.h>
-#include <mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -39,19 +40,39 @@
 #include <preprocess.h>
 #include <common.h>
 #include <device.h>
-#include <io.h>
+#include <pool.h>
 #include <errno.h>
+#include <time.h>
 #include <cuda_runtime.h>
+#ifdef _WIN32
+#include <mman.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#define _stat64 stat
+#define _fstat64 fstat
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define LOAD_CHUNK 1048576		//Elements converted per work item
 
 /*
- * Loads data from file into host memory
+ * Loads the payload described by desc from file into host memory
  * 
  * src: data file
- * rows: number of rows
- * cols: number of cols
+ * desc: payload description (type, byte order, offset and shape)
  * dst: return variable with the data on memory
+ * mapping: if not NULL and the payload holds values of type real in native
+ *          byte order, the mapped pages are handed back in *dst and the
+ *          mapping is returned here (posix only, the mapping is private so
+ *          the data can be modified in place). Otherwise *mapping is NULL.
+ * mapsize: size of the returned mapping
  */
-error dataload(char* src, natural rows, natural cols, real** dst) {
+static error mapload(char* src, container_t* desc, real** dst, void** mapping, size_t* mapsize) {
+	if (mapping != NULL) *mapping = NULL;
 	int fd = open(src, O_RDONLY);
 	if (fd == -1) {
 		fprintf(stderr, "Error opening data file (%d) %s - %s\n", errno, strerror(errno), src);
@@ -60,22 +81,84 @@ error dataload(char* src, natural rows, natural cols, real** dst) {
 	struct _stat64 sb;
 	if (_fstat64(fd, &sb) == -1) {
 		fprintf(stderr, "Error stating data file %s\n", src);
+		close(fd);
 		return ERRORNOFILE;
 	}
-	void *mmaping = mmap(0, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	size_t elements = (size_t)(desc->channels * desc->frames * desc->epochs);
+	size_t payload = elements * dtypeSize(desc->dtype);
+	size_t size = sizeof(real) * elements;
+	if ((size_t)sb.st_size < desc->offset + payload) {
+		fprintf(stderr, "Data file %s has %lu bytes, %lu needed for %llu x %llu\n", src, (size_t)sb.st_size, (size_t)desc->offset + payload,
+				(unsigned long long)(desc->frames * desc->epochs), (unsigned long long)desc->channels);
+		close(fd);
+		return ERRORINVALIDPARAM;
+	}
 	size_t map_size = sb.st_size;
-	// float *matriz = (float*)mmaping;
-	double *matriz = (double*)mmaping;  // Read double-precision data
-	if (matriz == MAP_FAILED) {
+	int swap = containerSwapped(desc);
+
+#ifndef _WIN32
+	/*
+	 * When the payload is already an array of real the mapped pages can be
+	 * used as they are.
+	 */
+	if (mapping != NULL && desc->dtype == DTYPE_REAL && !swap && desc->offset % sizeof(real) == 0) {
+		void *mmaping = mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (mmaping != MAP_FAILED) {
+			madvise(mmaping, map_size, MADV_WILLNEED);
+			close(fd);
+			if ((desc->flags & CONTAINER_FLAG_CHECKSUM) && containerChecksum((char*)mmaping + desc->offset, payload) != desc->checksum) {
+				fprintf(stderr, "Checksum mismatch in data file %s\n", src);
+				munmap(mmaping, map_size);
+				return ERRORINVALIDCONFIG;
+			}
+			*dst = (real*)((char*)mmaping + desc->offset);
+			*mapping = mmaping;
+			*mapsize = map_size;
+			DPRINTF(1, "Data file %s mapped in place at %p\n", src, mmaping);
+			return SUCCESS;
+		}
+		DPRINTF(1, "Error mapping data file %s in place, copying it\n", src);
+	}
+#endif
+
+	void *mmaping = mmap(0, map_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mmaping == MAP_FAILED) {
 		fprintf(stderr, "Error mapping data file %s\n", src);
+		close(fd);
 		return ERRORNOFILE;
 	}
+#ifndef _WIN32
+	posix_fadvise(fd, 0, map_size, POSIX_FADV_SEQUENTIAL);
+	madvise(mmaping, map_size, MADV_SEQUENTIAL);	// Advice values, not flags: one call each
+	madvise(mmaping, map_size, MADV_WILLNEED);
+#endif
+	const char *matriz = (const char*)mmaping + desc->offset;
 	DPRINTF(2, "Matrix mapped at %p\n", matriz);
-	DPRINTF(2, "dataload from %p (%d x %d) to dataset\n", matriz, rows, cols);
-	size_t size = sizeof(real) * rows * cols;
+	DPRINTF(2, "dataload from %p (%lu elements of type %u) to dataset\n", matriz, elements, desc->dtype);
+	if ((desc->flags & CONTAINER_FLAG_CHECKSUM) && containerChecksum(matriz, payload) != desc->checksum) {
+		fprintf(stderr, "Checksum mismatch in data file %s\n", src);
+		munmap(mmaping, map_size);
+		close(fd);
+		return ERRORINVALIDCONFIG;
+	}
 	real* newdata = (real*)malloc(size);
-	for (int i = 0; i < rows*cols; i++) {
-		newdata[i] = (real)matriz[i];
+	if (newdata == NULL) {
+		fprintf(stderr, "Error allocating %lu bytes for data file %s\n", size, src);
+		munmap(mmaping, map_size);
+		close(fd);
+		return ERRORNODEVICEMEM;
+	}
+
+	/*
+	 * Converted in chunks so each thread streams over its own part of the file
+	 */
+	int nchunks = (int)((elements + LOAD_CHUNK - 1) / LOAD_CHUNK);
+	int c;
+	#pragma omp parallel for schedule(dynamic)
+	for (c = 0; c < nchunks; c++) {
+		size_t first = (size_t)c * LOAD_CHUNK;
+		size_t last = first + LOAD_CHUNK < elements ? first + LOAD_CHUNK : elements;
+		convertValues(matriz, newdata, first, last, desc->dtype, swap, (real)desc->scale);
 	}
 	*dst = newdata;
 	if (close(fd) == -1) {
@@ -88,6 +171,375 @@ error dataload(char* src, natural rows, natural cols, real** dst) {
 
 }
 
+/*
+ * Describes a headerless file of rows x cols values in native byte order
+ */
+static void rawdesc(container_t* desc, natural rows, natural cols, natural dtype) {
+	memset(desc, 0, sizeof(container_t));
+	desc->byteorder = CONTAINER_BYTEORDER;
+	desc->dtype = dtype;
+	desc->channels = cols;
+	desc->frames = rows;
+	desc->epochs = 1;
+	desc->scale = 1.0;
+}
+
+/*
+ * Loads a headerless double precision file of rows x cols into host memory
+ */
+error dataload(char* src, natural rows, natural cols, real** dst, void** mapping, size_t* mapsize) {
+	container_t desc;
+	rawdesc(&desc, rows, cols, DTYPE_F64);
+	return mapload(src, &desc, dst, mapping, mapsize);
+}
+
+/*
+ * Loads an EEGLAB .fdt file of rows x cols values into host memory. EEGLAB
+ * writes float32 channels x points in little endian, which is already the
+ * sample-major layout used here.
+ */
+error fdtload(char* src, natural rows, natural cols, real** dst, void** mapping, size_t* mapsize) {
+	container_t desc;
+	rawdesc(&desc, rows, cols, DTYPE_F32);
+	return mapload(src, &desc, dst, mapping, mapsize);
+}
+
+/*
+ * Loads the payload of a container of rows x cols values into host memory
+ */
+error containerload(char* src, natural rows, natural cols, real** dst, void** mapping, size_t* mapsize) {
+	container_t desc;
+	error err = containerProbe(src, &desc);
+	if (err != SUCCESS) {
+		fprintf(stderr, "Data file %s is not a valid container\n", src);
+		return err == ERRORNOPARAM ? ERRORINVALIDCONFIG : err;
+	}
+	if (desc.channels != cols || desc.frames * desc.epochs != rows) {
+		fprintf(stderr, "Container %s holds %llu x %llu values, %d x %d expected\n", src,
+				(unsigned long long)(desc.frames * desc.epochs), (unsigned long long)desc.channels, rows, cols);
+		return ERRORINVALIDCONFIG;
+	}
+	return mapload(src, &desc, dst, mapping, mapsize);
+}
+
+/*
+ * Opens the data file for the streaming mode instead of loading it
+ */
+static error streamload(config_t* config, natural rows, natural cols, stream_t** stream) {
+	container_t desc;
+	if (config->dataformat == FORMAT_CONTAINER) {
+		error err = containerProbe(config->datafile, &desc);
+		if (err != SUCCESS) {
+			return err == ERRORNOPARAM ? ERRORINVALIDCONFIG : err;
+		}
+	} else if (config->dataformat == FORMAT_FDT) {
+		rawdesc(&desc, rows, cols, DTYPE_F32);
+	} else if (config->dataformat == FORMAT_RAW) {
+		rawdesc(&desc, rows, cols, DTYPE_F64);
+	} else {
+		fprintf(stderr, "EDF and BDF recordings cannot be streamed, convert them to a container first\n");
+		return ERRORINVALIDCONFIG;
+	}
+	return streamOpen(config->datafile, &desc, (size_t)config->memcap << 20, stream);
+}
+
+/*
+ * EDF/BDF header information needed to decode the selected signals
+ */
+typedef struct {
+	natural		bytes;				//Bytes per sample, 2 (EDF) or 3 (BDF)
+	natural		nsignals;			//Signals in the file
+	natural		nselected;			//Selected signals
+	natural		spr;				//Samples per record of the selected signals
+	size_t		headerbytes;
+	size_t		recordbytes;
+	size_t		nrecords;
+	natural*	selected;			//Signal index of each selected signal
+	size_t*		sigoffset;			//Byte offset of each selected signal in a record
+	real*		gain;				//Digital to physical scaling
+	real*		offset;
+} edfinfo_t;
+
+/*
+ * Parses a fixed width ascii header field
+ */
+static double edffield(const char* field, int width) {
+	char buffer[81];
+	memcpy(buffer, field, width);
+	buffer[width] = 0;
+	return atof(buffer);
+}
+
+static void edffree(edfinfo_t *info) {
+	free(info->selected);
+	free(info->sigoffset);
+	free(info->gain);
+	free(info->offset);
+}
+
+/*
+ * Reads an EDF (format FORMAT_EDF) or BDF (FORMAT_BDF) header and selects
+ * the signals in chanlist, a comma separated list of 1-based signal numbers
+ * or ranges ("1-32,35"). Without a list every signal except the EDF+
+ * annotations and the BDF status channel is used. All selected signals
+ * must share the same sampling rate.
+ */
+static error edfheader(char* src, natural format, char* chanlist, edfinfo_t *info) {
+	memset(info, 0, sizeof(edfinfo_t));
+	FILE *file = fopen(src, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Error opening data file (%d) %s - %s\n", errno, strerror(errno), src);
+		return ERRORNOFILE;
+	}
+	char fixed[256];
+	if (fread(fixed, 1, 256, file) != 256) {
+		fprintf(stderr, "Data file %s is too short for an EDF/BDF header\n", src);
+		fclose(file);
+		return ERRORINVALIDCONFIG;
+	}
+	if (format == FORMAT_BDF ? memcmp(fixed, "\xff" "BIOSEMI", 8) != 0 : fixed[0] != '0') {
+		fprintf(stderr, "Data file %s is not a %s file\n", src, format == FORMAT_BDF ? "BDF" : "EDF");
+		fclose(file);
+		return ERRORINVALIDCONFIG;
+	}
+	info->bytes = (format == FORMAT_BDF) ? 3 : 2;
+	info->headerbytes = (size_t)edffield(fixed + 184, 8);
+	double nrecords = edffield(fixed + 236, 8);
+	info->nsignals = (natural)edffield(fixed + 252, 4);
+	natural ns = info->nsignals;
+	if (ns == 0 || info->headerbytes != 256 * (ns + 1)) {
+		fprintf(stderr, "Data file %s has an invalid EDF/BDF header\n", src);
+		fclose(file);
+		return ERRORINVALIDCONFIG;
+	}
+	char *sig = (char*)malloc(256 * ns);
+	if (fread(sig, 1, 256 * ns, file) != 256 * ns) {
+		fprintf(stderr, "Data file %s has a truncated EDF/BDF header\n", src);
+		free(sig);
+		fclose(file);
+		return ERRORINVALIDCONFIG;
+	}
+	fseek(file, 0, SEEK_END);
+#ifdef _WIN32
+	uint64_t fsize = _ftelli64(file);
+#else
+	uint64_t fsize = ftello(file);
+#endif
+	fclose(file);
+
+	/*
+	 * Signal fields are stored field by field for all signals
+	 */
+	char *labels = sig;
+	char *physmin = sig + ns * (16 + 80 + 8);
+	char *physmax = physmin + ns * 8;
+	char *digmin = physmax + ns * 8;
+	char *digmax = digmin + ns * 8;
+	char *samples = digmax + ns * 8 + ns * 80;
+	size_t *spr = (size_t*)malloc(ns * sizeof(size_t));
+	size_t *sigoffset = (size_t*)malloc(ns * sizeof(size_t));
+	info->recordbytes = 0;
+	for (natural i = 0; i < ns; i++) {
+		spr[i] = (size_t)edffield(samples + i * 8, 8);
+		sigoffset[i] = info->recordbytes;
+		info->recordbytes += spr[i] * info->bytes;
+	}
+	size_t available = info->recordbytes > 0 ? (size_t)((fsize - info->headerbytes) / info->recordbytes) : 0;
+	if (nrecords < 0) {
+		info->nrecords = available;
+	} else if ((size_t)nrecords > available) {
+		fprintf(stderr, "Data file %s is truncated, using %lu of %.0f records\n", src, available, nrecords);
+		info->nrecords = available;
+	} else {
+		info->nrecords = (size_t)nrecords;
+	}
+
+	/*
+	 * Channel selection
+	 */
+	info->selected = (natural*)malloc(ns * sizeof(natural));
+	info->nselected = 0;
+	if (chanlist != NULL) {
+		char *list = (char*)malloc(strlen(chanlist) + 1);
+		strcpy(list, chanlist);
+		for (char *item = strtok(list, ","); item != NULL; item = strtok(NULL, ",")) {
+			int first = atoi(item);
+			char *dash = strchr(item, '-');
+			int last = dash != NULL ? atoi(dash + 1) : first;
+			if (first < 1 || last < first || last > (int)ns) {
+				fprintf(stderr, "Invalid channel selection %s for %d signals\n", item, ns);
+				free(list);
+				free(sig);
+				free(spr);
+				free(sigoffset);
+				edffree(info);
+				return ERRORINVALIDPARAM;
+			}
+			for (int c = first; c <= last && info->nselected < ns; c++) {
+				info->selected[info->nselected++] = c - 1;
+			}
+		}
+		free(list);
+	} else {
+		for (natural i = 0; i < ns; i++) {
+			if (strncmp(labels + i * 16, "EDF Annotations", 15) == 0 || strncmp(labels + i * 16, "Status", 6) == 0) continue;
+			info->selected[info->nselected++] = i;
+		}
+	}
+
+	info->sigoffset = (size_t*)malloc(info->nselected * sizeof(size_t));
+	info->gain = (real*)malloc(info->nselected * sizeof(real));
+	info->offset = (real*)malloc(info->nselected * sizeof(real));
+	error err = info->nselected > 0 ? SUCCESS : ERRORINVALIDPARAM;
+	info->spr = info->nselected > 0 ? (natural)spr[info->selected[0]] : 0;
+	for (natural c = 0; c < info->nselected; c++) {
+		natural i = info->selected[c];
+		if (spr[i] != info->spr) {
+			fprintf(stderr, "Signal %d has %lu samples per record, %d expected: select signals with the same rate\n", i + 1, spr[i], info->spr);
+			err = ERRORINVALIDPARAM;
+		}
+		double pmin = edffield(physmin + i * 8, 8);
+		double pmax = edffield(physmax + i * 8, 8);
+		double dmin = edffield(digmin + i * 8, 8);
+		double dmax = edffield(digmax + i * 8, 8);
+		double gain = (dmax != dmin) ? (pmax - pmin) / (dmax - dmin) : 1.0;
+		info->gain[c] = (real)gain;
+		info->offset[c] = (real)(pmin - gain * dmin);
+		info->sigoffset[c] = sigoffset[i];
+	}
+	free(sig);
+	free(spr);
+	free(sigoffset);
+	if (err != SUCCESS) {
+		edffree(info);
+	}
+	return err;
+}
+
+/*
+ * Shape of the selected signals of an EDF/BDF file, used by parseConfig()
+ */
+error edfProbe(char* src, natural format, char* chanlist, natural* channels, natural* frames) {
+	edfinfo_t info;
+	error err = edfheader(src, format, chanlist, &info);
+	if (err != SUCCESS) return err;
+	*channels = info.nselected;
+	*frames = (natural)(info.nrecords * info.spr);
+	edffree(&info);
+	return SUCCESS;
+}
+
+/*
+ * Loads the selected signals of an EDF/BDF file into host memory, scaled to
+ * physical units. Records are decoded in parallel: each signal of a record
+ * is scaled into a contiguous buffer and then interleaved into the
+ * sample-major data.
+ */
+error edfload(char* src, natural format, char* chanlist, natural rows, natural cols, real** dst) {
+	edfinfo_t info;
+	error err = edfheader(src, format, chanlist, &info);
+	if (err != SUCCESS) return err;
+	if (info.nselected != cols || info.nrecords * info.spr != rows) {
+		fprintf(stderr, "Data file %s holds %lu x %d values, %d x %d expected\n", src, info.nrecords * info.spr, info.nselected, rows, cols);
+		edffree(&info);
+		return ERRORINVALIDCONFIG;
+	}
+	int fd = open(src, O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "Error opening data file (%d) %s - %s\n", errno, strerror(errno), src);
+		edffree(&info);
+		return ERRORNOFILE;
+	}
+	size_t map_size = info.headerbytes + info.nrecords * info.recordbytes;
+	void *mmaping = mmap(0, map_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mmaping == MAP_FAILED) {
+		fprintf(stderr, "Error mapping data file %s\n", src);
+		close(fd);
+		edffree(&info);
+		return ERRORNOFILE;
+	}
+#ifndef _WIN32
+	posix_fadvise(fd, 0, map_size, POSIX_FADV_SEQUENTIAL);
+	madvise(mmaping, map_size, MADV_SEQUENTIAL);	// Advice values, not flags: one call each
+	madvise(mmaping, map_size, MADV_WILLNEED);
+#endif
+	real *newdata = (real*)malloc(sizeof(real) * rows * cols);
+	if (newdata == NULL) {
+		fprintf(stderr, "Error allocating %lu bytes for data file %s\n", sizeof(real) * rows * cols, src);
+		munmap(mmaping, map_size);
+		close(fd);
+		edffree(&info);
+		return ERRORNODEVICEMEM;
+	}
+	const unsigned char *records = (const unsigned char*)mmaping + info.headerbytes;
+	natural spr = info.spr;
+	natural nsel = info.nselected;
+	int nrecords = (int)info.nrecords;
+
+	#pragma omp parallel
+	{
+		real *tmp = (real*)malloc(sizeof(real) * spr * nsel);
+		int r;
+		#pragma omp for schedule(static)
+		for (r = 0; r < nrecords; r++) {
+			const unsigned char *record = records + (size_t)r * info.recordbytes;
+			for (natural c = 0; c < nsel; c++) {
+				const unsigned char *in = record + info.sigoffset[c];
+				real *out = tmp + c * spr;
+				real gain = info.gain[c];
+				real offset = info.offset[c];
+				if (info.bytes == 2) {
+					for (natural i = 0; i < spr; i++) {
+						int16_t v = (int16_t)(in[2*i] | (in[2*i + 1] << 8));
+						out[i] = gain * v + offset;
+					}
+				} else {
+					for (natural i = 0; i < spr; i++) {
+						uint32_t u = in[3*i] | (in[3*i + 1] << 8) | ((uint32_t)in[3*i + 2] << 16);
+						int32_t v = (int32_t)(u << 8) >> 8;
+						out[i] = gain * v + offset;
+					}
+				}
+			}
+			real *block = newdata + (size_t)r * spr * nsel;
+			for (natural i = 0; i < spr; i++) {
+				for (natural c = 0; c < nsel; c++) {
+					block[i * nsel + c] = tmp[c * spr + i];
+				}
+			}
+		}
+		free(tmp);
+	}
+	*dst = newdata;
+	if (close(fd) == -1) {
+		fprintf(stderr, "Error closing data file %d\n",fd);
+	}
+	if (munmap (mmaping, map_size) == -1) {
+		fprintf(stderr, "Error unmapping data file at %p with size %lu\n", mmaping, map_size);
+	}
+	edffree(&info);
+	return SUCCESS;
+}
+
+/*
+ * Frees the host copy of the data, unmapping it if it was loaded in place
+ */
+void freeData(eegdataset_t *dataset) {
+	if (dataset->data == NULL) return;
+	char *start = (char*)dataset->mapping;
+	if (start != NULL && (char*)dataset->data >= start && (char*)dataset->data < start + dataset->mapsize) {
+		if (munmap(dataset->mapping, dataset->mapsize) == -1) {
+			fprintf(stderr, "Error unmapping data file at %p with size %lu\n", dataset->mapping, dataset->mapsize);
+		}
+	} else {
+		free(dataset->data);
+		if (dataset->mapping != NULL) munmap(dataset->mapping, dataset->mapsize);
+	}
+	dataset->mapping = NULL;
+	dataset->mapsize = 0;
+	dataset->data = NULL;
+}
+
 
 /*
  * Prints dataset info
@@ -127,21 +579,41 @@ error loadEEG(eegdataset_t *dataset) {
 	dataset->signs = NULL;
 	dataset->wpitch = 0;
 	dataset->spitch = 0;
+	dataset->mapping = NULL;
+	dataset->mapsize = 0;
+	dataset->stream = NULL;
 	
 	/*
 	 * Load data file
 	 */ 
-	error err = dataload(dataset->config.datafile, nsamples, nchannels, &dataset->data);
+	double start = wallclock();
+	error err;
+	if (dataset->config.streaming) {
+		err = streamload(&dataset->config, nsamples, nchannels, &dataset->stream);
+	} else if (dataset->config.dataformat == FORMAT_CONTAINER) {
+		err = containerload(dataset->config.datafile, nsamples, nchannels, &dataset->data, &dataset->mapping, &dataset->mapsize);
+	} else if (dataset->config.dataformat == FORMAT_FDT) {
+		err = fdtload(dataset->config.datafile, nsamples, nchannels, &dataset->data, &dataset->mapping, &dataset->mapsize);
+	} else if (dataset->config.dataformat == FORMAT_EDF || dataset->config.dataformat == FORMAT_BDF) {
+		err = edfload(dataset->config.datafile, dataset->config.dataformat, dataset->config.chanlist, nsamples, nchannels, &dataset->data);
+	} else {
+		err = dataload(dataset->config.datafile, nsamples, nchannels, &dataset->data, &dataset->mapping, &dataset->mapsize);
+	}
 	if (err != SUCCESS) {
 		fprintf(stderr, "Error loading data file %s\n", dataset->config.datafile);
 		return err;
 	}
+	double elapsed = wallclock() - start;
+	if (dataset->config.verbose && elapsed > 0 && dataset->stream == NULL) {
+		double mbytes = (double)nsamples * nchannels * sizeof(real) / 1048576.0;
+		printf("%.0f MB %s in %.2f s (%.1f MB/s)...", mbytes, dataset->mapping != NULL ? "mapped" : "read", elapsed, mbytes / elapsed);
+	}
 	
 	/*
 	 * Load weights file
 	 */ 
 	if (dataset->config.weightsinfile != NULL) {
-		err = dataload(dataset->config.weightsinfile, nchannels, nchannels, &dataset->h_weights);
+		err = dataload(dataset->config.weightsinfile, nchannels, nchannels, &dataset->h_weights, NULL, NULL);
 		if (err != SUCCESS) {
 			fprintf(stderr, "Error loading weights file %s\n", dataset->config.weightsinfile);
 			return err;
@@ -157,11 +629,89 @@ error loadEEG(eegdataset_t *dataset) {
 }
 
 
+/*
+ * Saves the results of the cpu backend, which are kept in host memory
+ */
+error hostSaveEEG(eegdataset_t *dataset) {
+	if (dataset->weights != NULL) {
+		DPRINTF(1, "Saving weights results in %s\n", dataset->config.weightsoutfile);
+		matwrite(dataset->config.weightsoutfile, dataset->nchannels, dataset->nchannels, dataset->weights, dataset->wpitch);
+	}
+	if (dataset->sphere != NULL) {
+		DPRINTF(1, "Saving sphere results in %s\n", dataset->config.sphereoutfile);
+		matwrite(dataset->config.sphereoutfile, dataset->nchannels, dataset->nchannels, dataset->sphere, dataset->spitch);
+	}
+	if (dataset->bias != NULL && dataset->config.biasfile != NULL) {
+		DPRINTF(1, "Saving bias results in %s\n", dataset->config.biasfile);
+		matwrite(dataset->config.biasfile, 1, dataset->nchannels, dataset->bias, dataset->nchannels * sizeof(real));
+	}
+	if (dataset->signs != NULL && dataset->config.signfile != NULL) {
+		DPRINTF(1, "Saving signs results in %s\n", dataset->config.signfile);
+		matwriteInt(dataset->config.signfile, 1, dataset->nchannels, dataset->signs, dataset->nchannels * sizeof(int));
+	}
+	return SUCCESS;
+}
+
+
+/*
+ * Writes one result matrix as a container, copying it from the device first
+ * when the results are in device memory
+ */
+static void resultwrite(eegdataset_t *dataset, char *fname, natural dtype, int rows, int cols, void *mat, size_t pitch) {
+	if (dataset->config.backend == BACKEND_CPU) {
+		containerWrite(fname, dtype, rows, cols, mat, pitch);
+		return;
+	}
+	size_t width = cols * dtypeSize(dtype);
+	void *buffer = malloc(rows * width);
+	HANDLE_ERROR(cudaMemcpy2D(buffer, width, mat, pitch, width, rows, cudaMemcpyDeviceToHost));
+	containerWrite(fname, dtype, rows, cols, buffer, width);
+	free(buffer);
+}
+
+/*
+ * Saves the results as containers, used when the data came in a container
+ */
+error containerSaveEEG(eegdataset_t *dataset) {
+	if (dataset->weights != NULL) {
+		DPRINTF(1, "Saving weights results in %s\n", dataset->config.weightsoutfile);
+		resultwrite(dataset, dataset->config.weightsoutfile, DTYPE_REAL, dataset->nchannels, dataset->nchannels, dataset->weights, dataset->wpitch);
+	}
+	if (dataset->sphere != NULL) {
+		DPRINTF(1, "Saving sphere results in %s\n", dataset->config.sphereoutfile);
+		resultwrite(dataset, dataset->config.sphereoutfile, DTYPE_REAL, dataset->nchannels, dataset->nchannels, dataset->sphere, dataset->spitch);
+	}
+	if (dataset->bias != NULL && dataset->config.biasfile != NULL) {
+		DPRINTF(1, "Saving bias results in %s\n", dataset->config.biasfile);
+		resultwrite(dataset, dataset->config.biasfile, DTYPE_REAL, 1, dataset->nchannels, dataset->bias, dataset->nchannels * sizeof(real));
+	}
+	if (dataset->signs != NULL && dataset->config.signfile != NULL) {
+		DPRINTF(1, "Saving signs results in %s\n", dataset->config.signfile);
+		resultwrite(dataset, dataset->config.signfile, DTYPE_I32, 1, dataset->nchannels, dataset->signs, dataset->nchannels * sizeof(integer));
+	}
+	return SUCCESS;
+}
+
+
 /*
  * Saves the data from the dataset into the corresponding files
  */ 
 error saveEEG(eegdataset_t *dataset) {
 	DPRINTF(1, "Saving dataset results\n");
+	if (dataset->projection != NULL) {
+		DPRINTF(1, "Saving pca projection in %s\n", dataset->config.pcafile);
+		if (dataset->config.dataformat == FORMAT_CONTAINER) {
+			containerWrite(dataset->config.pcafile, DTYPE_REAL, dataset->urchannels, dataset->nchannels, dataset->projection, dataset->nchannels * sizeof(real));
+		} else {
+			matwrite(dataset->config.pcafile, dataset->urchannels, dataset->nchannels, dataset->projection, dataset->nchannels * sizeof(real));
+		}
+	}
+	if (dataset->config.dataformat == FORMAT_CONTAINER) {
+		return containerSaveEEG(dataset);
+	}
+	if (dataset->config.backend == BACKEND_CPU) {
+		return hostSaveEEG(dataset);
+	}
 	if (dataset->weights != NULL) {
 		DPRINTF(1, "Saving weights results in %s\n", dataset->config.weightsoutfile);
 		dev_matwrite(dataset->config.weightsoutfile, dataset->nchannels, dataset->nchannels, dataset->weights, dataset->wpitch);
@@ -190,11 +740,24 @@ error saveEEG(eegdataset_t *dataset) {
  */  
 error freeEEG(eegdataset_t *dataset) {
 	if (dataset->h_weights != NULL) free(dataset->h_weights);
-	if (dataset->weights != NULL) HANDLE_ERROR(cudaFree(dataset->weights));
-	if (dataset->sphere != NULL) HANDLE_ERROR(cudaFree(dataset->sphere));
-	if (dataset->signs != NULL) HANDLE_ERROR(cudaFree(dataset->signs));
-	if (dataset->bias != NULL) HANDLE_ERROR(cudaFree(dataset->bias));
-	if (dataset->data != NULL) free(dataset->data);
+	if (dataset->mean != NULL) free(dataset->mean);
+	if (dataset->cov != NULL) free(dataset->cov);
+	if (dataset->projection != NULL) free(dataset->projection);
+	if (dataset->config.backend == BACKEND_CPU) {
+		if (dataset->weights != NULL) poolFree(dataset->weights);
+		if (dataset->sphere != NULL) poolFree(dataset->sphere);
+		if (dataset->signs != NULL) poolFree(dataset->signs);
+		if (dataset->bias != NULL) poolFree(dataset->bias);
+		if (dataset->stream != NULL) streamClose(dataset->stream);
+		freeData(dataset);
+		free(dataset);
+		return SUCCESS;
+	}
+	if (dataset->weights != NULL) poolCudaFree(dataset->weights);
+	if (dataset->sphere != NULL) poolCudaFree(dataset->sphere);
+	if (dataset->signs != NULL) poolCudaFree(dataset->signs);
+	if (dataset->bias != NULL) poolCudaFree(dataset->bias);
+	freeData(dataset);
 	free(dataset);
 	return SUCCESS;
 }
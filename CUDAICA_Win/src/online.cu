@@ -0,0 +1,441 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <online.h>
+#include <hostinfomax.h>
+#include <whitening.h>
+#include <loader.h>
+#include <error.h>
+#include <common.h>
+#include <cblas.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+/*
+ * Ring of capacity samples. head and tail count every sample pushed and
+ * popped, a push on a full ring drops the oldest sample, or waits for room
+ * when wait is set.
+ */
+struct ring_s {
+	real *					buffer;
+	natural					channels;
+	size_t					capacity;
+	uint64_t				head;
+	uint64_t				tail;
+	uint64_t				dropped;
+	int						closed;
+	int						wait;
+	std::mutex				lock;
+	std::condition_variable	ready;
+	std::condition_variable	room;
+};
+
+ring_t *ringCreate(natural channels, natural capacity, int wait) {
+	ring_t *ring = new ring_t;
+	ring->buffer = (real*)malloc((size_t)capacity * channels * sizeof(real));
+	ring->channels = channels;
+	ring->capacity = capacity;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->dropped = 0;
+	ring->closed = 0;
+	ring->wait = wait;
+	return ring;
+}
+
+/*
+ * Adds count samples (one per row), dropping the oldest ones if the ring
+ * is full, or waiting for ringPop() to make room when the ring waits.
+ * Samples pushed after ringClose() are ignored.
+ */
+void ringPush(ring_t *ring, real *samples, natural count) {
+	natural s;
+	{
+		std::unique_lock<std::mutex> guard(ring->lock);
+		for (s = 0; s < count; s++) {
+			while (ring->wait && ring->head - ring->tail == ring->capacity && !ring->closed) {
+				ring->ready.notify_one();
+				ring->room.wait(guard);
+			}
+			if (ring->closed) return;
+			if (ring->head - ring->tail == ring->capacity) {
+				ring->tail++;
+				ring->dropped++;
+			}
+			size_t slot = (size_t)(ring->head % ring->capacity);
+			memcpy(ring->buffer + slot * ring->channels, samples + (size_t)s * ring->channels, ring->channels * sizeof(real));
+			ring->head++;
+		}
+	}
+	ring->ready.notify_one();
+}
+
+/*
+ * Waits for count samples and takes them. Returns 0 once the ring is
+ * closed with fewer than count samples left.
+ */
+natural ringPop(ring_t *ring, real *samples, natural count) {
+	std::unique_lock<std::mutex> guard(ring->lock);
+	natural s;
+	while (ring->head - ring->tail < count && !ring->closed) {
+		ring->ready.wait(guard);
+	}
+	if (ring->head - ring->tail < count) return 0;
+	for (s = 0; s < count; s++) {
+		size_t slot = (size_t)(ring->tail % ring->capacity);
+		memcpy(samples + (size_t)s * ring->channels, ring->buffer + slot * ring->channels, ring->channels * sizeof(real));
+		ring->tail++;
+	}
+	guard.unlock();
+	ring->room.notify_one();
+	return count;
+}
+
+/*
+ * No more samples will come, or no more will be taken
+ */
+void ringClose(ring_t *ring) {
+	{
+		std::lock_guard<std::mutex> guard(ring->lock);
+		ring->closed = 1;
+	}
+	ring->ready.notify_all();
+	ring->room.notify_all();
+}
+
+void ringFree(ring_t *ring) {
+	free(ring->buffer);
+	delete ring;
+}
+
+/*
+ * Samples waiting in the ring and samples dropped so far
+ */
+static void ringStats(ring_t *ring, natural *backlog, uint64_t *dropped) {
+	std::lock_guard<std::mutex> guard(ring->lock);
+	*backlog = (natural)(ring->head - ring->tail);
+	*dropped = ring->dropped;
+}
+
+static int ringClosed(ring_t *ring) {
+	std::lock_guard<std::mutex> guard(ring->lock);
+	return ring->closed;
+}
+
+/*
+ * Reader thread: pushes the samples of in to the ring, block samples at a
+ * time, until the end of the data or until the learner closes the ring
+ */
+static void onlineRead(FILE *in, natural format, natural block, ring_t *ring) {
+	natural channels = ring->channels;
+	size_t width = format == FORMAT_FDT ? sizeof(float) : sizeof(double);
+	char *raw = (char*)malloc((size_t)block * channels * width);
+	real *samples = (real*)malloc((size_t)block * channels * sizeof(real));
+	size_t count, i;
+	while ((count = fread(raw, channels * width, block, in)) > 0) {
+		for (i = 0; i < count * channels; i++) {
+			samples[i] = format == FORMAT_FDT ? (real)((float*)raw)[i] : (real)((double*)raw)[i];
+		}
+		ringPush(ring, samples, (natural)count);
+		if (ringClosed(ring)) break;
+	}
+	ringClose(ring);
+	free(samples);
+	free(raw);
+}
+
+/*
+ * Adds a block (one sample per row) to the running mean and second moment
+ * (upper triangle, column major). Block n weighs 1/n up to ONLINE_WINDOW
+ * blocks and 1/ONLINE_WINDOW after.
+ */
+static void onlineMoments(real *x, natural block, natural channels, real *mean, real *moment, natural n) {
+	real a = 1.0 / (real)(n < ONLINE_WINDOW ? n : ONLINE_WINDOW);
+	real alpha = a / block;
+	real beta = 1.0 - a;
+	int m = channels, k = block;
+	char uplo = 'U', transn = 'N';
+	natural s, c;
+	for (c = 0; c < channels; c++) {
+		real sum = 0.0;
+		for (s = 0; s < block; s++) {
+			sum += x[(size_t)s * channels + c];
+		}
+		mean[c] = beta * mean[c] + alpha * sum;
+	}
+	dsyrk_(&uplo, &transn, &m, &k, &alpha, x, &m, &beta, moment, &m);
+}
+
+/*
+ * New sphere from the running moments. When weights is not NULL they are
+ * changed to weights * sphere * newsphere^-1, so that the unmixing
+ * weights * sphere is not changed by the new sphere.
+ */
+static void onlineSphere(natural channels, real *mean, real *moment, real *sphere, real *weights) {
+	int m = channels, info = 0;
+	size_t chxch = (size_t)channels * channels;
+	real *cov = (real*)malloc(chxch * sizeof(real));
+	natural i, j;
+	for (j = 0; j < channels; j++) {
+		for (i = 0; i <= j; i++) {
+			cov[i + j * channels] = moment[i + j * channels] - mean[i] * mean[j];
+		}
+	}
+	sphereFromCov(cov, channels);
+	if (weights != NULL) {
+		real alpha = 1.0, beta = 0.0;
+		char transn = 'N', transt = 'T';
+		real *lu = (real*)malloc(chxch * sizeof(real));
+		real *product = (real*)malloc(chxch * sizeof(real));
+		int *ipiv = (int*)malloc(channels * sizeof(int));
+		memcpy(lu, cov, chxch * sizeof(real));
+		/* spheres are symmetric: newweights' = newsphere^-1 * sphere * weights' */
+		dgemm_(&transn, &transt, &m, &m, &m, &alpha, sphere, &m, weights, &m, &beta, product, &m);
+		dgesv_(&m, &m, lu, &m, ipiv, product, &m, &info);
+		if (info == 0) {
+			for (j = 0; j < channels; j++) {
+				for (i = 0; i < channels; i++) {
+					weights[i + j * channels] = product[j + i * channels];
+				}
+			}
+		} else {
+			fprintf(stderr, "ERROR: Singular sphere, keeping the previous one\n");
+			memcpy(cov, sphere, chxch * sizeof(real));
+		}
+		free(ipiv);
+		free(product);
+		free(lu);
+	}
+	memcpy(sphere, cov, chxch * sizeof(real));
+	free(cov);
+}
+
+/*
+ * Replaces fname with a rows x cols matrix, through fname.tmp so readers
+ * never see a partial file
+ */
+static void onlineWrite(char *fname, int rows, int cols, void *mat, int integers) {
+	if (fname == NULL) return;
+	char *tmp = (char*)malloc(strlen(fname) + 5);
+	sprintf(tmp, "%s.tmp", fname);
+	if (integers) {
+		matwriteInt(tmp, rows, cols, (int*)mat, cols * sizeof(int));
+	} else {
+		matwrite(tmp, rows, cols, (real*)mat, cols * sizeof(real));
+	}
+	if (replaceFile(tmp, fname) != 0) {
+		fprintf(stderr, "ERROR: Cannot rename %s to %s\n", tmp, fname);
+	}
+	free(tmp);
+}
+
+static void onlinePublish(config_t *config, hostblock_t *hb, real *sphere) {
+	natural channels = hb->channels;
+	onlineWrite(config->weightsoutfile, channels, channels, hb->weights, 0);
+	onlineWrite(config->sphereoutfile, channels, channels, sphere, 0);
+	if (hb->bias != NULL) onlineWrite(config->biasfile, 1, channels, hb->bias, 0);
+	if (hb->signs != NULL) onlineWrite(config->signfile, 1, channels, hb->signs, 1);
+}
+
+/*
+ * Learns from the blocks of ring until it is closed and drained. The
+ * weights start from set->h_weights when not NULL.
+ */
+error onlineLearn(eegdataset_t *set, ring_t *ring) {
+	config_t *config = &set->config;
+	natural channels = config->nchannels;
+	natural block = config->block;
+	natural publish = config->publish;
+	natural extblocks = config->extblocks;
+	natural verbose = config->verbose;
+	size_t chxch = (size_t)channels * channels * sizeof(real);
+	real lrate = config->lrate;
+	real minlrate = lrate * ONLINE_MIN_LRATE;
+	real *x = (real*)malloc((size_t)block * channels * sizeof(real));
+	real *mean = (real*)calloc(channels, sizeof(real));
+	real *moment = (real*)calloc((size_t)channels * channels, sizeof(real));
+	real *sphere = (real*)malloc(chxch);
+	real *published = (real*)malloc(chxch);
+	natural warmup = ONLINE_WARMUP;
+	natural n = 0;
+	natural blockno = 1;
+	natural backlog = 0;
+	uint64_t dropped = 0;
+	double worst = 0.0;
+	double busy = 0.0;
+	natural s, c;
+	error err = SUCCESS;
+
+	hostblock_t hb;
+	hostBlockInit(&hb, config, channels, set->h_weights);
+	memcpy(published, hb.weights, chxch);
+	hostEye(sphere, channels);
+	while ((size_t)warmup * block < 2 * (size_t)channels) warmup++;
+
+	while (ringPop(ring, x, block) == block) {
+		double start = wallclock();
+		onlineMoments(x, block, channels, mean, moment, ++n);
+		if (n < warmup) continue;
+		if (n == warmup && config->sphering == 1) {
+			onlineSphere(channels, mean, moment, sphere, NULL);
+		}
+
+		for (s = 0; s < block; s++) {
+			real *sample = x + (size_t)s * channels;
+			for (c = 0; c < channels; c++) {
+				sample[c] -= mean[c];
+			}
+		}
+		if (config->sphering == 1) {
+			hostMultbySphere(sphere, NULL, x, channels, block, 1);
+		}
+
+		int pdf = hb.extended && extblocks > 0 && blockno % extblocks == 0;
+		if (hostBlockUpdate(&hb, x, lrate, pdf)) {
+			memcpy(hb.weights, published, chxch);
+			hostBlockReset(&hb);
+			lrate = lrate * DEFAULT_RESTART_FAC;
+			minlrate = lrate * ONLINE_MIN_LRATE;
+			printf("Block %d [ BLOWUP! ]\n", blockno);
+			if (lrate > MIN_LRATE) {
+				if (verbose != 0) {
+					printf("Lowering learning rate to %g and going on.\n", lrate);
+				}
+			} else {
+				printf("QUITTING - weight matrix may not be invertible!\n");
+				err = ERRORDIVERGED;
+				break;
+			}
+		} else {
+			lrate = lrate * config->decay;
+			if (lrate < minlrate) lrate = minlrate;
+		}
+		double took = wallclock() - start;
+		busy += took;
+		if (took > worst) worst = took;
+
+		if (blockno % publish == 0) {
+			real change = 0.0;
+			size_t i;
+			for (i = 0; i < (size_t)channels * channels; i++) {
+				real d = hb.weights[i] - published[i];
+				change += d * d;
+			}
+			if (config->sphering == 1) {
+				onlineSphere(channels, mean, moment, sphere, hb.weights);
+			}
+			memcpy(published, hb.weights, chxch);
+			onlinePublish(config, &hb, sphere);
+			ringStats(ring, &backlog, &dropped);
+			if (verbose != 0) {
+				printf("Block %d - lrate %7.9f, wchange %7.9f, backlog %d samples, dropped %llu, block %.2f ms (max %.2f)\n",
+						blockno, lrate, change, backlog, (unsigned long long)dropped, 1000.0 * busy / publish, 1000.0 * worst);
+			} else {
+				printf("Block %d.\n", blockno);
+			}
+			worst = 0.0;
+			busy = 0.0;
+		}
+		blockno++;
+	}
+
+	if (err != SUCCESS) {
+		ringClose(ring);
+	} else if (n >= warmup) {
+		onlinePublish(config, &hb, sphere);
+	} else {
+		fprintf(stderr, "ERROR: The data ended before the first %d blocks, nothing learnt\n", warmup);
+	}
+	ringStats(ring, &backlog, &dropped);
+	printf("Learnt %d blocks, %llu samples dropped\n", blockno - 1, (unsigned long long)dropped);
+
+	hostBlockFree(&hb);
+	free(published);
+	free(sphere);
+	free(moment);
+	free(mean);
+	free(x);
+	if (err != SUCCESS) return err;
+	return n >= warmup ? SUCCESS : ERRORINVALIDCONFIG;
+}
+
+/*
+ * Online mode: learns from config.datafile (- for stdin) until the end of
+ * the data, seeding the weights with WeightsInFile when given
+ */
+error runOnline(eegdataset_t *set) {
+	config_t *config = &set->config;
+	natural channels = config->nchannels;
+	FILE *in = NULL;
+	error err;
+
+	if (config->weightsinfile != NULL) {
+		err = dataload(config->weightsinfile, channels, channels, &set->h_weights, NULL, NULL);
+		if (err != SUCCESS) {
+			fprintf(stderr, "Error loading weights file %s\n", config->weightsinfile);
+			return err;
+		}
+	}
+
+	if (strcmp(config->datafile, "-") == 0) {
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
+		in = stdin;
+	} else {
+		in = fopen(config->datafile, "rb");
+		if (in == NULL) {
+			fprintf(stderr, "ERROR: Cannot open %s\n", config->datafile);
+			return ERRORNOFILE;
+		}
+	}
+
+	/*
+	 * A regular file has all its samples already, none are dropped for it
+	 */
+	struct stat st;
+	int wait = fstat(fileno(in), &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG;
+
+	printf("Learning online from %s, %d channels, blocks of %d samples, up to %d blocks buffered%s\n",
+			config->datafile, channels, config->block, config->latency, wait ? ", not dropped" : "");
+	ring_t *ring = ringCreate(channels, config->latency * config->block, wait);
+	std::thread reader(onlineRead, in, config->dataformat, config->block, ring);
+	err = onlineLearn(set, ring);
+	reader.join();
+	ringFree(ring);
+
+	if (in != stdin) fclose(in);
+	if (set->h_weights != NULL) {
+		free(set->h_weights);
+		set->h_weights = NULL;
+	}
+	return err;
+}
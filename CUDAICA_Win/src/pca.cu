@@ -0,0 +1,305 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *  Modified to build under Windows by Yunhui Zhou.
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pca.h>
+#include <device.h>
+#include <error.h>
+#include <common.h>
+#include <cblas.h>
+#include <cuda_runtime.h>
+#include "../lib/include/r250.h"
+
+/*
+ * Whether the data is reduced before whitening
+ */
+int pcaReduces(eegdataset_t *set) {
+	return set->config.pca > 0 && set->config.pca < set->nchannels;
+}
+
+/*
+ * n samples starting at x, centered on mean into tmp when mean is given
+ */
+static real *pcaChunk(real *x, real *mean, natural channels, int n, real *tmp) {
+	if (mean == NULL) return x;
+	size_t i;
+	for (i = 0; i < (size_t)n * channels; i++) {
+		tmp[i] = x[i] - mean[i % channels];
+	}
+	return tmp;
+}
+
+/*
+ * Makes the largest entry of every vector positive, so that both methods
+ * give the same projection
+ */
+static void pcaSigns(real *vectors, natural channels, natural k) {
+	natural i, c;
+	for (i = 0; i < k; i++) {
+		real *v = vectors + (size_t)i * channels;
+		natural largest = 0;
+		for (c = 1; c < channels; c++) {
+			if (fabs(v[c]) > fabs(v[largest])) largest = c;
+		}
+		if (v[largest] < 0) {
+			for (c = 0; c < channels; c++) v[c] = -v[c];
+		}
+	}
+}
+
+/*
+ * Eigenvectors of the k largest eigenvalues of a symmetric matrix (upper
+ * triangle, column major, overwritten), in decreasing order. Returns
+ * ERRORLAPACK if dsyev did not converge.
+ */
+static error pcaEig(real *mat, natural channels, natural k, real *vectors, real *values) {
+	int m = channels;
+	int info = 0;
+	int lwork = (8 + 2) * m;	//As sphereFromCov
+	char jobz = 'V', uplo = 'U';
+	real *eigd = (real*)malloc(m * sizeof(real));
+	real *work = (real*)malloc(lwork * sizeof(real));
+	natural i;
+
+	dsyev_(&jobz, &uplo, &m, mat, &m, eigd, work, &lwork, &info);
+	free(work);
+	if (info != 0) {
+		fprintf(stderr, "ERROR: PCA eigendecomposition failed (%d)\n", info);
+		free(eigd);
+		return ERRORLAPACK;
+	}
+	for (i = 0; i < k; i++) {
+		natural src = channels - 1 - i;
+		memcpy(vectors + (size_t)i * channels, mat + (size_t)src * channels, channels * sizeof(real));
+		values[i] = eigd[src];
+	}
+	free(eigd);
+	return SUCCESS;
+}
+
+/*
+ * out = cov * q (channels x l) without forming the covariance: each thread
+ * adds x * (x' * q) over its samples, PCA_CHUNK at a time
+ */
+static void pcaProduct(real *data, real *mean, natural channels, natural samples, int nparts, real *q, natural l, real *out) {
+	size_t mxl = (size_t)channels * l;
+	real *partial = (real*)calloc(nparts * mxl, sizeof(real));
+	int p = 0;
+	#pragma omp parallel for
+	for (p = 0; p < nparts; p++) {
+		char transn = 'N', transt = 'T';
+		int m = channels, cols = l;
+		real alpha = 1.0, zero = 0.0, one = 1.0;
+		size_t i = ((size_t)samples * p) / nparts;
+		size_t end = ((size_t)samples * (p + 1)) / nparts;
+		real *tmp = (real*)malloc((size_t)PCA_CHUNK * channels * sizeof(real));
+		real *t = (real*)malloc((size_t)PCA_CHUNK * l * sizeof(real));
+		for (; i < end; i += PCA_CHUNK) {
+			int n = (end - i) > PCA_CHUNK ? PCA_CHUNK : (int)(end - i);
+			real *x = pcaChunk(data + i * channels, mean, channels, n, tmp);
+			dgemm_(&transt, &transn, &n, &cols, &m, &alpha, x, &m, q, &m, &zero, t, &n);
+			dgemm_(&transn, &transn, &m, &cols, &n, &alpha, x, &m, t, &n, &one, partial + p * mxl, &m);
+		}
+		free(t);
+		free(tmp);
+	}
+	size_t i;
+	for (i = 0; i < mxl; i++) {
+		real sum = 0.0;
+		for (p = 0; p < nparts; p++) {
+			sum += partial[p * mxl + i];
+		}
+		out[i] = sum / (samples - 1);
+	}
+	free(partial);
+}
+
+/*
+ * Orthonormal columns (modified Gram-Schmidt, applied twice)
+ */
+static void pcaOrthonormalize(real *q, natural rows, natural cols) {
+	int pass;
+	natural i, j, r;
+	for (pass = 0; pass < 2; pass++) {
+		for (j = 0; j < cols; j++) {
+			real *col = q + (size_t)j * rows;
+			for (i = 0; i < j; i++) {
+				real *prev = q + (size_t)i * rows;
+				real dot = 0.0;
+				for (r = 0; r < rows; r++) dot += col[r] * prev[r];
+				for (r = 0; r < rows; r++) col[r] -= dot * prev[r];
+			}
+			real norm = 0.0;
+			for (r = 0; r < rows; r++) norm += col[r] * col[r];
+			norm = sqrt(norm);
+			if (norm > 0.0) {
+				for (r = 0; r < rows; r++) col[r] /= norm;
+			}
+		}
+	}
+}
+
+/*
+ * k leading eigenvectors of the covariance by the randomized range finder
+ */
+static error pcaRandom(eegdataset_t *set, natural k, real *vectors, real *values) {
+	natural channels = set->nchannels;
+	natural l = k + PCA_OVERSAMPLE > channels ? channels : k + PCA_OVERSAMPLE;
+	size_t mxl = (size_t)channels * l;
+	real *q = (real*)malloc(mxl * sizeof(real));
+	real *w = (real*)malloc(mxl * sizeof(real));
+	real *b = (real*)malloc((size_t)l * l * sizeof(real));
+	real *u = (real*)malloc((size_t)l * k * sizeof(real));
+	r250_state rng;
+	size_t i;
+	natural r, c;
+	int it;
+
+	r250_init_r(&rng, set->config.seed);
+	for (i = 0; i < mxl; i++) {
+		q[i] = (r250_r(&rng) & 0x7fffffffU) / 2147483648.0 - 0.5;
+	}
+	for (it = 0; it < PCA_POWER; it++) {
+		if (it > 0) {
+			real *swap = q;
+			q = w;
+			w = swap;
+		}
+		pcaOrthonormalize(q, channels, l);
+		pcaProduct(set->data, set->mean, channels, set->nsamples, set->config.nthreads, q, l, w);
+	}
+
+	/*
+	 * Covariance restricted to the basis, b = q' * cov * q
+	 */
+	char transn = 'N', transt = 'T';
+	int m = channels, n = l, cols = k;
+	real alpha = 1.0, beta = 0.0;
+	dgemm_(&transt, &transn, &n, &n, &m, &alpha, q, &m, w, &m, &beta, b, &n);
+	for (c = 0; c < l; c++) {
+		for (r = 0; r < c; r++) {
+			b[r + c * l] = 0.5 * (b[r + c * l] + b[c + r * l]);
+		}
+	}
+	error err = pcaEig(b, l, k, u, values);
+	if (err == SUCCESS) {
+		dgemm_(&transn, &transn, &m, &cols, &n, &alpha, q, &m, u, &n, &beta, vectors, &m);
+	}
+
+	free(u);
+	free(b);
+	free(w);
+	free(q);
+	return err;
+}
+
+/*
+ * Centered data projected on the vectors (samples x k)
+ */
+static real *pcaProject(real *data, real *mean, natural channels, natural samples, int nparts, real *vectors, natural k) {
+	real *out = (real*)malloc((size_t)samples * k * sizeof(real));
+	int p = 0;
+	#pragma omp parallel for
+	for (p = 0; p < nparts; p++) {
+		char transn = 'N', transt = 'T';
+		int m = channels, rows = k;
+		real alpha = 1.0, beta = 0.0;
+		size_t i = ((size_t)samples * p) / nparts;
+		size_t end = ((size_t)samples * (p + 1)) / nparts;
+		real *tmp = (real*)malloc((size_t)PCA_CHUNK * channels * sizeof(real));
+		for (; i < end; i += PCA_CHUNK) {
+			int n = (end - i) > PCA_CHUNK ? PCA_CHUNK : (int)(end - i);
+			real *x = pcaChunk(data + i * channels, mean, channels, n, tmp);
+			dgemm_(&transt, &transn, &rows, &n, &m, &alpha, vectors, &m, x, &m, &beta, out + i * k, &rows);
+		}
+		free(tmp);
+	}
+	return out;
+}
+
+/*
+ * Reduces the data to its config.pca principal components. Works on the host
+ * data, centerData() leaves the means (and for eig the covariance) in set.
+ */
+error pcaReduce(eegdataset_t *set) {
+	natural channels = set->nchannels;
+	natural k = set->config.pca;
+	real *vectors = (real*)malloc((size_t)channels * k * sizeof(real));
+	real *values = (real*)malloc(k * sizeof(real));
+	natural i, c;
+	error err;
+
+	if (set->config.pcamethod == PCA_RANDOM || set->cov == NULL) {
+		DPRINTF(1, "PCA: randomized range finder, %d of %d channels\n", k, channels);
+		err = pcaRandom(set, k, vectors, values);
+	} else {
+		DPRINTF(1, "PCA: covariance eigenvectors, %d of %d channels\n", k, channels);
+		err = pcaEig(set->cov, channels, k, vectors, values);
+	}
+	if (err != SUCCESS) {
+		free(values);
+		free(vectors);
+		return err;
+	}
+	pcaSigns(vectors, channels, k);
+	if (set->cov != NULL) {
+		free(set->cov);
+		set->cov = NULL;
+	}
+
+	real *reduced = pcaProject(set->data, set->mean, channels, set->nsamples, set->config.nthreads, vectors, k);
+	if (set->mean != NULL) {
+		free(set->mean);
+		set->mean = NULL;
+	}
+	freeData(set);
+	set->data = reduced;
+	set->nchannels = k;
+	set->urchannels = channels;
+
+	set->projection = (real*)malloc((size_t)k * channels * sizeof(real));
+	for (c = 0; c < channels; c++) {
+		for (i = 0; i < k; i++) {
+			set->projection[i + c * k] = vectors[c + i * channels];
+		}
+	}
+
+	/*
+	 * The projected data is uncorrelated, whiten() takes its covariance
+	 */
+	set->cov = (real*)calloc((size_t)k * k, sizeof(real));
+	for (i = 0; i < k; i++) {
+		set->cov[i + i * k] = values[i];
+	}
+	free(values);
+	free(vectors);
+
+	if (set->config.backend == BACKEND_GPU) {
+		freeDeviceMem(set);
+		err = loadToDevice(set);
+		if (err != SUCCESS) {
+			fprintf(stderr, "ERROR: Cannot load the reduced data to device\n");
+		}
+	}
+	return err;
+}
@@ -0,0 +1,95 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <permutation.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*
+ * Fills table with a random permutation of samples elements (Fisher-Yates)
+ */
+void permShuffle(natural samples, natural *table, r250_state *rng) {
+	natural i = 0;
+	for (i = 0; i < samples; i++) {
+		table[i] = i;
+	}
+	natural temp;
+	natural swap;
+	for (i = samples; i > 0; i--) {
+		swap = r250_r(rng) %i;
+
+		if ((i-1) != swap) {
+			temp = table[swap];
+			table[swap] = table[i-1];
+			table[i-1] = temp;
+		}
+	}
+}
+
+/*
+ * Sets perm up for samples samples, on table or on Feistel keys over chunks
+ * of chunk samples (a power of 2) when it is NULL. The first permutation is
+ * drawn by permNext().
+ */
+void permInit(perm_t *perm, natural samples, natural *table, natural chunk) {
+	memset(perm, 0, sizeof(perm_t));
+	perm->table = table;
+	perm->samples = samples;
+	while ((1U << perm->shift) < chunk) {
+		perm->shift++;
+	}
+	perm->chunks = (natural)(((unsigned long long)samples + chunk - 1) >> perm->shift);
+	perm->bits = 1;
+	while (perm->bits < 16 && (1ULL << (2 * perm->bits)) < perm->chunks) {
+		perm->bits++;
+	}
+}
+
+/*
+ * Draws the next permutation. Tables in device memory are shuffled by the
+ * caller (see initperm() in infomax.cu).
+ */
+void permNext(perm_t *perm, r250_state *rng) {
+	if (perm->table) {
+		permShuffle(perm->samples, perm->table, rng);
+	} else {
+		int r;
+		for (r = 0; r < FEISTEL_ROUNDS; r++) {
+			perm->keys[r] = r250_r(rng);
+		}
+	}
+}
+
+/*
+ * out[i] = permAt(perm, first + i) for i < count
+ */
+void permFill(const perm_t *perm, natural first, natural count, natural *out) {
+	int i = 0;
+	if (perm->table) {
+		memcpy(out, perm->table + first, count * sizeof(natural));
+		return;
+	}
+	#pragma omp parallel for
+	for (i = 0; i < (int)count; i++) {
+		out[i] = permAt(perm, first + i);
+	}
+}
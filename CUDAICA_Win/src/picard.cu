@@ -0,0 +1,501 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <picard.h>
+#include <hostinfomax.h>
+#include <whitening.h>
+#include <error.h>
+#include <common.h>
+#include <cblas.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define PICARD_LN2		0.69314718055994530942
+
+/*
+ * log(cosh(u)) without overflow
+ */
+static inline real picardLogcosh(real u) {
+	real a = fabs(u);
+	return a + log1p(exp(-2.0 * a)) - PICARD_LN2;
+}
+
+/*
+ * Evaluates W on the whole data (one sample per row):
+ *
+ * returns the loss -log|det W| + E[sum_i g(u_i)]
+ * G = E[g'(u) u'] - I
+ * h = E[g''(u) (u.^2)']
+ * kurt[i] = E[u_i^4] / E[u_i^2]^2 - 3
+ *
+ * Each thread takes a fraction of the samples, PICARD_CHUNK at a time, and
+ * keeps its own sums, which are added in thread order. Returns HUGE_VAL if
+ * W is singular.
+ */
+static real picardPass(real *data, natural channels, natural samples, real *W, natural extended, int *signs, real *G, real *h, real *kurt, int nparts) {
+	size_t chxch = (size_t)channels * channels;
+	size_t partsize = 2 * chxch + 2 * channels + 1;
+	real *part = (real*)calloc(nparts * partsize, sizeof(real));
+	int p = 0;
+
+	#pragma omp parallel for
+	for (p = 0; p < nparts; p++) {
+		real *Gp = part + p * partsize;
+		real *hp = Gp + chxch;
+		real *s2 = hp + chxch;
+		real *s4 = s2 + channels;
+		real *lossp = s4 + channels;
+		real *y = (real*)malloc(channels * PICARD_CHUNK * sizeof(real));
+		real *psi = (real*)malloc(channels * PICARD_CHUNK * sizeof(real));
+		real *psid = (real*)malloc(channels * PICARD_CHUNK * sizeof(real));
+		real alpha = 1.0, beta = 0.0;
+		char transn = 'N', transt = 'T';
+		int m = channels;
+		size_t i = ((size_t)samples * p) / nparts;
+		size_t end = ((size_t)samples * (p + 1)) / nparts;
+		for (; i < end; i += PICARD_CHUNK) {
+			int n = (end - i) > PICARD_CHUNK ? PICARD_CHUNK : (int)(end - i);
+			size_t k;
+			natural c;
+			dgemm_(&transn, &transn, &m, &n, &m, &alpha, W, &m, data + i * channels, &m, &beta, y, &m);
+			for (k = 0, c = 0; k < (size_t)n * channels; k++, c = (c + 1 == channels) ? 0 : c + 1) {
+				real u = y[k];
+				real t;
+				if (!extended) {
+					t = tanh(u / 2.0);
+					psi[k] = t;
+					psid[k] = (1.0 - t * t) / 2.0;
+					*lossp += 2.0 * picardLogcosh(u / 2.0);
+				} else if (signs[c]) {
+					t = tanh(u);
+					psi[k] = u - t;
+					psid[k] = t * t;
+					*lossp += u * u / 2.0 - picardLogcosh(u);
+				} else {
+					t = tanh(u);
+					psi[k] = u + t;
+					psid[k] = 2.0 - t * t;
+					*lossp += u * u / 2.0 + picardLogcosh(u);
+				}
+			}
+			dgemm_(&transn, &transt, &m, &m, &n, &alpha, psi, &m, y, &m, &alpha, Gp, &m);
+			for (k = 0, c = 0; k < (size_t)n * channels; k++, c = (c + 1 == channels) ? 0 : c + 1) {
+				real u2 = y[k] * y[k];
+				s2[c] += u2;
+				s4[c] += u2 * u2;
+				y[k] = u2;
+			}
+			dgemm_(&transn, &transt, &m, &m, &n, &alpha, psid, &m, y, &m, &alpha, hp, &m);
+		}
+		free(psid);
+		free(psi);
+		free(y);
+	}
+
+	size_t i;
+	natural c;
+	real loss = 0.0;
+	memset(G, 0, chxch * sizeof(real));
+	memset(h, 0, chxch * sizeof(real));
+	for (p = 0; p < nparts; p++) {
+		real *Gp = part + p * partsize;
+		real *hp = Gp + chxch;
+		for (i = 0; i < chxch; i++) {
+			G[i] += Gp[i];
+			h[i] += hp[i];
+		}
+		loss += hp[chxch + 2 * channels];
+	}
+	for (i = 0; i < chxch; i++) {
+		G[i] /= samples;
+		h[i] /= samples;
+	}
+	for (c = 0; c < channels; c++) {
+		real s2 = 0.0, s4 = 0.0;
+		for (p = 0; p < nparts; p++) {
+			s2 += part[p * partsize + 2 * chxch + c];
+			s4 += part[p * partsize + 2 * chxch + channels + c];
+		}
+		s2 /= samples;
+		s4 /= samples;
+		kurt[c] = s4 / (s2 * s2) - 3.0;
+		G[c + c * channels] -= 1.0;
+	}
+	free(part);
+
+	/* log|det W| from the LU factors */
+	int m = channels, info = 0;
+	real *lu = (real*)malloc(chxch * sizeof(real));
+	int *ipiv = (int*)malloc(channels * sizeof(int));
+	memcpy(lu, W, chxch * sizeof(real));
+	dgetrf_(&m, &m, lu, &m, ipiv, &info);
+	real logdet = 0.0;
+	for (c = 0; c < channels && info == 0; c++) {
+		logdet += log(fabs(lu[c + c * channels]));
+	}
+	free(ipiv);
+	free(lu);
+	if (info != 0) return HUGE_VAL;
+	return loss / samples - logdet;
+}
+
+/*
+ * Sets the signs from the kurtosis like the pdf step, returns the number
+ * of signs changed
+ */
+static natural picardSigns(natural channels, real *kurt, int *signs, real signsbias) {
+	natural c, changed = 0;
+	for (c = 0; c < channels; c++) {
+		int sign = kurt[c] < -signsbias;
+		if (sign != signs[c]) changed++;
+		signs[c] = sign;
+	}
+	return changed;
+}
+
+/*
+ * Moves the 2x2 blocks of h to eigenvalues of at least PICARD_LAMBDA_MIN
+ */
+static void picardRegularize(natural channels, real *h) {
+	natural i, j;
+	for (j = 0; j < channels; j++) {
+		for (i = 0; i < j; i++) {
+			real hij = h[i + j * channels];
+			real hji = h[j + i * channels];
+			real discr = sqrt((hij - hji) * (hij - hji) + 4.0);
+			real eigenvalue = 0.5 * (hij + hji - discr);
+			if (eigenvalue < PICARD_LAMBDA_MIN) {
+				h[i + j * channels] += PICARD_LAMBDA_MIN - eigenvalue;
+				h[j + i * channels] += PICARD_LAMBDA_MIN - eigenvalue;
+			}
+		}
+	}
+}
+
+/*
+ * out = H^-1 in, H being the block diagonal approximation in h: 2x2 blocks
+ * [h_ij 1; 1 h_ji] for every pair and h_ii + 1 on the diagonal
+ */
+static void picardSolve(natural channels, real *in, real *h, real *out) {
+	natural i, j;
+	for (j = 0; j < channels; j++) {
+		for (i = 0; i < channels; i++) {
+			size_t ij = i + j * channels;
+			size_t ji = j + i * channels;
+			if (i == j) {
+				out[ij] = in[ij] / (h[ij] + 1.0);
+			} else {
+				out[ij] = (in[ij] * h[ji] - in[ji]) / (h[ij] * h[ji] - 1.0);
+			}
+		}
+	}
+}
+
+static real picardDot(size_t n, real *a, real *b) {
+	size_t i;
+	real sum = 0.0;
+	for (i = 0; i < n; i++) {
+		sum += a[i] * b[i];
+	}
+	return sum;
+}
+
+/*
+ * L-BFGS two loop recursion on the count updates (s, y, r = 1/<s,y>),
+ * oldest first, with the Hessian approximation as initial matrix. D is the
+ * descent direction, q a work matrix.
+ */
+static void picardDirection(natural channels, real *G, real *h, real **s, real **y, real *r, int count, real *D, real *q) {
+	size_t n = (size_t)channels * channels;
+	real a[PICARD_MEMORY];
+	size_t i;
+	int k;
+	memcpy(q, G, n * sizeof(real));
+	for (k = count - 1; k >= 0; k--) {
+		a[k] = r[k] * picardDot(n, s[k], q);
+		for (i = 0; i < n; i++) {
+			q[i] -= a[k] * y[k][i];
+		}
+	}
+	picardSolve(channels, q, h, D);
+	for (k = 0; k < count; k++) {
+		real b = r[k] * picardDot(n, y[k], D);
+		for (i = 0; i < n; i++) {
+			D[i] += (a[k] - b) * s[k][i];
+		}
+	}
+	for (i = 0; i < n; i++) {
+		D[i] = -D[i];
+	}
+}
+
+/*
+ * Runs Picard on the dataset and stores weights (and zero bias, signs) in
+ * it. Reports the number of steps, the time, the final loss and gradient,
+ * and the time at which the loss first went below target (-1 if never).
+ */
+static void picardRun(eegdataset_t *set, real target, natural *steps, double *seconds, real *finalloss, real *gradient, double *reached) {
+	natural channels = set->nchannels;
+	natural samples = set->nsamples;
+	natural extended = set->config.extended;
+	natural verbose = set->config.verbose;
+	real tolerance = set->config.nochange;
+	real signsbias = set->config.signsbias;
+	int maxsteps = set->config.maxsteps;
+	int nparts = set->config.nthreads;
+	real *data = set->data;
+	size_t n = (size_t)channels * channels;
+	size_t chxch = n * sizeof(real);
+	int m = channels;
+
+	if (verbose != 0) {
+		fprintf(stdout, "*********************************\n");
+		fprintf(stdout, "      Picard configuration       \n");
+		fprintf(stdout, "*********************************\n");
+		fprintf(stdout, "  backend cpu (%d threads)\n", nparts);
+		fprintf(stdout, "  channels %d\n", channels);
+		fprintf(stdout, "  samples %d\n", samples);
+		fprintf(stdout, "  extended %d\n", extended);
+		fprintf(stdout, "  memory %d\n", PICARD_MEMORY);
+		fprintf(stdout, "  tolerance %.16f\n", tolerance);
+		fprintf(stdout, "  maxsteps %d\n", maxsteps);
+		fprintf(stdout, "*********************************\n");
+	}
+
+	real *W = (real*)malloc(chxch);
+	real *Wn = (real*)malloc(chxch);
+	real *G = (real*)malloc(chxch);
+	real *Gn = (real*)malloc(chxch);
+	real *h = (real*)malloc(chxch);
+	real *hn = (real*)malloc(chxch);
+	real *D = (real*)malloc(chxch);
+	real *q = (real*)malloc(chxch);
+	real *kurt = (real*)malloc(channels * sizeof(real));
+	real *kurtn = (real*)malloc(channels * sizeof(real));
+	int *signs = (int*)calloc(channels, sizeof(int));
+	real *s[PICARD_MEMORY];
+	real *y[PICARD_MEMORY];
+	real r[PICARD_MEMORY];
+	int count = 0;
+	int k;
+	for (k = 0; k < PICARD_MEMORY; k++) {
+		s[k] = (real*)malloc(chxch);
+		y[k] = (real*)malloc(chxch);
+	}
+
+	if (set->h_weights != NULL) {
+		memcpy(W, set->h_weights, chxch);
+	} else {
+		hostEye(W, channels);
+	}
+
+	double start = wallclock();
+	*reached = -1.0;
+	real loss = picardPass(data, channels, samples, W, extended, signs, G, h, kurt, nparts);
+	if (extended && picardSigns(channels, kurt, signs, signsbias)) {
+		loss = picardPass(data, channels, samples, W, extended, signs, G, h, kurt, nparts);
+	}
+
+	int step = 0;
+	int converged = 0;
+	real gmax = 0.0;
+	real alpha = 0.0;
+	for (step = 0; ; step++) {
+		size_t i;
+		gmax = 0.0;
+		for (i = 0; i < n; i++) {
+			if (fabs(G[i]) > gmax) gmax = fabs(G[i]);
+		}
+		if (*reached < 0.0 && loss <= target) *reached = wallclock() - start;
+		if (verbose != 0) {
+			printf("Step %d - loss %.9f, gradient %.9f, alpha %g - time = %.2f s\n", step, loss, gmax, alpha, wallclock() - start);
+		} else {
+			printf("Step %d.\n", step);
+		}
+		if (gmax < tolerance) {
+			converged = 1;
+			break;
+		}
+		if (step >= maxsteps) break;
+
+		picardRegularize(channels, h);
+		picardDirection(channels, G, h, s, y, r, count, D, q);
+
+		/* Backtracking on W = (I + alpha D) W, then on the preconditioned gradient */
+		real lossn = HUGE_VAL;
+		int attempt, tries = 0;
+		for (attempt = 0; attempt < 2 && !(lossn < loss); attempt++) {
+			if (attempt == 1) {
+				count = 0;
+				picardSolve(channels, G, h, D);
+				for (i = 0; i < n; i++) D[i] = -D[i];
+			}
+			alpha = 1.0;
+			for (tries = 0; tries < PICARD_LS_TRIES; tries++) {
+				real one = 1.0;
+				char transn = 'N';
+				memcpy(Wn, W, chxch);
+				dgemm_(&transn, &transn, &m, &m, &m, &alpha, D, &m, W, &m, &one, Wn, &m);
+				lossn = picardPass(data, channels, samples, Wn, extended, signs, Gn, hn, kurtn, nparts);
+				if (lossn < loss) break;
+				alpha /= 2.0;
+			}
+		}
+		if (!(lossn < loss)) {
+			printf("Line search failed, stopping at step %d\n", step);
+			break;
+		}
+
+		/* L-BFGS update, dropping the oldest one when full */
+		if (count == PICARD_MEMORY) {
+			real *olds = s[0];
+			real *oldy = y[0];
+			for (k = 1; k < PICARD_MEMORY; k++) {
+				s[k - 1] = s[k];
+				y[k - 1] = y[k];
+				r[k - 1] = r[k];
+			}
+			s[PICARD_MEMORY - 1] = olds;
+			y[PICARD_MEMORY - 1] = oldy;
+			count--;
+		}
+		for (i = 0; i < n; i++) {
+			s[count][i] = alpha * D[i];
+			y[count][i] = Gn[i] - G[i];
+		}
+		real sy = picardDot(n, s[count], y[count]);
+		if (sy > 0.0) {
+			r[count] = 1.0 / sy;
+			count++;
+		}
+
+		real *swap;
+		swap = W; W = Wn; Wn = swap;
+		swap = G; G = Gn; Gn = swap;
+		swap = h; h = hn; hn = swap;
+		swap = kurt; kurt = kurtn; kurtn = swap;
+		loss = lossn;
+
+		/* New signs change the loss, start the memory again */
+		if (extended && picardSigns(channels, kurt, signs, signsbias)) {
+			DPRINTF(2, "Signs changed at step %d\n", step + 1);
+			loss = picardPass(data, channels, samples, W, extended, signs, G, h, kurt, nparts);
+			count = 0;
+		}
+	}
+	*seconds = wallclock() - start;
+	*steps = step;
+	*finalloss = loss;
+	*gradient = gmax;
+	printf("Picard %s after %d steps, %.2f s\n", converged ? "converged" : "stopped", step, *seconds);
+
+	if (set->weights != NULL) free(set->weights);
+	set->weights = W;
+	set->wpitch = channels * sizeof(real);
+	if (set->config.biasing) set->bias = (real*)calloc(channels, sizeof(real));
+	if (extended) {
+		set->signs = signs;
+	} else {
+		free(signs);
+	}
+
+	for (k = 0; k < PICARD_MEMORY; k++) {
+		free(s[k]);
+		free(y[k]);
+	}
+	free(kurtn);
+	free(kurt);
+	free(q);
+	free(D);
+	free(hn);
+	free(h);
+	free(Gn);
+	free(G);
+	free(Wn);
+}
+
+void picard(eegdataset_t *set) {
+	natural steps;
+	double seconds, reached;
+	real loss, gradient;
+	picardRun(set, -HUGE_VAL, &steps, &seconds, &loss, &gradient, &reached);
+}
+
+/*
+ * Runs Infomax and then Picard on the same data, and prints the time each
+ * one took, their final loss and gradient, and the time Picard took to get
+ * to the loss of the Infomax result. Picard's results are kept. Returns
+ * the error of Infomax, Picard does not run then.
+ */
+error picardCompare(eegdataset_t *set) {
+	natural channels = set->nchannels;
+	size_t chxch = (size_t)channels * channels * sizeof(real);
+
+	/*
+	 * The Infomax run converts the data to its precision and back in
+	 * place (it may move), so both solvers see the same rounded values
+	 */
+	double start = wallclock();
+	error err = hostInfomax(set);
+	double infomaxseconds = wallclock() - start;
+	if (err != SUCCESS) return err;
+
+	real *G = (real*)malloc(chxch);
+	real *h = (real*)malloc(chxch);
+	real *kurt = (real*)malloc(channels * sizeof(real));
+	int *signs = (int*)calloc(channels, sizeof(int));
+	real *data = set->data;
+
+	real infomaxloss = picardPass(data, channels, set->nsamples, set->weights, set->config.extended, signs, G, h, kurt, set->config.nthreads);
+	if (set->config.extended && picardSigns(channels, kurt, signs, set->config.signsbias)) {
+		infomaxloss = picardPass(data, channels, set->nsamples, set->weights, set->config.extended, signs, G, h, kurt, set->config.nthreads);
+	}
+	real infomaxgradient = 0.0;
+	size_t i;
+	for (i = 0; i < (size_t)channels * channels; i++) {
+		if (fabs(G[i]) > infomaxgradient) infomaxgradient = fabs(G[i]);
+	}
+	if (set->bias != NULL) free(set->bias);
+	if (set->signs != NULL) free(set->signs);
+	set->bias = NULL;
+	set->signs = NULL;
+
+	natural steps;
+	double seconds, reached;
+	real loss, gradient;
+	picardRun(set, infomaxloss, &steps, &seconds, &loss, &gradient, &reached);
+
+	printf("\nSolver comparison\n");
+	printf("  infomax  %10.2f s  loss %.9f  gradient %.9f\n", infomaxseconds, infomaxloss, infomaxgradient);
+	printf("  picard   %10.2f s  loss %.9f  gradient %.9f  (%d steps)\n", seconds, loss, gradient, steps);
+	if (reached >= 0.0) {
+		printf("  picard reached the infomax loss in %.2f s (%.1fx faster)\n", reached, reached > 0.0 ? infomaxseconds / reached : 0.0);
+	} else {
+		printf("  picard did not reach the infomax loss\n");
+	}
+
+	free(signs);
+	free(kurt);
+	free(h);
+	free(G);
+	return SUCCESS;
+}
@@ -0,0 +1,423 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <plan.h>
+#include <error.h>
+#include <pool.h>
+#include <container.h>
+#include <device.h>
+#include <centering.h>
+#include <pca.h>
+#include <whitening.h>
+#include <hostinfomax.h>
+#include <picard.h>
+#include <postprocess.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+static const char *stageNames[PLAN_STAGES] = {
+	"load", "center", "pca", "whiten", "infomax", "save"
+};
+
+/*
+ * Allocations of a run being replayed
+ */
+typedef struct {
+	plan_t *	plan;
+	int			stage;
+	size_t		host;					//Host bytes in use
+	arena_t		device;
+} replay_t;
+
+static void replayStage(replay_t *r, int stage) {
+	r->stage = stage;
+	r->plan->host[stage] = r->host;
+	r->plan->device[stage] = r->device.top;
+	arenaMark(&r->device);
+}
+
+static void hostAlloc(replay_t *r, size_t bytes) {
+	r->host += bytes;
+	if (r->host > r->plan->host[r->stage]) r->plan->host[r->stage] = r->host;
+}
+
+static void hostFree(replay_t *r, size_t bytes) {
+	r->host -= bytes;
+}
+
+/*
+ * Same rows as poolMallocPitch() on the arena, returns the buffer offset
+ */
+static size_t deviceAlloc(replay_t *r, size_t width, size_t height) {
+	size_t offset = 0;
+	arenaAlloc(&r->device, poolPitch(width) * height, &offset);
+	if (r->device.peak > r->plan->device[r->stage]) r->plan->device[r->stage] = r->device.peak;
+	return offset;
+}
+
+static void deviceFree(replay_t *r, size_t offset) {
+	arenaFree(&r->device, offset);
+}
+
+/*
+ * Bytes per value of the data file, 0 when the data is used from the
+ * mapping as it is
+ */
+static size_t fileValue(config_t *c) {
+	natural dtype = DTYPE_F64;
+	switch (c->dataformat) {
+		case FORMAT_FDT: dtype = DTYPE_F32; break;
+		case FORMAT_EDF: return 2;
+		case FORMAT_BDF: return 3;
+		case FORMAT_CONTAINER: {
+			container_t header;
+			if (containerProbe(c->datafile, &header) != SUCCESS) return 0;
+			if (header.dtype != DTYPE_REAL || containerSwapped(&header)) return dtypeSize(header.dtype);
+			return 0;
+		}
+	}
+#ifdef _WIN32
+	return dtypeSize(dtype);
+#else
+	return dtype == DTYPE_REAL ? 0 : dtypeSize(dtype);
+#endif
+}
+
+/*
+ * Per thread sums of hostMoments() and streamMoments()
+ */
+static void replayMoments(replay_t *r, size_t m, int nparts) {
+	size_t bytes = nparts * (m * m + MOMENTS_CHUNK * m) * sizeof(real);
+	hostAlloc(r, bytes);
+	hostFree(r, bytes);
+}
+
+/*
+ * Host Infomax (hostinfomax.cu) of nruns runs at the same time with nparts
+ * threads each, the weights are kept
+ */
+static void replayHostInfomax(replay_t *r, config_t *c, size_t m, size_t n, int nparts, int nruns) {
+	size_t sa = c->precision == PRECISION_SINGLE ? sizeof(float) : sizeof(double);
+	size_t st = c->precision == PRECISION_DOUBLE ? sizeof(double) : sizeof(float);
+	size_t pdfsize = c->pdfsize > n ? n : c->pdfsize;
+	size_t block = c->block;
+	size_t work = 6 * m * m * sa;
+	if (c->momentum > 0) work += 2 * m * m * sa;
+	if (c->biasing) work += nparts * m * sa;
+	if (c->extended) {
+		work += nparts * 2 * m * sa;
+		if (c->permutation == PERMUTATION_SHUFFLE) work += n * sizeof(natural);
+	}
+	if (c->permutation == PERMUTATION_SHUFFLE) work += n * sizeof(natural);
+	work += 3 * nparts * HOST_TILE * m * sa + (nparts + 1) * m * m * sa;
+	if (c->streaming) {
+		work += (c->extended && pdfsize > block ? pdfsize : block) * m * sizeof(real) + block * m * st;
+		if (c->extended) work += pdfsize * m * st;
+		if (c->permutation != PERMUTATION_SHUFFLE) {
+			size_t count = c->prefetch * block > pdfsize ? c->prefetch * block : pdfsize;
+			work += (count > block ? count : block) * sizeof(natural);
+		}
+	}
+	hostAlloc(r, nruns * (work + m * m * sizeof(real)));
+	hostFree(r, nruns * work);
+}
+
+/*
+ * Device Infomax (infomax.cu), in the order of its allocations and frees.
+ * The weights, bias and signs are kept. Step 4 swaps weights and
+ * tmpweights, an even or odd number of times, so the run keeps either
+ * buffer: the second one is replayed as kept, the first one then stays in
+ * the arena under it until it is reclaimed, the larger of the two. When
+ * the precision key is not real the weights and bias are copied to real
+ * ones at the end and both weights buffers are freed.
+ */
+static void replayDeviceInfomax(replay_t *r, config_t *c, size_t m, size_t n) {
+	size_t sa = c->precision == PRECISION_SINGLE ? sizeof(float) : sizeof(double);
+	size_t st = c->precision == PRECISION_DOUBLE ? sizeof(double) : sizeof(float);
+	size_t ch = m * sa;
+	size_t pdfsize = c->pdfsize > n ? n : c->pdfsize;
+	int shuffle = c->permutation == PERMUTATION_SHUFFLE;
+	size_t datatable = 0, weights, tmpweights, oldweights, startweights, delta, olddelta;
+	size_t prevweights = 0, prevwtschange = 0, bias = 0, bsum = 0, bpart = 0, pdftable = 0, kk = 0, oldkk = 0;
+	size_t u, y, yu;
+
+	if (shuffle) {
+		datatable = deviceAlloc(r, n * sizeof(natural), 1);
+		hostAlloc(r, n * sizeof(natural));
+	}
+	weights = deviceAlloc(r, ch, m);
+	tmpweights = deviceAlloc(r, ch, m);
+	oldweights = deviceAlloc(r, ch, m);
+	startweights = deviceAlloc(r, ch, m);
+	delta = deviceAlloc(r, ch, m);
+	olddelta = deviceAlloc(r, ch, m);
+	if (c->momentum > 0) {
+		prevweights = deviceAlloc(r, ch, m);
+		prevwtschange = deviceAlloc(r, ch, m);
+	}
+	if (c->biasing) {
+		bias = deviceAlloc(r, ch, 1);
+		bsum = deviceAlloc(r, ch, 1);
+		bpart = deviceAlloc(r, MAX_MULTIPROCESSORS * ch, 1);
+	}
+	if (c->extended) {
+		deviceAlloc(r, ch, 1);
+		if (shuffle) {
+			pdftable = deviceAlloc(r, n * sizeof(natural), 1);
+			hostAlloc(r, n * sizeof(natural));
+		}
+		kk = deviceAlloc(r, ch, 2 * pdfsize);
+		oldkk = deviceAlloc(r, ch, 1);
+	}
+	u = deviceAlloc(r, m * st, c->block);
+	y = deviceAlloc(r, m * st, c->block);
+	yu = deviceAlloc(r, ch, m);
+
+	if (shuffle) deviceFree(r, datatable);
+	deviceFree(r, weights);
+	deviceFree(r, oldweights);
+	deviceFree(r, startweights);
+	if (c->biasing) {
+		deviceFree(r, bsum);
+		deviceFree(r, bpart);
+	}
+	if (c->extended) {
+		if (shuffle) deviceFree(r, pdftable);
+		deviceFree(r, kk);
+		deviceFree(r, oldkk);
+	}
+	deviceFree(r, u);
+	deviceFree(r, y);
+	deviceFree(r, yu);
+	deviceFree(r, delta);
+	deviceFree(r, olddelta);
+	if (c->momentum > 0) {
+		deviceFree(r, prevweights);
+		deviceFree(r, prevwtschange);
+	}
+	if (shuffle) hostFree(r, (c->extended ? 2 : 1) * n * sizeof(natural));
+	if (sa != sizeof(real)) {
+		deviceAlloc(r, m * sizeof(real), m);
+		deviceFree(r, tmpweights);
+		if (c->biasing) {
+			deviceAlloc(r, m * sizeof(real), 1);
+			deviceFree(r, bias);
+		}
+	}
+}
+
+/*
+ * Picard (picard.cu): its matrices and the per thread sums of a pass
+ */
+static void replayPicard(replay_t *r, size_t m, int nparts) {
+	size_t work = (8 + 2 * PICARD_MEMORY) * m * m * sizeof(real);
+	work += nparts * (2 * m * m + 3 * PICARD_CHUNK * m) * sizeof(real);
+	hostAlloc(r, work);
+	hostFree(r, work);
+}
+
+/*
+ * Replays a run of config, see plan.h
+ */
+void planJob(config_t *config, plan_t *plan) {
+	config_t *c = config;
+	replay_t replay;
+	replay_t *r = &replay;
+	size_t m = c->nchannels;
+	size_t n = c->nsamples;
+	size_t k = c->pca > 0 && c->pca < m ? c->pca : m;
+	int nparts = c->nthreads;
+	int gpu = c->backend == BACKEND_GPU;
+	int spheres = c->sphering == 1 || (c->sphering == 0 && c->weightsinfile == NULL);
+	size_t data = 0, cov = 0;
+	size_t device = 0;
+	int s;
+
+	memset(plan, 0, sizeof(plan_t));
+	r->plan = plan;
+	r->host = 0;
+	arenaInit(&r->device, NULL, 0);
+
+	replayStage(r, PLAN_LOAD);
+	if (c->streaming) {
+		data = n * m * sizeof(real);
+		if (c->memcap > 0 && (size_t)c->memcap * 1048576 < data) data = (size_t)c->memcap * 1048576;
+		hostAlloc(r, data);
+	} else {
+		size_t file = n * m * fileValue(c);
+		data = n * m * sizeof(real);
+		hostAlloc(r, file + data);
+		hostFree(r, file);
+		if (gpu) device = deviceAlloc(r, m * sizeof(real), n);
+	}
+
+	replayStage(r, PLAN_CENTER);
+	if (k < m ? c->pcamethod == PCA_EIG : spheres) {
+		cov = m * m * sizeof(real);
+		hostAlloc(r, cov);
+		replayMoments(r, m, nparts);
+	}
+	if (gpu && k == m) {
+		size_t sums = deviceAlloc(r, m * sizeof(real), getMaxBlocks());
+		deviceFree(r, sums);
+	}
+
+	replayStage(r, PLAN_PCA);
+	if (k < m) {
+		size_t l = k + PCA_OVERSAMPLE > m ? m : k + PCA_OVERSAMPLE;
+		size_t work = m * k * sizeof(real);
+		if (c->pcamethod == PCA_RANDOM) {
+			work += (2 * m * l + l * l + l * k) * sizeof(real);
+			work += nparts * (m * l + PCA_CHUNK * m + PCA_CHUNK * l) * sizeof(real);
+		}
+		hostAlloc(r, work);
+		hostFree(r, work);
+		hostAlloc(r, n * k * sizeof(real) + nparts * PCA_CHUNK * m * sizeof(real) + m * k * sizeof(real));
+		hostFree(r, data + nparts * PCA_CHUNK * m * sizeof(real) + cov);
+		data = n * k * sizeof(real);
+		cov = k * k * sizeof(real);
+		hostAlloc(r, cov);
+		if (gpu) {
+			deviceFree(r, device);
+			device = deviceAlloc(r, k * sizeof(real), n);
+		}
+		m = k;
+	}
+
+	replayStage(r, PLAN_WHITEN);
+	if (c->sphering == 0 || c->sphering == 1) {
+		size_t ch = m * sizeof(real);
+		if (spheres) {
+			size_t temp = (cov ? 2 : 3) * m * m * sizeof(real);
+			if (!gpu && !c->streaming) temp += nparts * SPHERE_CHUNK * ch;
+			hostAlloc(r, temp);
+			hostFree(r, temp + cov);
+			cov = 0;
+		}
+		if (gpu) {
+			deviceAlloc(r, ch, m);
+			if (spheres) {
+				size_t pitch = poolPitch(ch);
+				size_t nblocks = n > MAX_CUDA_BLOCKS ? MAX_CUDA_BLOCKS : n;
+				if (nblocks * pitch > SPHERE_BUFFER) nblocks = SPHERE_BUFFER / pitch;
+				deviceFree(r, deviceAlloc(r, nblocks * pitch, 1));
+				if (c->sphering == 0) deviceAlloc(r, ch, m);
+			}
+		} else {
+			hostAlloc(r, m * m * sizeof(real));
+			if (spheres && (c->streaming || c->sphering == 0)) hostAlloc(r, m * m * sizeof(real));
+		}
+	}
+
+	replayStage(r, PLAN_INFOMAX);
+	if (gpu) {
+		natural e;
+		for (e = 0; e < c->ensemble; e++) {
+			replayDeviceInfomax(r, c, m, n);
+		}
+	} else {
+		/*
+		 * The data is converted in place, through one chunk per thread. A
+		 * wider type grows it first, which may copy it.
+		 */
+		size_t converted = 0;
+		if (c->precision != DEFAULT_PRECISION && !c->streaming && c->solver != SOLVER_PICARD) {
+			size_t st = c->precision == PRECISION_DOUBLE ? sizeof(double) : sizeof(float);
+			size_t chunks = n * m < (size_t)nparts * HOST_CONVERT_CHUNK ? n * m : (size_t)nparts * HOST_CONVERT_CHUNK;
+			if (st > sizeof(real)) {
+				hostAlloc(r, n * m * st);
+				hostFree(r, n * m * st);
+				converted = n * m * (st - sizeof(real));
+				hostAlloc(r, converted);
+			}
+			hostAlloc(r, chunks * st);
+			hostFree(r, chunks * st);
+		}
+		if (c->solver != SOLVER_INFOMAX) {
+			if (c->solver == SOLVER_COMPARE) replayHostInfomax(r, c, m, n, nparts, 1);
+			hostFree(r, converted);
+			replayPicard(r, m, nparts);
+		} else {
+			natural runs = c->ensemble;
+			natural concurrent = c->streaming ? 1 : (runs < (natural)nparts ? runs : nparts);
+			natural done;
+			for (done = 0; done < runs; done += concurrent) {
+				natural wave = runs - done < concurrent ? runs - done : concurrent;
+				replayHostInfomax(r, c, m, n, nparts / concurrent, wave);
+			}
+			hostFree(r, converted);
+		}
+	}
+
+	replayStage(r, PLAN_SAVE);
+	if (c->activationsfile != NULL) {
+		size_t width = m * sizeof(real);
+		size_t esize = c->actprecision == PRECISION_SINGLE ? sizeof(float) : sizeof(double);
+		size_t tile = ACT_TILE_BYTES / width;
+		if (tile < POST_TILE) tile = POST_TILE;
+		if (tile > n) tile = n;
+		size_t work = m * width + tile * width + 2 * tile * m * esize + tile * sizeof(natural);
+		if (esize != sizeof(real)) work += tile * width;
+		hostAlloc(r, work);
+		hostFree(r, work);
+	}
+
+	for (s = 0; s < PLAN_STAGES; s++) {
+		if (plan->host[s] > plan->hostpeak) plan->hostpeak = plan->host[s];
+		if (plan->device[s] > plan->devicepeak) plan->devicepeak = plan->device[s];
+	}
+	arenaClear(&r->device);
+}
+
+/*
+ * Prints the peak of every stage in MB
+ */
+void planPrint(config_t *config, plan_t *plan) {
+	int gpu = config->backend == BACKEND_GPU;
+	int s;
+	printf("Memory plan: %u channels, %u samples, block %u, backend %s\n", config->nchannels, config->nsamples, config->block, gpu ? "gpu" : "cpu");
+	printf("\tstage\t\thost MB\t\tdevice MB\n");
+	for (s = 0; s < PLAN_STAGES; s++) {
+		printf("\t%s\t\t%.1f\t\t%.1f\n", stageNames[s], plan->host[s] / 1048576.0, plan->device[s] / 1048576.0);
+	}
+	printf("\tpeak\t\t%.1f\t\t%.1f\n", plan->hostpeak / 1048576.0, plan->devicepeak / 1048576.0);
+}
+
+/*
+ * Physical memory of the host in bytes, 0 if unknown
+ */
+size_t planHostMemory(void) {
+#ifdef _WIN32
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+	if (!GlobalMemoryStatusEx(&status)) return 0;
+	return (size_t)status.ullTotalPhys;
+#else
+	long pages = sysconf(_SC_PHYS_PAGES);
+	long size = sysconf(_SC_PAGESIZE);
+	if (pages < 0 || size < 0) return 0;
+	return (size_t)pages * (size_t)size;
+#endif
+}
@@ -0,0 +1,275 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <pool.h>
+#include <error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct poolentry_s {
+	void *					ptr;
+	int						device;
+	size_t					width;			//Bytes, the size for host buffers
+	size_t					height;			//Rows, 1 for host buffers
+	size_t					pitch;
+	int						inuse;
+	struct poolentry_s *	next;
+} poolentry_t;
+
+struct arenablock_s {
+	size_t					offset;
+	size_t					bytes;
+	int						freed;
+	struct arenablock_s *	next;
+};
+
+static poolentry_t *entries = NULL;
+static int enabled = 0;
+static arena_t arena;					//Device arena, base NULL = none
+
+/*
+ * Starts (or stops) keeping released buffers
+ */
+void poolEnable(int enable) {
+	enabled = enable;
+}
+
+/*
+ * Hands out a free buffer of the given shape, or NULL
+ */
+static void *poolTake(int device, size_t width, size_t height, size_t *pitch) {
+	void *ptr = NULL;
+	#pragma omp critical (pool)
+	{
+		poolentry_t *e;
+		for (e = entries; e != NULL; e = e->next) {
+			if (!e->inuse && e->device == device && e->width == width && e->height == height) {
+				e->inuse = 1;
+				ptr = e->ptr;
+				if (pitch) *pitch = e->pitch;
+				break;
+			}
+		}
+	}
+	return ptr;
+}
+
+/*
+ * Records a new buffer, handed out
+ */
+static void poolAdd(void *ptr, int device, size_t width, size_t height, size_t pitch) {
+	poolentry_t *e = (poolentry_t*)malloc(sizeof(poolentry_t));
+	e->ptr = ptr;
+	e->device = device;
+	e->width = width;
+	e->height = height;
+	e->pitch = pitch;
+	e->inuse = 1;
+	#pragma omp critical (pool)
+	{
+		e->next = entries;
+		entries = e;
+	}
+}
+
+/*
+ * Marks a buffer as free. Returns 0 if the pool did not hand it out.
+ */
+static int poolGive(void *ptr) {
+	int found = 0;
+	#pragma omp critical (pool)
+	{
+		poolentry_t *e;
+		for (e = entries; e != NULL; e = e->next) {
+			if (e->ptr == ptr) {
+				e->inuse = 0;
+				found = 1;
+				break;
+			}
+		}
+	}
+	return found;
+}
+
+void *poolMalloc(size_t size) {
+	if (!enabled) return malloc(size);
+	void *ptr = poolTake(0, size, 1, NULL);
+	if (ptr == NULL) {
+		ptr = malloc(size);
+		if (ptr != NULL) poolAdd(ptr, 0, size, 1, size);
+	}
+	return ptr;
+}
+
+void *poolCalloc(size_t count, size_t size) {
+	if (!enabled) return calloc(count, size);
+	void *ptr = poolMalloc(count * size);
+	if (ptr != NULL) memset(ptr, 0, count * size);
+	return ptr;
+}
+
+void poolFree(void *ptr) {
+	if (ptr == NULL) return;
+	if (!poolGive(ptr)) free(ptr);
+}
+
+cudaError_t poolMallocPitch(void **ptr, size_t *pitch, size_t width, size_t height) {
+	if (arena.base != NULL) {
+		size_t offset = 0;
+		int ok = 0;
+		*pitch = poolPitch(width);
+		#pragma omp critical (pool)
+		ok = arenaAlloc(&arena, *pitch * height, &offset);
+		if (ok) {
+			*ptr = arena.base + offset;
+			return cudaSuccess;
+		}
+		fprintf(stderr, "ERROR: Device arena of %llu bytes exhausted, the memory plan is short: %llu bytes from cudaMallocPitch\n", (unsigned long long)arena.size, (unsigned long long)(*pitch * height));
+	}
+	if (enabled) {
+		*ptr = poolTake(1, width, height, pitch);
+		if (*ptr != NULL) return cudaSuccess;
+	}
+	cudaError_t err = cudaMallocPitch(ptr, pitch, width, height);
+	if (enabled && err == cudaSuccess) poolAdd(*ptr, 1, width, height, *pitch);
+	return err;
+}
+
+cudaError_t poolCudaMalloc(void **ptr, size_t size) {
+	size_t pitch;
+	return poolMallocPitch(ptr, &pitch, size, 1);
+}
+
+void poolCudaFree(void *ptr) {
+	if (ptr == NULL) return;
+	if (arena.base != NULL && (char*)ptr >= arena.base && (char*)ptr < arena.base + arena.size) {
+		#pragma omp critical (pool)
+		arenaFree(&arena, (char*)ptr - arena.base);
+		return;
+	}
+	if (!poolGive(ptr)) HANDLE_ERROR(cudaFree(ptr));
+}
+
+/*
+ * Releases the free buffers, the ones in use are kept until given back
+ */
+void poolTrim(void) {
+	#pragma omp critical (pool)
+	{
+		poolentry_t **link = &entries;
+		while (*link != NULL) {
+			poolentry_t *e = *link;
+			if (e->inuse) {
+				link = &e->next;
+				continue;
+			}
+			if (e->device) {
+				HANDLE_ERROR(cudaFree(e->ptr));
+			} else {
+				free(e->ptr);
+			}
+			*link = e->next;
+			free(e);
+		}
+	}
+}
+
+/*
+ * Serves the device buffers from one allocation of bytes from now on
+ */
+cudaError_t poolArena(size_t bytes) {
+	void *base = NULL;
+	cudaError_t err = cudaMalloc(&base, bytes);
+	if (err != cudaSuccess) return err;
+	arenaInit(&arena, base, bytes);
+	return cudaSuccess;
+}
+
+/*
+ * Frees the arena, its buffers must not be used any more
+ */
+void poolArenaRelease(void) {
+	if (arena.base == NULL) return;
+	HANDLE_ERROR(cudaFree(arena.base));
+	arenaClear(&arena);
+}
+
+void arenaInit(arena_t *arena, void *base, size_t size) {
+	arena->base = (char*)base;
+	arena->size = size;
+	arena->top = 0;
+	arena->peak = 0;
+	arena->blocks = NULL;
+}
+
+/*
+ * Puts a buffer on top, returns 0 if it does not fit
+ */
+int arenaAlloc(arena_t *arena, size_t bytes, size_t *offset) {
+	if (arena->size != 0 && bytes > arena->size - arena->top) return 0;
+	arenablock_t *b = (arenablock_t*)malloc(sizeof(arenablock_t));
+	b->offset = arena->top;
+	b->bytes = bytes;
+	b->freed = 0;
+	b->next = arena->blocks;
+	arena->blocks = b;
+	arena->top += bytes;
+	if (arena->top > arena->peak) arena->peak = arena->top;
+	*offset = b->offset;
+	return 1;
+}
+
+/*
+ * Frees the buffer at offset and reclaims the freed buffers on top. Returns
+ * 0 if there is no such buffer.
+ */
+int arenaFree(arena_t *arena, size_t offset) {
+	arenablock_t *b;
+	for (b = arena->blocks; b != NULL && b->offset != offset; b = b->next);
+	if (b == NULL) return 0;
+	b->freed = 1;
+	while (arena->blocks != NULL && arena->blocks->freed) {
+		b = arena->blocks;
+		arena->blocks = b->next;
+		arena->top = b->offset;
+		free(b);
+	}
+	return 1;
+}
+
+/*
+ * Starts a new peak from the current top
+ */
+void arenaMark(arena_t *arena) {
+	arena->peak = arena->top;
+}
+
+/*
+ * Forgets every buffer
+ */
+void arenaClear(arena_t *arena) {
+	while (arena->blocks != NULL) {
+		arenablock_t *b = arena->blocks;
+		arena->blocks = b->next;
+		free(b);
+	}
+	arenaInit(arena, NULL, 0);
+}
@@ -21,92 +21,154 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <postprocess.h>
+#include <stream.h>
+#include <container.h>
+#include <loader.h>
 #include <error.h>
 #include <common.h>
 #include "cblas.h"
-#include <mkl_cblas.h>
 #include <cuda_runtime.h>
+#include <thread>
 
 /*
  * This methods were extracted from original Infomax
  */
 
 
-/*************** Orient components toward positive activations ****************/
-/* Project data using trsf. Negate components and their corresponding weights */
-/* to assure positive RMS. Returns projections in proj.                       */
-/*                                                                            */
-/* data: double array [m,n] (input)                                           */
-/* trsf: double array [m,m] (input/output)                                    */
-/* m:    natural (input)                                                      */
-/* n:    natural (input)                                                      */
-/* proj: double array [m,n] (output)                                          */
-
-void posact(real *data, real *trsf, integer m, integer n, real *proj) {
-	char trans='N';
-	real alpha = 1.0;
-	real beta = 0.0;
-	real posrms, negrms;
-	natural pos, neg, i, j;
-
-	dgemm_(&trans,&trans,&m,&n,&m,&alpha,trsf,&m,data,&m,&beta,proj,&m);
+/*
+ * Copies rows of width bytes between the host and a result, which is in
+ * device memory for the gpu backend only
+ */
+static void postCopy(eegdataset_t *set, void *dst, size_t dpitch, const void *src, size_t spitch, size_t width, natural rows, cudaMemcpyKind kind) {
+	if (set->config.backend == BACKEND_CPU) {
+		natural r;
+		for (r = 0; r < rows; r++) {
+			memcpy((char*)dst + r * dpitch, (const char*)src + r * spitch, width);
+		}
+	} else {
+		HANDLE_ERROR(cudaMemcpy2D(dst, dpitch, src, spitch, width, rows, kind));
+	}
+}
 
-	printf("Inverting negative activations: ");
-	for (i=0 ; i<m ; i++) {
-		posrms = 0.0; negrms = 0.0;
-		pos = 0; neg = 0;
-		for (j=i ; j<m*n ; j+=m)
-			if (proj[j] >= 0) {
-				posrms += proj[j]*proj[j];
-				pos++;
-			}
-			else {
-				negrms += proj[j]*proj[j];
-				neg++;
-			}
+/*
+ * Whether the sphered samples can still be read: from the stream, the
+ * device or the host copy, which no stage releases before the results are
+ * saved. Reports what cannot be done otherwise.
+ */
+static error postSource(eegdataset_t *set, const char *what) {
+	if (set->stream != NULL) return SUCCESS;
+	if (set->config.backend == BACKEND_CPU ? set->data != NULL : set->devicePointer != NULL) return SUCCESS;
+	fprintf(stderr, "ERROR: The data is no longer in memory, cannot %s\n", what);
+	return ERRORINVALIDPARAM;
+}
 
-		if (negrms*(real)pos > posrms*(real)neg) {
-			printf("-");
-			for (j=i ; j<m*n ; j+=m) proj[j] = -proj[j];
-			for (j=i ; j<m*m ; j+=m) trsf[j] = -trsf[j];
+/*
+ * n sphered samples from start: in place for the cpu backend, read into tmp
+ * from the stream or the device otherwise
+ */
+static real *postTile(eegdataset_t *set, size_t start, int n, real *tmp, natural *idx) {
+	natural m = set->nchannels;
+	if (set->stream != NULL) {
+		int j;
+		for (j = 0; j < n; j++) idx[j] = (natural)(start + j);
+		#pragma omp critical(posttile)
+		streamGather(set->stream, idx, n, tmp);
+		return tmp;
+	}
+	if (set->config.backend == BACKEND_CPU) {
+		return set->data + start * m;
+	}
+	#pragma omp critical(posttile)
+	HANDLE_ERROR(cudaMemcpy2D(tmp, m * sizeof(real), (char*)set->devicePointer + start * set->pitch, set->pitch, m * sizeof(real), n, cudaMemcpyDeviceToHost));
+	return tmp;
+}
+
+/*
+ * One pass over the activations u = weights * x, POST_TILE samples at a
+ * time per thread. For every component: sums of squares of the positive and
+ * the negative activations (pos, neg) and their counts (npos, nneg).
+ */
+static void postStats(eegdataset_t *set, real *weights, int nparts, real *pos, real *neg, real *npos, real *nneg) {
+	natural m = set->nchannels;
+	size_t samples = set->nsamples;
+	real *partial = (real*)calloc(nparts * 4 * m, sizeof(real));
+	int p = 0;
+	#pragma omp parallel for
+	for (p = 0; p < nparts; p++) {
+		char trans = 'N';
+		int rows = m;
+		real alpha = 1.0, beta = 0.0;
+		real *acc = partial + p * 4 * m;
+		size_t i = (samples * p) / nparts;
+		size_t end = (samples * (p + 1)) / nparts;
+		real *tmp = (real*)malloc((size_t)POST_TILE * m * sizeof(real));
+		real *u = (real*)malloc((size_t)POST_TILE * m * sizeof(real));
+		natural *idx = (natural*)malloc(POST_TILE * sizeof(natural));
+		for (; i < end; i += POST_TILE) {
+			int n = (end - i) > POST_TILE ? POST_TILE : (int)(end - i);
+			real *x = postTile(set, i, n, tmp, idx);
+			dgemm_(&trans, &trans, &rows, &n, &rows, &alpha, weights, &rows, x, &rows, &beta, u, &rows);
+			int j;
+			natural c;
+			for (j = 0; j < n; j++) {
+				real *col = u + (size_t)j * m;
+				for (c = 0; c < m; c++) {
+					real v = col[c];
+					if (v >= 0) {
+						acc[c] += v * v;
+						acc[2 * m + c] += 1.0;
+					} else {
+						acc[m + c] += v * v;
+						acc[3 * m + c] += 1.0;
+					}
+				}
+			}
 		}
-		printf("%d ",(int)(i+1));
+		free(idx);
+		free(u);
+		free(tmp);
 	}
-	printf("\n");
+	natural c;
+	for (c = 0; c < m; c++) {
+		pos[c] = neg[c] = npos[c] = nneg[c] = 0.0;
+		for (p = 0; p < nparts; p++) {
+			real *acc = partial + p * 4 * m;
+			pos[c] += acc[c];
+			neg[c] += acc[m + c];
+			npos[c] += acc[2 * m + c];
+			nneg[c] += acc[3 * m + c];
+		}
+	}
+	free(partial);
 }
 
-/******************* Project data using a general projection ******************/
-/* Project data using trsf. Return projections in proj.                       */
-/*                                                                            */
-/* data: double array [m,n] (input)                                           */
-/* trsf: double array [m,m] (input)                                           */
-/* m:    natural (input)                                                      */
-/* n:    natural (input)                                                      */
-/* proj: double array [m,n] (output)                                          */
 
-void geproj(real *data, real *trsf, integer m, integer n, real *proj) {
-	real alpha = 1.0, beta = 0.0;
-	char trans='N';
+/*************** Orient components toward positive activations ****************/
+/* Negate the weights of the components whose negative activations have a     */
+/* larger RMS than the positive ones.                                         */
 
-	dgemm_(&trans,&trans,&m,&n,&m,&alpha,trsf,&m,data,&m,&beta,proj,&m);
+static void posact(real *weights, natural m, real *pos, real *neg, real *npos, real *nneg) {
+	natural i, c;
+
+	printf("Inverting negative activations: ");
+	for (i = 0; i < m; i++) {
+		if (neg[i] * npos[i] > pos[i] * nneg[i]) {
+			printf("-");
+			for (c = 0; c < m; c++) weights[i + c * m] = -weights[i + c * m];
+		}
+		printf("%d ", (int)(i + 1));
+	}
+	printf("\n");
 }
 
 
 /****************** Sort data according to projected variance *****************/
-/* Compute back-projected variances for each component based on inverse of    */
-/* weights and sphere or pseudoinverse of weights, sphere, and eigv. Reorder  */
-/* data and weights accordingly. Also if not NULL, reorder bia and signs.    */
-/*                                                                            */
-/* data:    double array [m,n] (input/output)                                 */
-/* weights: double array [m,m] (input/output)                                 */
-/* sphere:  double array [m,m] (input)                                        */
-/* eigv:    double array [m,k] (input) or NULL                                */
-/* bias:    double array [m] (input/output) or NULL                           */
-/* signs:   integer array [m] (input/output) or NULL                          */
-/* m:       integer (input)                                                   */
-/* n:       integer (input)                                                   */
-/* k:       integer (input)                                                   */
+/* The back-projected variance of component i is the squared norm of column i */
+/* of inv(weights * sphere) times the sum of squares of its activations over  */
+/* m * n - 1. The PCA projection has orthonormal columns and leaves the norms */
+/* unchanged. Reorders the rows of weights and, if not NULL, bias and signs.  */
 
 typedef struct {
     integer    idx;
@@ -119,144 +181,199 @@ int compar(const void *x, const void *y) {
 	return 0;
 }
 
-void varsort(real *data, real *weights, real *sphere, real *eigv, real *bias, integer *signs, integer m, integer n, integer k) {
+static void varsort(real *weights, real *sphere, real *bias, integer *signs, integer m, size_t n, real *sumsq) {
 	real alpha = 1.0, beta = 0.0;
-	integer i, j, l, jm, ik, info = 0;
-	char transn='N', transt='T', uplo='U', side = 'R';
-
+	integer i, l, info = 0;
+	char uplo='U', side = 'R';
 
 	integer nb = 8; //ilaenv_(&ispec,name,opts,&m,&na,&na,&na); segfaults!
-	integer itmp, lwork = m*nb, inc = 1;
-	real act, dtmp, *wcpy;
-
+	integer lwork = m*nb;
 
 	integer    *ipiv = (integer*)malloc(m*sizeof(integer));
 	real *work = (real*)malloc(lwork*sizeof(real));
-	real *winv = (real*)malloc(m*k*sizeof(real));
-	real *sum  = (real*)malloc(n*sizeof(real));
+	real *winv = (real*)malloc(m*m*sizeof(real));
 	idxelm  *meanvar = (idxelm*)malloc(m*sizeof(idxelm));
 
-	if (eigv) {
-/* Compute pseudoinverse of weights*sphere*eigv */
-		wcpy = (real*)malloc(m*m*sizeof(real));
-		dsymm_(&side,&uplo,&m,&m,&alpha,sphere,&m,weights,&m,&beta,wcpy,&m);
-		dgemm_(&transn,&transt,&m,&k,&m,&alpha,wcpy,&m,eigv,&k,&beta,weights,&m);
-
-		dgetrf_(&m,&m,wcpy,&m,ipiv,&info);
-		dgetri_(&m,wcpy,&m,ipiv,work,&lwork,&info);
-		dgemm_(&transn,&transn,&k,&m,&m,&alpha,eigv,&k,wcpy,&m,&beta,winv,&k);
-		free(wcpy);
-	}
-	else {
 /* Compute inverse of weights*sphere */
-		dsymm_(&side,&uplo,&m,&m,&alpha,sphere,&m,weights,&m,&beta,winv,&m);
-		dgetrf_(&m,&m,winv,&m,ipiv,&info);
-		dgetri_(&m,winv,&m,ipiv,work,&lwork,&info);
-	}
+	dsymm_(&side,&uplo,&m,&m,&alpha,sphere,&m,weights,&m,&beta,winv,&m);
+	dgetrf_(&m,&m,winv,&m,ipiv,&info);
+	dgetri_(&m,winv,&m,ipiv,work,&lwork,&info);
 
 /* Compute mean variances for back-projected components */
-	for (i=0 ; i<m*k ; i++) winv[i] = winv[i]*winv[i];
-
-	for (i=0,ik=0 ; i<m ; i++,ik+=k) {
-		for (j=0,jm=0 ; j<n ; j++,jm+=m) {
-			sum[j] = 0;
-			act = data[i+jm]*data[i+jm];
-			for(l=0 ; l<k ; l++) sum[j] += act*winv[l+ik];
-		}
-
+	for (i = 0; i < m; i++) {
+		real norm = 0.0;
+		for (l = 0; l < m; l++) norm += winv[l + i * m] * winv[l + i * m];
 		meanvar[i].idx = i;
-		meanvar[i].val = dsum_(&n,sum,&inc) / (real)((m*n)-1);
-
+		meanvar[i].val = norm * sumsq[i] / (real)((m * n) - 1);
 	}
 
-
 /* Sort meanvar */
 	qsort(meanvar,m,sizeof(idxelm),compar);
 
-	printf("Permuting the activation wave forms ...\n");
-
-/* Perform in-place reordering of weights, data, bias, and signs */
-	for (i=0 ; i<m-1 ; i++) {
-		j = meanvar[i].idx;
-		if (i != j) {
-			dswap_(&k,&weights[i],&m,&weights[j],&m);
-			dswap_(&n,&data[i],&m,&data[j],&m);
+	printf("Permuting the components ...\n");
 
-			if (bias) {
-				dtmp = bias[i];
-				bias[i] = bias[j];
-				bias[j] = dtmp;
-			}
-
-			if (signs) {
-				itmp = signs[i];
-				signs[i] = signs[j];
-				signs[j] = itmp;
-			}
-
-			for (l=i+1 ; i!=meanvar[l].idx ; l++);
-			meanvar[l].idx = j;
-		}
-		printf("%d ",(int)(i+1));
+/* Reorder the rows of weights, bias, and signs */
+	memcpy(winv, weights, m * m * sizeof(real));
+	for (i = 0; i < m; i++) {
+		integer j = meanvar[i].idx;
+		for (l = 0; l < m; l++) weights[i + l * m] = winv[j + l * m];
+		work[i] = bias ? bias[j] : 0.0;
+		ipiv[i] = signs ? signs[j] : 0;
 	}
-	printf("\n");
+	if (bias) memcpy(bias, work, m * sizeof(real));
+	if (signs) memcpy(signs, ipiv, m * sizeof(integer));
 
 	free(ipiv);
 	free(work);
 	free(winv);
-	free(sum);
 	free(meanvar);
 }
 
 
 /*
- * Post process data
- * TODO: do it in cuda.
+ * Post process the results: activations are computed tile by tile in one
+ * parallel pass over the sphered data, which is left as it is.
  */
-void postprocess(eegdataset_t *set) {
-
-	integer ncomps = set->nchannels;
-	integer datalength = set->nsamples;
-	real * dataB = (real*)malloc(ncomps*datalength*sizeof(real));
-	real * weights = (real*)malloc(ncomps*ncomps*sizeof(real));
+error postprocess(eegdataset_t *set) {
+	if (postSource(set, "post process the components") != SUCCESS) return ERRORINVALIDPARAM;
+
+	natural m = set->nchannels;
+	size_t width = m * sizeof(real);
+	real *weights = (real*)malloc(m * width);
+	real *sphere = (real*)malloc(m * width);
+	real *pos = (real*)malloc(4 * width);
+	real *neg = pos + m;
+	real *npos = pos + 2 * m;
+	real *nneg = pos + 3 * m;
+	real * bias = NULL;
+	integer * signs = NULL;
+	natural c;
 
-	HANDLE_ERROR(cudaMemcpy2D(weights, ncomps*sizeof(real), set->weights, set->wpitch, ncomps*sizeof(real), ncomps, cudaMemcpyDeviceToHost));
+	postCopy(set, weights, width, set->weights, set->wpitch, width, m, cudaMemcpyDeviceToHost);
+	postCopy(set, sphere, width, set->sphere, set->spitch, width, m, cudaMemcpyDeviceToHost);
+	postStats(set, weights, set->config.nthreads, pos, neg, npos, nneg);
 
 	if (set->config.posact) {
-		posact(set->data,weights,ncomps,datalength,dataB);
-	} else {
-		geproj(set->data,weights,ncomps,datalength,dataB);
+		posact(weights, m, pos, neg, npos, nneg);
 	}
 
-	free(set->data);
-	set->data = dataB;
-
 	printf("Sorting components in descending order of mean projected variance ...\n");
-	real * sphere = (real*)malloc(ncomps*ncomps*sizeof(real));
-	real * bias = NULL;
-	integer * signs = NULL;
-
-	HANDLE_ERROR(cudaMemcpy2D(sphere, ncomps*sizeof(real), set->sphere, set->spitch, ncomps*sizeof(real), ncomps, cudaMemcpyDeviceToHost));
+	for (c = 0; c < m; c++) pos[c] += neg[c];
 	if (set->bias != NULL) {
-		bias = (real*)malloc(ncomps*sizeof(real));
-		HANDLE_ERROR(cudaMemcpy(bias, set->bias, ncomps*sizeof(real), cudaMemcpyDeviceToHost));
+		bias = (real*)malloc(width);
+		postCopy(set, bias, width, set->bias, width, width, 1, cudaMemcpyDeviceToHost);
 	}
 	if (set->signs != NULL) {
-		signs = (integer*)malloc(ncomps*sizeof(integer));
-		HANDLE_ERROR(cudaMemcpy(signs, set->signs, ncomps*sizeof(integer), cudaMemcpyDeviceToHost));
+		signs = (integer*)malloc(m * sizeof(integer));
+		postCopy(set, signs, m * sizeof(integer), set->signs, m * sizeof(integer), m * sizeof(integer), 1, cudaMemcpyDeviceToHost);
 	}
-	varsort(set->data,weights,sphere,NULL,bias,signs,ncomps,datalength, ncomps);
-	HANDLE_ERROR(cudaMemcpy2D(set->weights, set->wpitch, weights, ncomps*sizeof(real), ncomps*sizeof(real), ncomps, cudaMemcpyHostToDevice));
-	HANDLE_ERROR(cudaMemcpy2D(set->sphere, set->spitch, sphere, ncomps*sizeof(real), ncomps*sizeof(real), ncomps, cudaMemcpyHostToDevice));
-	if (set->bias != NULL) {
-		HANDLE_ERROR(cudaMemcpy(set->bias, bias, ncomps*sizeof(real), cudaMemcpyHostToDevice));
+	varsort(weights, sphere, bias, signs, m, set->nsamples, pos);
+
+	postCopy(set, set->weights, set->wpitch, weights, width, width, m, cudaMemcpyHostToDevice);
+	if (bias != NULL) {
+		postCopy(set, set->bias, width, bias, width, width, 1, cudaMemcpyHostToDevice);
 		free(bias);
 	}
-	if (set->signs != NULL) {
-		HANDLE_ERROR(cudaMemcpy(set->signs, signs, ncomps*sizeof(integer), cudaMemcpyHostToDevice));
+	if (signs != NULL) {
+		postCopy(set, set->signs, m * sizeof(integer), signs, m * sizeof(integer), m * sizeof(integer), 1, cudaMemcpyHostToDevice);
 		free(signs);
 	}
 
+	free(pos);
 	free(sphere);
+	free(weights);
+	return SUCCESS;
+}
+
+
+/*
+ * Background part of saveActivations(): appends a tile to the file
+ */
+static void activationsWrite(FILE *out, char *buffer, size_t size, int *failed) {
+	if (fwrite(buffer, 1, size, out) != size) *failed = 1;
+}
+
+/*
+ * Writes the activations weights * x of every sample to ActivationsFile,
+ * ncomps values per sample, as a container when the data came in one.
+ */
+error saveActivations(eegdataset_t *set) {
+	char *filename = set->config.activationsfile;
+	natural m = set->nchannels;
+	size_t width = m * sizeof(real);
+	natural dtype = set->config.actprecision == PRECISION_SINGLE ? DTYPE_F32 : DTYPE_F64;
+	size_t esize = dtypeSize(dtype);
+	size_t tile = ACT_TILE_BYTES / width;
+	if (tile < POST_TILE) tile = POST_TILE;
+	if (tile > set->nsamples) tile = set->nsamples;
+	if (postSource(set, "write the activations") != SUCCESS) return ERRORINVALIDPARAM;
+
+	FILE *out = fopen(filename, "wb");
+	if (out == NULL) {
+		fprintf(stderr, "ERROR: Cannot open activations file %s\n", filename);
+		return ERRORNOFILE;
+	}
+	if (set->config.dataformat == FORMAT_CONTAINER) {
+		containerBegin(out, dtype, set->nsamples, m, 0);
+	}
+
+	real *weights = (real*)malloc(m * width);
+	real *tmp = (real*)malloc(tile * width);
+	real *u = esize == sizeof(real) ? NULL : (real*)malloc(tile * width);
+	natural *idx = (natural*)malloc(tile * sizeof(natural));
+	char *buffer[2];
+	buffer[0] = (char*)malloc(tile * m * esize);
+	buffer[1] = (char*)malloc(tile * m * esize);
+	std::thread *writer = NULL;
+	int failed = 0;
+	size_t start;
+	int k = 0;
+
+	postCopy(set, weights, width, set->weights, set->wpitch, width, m, cudaMemcpyDeviceToHost);
+	for (start = 0; start < set->nsamples; start += tile, k ^= 1) {
+		int n = (set->nsamples - start) > tile ? (int)tile : (int)(set->nsamples - start);
+		int parts = (n + POST_TILE - 1) / POST_TILE;
+		real *dst = u != NULL ? u : (real*)buffer[k];
+		int p = 0;
+		#pragma omp parallel for
+		for (p = 0; p < parts; p++) {
+			char trans = 'N';
+			int rows = m;
+			real alpha = 1.0, beta = 0.0;
+			size_t first = (size_t)p * POST_TILE;
+			int cols = (n - first) > POST_TILE ? POST_TILE : (int)(n - first);
+			real *x = postTile(set, start + first, cols, tmp + first * m, idx + first);
+			dgemm_(&trans, &trans, &rows, &cols, &rows, &alpha, weights, &rows, x, &rows, &beta, dst + first * m, &rows);
+			if (u != NULL) {
+				size_t i;
+				for (i = first * m; i < (first + cols) * m; i++) {
+					if (dtype == DTYPE_F32) ((float*)buffer[k])[i] = (float)u[i];
+					else ((double*)buffer[k])[i] = (double)u[i];
+				}
+			}
+		}
+		if (writer != NULL) {
+			writer->join();
+			delete writer;
+			writer = NULL;
+		}
+		if (failed) break;
+		writer = new std::thread(activationsWrite, out, buffer[k], (size_t)n * m * esize, &failed);
+	}
+	if (writer != NULL) {
+		writer->join();
+		delete writer;
+	}
+	if (fclose(out) != 0) failed = 1;
+	if (failed) {
+		fprintf(stderr, "ERROR: Cannot write activations file %s\n", filename);
+	}
 
+	free(buffer[1]);
+	free(buffer[0]);
+	free(idx);
+	if (u != NULL) free(u);
+	free(tmp);
+	free(weights);
+	return failed ? ERRORNOFILE : SUCCESS;
 }
@@ -0,0 +1,276 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <profile.h>
+#include <error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cuda_runtime.h>
+#include <atomic>
+#include <chrono>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+int profileEnabled = 0;
+
+static const char *stageNames[PROFILE_STAGES] = {
+	"load", "center", "whiten", "save", "initperm", "gather",
+	"nonlinearity", "yu", "block", "update", "pdf", "sync", "pca"
+};
+
+typedef struct {
+	std::atomic<uint64_t>	ns;
+	std::atomic<uint64_t>	calls;
+	uint64_t				start;
+	uint64_t				cycles;
+	uint64_t				misses;
+	uint64_t				cstart[2];
+} stage_t;
+
+static stage_t stages[PROFILE_STAGES];
+static FILE *trace = NULL;
+static int csv = 0;
+static int rows = 0;
+static int device = 0;
+
+/*
+ * perf_event group (cycles, cache misses) of each OpenMP thread, -1 when
+ * counters are off
+ */
+static int *leaders = NULL;
+static int nleaders = 0;
+
+#ifdef __linux__
+static int counterOpen(uint64_t config, int group) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = group == -1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+/*
+ * Opens the counters on every OpenMP thread, returns the number of groups
+ * or 0 when some of them cannot be opened
+ */
+static int counterInit(void) {
+#ifdef __linux__
+	int count = 1;
+	int failed = 0;
+#ifdef _OPENMP
+	count = omp_get_max_threads();
+#endif
+	leaders = (int*)malloc(count * sizeof(int));
+	int i = 0;
+	for (i = 0; i < count; i++) leaders[i] = -1;
+	#pragma omp parallel num_threads(count)
+	{
+		int id = 0;
+#ifdef _OPENMP
+		id = omp_get_thread_num();
+#endif
+		int leader = counterOpen(PERF_COUNT_HW_CPU_CYCLES, -1);
+		if (leader >= 0 && counterOpen(PERF_COUNT_HW_CACHE_MISSES, leader) >= 0) {
+			ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+			leaders[id] = leader;
+		} else {
+			if (leader >= 0) close(leader);
+			#pragma omp atomic
+			failed++;
+		}
+	}
+	if (failed) {
+		for (i = 0; i < count; i++) {
+			if (leaders[i] >= 0) close(leaders[i]);
+		}
+		free(leaders);
+		leaders = NULL;
+		return 0;
+	}
+	return count;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Cycles and cache misses summed over the threads
+ */
+static void counterRead(uint64_t *values) {
+	values[0] = values[1] = 0;
+#ifdef __linux__
+	int i = 0;
+	for (i = 0; i < nleaders; i++) {
+		uint64_t group[3];
+		if (read(leaders[i], group, sizeof(group)) == sizeof(group)) {
+			values[0] += group[1];
+			values[1] += group[2];
+		}
+	}
+#endif
+}
+
+/*
+ * Opens the trace file and the counters. Profiling stays off on error.
+ */
+error profileInit(config_t *config) {
+	const char *file = config->profilefile;
+	size_t len = strlen(file);
+	trace = fopen(file, "w");
+	if (trace == NULL) {
+		fprintf(stderr, "ERROR: cannot open profile file %s\n", file);
+		return ERRORINVALIDPARAM;
+	}
+	csv = len > 4 && strcmp(file + len - 4, ".csv") == 0;
+	device = config->backend == BACKEND_GPU;
+	if (config->counters) {
+		nleaders = counterInit();
+		if (nleaders == 0) {
+			printf("Hardware counters are not available (perf_event), profiling time only\n");
+		}
+	}
+	int i = 0;
+	for (i = 0; i < PROFILE_STAGES; i++) {
+		stages[i].ns = 0;
+		stages[i].calls = 0;
+		stages[i].cycles = 0;
+		stages[i].misses = 0;
+	}
+	if (csv) {
+		fprintf(trace, "phase,step,stage,calls,ns,cycles,llc_misses,bytes\n");
+	} else {
+		fprintf(trace, "[\n");
+	}
+	rows = 0;
+	profileEnabled = 1;
+	return SUCCESS;
+}
+
+/*
+ * Monotonic time in nanoseconds
+ */
+uint64_t profileNow(void) {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * Opens a stage on the calling thread
+ */
+void profileBegin(int stage) {
+	stage_t *s = &stages[stage];
+	if (nleaders) counterRead(s->cstart);
+	s->start = profileNow();
+}
+
+/*
+ * Closes a stage opened with profileBegin()
+ */
+void profileEnd(int stage) {
+	stage_t *s = &stages[stage];
+	uint64_t end = profileNow();
+	s->ns += end - s->start;
+	s->calls++;
+	if (nleaders) {
+		uint64_t values[2];
+		counterRead(values);
+		s->cycles += values[0] - s->cstart[0];
+		s->misses += values[1] - s->cstart[1];
+	}
+}
+
+/*
+ * Closes a stage after the kernels it launched are done
+ */
+void profileDeviceEnd(int stage) {
+	if (device) cudaDeviceSynchronize();
+	profileEnd(stage);
+}
+
+/*
+ * Adds ns to a stage, from any thread
+ */
+void profileAdd(int stage, uint64_t ns) {
+	stages[stage].ns += ns;
+	stages[stage].calls++;
+}
+
+/*
+ * Writes the stages used since the last call and resets them
+ */
+void profileStep(const char *phase, int step) {
+	int i = 0;
+	for (i = 0; i < PROFILE_STAGES; i++) {
+		stage_t *s = &stages[i];
+		uint64_t calls = s->calls;
+		if (calls == 0) continue;
+		uint64_t ns = s->ns;
+		if (csv) {
+			if (nleaders) {
+				fprintf(trace, "%s,%d,%s,%llu,%llu,%llu,%llu,%llu\n", phase, step, stageNames[i], (unsigned long long)calls, (unsigned long long)ns, (unsigned long long)s->cycles, (unsigned long long)s->misses, (unsigned long long)s->misses * PROFILE_LINE);
+			} else {
+				fprintf(trace, "%s,%d,%s,%llu,%llu,,,\n", phase, step, stageNames[i], (unsigned long long)calls, (unsigned long long)ns);
+			}
+		} else {
+			fprintf(trace, "%s  {\"phase\": \"%s\", \"step\": %d, \"stage\": \"%s\", \"calls\": %llu, \"ns\": %llu", rows ? ",\n" : "", phase, step, stageNames[i], (unsigned long long)calls, (unsigned long long)ns);
+			if (nleaders) {
+				fprintf(trace, ", \"cycles\": %llu, \"llc_misses\": %llu, \"bytes\": %llu}", (unsigned long long)s->cycles, (unsigned long long)s->misses, (unsigned long long)s->misses * PROFILE_LINE);
+			} else {
+				fprintf(trace, ", \"cycles\": null, \"llc_misses\": null, \"bytes\": null}");
+			}
+		}
+		rows++;
+		s->ns = 0;
+		s->calls = 0;
+		s->cycles = 0;
+		s->misses = 0;
+	}
+}
+
+/*
+ * Closes the trace and the counters
+ */
+void profileClose(void) {
+	if (!profileEnabled) return;
+	profileEnabled = 0;
+	if (!csv) fprintf(trace, "%s]\n", rows ? "\n" : "");
+	fclose(trace);
+	trace = NULL;
+#ifdef __linux__
+	int i = 0;
+	for (i = 0; i < nleaders; i++) close(leaders[i]);
+#endif
+	free(leaders);
+	leaders = NULL;
+	nleaders = 0;
+}
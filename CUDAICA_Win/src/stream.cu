@@ -0,0 +1,360 @@
+/*
+ *	Copyright (C) 2011, Federico Raimondo (fraimondo@dc.uba.ar)
+ *
+ *	This file is part of Cudaica.
+ *
+ *  Cudaica is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  any later version.
+ *
+ *  Cudaica is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Cudaica.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Out-of-core store used by the streaming mode of the cpu backend.
+ */
+
+#include <stream.h>
+#include <centering.h>
+#include <error.h>
+#include <cblas.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <mman.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#define _stat64 stat
+#define _fstat64 fstat
+#endif
+
+
+static size_t pagesize(void) {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+/*
+ * Page aligned range covering rows [first, first + count)
+ */
+static void rowRange(stream_t *stream, size_t first, size_t count, char **start, size_t *len) {
+	size_t page = pagesize();
+	size_t from = (size_t)(stream->base - (char*)stream->mapping) + first * stream->rowbytes;
+	size_t to = from + count * stream->rowbytes;
+	from -= from % page;
+	if (to > stream->mapsize) to = stream->mapsize;
+	*start = (char*)stream->mapping + from;
+	*len = to - from;
+}
+
+/*
+ * Rows [first, first + count) of a tile
+ */
+static void tileRows(stream_t *stream, natural tile, size_t *first, natural *count) {
+	*first = (size_t)tile * stream->tilesamples;
+	*count = (natural)(*first + stream->tilesamples < stream->samples ? stream->tilesamples : stream->samples - *first);
+}
+
+/*
+ * Hands the pages of a tile back to the kernel. The mapping is read only,
+ * so they are simply read again if needed.
+ */
+static void dropTile(stream_t *stream, natural tile) {
+	char *start;
+	size_t len;
+	size_t first;
+	natural count;
+	tileRows(stream, tile, &first, &count);
+	rowRange(stream, first, count, &start, &len);
+#ifdef _WIN32
+	VirtualUnlock(start, len);		// Removes unlocked pages from the working set
+#else
+	madvise(start, len, MADV_DONTNEED);
+#endif
+}
+
+static void prefetchRows(stream_t *stream, size_t first, size_t count) {
+	char *start;
+	size_t len;
+	rowRange(stream, first, count, &start, &len);
+#ifdef _WIN32
+	WIN32_MEMORY_RANGE_ENTRY entry;
+	entry.VirtualAddress = start;
+	entry.NumberOfBytes = len;
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &entry, 0);
+#else
+	madvise(start, len, MADV_WILLNEED);
+#endif
+}
+
+static void touchTile(stream_t *stream, natural tile) {
+	if (stream->resident[tile] == 0) {
+		stream->nresident++;
+	}
+	stream->resident[tile] = 2;
+}
+
+/*
+ * Clock eviction down to maxresident tiles. Tiles touched since the hand
+ * last passed get a second chance.
+ */
+static void evictTiles(stream_t *stream) {
+	natural steps = 0;
+	while (stream->maxresident && stream->nresident > stream->maxresident && steps < 2 * stream->ntiles) {
+		natural tile = stream->hand;
+		stream->hand = (stream->hand + 1) % stream->ntiles;
+		steps++;
+		if (stream->resident[tile] == 2) {
+			stream->resident[tile] = 1;
+		} else if (stream->resident[tile] == 1) {
+			dropTile(stream, tile);
+			stream->resident[tile] = 0;
+			stream->nresident--;
+		}
+	}
+}
+
+/*
+ * Maps the payload described by desc read-only.
+ *
+ * src: data file
+ * desc: payload description (type, byte order, offset and shape)
+ * memcap: resident memory cap in bytes, 0 for none
+ * stream: returns the new store
+ */
+error streamOpen(char *src, container_t *desc, size_t memcap, stream_t **stream) {
+	int fd = open(src, O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "Error opening data file (%d) %s - %s\n", errno, strerror(errno), src);
+		return ERRORNOFILE;
+	}
+	struct _stat64 sb;
+	if (_fstat64(fd, &sb) == -1) {
+		fprintf(stderr, "Error stating data file %s\n", src);
+		close(fd);
+		return ERRORNOFILE;
+	}
+	size_t rowbytes = (size_t)desc->channels * dtypeSize(desc->dtype);
+	size_t samples = (size_t)(desc->frames * desc->epochs);
+	if ((size_t)sb.st_size < desc->offset + samples * rowbytes) {
+		fprintf(stderr, "Data file %s has %lu bytes, %lu needed\n", src, (size_t)sb.st_size, (size_t)desc->offset + samples * rowbytes);
+		close(fd);
+		return ERRORINVALIDPARAM;
+	}
+	void *mmaping = mmap(0, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mmaping == MAP_FAILED) {
+		fprintf(stderr, "Error mapping data file %s\n", src);
+		return ERRORNOFILE;
+	}
+#ifndef _WIN32
+	madvise(mmaping, sb.st_size, MADV_RANDOM);
+#endif
+
+	stream_t *s = (stream_t*)calloc(1, sizeof(stream_t));
+	s->mapping = mmaping;
+	s->mapsize = sb.st_size;
+	s->base = (char*)mmaping + desc->offset;
+	s->desc = *desc;
+	s->swap = containerSwapped(desc);
+	s->channels = (natural)desc->channels;
+	s->samples = (natural)samples;
+	s->rowbytes = rowbytes;
+	s->tilesamples = (natural)(STREAM_TILE_BYTES / rowbytes);
+	if (s->tilesamples == 0) s->tilesamples = 1;
+	s->ntiles = (s->samples + s->tilesamples - 1) / s->tilesamples;
+	if (memcap > 0) {
+		s->maxresident = (natural)(memcap / (s->tilesamples * rowbytes));
+		if (s->maxresident == 0) s->maxresident = 1;
+	}
+	s->resident = (unsigned char*)calloc(s->ntiles, 1);
+	DPRINTF(1, "Streaming %s: %d tiles of %d samples, at most %d resident\n", src, s->ntiles, s->tilesamples, s->maxresident);
+	*stream = s;
+	return SUCCESS;
+}
+
+void streamClose(stream_t *stream) {
+	if (stream == NULL) return;
+	if (munmap(stream->mapping, stream->mapsize) == -1) {
+		fprintf(stderr, "Error unmapping data file at %p with size %lu\n", stream->mapping, stream->mapsize);
+	}
+	free(stream->resident);
+	if (stream->mean) free(stream->mean);
+	if (stream->sphere) free(stream->sphere);
+	if (stream->scratch) free(stream->scratch);
+	free(stream);
+}
+
+/*
+ * Copies rows [first, first + count) into out (count x channels), centered
+ */
+static void readRows(stream_t *stream, size_t first, natural count, real *out) {
+	natural channels = stream->channels;
+	convertValues(stream->base + first * stream->rowbytes, out, 0, (size_t)count * channels, stream->desc.dtype, stream->swap, (real)stream->desc.scale);
+	if (stream->mean) {
+		for (natural i = 0; i < count; i++) {
+			real *x = out + (size_t)i * channels;
+			for (natural c = 0; c < channels; c++) {
+				x[c] -= stream->mean[c];
+			}
+		}
+	}
+}
+
+/*
+ * Gathers the samples perm[0..count) into out (count x channels), centered
+ * and sphered. The resident cap is enforced once the block has been read.
+ */
+void streamGather(stream_t *stream, natural *perm, natural count, real *out) {
+	natural channels = stream->channels;
+	natural i;
+	for (i = 0; i < count; i++) {
+		touchTile(stream, perm[i] / stream->tilesamples);
+	}
+	int b;
+	#pragma omp parallel for
+	for (b = 0; b < (int)count; b++) {
+		readRows(stream, perm[b], 1, out + (size_t)b * channels);
+	}
+	if (stream->sphere) {
+		if (stream->scratchrows < count) {
+			if (stream->scratch) free(stream->scratch);
+			stream->scratch = (real*)malloc((size_t)count * channels * sizeof(real));
+			stream->scratchrows = count;
+		}
+		real alpha = 1.0, beta = 0.0;
+		char transn = 'N';
+		int m = channels;
+		int n = count;
+		dgemm_(&transn, &transn, &m, &n, &m, &alpha, stream->sphere, &m, out, &m, &beta, stream->scratch, &m);
+		memcpy(out, stream->scratch, (size_t)count * channels * sizeof(real));
+	}
+	evictTiles(stream);
+}
+
+/*
+ * Asks the kernel to start reading the samples perm[0..count) that are not
+ * resident yet
+ */
+void streamPrefetch(stream_t *stream, natural *perm, natural count) {
+	natural i;
+	for (i = 0; i < count; i++) {
+		if (stream->resident[perm[i] / stream->tilesamples] == 0) {
+			prefetchRows(stream, perm[i], 1);
+		}
+	}
+}
+
+/*
+ * Reads a tile for a sequential pass: the next tile is prefetched and, when
+ * there is a cap, the previous one dropped.
+ */
+static natural readTile(stream_t *stream, natural tile, natural tend, real *buffer) {
+	size_t first;
+	natural count;
+	tileRows(stream, tile, &first, &count);
+	if (tile + 1 < tend) prefetchRows(stream, first + count, stream->tilesamples);
+	readRows(stream, first, count, buffer);
+	if (stream->maxresident) dropTile(stream, tile);
+	return count;
+}
+
+/*
+ * Channel means, kept in the store and subtracted from every read.
+ * Each of nparts threads streams through a contiguous range of tiles.
+ */
+void streamMean(stream_t *stream, int nparts) {
+	natural channels = stream->channels;
+	double *sums = (double*)calloc((size_t)nparts * channels, sizeof(double));
+	int p = 0;
+	if (stream->mean) {
+		free(stream->mean);
+		stream->mean = NULL;
+	}
+
+	#pragma omp parallel for
+	for (p = 0; p < nparts; p++) {
+		natural tile = (natural)(((size_t)stream->ntiles * p) / nparts);
+		natural tend = (natural)(((size_t)stream->ntiles * (p + 1)) / nparts);
+		real *buffer = (real*)malloc((size_t)stream->tilesamples * channels * sizeof(real));
+		double *sum = sums + (size_t)p * channels;
+		for (; tile < tend; tile++) {
+			natural count = readTile(stream, tile, tend, buffer);
+			for (natural i = 0; i < count; i++) {
+				real *x = buffer + (size_t)i * channels;
+				for (natural c = 0; c < channels; c++) {
+					sum[c] += x[c];
+				}
+			}
+		}
+		free(buffer);
+	}
+
+	real *mean = (real*)malloc(channels * sizeof(real));
+	for (natural c = 0; c < channels; c++) {
+		double sum = 0.0;
+		for (p = 0; p < nparts; p++) {
+			sum += sums[(size_t)p * channels + c];
+		}
+		mean[c] = sum / stream->samples;
+	}
+	free(sums);
+	stream->mean = mean;
+}
+
+/*
+ * Channel means, as streamMean(), and the covariance of the centered data
+ * (upper triangle, column major) in the same pass over the tiles
+ */
+void streamMoments(stream_t *stream, real *cov, int nparts) {
+	natural channels = stream->channels;
+	moments_t *parts = (moments_t*)malloc(nparts * sizeof(moments_t));
+	int p = 0;
+	if (stream->mean) {
+		free(stream->mean);
+		stream->mean = NULL;
+	}
+
+	#pragma omp parallel for
+	for (p = 0; p < nparts; p++) {
+		natural tile = (natural)(((size_t)stream->ntiles * p) / nparts);
+		natural tend = (natural)(((size_t)stream->ntiles * (p + 1)) / nparts);
+		real *buffer = (real*)malloc((size_t)stream->tilesamples * channels * sizeof(real));
+		momentsInit(&parts[p], channels);
+		for (; tile < tend; tile++) {
+			natural count = readTile(stream, tile, tend, buffer);
+			momentsAdd(&parts[p], buffer, count, channels);
+		}
+		free(buffer);
+	}
+
+	for (p = 1; p < nparts; p++) {
+		momentsMerge(&parts[0], &parts[p], channels);
+		momentsFree(&parts[p]);
+	}
+	real *mean = (real*)malloc(channels * sizeof(real));
+	momentsResult(&parts[0], channels, mean, cov);
+	momentsFree(&parts[0]);
+	free(parts);
+	stream->mean = mean;
+}
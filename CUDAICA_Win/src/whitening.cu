@@ -21,77 +21,159 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 #include <whitening.h>
+#include <stream.h>
 #include <error.h>
 #include <common.h>
 #include <device.h>
+#include <pool.h>
 #include <cblas.h>
 #include <cuda_runtime.h>
 
 /*
  * Multiplies sphere matrix by data
- * Should be launched with samples blocks and channels threads
+ * Should be launched with ceil(count / KERNEL_TILE(CH)) x
+ * CHANNEL_TILES(channels) blocks of CHANNEL_THREADS(channels) threads, and
+ * KERNEL_TILE(CH) x CHANNEL_THREADS(channels) A values of shared memory.
+ * Each block computes a tile of channels of KERNEL_TILE(CH) of the count
+ * samples, loading them one tile at a time into shared memory. Blocks of
+ * the same sample read channels others write, so the result goes to out.
+ * CH is the channel count of the specializations, 0 for any other. A is
+ * the arithmetic of the precision key (float for single, else double).
  *
  * sphere: sphere matrix
  * spitch: sphere matrix row size in bytes
  * data: data matrix
- * pitch: data matrix row size in bytes
+ * pitch: data and out matrix row size in bytes
  * channles: number of channels
+ * count: number of samples
+ * out: output matrix
  */
 extern __shared__ real sample[];
-__global__ void multbySphere(real *sphere, size_t spitch, real* data, size_t pitch, natural channels) {
+template <int CH, typename A>
+__global__ void multbySphere(real *sphere, size_t spitch, real* data, size_t pitch, natural channels, natural count, real *out) {
+	const int R = KERNEL_TILE(CH);
 	int colwidth = pitch/sizeof(real);
 	int scolwidth = spitch/sizeof(real);
-	sample[threadIdx.x]  = data[blockIdx.x * colwidth + threadIdx.x];
-	__syncthreads();
-
-	real value = 0.0f;
+	natural nch = CH ? CH : channels;
+	natural row = threadIdx.x + blockIdx.y * blockDim.x;
+	natural first = blockIdx.x * R;
+	natural s[R];
+	A value[R];
+	A *tile = (A*)sample;
+	natural k0 = 0;
 	int i = 0;
-	for (i = 0; i < channels; i++) {
-		value += sphere[threadIdx.x + scolwidth * i] * sample[i];
+	int r = 0;
+
+	#pragma unroll
+	for (r = 0; r < R; r++) {
+		s[r] = first + r < count ? first + r : first;
+		value[r] = 0.0f;
+	}
+	for (k0 = 0; k0 < nch; k0 += blockDim.x) {
+		natural n = (CH && CH <= CHANNEL_TILE) ? CH : (nch - k0 < blockDim.x ? nch - k0 : blockDim.x);
+		if (threadIdx.x < n) {
+			#pragma unroll
+			for (r = 0; r < R; r++) {
+				tile[r * blockDim.x + threadIdx.x] = (A)data[s[r] * colwidth + k0 + threadIdx.x];
+			}
+		}
+		__syncthreads();
+		if (row < nch) {
+			#pragma unroll
+			for (i = 0; i < n; i++) {
+				A w = (A)sphere[row + scolwidth * (k0 + i)];
+				#pragma unroll
+				for (r = 0; r < R; r++) {
+					value[r] += w * tile[r * blockDim.x + i];
+				}
+			}
+		}
+		__syncthreads();
+	}
+	if (row < nch) {
+		#pragma unroll
+		for (r = 0; r < R; r++) {
+			if (first + r >= count) break;
+			out[(first + r) * colwidth + row] = (real)value[r];
+		}
+	}
+}
+
+typedef decltype(&multbySphere<0, real>) multbysphere_t;
+
+/*
+ * Returns the multbySphere instantiation for the channel count summing in
+ * A, and its samples per block in ktile
+ */
+template <typename A>
+static multbysphere_t multbySphereCH(natural channels, natural *ktile) {
+	switch (channels) {
+		case 32: *ktile = KERNEL_TILE(32); return multbySphere<32, A>;
+		case 64: *ktile = KERNEL_TILE(64); return multbySphere<64, A>;
+		case 128: *ktile = KERNEL_TILE(128); return multbySphere<128, A>;
+		case 256: *ktile = KERNEL_TILE(256); return multbySphere<256, A>;
 	}
-	data[blockIdx.x * colwidth + threadIdx.x] = value;
+	*ktile = 1;
+	return multbySphere<0, A>;
 }
 
 /*
  *	[v d] = eig(cov(data'))
  *   sphere = v * d^(-1) * v'
  *  Taken from Efficient Independent Component Analysis on a GPU
+ *
+ *  Computes the sphere matrix from the host data.
+ *
+ *  set: the dataset
+ *  host_sphe: output sphere matrix (channels x channels, column major)
  */
-void whiten(eegdataset_t *set) {
-	DPRINTF(1,"Whitening dataset\n");
-	real *spherematrix;
-	size_t spitch;
-	DPRINTF(2, "cudaMallocPitch %d rows of %lu bytes for sphere matrix\n", set->nchannels, set->nchannels * sizeof(real));
-	HANDLE_ERROR(cudaMallocPitch(&spherematrix, &spitch, set->nchannels * sizeof(real), set->nchannels));
-
-	if (set->config.sphering == 2 || (set->config.sphering == 0 && set->config.weightsinfile != NULL)) {
-		eye<<<set->nchannels, set->nchannels>>>(spherematrix, spitch);
-		CHECK_ERROR();
-		set->spitch = spitch;
-		set->sphere = spherematrix;
-		return;
-	}
-
+void calcSphere(eegdataset_t *set, real *host_sphe) {
 	int n = set->nsamples;
 	int m = set->nchannels;
 
 	real alpha = 1.0/(real)(n-1);
 	real beta = 0.0;
+	char uplo='U', transn='N';
+	real *host_data = set->data;
+
+	dsyrk_(&uplo,&transn,&m,&n,&alpha,host_data,&m,&beta,host_sphe,&m);
+	sphereFromCov(host_sphe, m);
+}
+
+/*
+ * Sphere matrix of the data, from the covariance centerData() took along
+ * with the means when there is one
+ */
+static void sphereOf(eegdataset_t *set, real *host_sphe) {
+	if (set->cov == NULL) {
+		calcSphere(set, host_sphe);
+		return;
+	}
+	memcpy(host_sphe, set->cov, (size_t)set->nchannels * set->nchannels * sizeof(real));
+	free(set->cov);
+	set->cov = NULL;
+	sphereFromCov(host_sphe, set->nchannels);
+}
+
+/*
+ * Turns a covariance matrix (upper triangle, column major) into the sphere
+ * matrix in place
+ */
+void sphereFromCov(real *host_sphe, natural channels) {
+	int m = channels;
 	int info = 0;
 
 	int nb = 8;//ilaenv_(&ispec,name,opts,&m,&na,&na,&na); Segfaults
 	int i, im, lwork = (nb+2)*m, inc = 1, mxm = m*m;
 
-	char uplo='U', transn='N', jobz='V';
-	real *host_sphe = (real*)malloc(m*m*sizeof(real));
+	char uplo='U', jobz='V';
 	real *host_eigv = (real*)malloc(m*m*sizeof(real));
 	real *host_eigd = (real*)malloc(m*sizeof(real));
 	int  *host_ipiv = (int*)malloc(m*sizeof(int));
 	real *host_work = (real*)malloc(lwork*sizeof(real));
-	real *host_data = set->data;
 
-	dsyrk_(&uplo,&transn,&m,&n,&alpha,host_data,&m,&beta,host_sphe,&m);
 	dsyev_(&jobz,&uplo,&m,host_sphe,&m,host_eigd,host_work,&lwork,&info);
 	
 	for (i=0,im=0 ; i<m ; i++,im+=m)
@@ -105,22 +187,163 @@ void whiten(eegdataset_t *set) {
 	}
 	dgesv_(&m,&m,host_eigv,&m,host_ipiv,host_sphe,&m,&info);
 
-	HANDLE_ERROR(cudaMemcpy2D(spherematrix, spitch, host_sphe, set->nchannels*sizeof(real), set->nchannels*sizeof(real), set->nchannels,  cudaMemcpyHostToDevice));
-	free(host_sphe);
 	free(host_work);
 	free(host_ipiv);
 	free(host_eigd);
 	free(host_eigv);
+}
+
+/*
+ * Host identity matrix
+ *
+ * data: matrix (channels x channels)
+ * channels: number of channels
+ */
+void hostEye(real *data, natural channels) {
+	natural i = 0;
+	memset(data, 0, channels * channels * sizeof(real));
+	for (i = 0; i < channels; i++) {
+		data[i + i * channels] = 1.0;
+	}
+}
+
+/*
+ * Host version of multbySphere for the cpu backend.
+ * Each thread multiplies a fraction of the samples, in chunks of
+ * SPHERE_CHUNK samples. When mean is given the samples are centered on it
+ * first, in the same pass.
+ *
+ * sphere: sphere matrix
+ * mean: channel means, NULL when the data is already centered
+ * data: data matrix (samples x channels)
+ * channels: number of channels
+ * samples: number of samples
+ * nparts: number of threads
+ */
+void hostMultbySphere(real *sphere, real *mean, real *data, natural channels, natural samples, int nparts) {
+	int p = 0;
+	#pragma omp parallel for
+	for (p = 0; p < nparts; p++) {
+		real alpha = 1.0, beta = 0.0;
+		char transn = 'N';
+		int m = channels;
+		size_t i = ((size_t)samples * p) / nparts;
+		size_t end = ((size_t)samples * (p + 1)) / nparts;
+		real *tmp = (real*)malloc(channels * SPHERE_CHUNK * sizeof(real));
+		for (; i < end; i += SPHERE_CHUNK) {
+			int n = (end - i) > SPHERE_CHUNK ? SPHERE_CHUNK : (int)(end - i);
+			real *x = data + i * channels;
+			if (mean != NULL) {
+				size_t k;
+				for (k = 0; k < (size_t)n * channels; k++) {
+					tmp[k] = x[k] - mean[k % channels];
+				}
+				dgemm_(&transn,&transn,&m,&n,&m,&alpha,sphere,&m,tmp,&m,&beta,x,&m);
+			} else {
+				dgemm_(&transn,&transn,&m,&n,&m,&alpha,sphere,&m,x,&m,&beta,tmp,&m);
+				memcpy(x, tmp, channels * n * sizeof(real));
+			}
+		}
+		free(tmp);
+	}
+}
+
+/*
+ * Host version of whiten for the cpu backend. Data, sphere and weights
+ * stay in host memory with pitch channels * sizeof(real).
+ */
+void hostWhiten(eegdataset_t *set) {
+	natural m = set->nchannels;
+	size_t spitch = m * sizeof(real);
+	real *spherematrix = (real*)malloc(m * spitch);
+
+	if (set->config.sphering == 2 || (set->config.sphering == 0 && set->config.weightsinfile != NULL)) {
+		hostEye(spherematrix, m);
+		set->spitch = spitch;
+		set->sphere = spherematrix;
+		return;
+	}
+
+	sphereOf(set, spherematrix);
+	if (set->stream != NULL) {
+		/*
+		 * Out-of-core data is left untouched, the sphere is applied as the
+		 * blocks are gathered
+		 */
+		set->stream->sphere = (real*)malloc(m * spitch);
+		memcpy(set->stream->sphere, spherematrix, m * spitch);
+	} else {
+		hostMultbySphere(spherematrix, set->mean, set->data, m, set->nsamples, set->config.nthreads);
+		if (set->mean != NULL) {
+			free(set->mean);
+			set->mean = NULL;
+		}
+	}
+
+	if (set->config.sphering == 1) {
+		set->spitch = spitch;
+		set->sphere = spherematrix;
+	} else if (set->config.sphering == 0) {
+		if (set->config.weightsinfile == NULL) {
+			set->weights = spherematrix;
+			set->wpitch = spitch;
+			set->sphere = (real*)malloc(m * spitch);
+			set->spitch = spitch;
+			hostEye(set->sphere, m);
+		}
+	}
+}
+
+/*
+ *	[v d] = eig(cov(data'))
+ *   sphere = v * d^(-1) * v'
+ *  Taken from Efficient Independent Component Analysis on a GPU
+ */
+void whiten(eegdataset_t *set) {
+	DPRINTF(1,"Whitening dataset\n");
+	if (set->config.backend == BACKEND_CPU) {
+		hostWhiten(set);
+		return;
+	}
+	real *spherematrix;
+	size_t spitch;
+	DPRINTF(2, "cudaMallocPitch %d rows of %lu bytes for sphere matrix\n", set->nchannels, set->nchannels * sizeof(real));
+	HANDLE_ERROR(poolMallocPitch(&spherematrix, &spitch, set->nchannels * sizeof(real), set->nchannels));
+
+	if (set->config.sphering == 2 || (set->config.sphering == 0 && set->config.weightsinfile != NULL)) {
+		eye<<<dim3(set->nchannels, CHANNEL_TILES(set->nchannels)), CHANNEL_THREADS(set->nchannels)>>>(spherematrix, spitch, set->nchannels);
+		CHECK_ERROR();
+		set->spitch = spitch;
+		set->sphere = spherematrix;
+		return;
+	}
+
+	real *host_sphe = (real*)malloc(set->nchannels*set->nchannels*sizeof(real));
+	sphereOf(set, host_sphe);
+
+	HANDLE_ERROR(cudaMemcpy2D(spherematrix, spitch, host_sphe, set->nchannels*sizeof(real), set->nchannels*sizeof(real), set->nchannels,  cudaMemcpyHostToDevice));
+	free(host_sphe);
 
-	natural nthreads = set->nchannels;
+	natural nthreads = CHANNEL_THREADS(set->nchannels);
+	natural ktile = 1;
+	int single = set->config.precision == PRECISION_SINGLE;
+	multbysphere_t multbySpherek = single ? multbySphereCH<float>(set->nchannels, &ktile) : multbySphereCH<double>(set->nchannels, &ktile);
+	size_t tilebytes = ktile * nthreads * (single ? sizeof(float) : sizeof(double));
 	natural nblocks = set->nsamples > MAX_CUDA_BLOCKS ? MAX_CUDA_BLOCKS : set->nsamples;
 	natural start = 0;
+	real *sphered;
+	if (nblocks * set->pitch > SPHERE_BUFFER) nblocks = SPHERE_BUFFER / set->pitch;
+	DPRINTF(2, "cudaMalloc %d rows of %lu bytes for sphered samples\n", nblocks, set->pitch);
+	HANDLE_ERROR(poolCudaMalloc(&sphered, nblocks * set->pitch));
 	for (start = 0; start < set->nsamples; start += nblocks) {
 		if (nblocks > (set->nsamples - start)) nblocks = (set->nsamples - start);
+		real *chunk = (real*)set->devicePointer + (start * set->pitch/sizeof(real));
 		DPRINTF(3, "Calling multBySphere with %d blocks, %d threads, src %p, size (%d x %d), pitch %lu starting at offset %d\n", nblocks, nthreads, set->devicePointer, set->nsamples, set->nchannels, set->pitch, start);
-		multbySphere<<<nblocks, nthreads, set->nchannels * sizeof(real), 0>>>(spherematrix, spitch, (real*)set->devicePointer + (start * set->pitch/sizeof(real)), set->pitch, set->nchannels);
+		multbySpherek<<<dim3((nblocks + ktile - 1) / ktile, CHANNEL_TILES(set->nchannels)), nthreads, tilebytes, 0>>>(spherematrix, spitch, chunk, set->pitch, set->nchannels, nblocks, sphered);
 		CHECK_ERROR();
+		HANDLE_ERROR(cudaMemcpy(chunk, sphered, nblocks * set->pitch, cudaMemcpyDeviceToDevice));
 	}
+	poolCudaFree(sphered);
 	if (set->config.sphering == 1) {
 		set->spitch = spitch;
 		set->sphere = spherematrix;
@@ -128,8 +351,8 @@ void whiten(eegdataset_t *set) {
 		if (set->config.weightsinfile == NULL) {
 			set->weights = spherematrix;
 			set->wpitch = spitch;
-			HANDLE_ERROR(cudaMallocPitch(&set->sphere, &set->spitch, set->nchannels * sizeof(real), set->nchannels));
-			eye<<<set->nchannels, set->nchannels>>>(set->sphere, set->spitch);
+			HANDLE_ERROR(poolMallocPitch(&set->sphere, &set->spitch, set->nchannels * sizeof(real), set->nchannels));
+			eye<<<dim3(set->nchannels, CHANNEL_TILES(set->nchannels)), CHANNEL_THREADS(set->nchannels)>>>(set->sphere, set->spitch, set->nchannels);
 			CHECK_ERROR();
 		}
 	}
@@ -163,19 +163,20 @@ else
     Args.annealstep = num2str(0.90);
 end
 
-%% Perform PCA if requsted
+%% Perform PCA if requsted (in the cudaica binary, which writes the projection to PCAFile)
 if ischar(Args.pca)
     Args.pca = str2double(Args.pca);
 end
 
 if Args.pca > 0
-    if Args.pca <= nchans
+    if Args.pca < nchans
         fprintf('Reducing the data to %d principal dimensions...\n',Args.pca);
         pcaflag = 1;
-        [data,PCAweight] = runPCA(data,Args.pca);
         ncomps = Args.pca;
-        nchans = Args.pca;
-        Args.chans = Args.pca;
+    elseif Args.pca == nchans
+        Args.pca = 0;
+        ncomps = nchans;
+        pcaflag = 0;
     else
         warning('The number of PCA components must be within [1,nchans]. We will not perform PCA in this dataset.');
         Args.pca = 0;
@@ -207,6 +208,9 @@ end
 Args.DataFile = datafile;
 Args.WeightsOutFile = fullfile(pwd,['cudaica',rndint,'.wts']);
 Args.SphereFile = fullfile(pwd,['cudaica',rndint,'.sph']);
+if pcaflag
+    Args.PCAFile = fullfile(pwd,['cudaica',rndint,'.pca']);
+end
 
 %% Write data and input arguments to files
 % Write input arguments
@@ -252,10 +256,16 @@ end
 try
     if strcmpi(computer, 'MAC')
         weights = myfloatread(Args.WeightsOutFile,[ncomps,Inf],'ieee-be',0,'double');
-        sphere = myfloatread(Args.SphereFile,[nchans,Inf],'ieee-be',0,'double');
+        sphere = myfloatread(Args.SphereFile,[ncomps,Inf],'ieee-be',0,'double');
+        if pcaflag
+            PCAweight = myfloatread(Args.PCAFile,[ncomps,Inf],'ieee-be',0,'double');
+        end
     else
         weights = myfloatread(Args.WeightsOutFile,[ncomps,Inf],'native',0,'double');
-        sphere = myfloatread(Args.SphereFile,[nchans,Inf],'native',0,'double');
+        sphere = myfloatread(Args.SphereFile,[ncomps,Inf],'native',0,'double');
+        if pcaflag
+            PCAweight = myfloatread(Args.PCAFile,[ncomps,Inf],'native',0,'double');
+        end
     end
 catch
     error('Cannot read the result file. Please make sure you have installed NVIDIA CUDA and Intel MKL (or oneAPI), correctly set the environment variables, and have sufficient GPU memory.');
@@ -269,6 +279,9 @@ end
 
 % If created by cudaica(), remove temporary data file
 delete(Args.WeightsOutFile,Args.SphereFile);
+if pcaflag
+    delete(Args.PCAFile);
+end
 
 %% Post-Processing
 fprintf('\n====================================\n');
@@ -276,6 +289,9 @@ fprintf(' Post processing\n');
 fprintf('====================================\n\n');
 
 % runica.m sphere the data before ICA training, we do it after the training. They behave the same.
+if pcaflag
+    data = PCAweight * data;
+end
 data = sphere * data;
 
 % Multiply PCA weights back to ICA weights